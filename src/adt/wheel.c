@@ -0,0 +1,216 @@
+#include "adt/wheel.h"
+#include "mem/halloc.h"
+#include "dbg.h"
+#include <assert.h>
+
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_SHIFT(L) (WHEEL_ROOT_BITS + (L) * WHEEL_LEVEL_BITS)
+#define WHEEL_INDEX(T, L) (((T) >> WHEEL_SHIFT(L)) & WHEEL_LEVEL_MASK)
+#define WHEEL_MAX_TICKS 0xffffffffULL
+
+static inline void wheel_list_init(wheel_timer_t *head)
+{
+    head->next = head->prev = head;
+}
+
+static inline int wheel_list_empty(wheel_timer_t *head)
+{
+    return head->next == head;
+}
+
+static inline void wheel_list_push(wheel_timer_t *head, wheel_timer_t *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static inline void wheel_list_unlink(wheel_timer_t *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+/*
+ * Moves everything in from onto the end of to and leaves from empty.
+ */
+static inline void wheel_list_splice(wheel_timer_t *from, wheel_timer_t *to)
+{
+    if(!wheel_list_empty(from)) {
+        from->next->prev = to->prev;
+        to->prev->next = from->next;
+        from->prev->next = to;
+        to->prev = from->prev;
+        wheel_list_init(from);
+    }
+}
+
+wheel_t *wheel_create(uint64_t now)
+{
+    int i = 0;
+    int level = 0;
+    wheel_t *wheel = h_calloc(sizeof(wheel_t), 1);
+    check_mem(wheel);
+
+    wheel->now = now;
+
+    for(i = 0; i < WHEEL_ROOT_SIZE; i++) {
+        wheel_list_init(&wheel->root[i]);
+    }
+
+    for(level = 0; level < WHEEL_LEVELS; level++) {
+        for(i = 0; i < WHEEL_LEVEL_SIZE; i++) {
+            wheel_list_init(&wheel->levels[level][i]);
+        }
+    }
+
+    return wheel;
+
+error:
+    return NULL;
+}
+
+void wheel_destroy(wheel_t *wheel)
+{
+    // the timers belong to whoever added them
+    if(wheel) h_free(wheel);
+}
+
+/*
+ * Picks the slot by how far out the timer is from now: the root wheel if
+ * it's within 256 ticks, otherwise the first level whose span covers it.
+ */
+static inline void wheel_place(wheel_t *wheel, wheel_timer_t *timer)
+{
+    uint64_t delta = timer->expires - wheel->now;
+    int level = 0;
+
+    if(delta < WHEEL_ROOT_SIZE) {
+        wheel_list_push(&wheel->root[timer->expires & WHEEL_ROOT_MASK], timer);
+        return;
+    }
+
+    for(level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if(delta < (1ULL << WHEEL_SHIFT(level + 1))) break;
+    }
+
+    wheel_list_push(&wheel->levels[level][WHEEL_INDEX(timer->expires, level)], timer);
+}
+
+void wheel_add(wheel_t *wheel, wheel_timer_t *timer, uint64_t expires)
+{
+    assert(timer->fire != NULL && "Timer added to the wheel without a fire callback.");
+
+    if(wheel_timer_pending(timer)) {
+        wheel_cancel(wheel, timer);
+    }
+
+    // already late ones go off on the next tick
+    if(expires <= wheel->now) {
+        expires = wheel->now + 1;
+    } else if(expires - wheel->now > WHEEL_MAX_TICKS) {
+        expires = wheel->now + WHEEL_MAX_TICKS;
+    }
+
+    timer->expires = expires;
+    wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer)
+{
+    if(wheel_timer_pending(timer)) {
+        wheel_list_unlink(timer);
+        wheel->count--;
+    }
+}
+
+/*
+ * Empties one slot of a level back into the wheel, which puts each timer
+ * a level (or more) further down now that it's closer.  Returns the
+ * slot's index so the caller knows when the next level up has come round.
+ */
+static inline int wheel_cascade(wheel_t *wheel, int level)
+{
+    int index = WHEEL_INDEX(wheel->now, level);
+    wheel_timer_t pending;
+    wheel_timer_t *timer = NULL;
+
+    wheel_list_init(&pending);
+    wheel_list_splice(&wheel->levels[level][index], &pending);
+
+    while(!wheel_list_empty(&pending)) {
+        timer = pending.next;
+        wheel_list_unlink(timer);
+        wheel_place(wheel, timer);
+    }
+
+    return index;
+}
+
+/**
+ * Runs the wheel forward to now, calling fire on every timer that
+ * expires on the way, in order.  The fire callbacks can add and cancel
+ * any timers they want, including the one that fired.  Returns how many
+ * fired.
+ */
+int wheel_advance(wheel_t *wheel, uint64_t now)
+{
+    int fired = 0;
+    int level = 0;
+    wheel_timer_t expired;
+    wheel_timer_t *timer = NULL;
+
+    wheel_list_init(&expired);
+
+    while(wheel->now < now) {
+        if(wheel->count == 0) {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now++;
+
+        if((wheel->now & WHEEL_ROOT_MASK) == 0) {
+            for(level = 0; level < WHEEL_LEVELS && wheel_cascade(wheel, level) == 0; level++) {}
+        }
+
+        wheel_list_splice(&wheel->root[wheel->now & WHEEL_ROOT_MASK], &expired);
+
+        while(!wheel_list_empty(&expired)) {
+            timer = expired.next;
+            wheel_list_unlink(timer);
+            wheel->count--;
+            fired++;
+
+            timer->fire(timer);
+        }
+    }
+
+    return fired;
+}
+
+/**
+ * How many ticks past wheel->now until the wheel has to be advanced
+ * again, or -1 if there's nothing in it.  It's exact for anything in the
+ * root wheel, otherwise it's when the next level has to cascade down,
+ * which can be early but is never late.
+ */
+int64_t wheel_next(wheel_t *wheel)
+{
+    int64_t ticks = 0;
+    int64_t until_cascade = WHEEL_ROOT_SIZE - (wheel->now & WHEEL_ROOT_MASK);
+
+    if(wheel->count == 0) return -1;
+
+    for(ticks = 1; ticks <= until_cascade; ticks++) {
+        if(!wheel_list_empty(&wheel->root[(wheel->now + ticks) & WHEEL_ROOT_MASK])) {
+            return ticks;
+        }
+    }
+
+    return until_cascade;
+}
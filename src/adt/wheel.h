@@ -0,0 +1,65 @@
+#ifndef _wheel_h
+#define _wheel_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A hierarchical timer wheel counting in ticks (whatever the caller
+ * advances it by, fdtask uses milliseconds).  The root wheel has a slot
+ * per tick for the next 256 ticks and each level above covers 64 times
+ * more with the same number of slots, so adding and cancelling are O(1)
+ * and timers only move down a level when their slot comes up.  Timers
+ * can be up to 2^32 ticks out, anything further is clamped.
+ */
+
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 4
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+
+struct wheel_timer_t;
+
+typedef void (*wheel_fire_cb)(struct wheel_timer_t *timer);
+
+typedef struct wheel_timer_t {
+    // slots are circular lists, next is NULL when it isn't in one
+    struct wheel_timer_t *next;
+    struct wheel_timer_t *prev;
+    uint64_t expires;
+    wheel_fire_cb fire;
+    void *data;
+} wheel_timer_t;
+
+typedef struct wheel_t {
+    // every timer expiring at or before this has fired
+    uint64_t now;
+    int count;
+    wheel_timer_t root[WHEEL_ROOT_SIZE];
+    wheel_timer_t levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+} wheel_t;
+
+wheel_t *wheel_create(uint64_t now);
+
+void wheel_destroy(wheel_t *wheel);
+
+void wheel_add(wheel_t *wheel, wheel_timer_t *timer, uint64_t expires);
+
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer);
+
+int wheel_advance(wheel_t *wheel, uint64_t now);
+
+int64_t wheel_next(wheel_t *wheel);
+
+#define wheel_timer_pending(T) ((T)->next != NULL)
+
+static inline void wheel_timer_init(wheel_timer_t *timer, wheel_fire_cb fire, void *data)
+{
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->fire = fire;
+    timer->data = data;
+}
+
+#endif
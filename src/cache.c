@@ -5,49 +5,174 @@
 #include <limits.h>
 
 #include "dbg.h"
+#include "tnetstrings.h"
+#include "tnetstrings_impl.h"
+
+static Cache *CACHES = NULL;
+
+struct tagbstring CACHE_HEADERS = bsStatic("66:4:name,4:size,7:entries,5:bytes,3:fds,4:hits,6:misses,9:evictions,]");
+
+#define Cache_bucket(C, H) (&(C)->buckets[(H) & (C)->bucket_mask])
 
 Cache *Cache_create(int size, cache_lookup_cb lookup, cache_evict_cb evict)
 {
     Cache *cache = NULL;
-    size_t extra_size = 0;
+    uint32_t nbuckets = 1;
     int i = 0;
 
     check(lookup, "lookup passed to cache_create is NULL");
+    check(size > 0, "Cache size must be more than 0, not %d", size);
 
-    if(size > MIN_CACHE_SIZE) {
-        extra_size = (size - MIN_CACHE_SIZE) * sizeof(struct cache_entry);
-    }
-
-    cache = calloc(sizeof(Cache) + extra_size, 1);
+    cache = calloc(sizeof(Cache), 1);
     check_mem(cache);
 
     cache->size = size;
     cache->lookup = lookup;
     cache->evict = evict;
-    
+    cache->max_bytes = LONG_MAX;
+    cache->max_fds = INT_MAX;
+
+    // keep the chains short, power of 2 so we can mask
+    while(nbuckets < (uint32_t)size * 2) nbuckets <<= 1;
+    cache->bucket_mask = nbuckets - 1;
+
+    cache->buckets = calloc(sizeof(CacheEntry *), nbuckets);
+    check_mem(cache->buckets);
+
+    cache->entries = calloc(sizeof(CacheEntry), size);
+    check_mem(cache->entries);
+
     for(i = 0; i < size; i++) {
-        cache->arr[i].tag = INT_MAX;
+        cache->entries[i].chain = cache->free;
+        cache->free = &cache->entries[i];
     }
 
+    cache->next_cache = CACHES;
+    if(CACHES) CACHES->prev_cache = cache;
+    CACHES = cache;
+
     return cache;
 
 error:
+    if(cache) {
+        free(cache->buckets);
+        free(cache);
+    }
     return NULL;
 }
 
+void Cache_set_hash(Cache *cache, cache_hash_cb hash_key, cache_hash_cb hash_data)
+{
+    check(cache, "NULL cache argument to Cache_set_hash");
+    check(cache->count == 0, "Can't change the hash of a cache that has things in it.");
+    check((hash_key == NULL) == (hash_data == NULL), "Need both hash functions or neither.");
+
+    cache->hash_key = hash_key;
+    cache->hash_data = hash_data;
+
+error: // fallthrough
+    return;
+}
+
+void Cache_set_limits(Cache *cache, long max_bytes, int max_fds)
+{
+    check(cache, "NULL cache argument to Cache_set_limits");
+
+    cache->max_bytes = max_bytes > 0 ? max_bytes : LONG_MAX;
+    cache->max_fds = max_fds > 0 ? max_fds : INT_MAX;
+
+error: // fallthrough
+    return;
+}
+
+static inline void Cache_unlink(Cache *cache, CacheEntry *entry)
+{
+    if(entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+
+    if(entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+
+    entry->prev = entry->next = NULL;
+}
+
+static inline void Cache_push_front(Cache *cache, CacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if(cache->head) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+
+    cache->head = entry;
+}
+
+/*
+ * Takes the entry out of its bucket and the LRU, calls evict on the
+ * data, and puts the entry back on the free list.
+ */
+static void Cache_remove(Cache *cache, CacheEntry *entry)
+{
+    CacheEntry **link = Cache_bucket(cache, entry->hash);
+
+    while(*link && *link != entry) {
+        link = &(*link)->chain;
+    }
+
+    if(*link) *link = entry->chain;
+
+    Cache_unlink(cache, entry);
+
+    cache->count--;
+    cache->bytes -= entry->bytes;
+    cache->fds -= entry->fds;
+    cache->evictions++;
+
+    if(cache->evict) cache->evict(entry->data);
+
+    entry->data = NULL;
+    entry->chain = cache->free;
+    cache->free = entry;
+}
+
+static inline int Cache_over_budget(Cache *cache, long bytes, int fds)
+{
+    return cache->count >= cache->size ||
+        cache->bytes + bytes > cache->max_bytes ||
+        cache->fds + fds > cache->max_fds;
+}
+
 void Cache_destroy(Cache *cache)
 {
-    int i = 0;
+    CacheEntry *entry = NULL;
     check(cache, "NULL cache argument to Cache_destroy");
 
     if(cache->evict) {
-        for(i = 0; i < cache->size; i++) {
-            if(cache->arr[i].data) {
-                cache->evict(cache->arr[i].data);
-            }
+        for(entry = cache->head; entry != NULL; entry = entry->next) {
+            cache->evict(entry->data);
         }
     }
-    
+
+    if(cache->prev_cache) {
+        cache->prev_cache->next_cache = cache->next_cache;
+    } else {
+        CACHES = cache->next_cache;
+    }
+
+    if(cache->next_cache) cache->next_cache->prev_cache = cache->prev_cache;
+
+    bdestroy(cache->name);
+    free(cache->entries);
+    free(cache->buckets);
     free(cache);
 
 error: // fallthrough
@@ -58,88 +183,129 @@ void *Cache_lookup(Cache *cache, void *key)
 {
     check(cache, "NULL cache argument to Cache_lookup");
 
-    void *rdata = NULL;
-    int i = 0;
+    uint32_t hash = cache->hash_key ? cache->hash_key(key) : 0;
+    CacheEntry *entry = NULL;
 
-    for(i = 0; i < cache->size; i++) {
-        if(cache->arr[i].tag > 0) {
-            cache->arr[i].tag--;
-        }
-
-        rdata = cache->arr[i].data;
-
-        if(rdata && cache->lookup(rdata, key)) {
-            cache->arr[i].tag = INT_MAX;
-            break;
-        }
-        rdata = NULL;
-    }
+    for(entry = *Cache_bucket(cache, hash); entry != NULL; entry = entry->chain) {
+        if(entry->hash == hash && cache->lookup(entry->data, key)) {
+            // most recently used goes to the front
+            if(entry != cache->head) {
+                Cache_unlink(cache, entry);
+                Cache_push_front(cache, entry);
+            }
 
-    for(i = i + 1; i < cache->size; i++) {
-        if(cache->arr[i].tag > 0) {
-            cache->arr[i].tag--;
+            cache->hits++;
+            return entry->data;
         }
     }
 
-    return rdata;
+    cache->misses++;
 
-error:
+error: // fallthrough
     return NULL;
 }
 
 void Cache_add(Cache *cache, void *data)
 {
+    Cache_add_sized(cache, data, 0, 0);
+}
+
+/**
+ * Adds data that costs the given bytes and open fds, evicting the least
+ * recently used entries until it fits in the size, byte and fd budgets.
+ * If it's bigger than the whole budget it gets evicted right away, so the
+ * cache always owns what you hand it.
+ */
+void Cache_add_sized(Cache *cache, void *data, long bytes, int fds)
+{
+    CacheEntry *entry = NULL;
+    CacheEntry **bucket = NULL;
+
     check(cache, "NULL cache argument to Cache_add");
     check(data, "Cannot add NULL as data to cache");
 
-    int i = 0;
-    int min_idx = 0;
-    int min_tag = cache->arr[min_idx].tag;
+    if(bytes > cache->max_bytes || fds > cache->max_fds) {
+        cache->evictions++;
+        if(cache->evict) cache->evict(data);
+        return;
+    }
 
-    if(cache->arr[0].tag > 0) {
-        cache->arr[0].tag--;
+    while(cache->tail && Cache_over_budget(cache, bytes, fds)) {
+        Cache_remove(cache, cache->tail);
     }
 
-    for(i = 1; i < cache->size; i++) {
-        if(cache->arr[i].tag < min_tag) {
-            min_tag = cache->arr[i].tag;
-            min_idx = i;
-        }
+    entry = cache->free;
+    check(entry != NULL, "Cache has no free entries after evicting, that's a bug.");
+    cache->free = entry->chain;
 
-        if(cache->arr[i].tag > 0) {
-            cache->arr[i].tag--;
-        }
-    }
-    
-    if(cache->arr[min_idx].data && cache->evict) {
-        cache->evict(cache->arr[min_idx].data);
-    }
+    entry->data = data;
+    entry->hash = cache->hash_data ? cache->hash_data(data) : 0;
+    entry->bytes = bytes;
+    entry->fds = fds;
+
+    bucket = Cache_bucket(cache, entry->hash);
+    entry->chain = *bucket;
+    *bucket = entry;
+
+    Cache_push_front(cache, entry);
+
+    cache->count++;
+    cache->bytes += bytes;
+    cache->fds += fds;
 
-    cache->arr[min_idx].data = data;
-    cache->arr[min_idx].tag = INT_MAX;
-   
 error: // fallthrough
     return;
 }
 
 void Cache_evict_object(Cache *cache, void *obj)
 {
-    int i = 0;
+    CacheEntry *entry = NULL;
+    CacheEntry *next = NULL;
 
     check(cache, "NULL cache argument to Cache_evict_object");
     check(obj, "NULL obj argument to Cache_evict_object");
 
-    for(i = 0; i < cache->size; i++) {
-        if(cache->arr[i].data == obj) {
-            if(cache->evict) {
-                cache->evict(cache->arr[i].data);
-            }
+    if(cache->hash_data) {
+        uint32_t hash = cache->hash_data(obj);
 
-            cache->arr[i].data = NULL;
-            cache->arr[i].tag = 0;
+        for(entry = *Cache_bucket(cache, hash); entry != NULL; entry = next) {
+            next = entry->chain;
+            if(entry->data == obj) Cache_remove(cache, entry);
+        }
+    } else {
+        for(entry = cache->head; entry != NULL; entry = next) {
+            next = entry->next;
+            if(entry->data == obj) Cache_remove(cache, entry);
         }
     }
 
 error:
     return;
 }
+
+tns_value_t *Cache_info()
+{
+    Cache *cache = NULL;
+    tns_value_t *rows = tns_new_list();
+
+    for(cache = CACHES; cache != NULL; cache = cache->next_cache) {
+        tns_value_t *data = tns_new_list();
+
+        if(cache->name) {
+            tns_list_addstr(data, cache->name);
+        } else {
+            tns_add_to_list(data, tns_get_null());
+        }
+
+        tns_add_to_list(data, tns_new_integer(cache->size));
+        tns_add_to_list(data, tns_new_integer(cache->count));
+        tns_add_to_list(data, tns_new_integer(cache->bytes));
+        tns_add_to_list(data, tns_new_integer(cache->fds));
+        tns_add_to_list(data, tns_new_integer(cache->hits));
+        tns_add_to_list(data, tns_new_integer(cache->misses));
+        tns_add_to_list(data, tns_new_integer(cache->evictions));
+        tns_add_to_list(rows, data);
+    }
+
+    return tns_standard_table(&CACHE_HEADERS, rows);
+}
@@ -1,24 +1,61 @@
 #ifndef _CACHE_H
 #define _CACHE_H
 
+#include <stdint.h>
+#include <bstring.h>
+
 #define MIN_CACHE_SIZE 16
 
 
 typedef int (*cache_lookup_cb)(void *data, void *key);
 typedef void (*cache_evict_cb)(void *data);
+typedef uint32_t (*cache_hash_cb)(void *key_or_data);
 
-struct cache_entry {
-    int tag;
+typedef struct CacheEntry {
     void *data;
-};
+    uint32_t hash;
+    long bytes;
+    int fds;
+
+    // LRU order, head is the most recently used
+    struct CacheEntry *prev;
+    struct CacheEntry *next;
+
+    // next entry in the same bucket, or the free list
+    struct CacheEntry *chain;
+} CacheEntry;
 
 typedef struct Cache {
     cache_lookup_cb lookup;
     cache_evict_cb evict;
+
+    // without these everything lands in one bucket and lookups scan it
+    cache_hash_cb hash_key;
+    cache_hash_cb hash_data;
+
     int size;
-    // arr must be at the end so we can dynamically make it larger than
-    // MIN_CACHE_SIZE by allocating extra and treating it as additional slots
-    struct cache_entry arr[MIN_CACHE_SIZE];
+    int count;
+    long bytes;
+    long max_bytes;
+    int fds;
+    int max_fds;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+    bstring name;
+
+    CacheEntry *head;
+    CacheEntry *tail;
+    CacheEntry *free;
+    CacheEntry **buckets;
+    uint32_t bucket_mask;
+    CacheEntry *entries;
+
+    // every live cache is on this list for Cache_info
+    struct Cache *next_cache;
+    struct Cache *prev_cache;
 } Cache;
 
 Cache *Cache_create(int size, cache_lookup_cb lookup, cache_evict_cb evict);
@@ -27,4 +64,10 @@ void *Cache_lookup(Cache *cache, void *key);
 void Cache_add(Cache *cache, void *data);
 void Cache_evict_object(Cache *cache, void *obj);
 
+void Cache_set_hash(Cache *cache, cache_hash_cb hash_key, cache_hash_cb hash_data);
+void Cache_set_limits(Cache *cache, long max_bytes, int max_fds);
+void Cache_add_sized(Cache *cache, void *data, long bytes, int fds);
+
+struct tns_value_t *Cache_info();
+
 #endif
@@ -198,18 +198,23 @@ static int Config_load_proxy_cb(void *param, int cols, char **data, char **names
 {
     bstring key = cols_to_key("proxy", cols, data);
 
-    arity(3);
+    arity(6);
 
     BackendValue *backend = tst_search(LOADED, bdata(key), blength(key));
 
     if(backend) {
-        Proxy *proxy = backend->value;
-        proxy->running = 1;
+        Proxy_start(backend->value);
     } else {
         Proxy *proxy = Proxy_create(bfromcstr(data[1]), atoi(data[2]));
         check(proxy != NULL, "Failed to create proxy %s with address=%s port=%s", data[0], data[1], data[2]);
 
-        log_info("Loaded proxy %s with address=%s port=%s", data[0], data[1], data[2]);
+        check(Proxy_add_upstreams(proxy, data[3]) == 0,
+                "Failed to add upstreams '%s' to proxy %s", data[3], data[0]);
+        check(Proxy_set_balance(proxy, data[4], data[5]) == 0,
+                "Invalid balance '%s' for proxy %s", data[4], data[0]);
+
+        log_info("Loaded proxy %s with address=%s port=%s upstreams=%s balance=%s",
+                data[0], data[1], data[2], data[3], data[4]);
 
         check(store_in_loaded(key, proxy, BACKEND_PROXY) == 0, "Failed to store proxy.");
     }
@@ -223,7 +228,7 @@ error:
 
 static int Config_load_proxies()
 {
-    const char *PROXY_QUERY = "SELECT id, addr, port FROM proxy";
+    const char *PROXY_QUERY = "SELECT id, addr, port, upstreams, balance, hash_on FROM proxy";
 
     int rc = DB_exec(PROXY_QUERY, Config_load_proxy_cb, NULL);
     check(rc == 0, "Failed to load proxies");
@@ -523,8 +528,7 @@ static void shutdown_cb(void *value, void *data)
         handler->running = 0;
     } else if(backend->type == BACKEND_PROXY) {
         debug("Stopping proxy: %s", bdata(backend->key));
-        Proxy *proxy = backend->value;
-        proxy->running = 0;
+        Proxy_stop(backend->value);
     } else if(backend->type == BACKEND_DIR) {
         debug("Stopping dir: %s", bdata(backend->key));
         Dir *dir = backend->value;
@@ -37,7 +37,10 @@ CREATE TABLE handler (id INTEGER PRIMARY KEY,
 
 CREATE TABLE proxy (id INTEGER PRIMARY KEY,
     addr TEXT,
-    port INTEGER);
+    port INTEGER,
+    upstreams TEXT DEFAULT '',
+    balance TEXT DEFAULT 'roundrobin',
+    hash_on TEXT DEFAULT '');
 
 CREATE TABLE directory (id INTEGER PRIMARY KEY,
     base TEXT,
@@ -59,6 +59,9 @@ int BUFFER_SIZE = 4 * 1024;
 int CONNECTION_STACK = 32 * 1024;
 int CLIENT_READ_RETRIES = 5;
 
+// header reads smaller than this count against limits.client_read_retries
+#define CLIENT_SMALL_READ 512
+
 
 static inline int Connection_backend_event(Backend *found, Connection *conn)
 {
@@ -79,6 +82,39 @@ error:
 
 
 
+/*
+ * Gives proxy_iob back to its upstream's pool, which keeps it if the last
+ * response left it reusable and closes it otherwise.
+ */
+static inline void Connection_proxy_done(Connection *conn)
+{
+    if(conn->proxy_pending && conn->upstream) {
+        conn->upstream->outstanding--;
+    }
+
+    conn->proxy_pending = 0;
+}
+
+static inline void Connection_release_proxy(Connection *conn)
+{
+    Connection_proxy_done(conn);
+
+    if(conn->proxy_iob) {
+        if(conn->upstream) {
+            ProxyUpstream_release(conn->upstream, conn->proxy_iob,
+                    conn->proxy_connected, conn->proxy_reusable);
+        } else {
+            IOBuf_destroy(conn->proxy_iob);
+        }
+    }
+
+    conn->proxy_iob = NULL;
+    conn->upstream = NULL;
+    conn->proxy_reusable = 0;
+}
+
+
+
 int connection_send_socket_response(Connection *conn)
 {
     if(Response_send_socket_policy(conn) > 0) {
@@ -96,15 +132,9 @@ int connection_route_request(Connection *conn)
 
     bstring path = Request_path(conn->req);
 
-    if(conn->req->host_name) {
-        host = Server_match_backend(conn->server, conn->req->host_name);
-    } else {
-        host = conn->server->default_host;
-    }
+    Backend *found = Server_match_route(conn->server, conn->req->host_name, path, &host, &route);
 
     error_unless(host, conn, 404, "Request for a host we don't have registered: %s", bdata(conn->req->host_name));
-
-    Backend *found = Host_match_backend(host, path, &route);
     error_unless(found, conn, 404, "Handler not found: %s", bdata(path));
 
     Request_set_action(conn->req, found);
@@ -113,6 +143,9 @@ int connection_route_request(Connection *conn)
     conn->req->pattern = route->pattern;
     conn->req->prefix = route->prefix;
 
+    // only directory responses get held back for pipelined requests
+    if(found->type != BACKEND_DIR) IOBuf_flush(conn->iob);
+
     return Connection_backend_event(found, conn);
 
 error:
@@ -136,26 +169,10 @@ int connection_msg_to_handler(Connection *conn)
         Register_ping(IOBuf_fd(conn->iob));
     } else {
         check(body_len >= 0, "Parsing error, body length ended up being: %d", body_len);
-        bstring payload = NULL;
-
-        if(handler->protocol == HANDLER_PROTO_TNET) {
-            payload = Request_to_tnetstring(conn->req, handler->send_ident,
-                    IOBuf_fd(conn->iob), IOBuf_start(conn->iob) + header_len,
-                    body_len - 1);  // drop \0 on payloads
-        } else if(handler->protocol == HANDLER_PROTO_JSON) {
-            payload = Request_to_payload(conn->req, handler->send_ident,
-                    IOBuf_fd(conn->iob), IOBuf_start(conn->iob) + header_len,
-                    body_len - 1);  // drop \0 on payloads
-        } else {
-            sentinel("Invalid protocol type: %d", handler->protocol);
-        }
+        rc = Handler_send_request(handler, conn->req, IOBuf_fd(conn->iob),
+                IOBuf_start(conn->iob) + header_len,
+                body_len - 1);  // drop \0 on payloads
 
-        debug("SENT: %s", bdata(payload));
-        check(payload != NULL, "Failed to generate payload.");
-
-        rc = Handler_deliver(handler->send_socket, bdata(payload), blength(payload));
-        free(payload);
-    
         check(rc == 0, "Failed to deliver to handler: %s", bdata(Request_path(conn->req)));
     }
 
@@ -171,48 +188,24 @@ error:
 
 int Connection_send_to_handler(Connection *conn, Handler *handler, char *body, int content_len)
 {
-    int rc = 0;
-    bstring payload = NULL;
-
-    if(handler->protocol == HANDLER_PROTO_TNET) {
-        payload = Request_to_tnetstring(conn->req, handler->send_ident, 
-                IOBuf_fd(conn->iob), body, content_len);
-    } else if(handler->protocol == HANDLER_PROTO_JSON) {
-        payload = Request_to_payload(conn->req, handler->send_ident, 
-                IOBuf_fd(conn->iob), body, content_len);
-    } else {
-        sentinel("Invalid protocol type: %d", handler->protocol);
-    }
-
-    debug("SENT: %s", bdata(payload));
-
-    check(payload, "Failed to create payload for request.");
-
-    debug("HTTP TO HANDLER: %.*s", blength(payload) - content_len, bdata(payload));
-
-    rc = Handler_deliver(handler->send_socket, bdata(payload), blength(payload));
-    payload=NULL;
+    int rc = Handler_send_request(handler, conn->req, IOBuf_fd(conn->iob), body, content_len);
 
     error_unless(rc != -1, conn, 502, "Failed to deliver to handler: %s", 
             bdata(Request_path(conn->req)));
 
-    free(payload);
     return 0;
 
 error:
-    if(payload) free(payload);
     return -1;
 }
 
 
-static struct tagbstring UPGRADE = bsStatic("upgrade");
-static struct tagbstring CONNECTION = bsStatic("connection");
 const int WEBSOCKET_ARBITRARY_BODY_SIZE = 8;
 
 static inline int is_websocket(Connection *conn)
 {
-    return Request_get(conn->req, &UPGRADE) != NULL && 
-        Request_get(conn->req, &CONNECTION) != NULL;
+    return Request_known(conn->req, HEADER_UPGRADE) != NULL &&
+        Request_known(conn->req, HEADER_CONNECTION) != NULL;
 }
 
 int connection_http_to_handler(Connection *conn)
@@ -262,12 +255,24 @@ error:
 int connection_http_to_directory(Connection *conn)
 {
     Dir *dir = Request_get_action(conn->req, dir);
+    int req_len = Request_header_length(conn->req) + Request_content_length(conn->req);
+
+    // more pipelined requests are already buffered, so hold this response
+    // and send it along with theirs, otherwise send everything now
+    if(IOBuf_avail(conn->iob) > req_len && !conn->close) {
+        IOBuf_cork(conn->iob);
+    } else {
+        IOBuf_flush(conn->iob);
+    }
 
     int rc = Dir_serve_file(dir, conn->req, conn);
     check_debug(rc == 0, "Failed to serve file: %s", bdata(Request_path(conn->req)));
 
-    check(IOBuf_read_commit(conn->iob,
-            Request_header_length(conn->req) + Request_content_length(conn->req)) != -1, "Finaly commit failed sending from directory.");
+    if(!conn->iob->corked) {
+        check_debug(IOBuf_flush(conn->iob) != -1, "Failed to send held responses.");
+    }
+
+    check(IOBuf_read_commit(conn->iob, req_len) != -1, "Finaly commit failed sending from directory.");
 
 
     Log_request(conn, conn->req->status_code, conn->req->response_size);
@@ -285,19 +290,56 @@ error:
 
 
 
+/*
+ * Balances every request, not just the first one on a connection, so a
+ * keep-alive client only stays on its backend connection while
+ * Proxy_select keeps picking that upstream.  Otherwise the connection
+ * goes back to its pool and one to the new upstream is picked up or
+ * dialed, where a dead upstream costs one dial and then the next one
+ * gets a try.
+ */
+static int Connection_proxy_upstream(Connection *conn, Proxy *proxy)
+{
+    int tries = 0;
+    ProxyUpstream *up = Proxy_select(proxy, conn->req, NULL);
+
+    if(up != conn->upstream || !conn->proxy_reusable) {
+        Connection_release_proxy(conn);
+    }
+
+    while(conn->proxy_iob == NULL) {
+        check(up != NULL && tries++ < proxy->upstream_count,
+                "Failed to get a connection to proxy backend %s:%d",
+                bdata(proxy->server), proxy->port);
+
+        conn->proxy_iob = ProxyUpstream_connect(up, &conn->proxy_connected);
+
+        if(conn->proxy_iob == NULL) {
+            ProxyUpstream_failed(up);
+            up = Proxy_select(proxy, conn->req, up);
+        }
+    }
+
+    conn->upstream = up;
+    conn->proxy_reusable = 0;
+    conn->proxy_pending = 1;
+    up->outstanding++;
+
+    return 0;
+
+error:
+    return -1;
+}
+
 int connection_http_to_proxy(Connection *conn)
 {
     Proxy *proxy = Request_get_action(conn->req, proxy);
     check(proxy != NULL, "Should have a proxy backend.");
 
-    int proxy_fd = netdial(1, bdata(proxy->server), proxy->port);
-    check(proxy_fd != -1, "Failed to connect to proxy backend %s:%d",
-            bdata(proxy->server), proxy->port);
+    Connection_release_proxy(conn);
 
-    if(!conn->proxy_iob) {
-        conn->proxy_iob = IOBuf_create(BUFFER_SIZE, proxy_fd, IOBUF_SOCKET);
-        check_mem(conn->proxy_iob);
-    }
+    check_debug(Connection_proxy_upstream(conn, proxy) == 0,
+            "No upstream for proxy %s:%d", bdata(proxy->server), proxy->port);
 
     if(!conn->client) {
         conn->client = h_calloc(sizeof(httpclient_parser), 1);
@@ -318,11 +360,20 @@ int connection_proxy_deliver(Connection *conn)
     int rc = 0;
     int total_len = Request_header_length(conn->req) + Request_content_length(conn->req);
 
-    char *buf = IOBuf_read_all(conn->iob, total_len, CLIENT_READ_RETRIES);
-    check(buf != NULL, "Failed to read from the client socket to proxy.");
+    // it's not reusable until the whole response comes back
+    conn->proxy_reusable = 0;
 
-    rc = IOBuf_send(conn->proxy_iob, IOBuf_start(conn->iob), total_len);
-    check(rc > 0, "Failed to send to proxy.");
+    if(total_len > conn->iob->len) {
+        // big uploads get streamed (spliced if they can) not buffered
+        rc = IOBuf_stream(conn->iob, conn->proxy_iob, total_len);
+        check(rc == total_len, "Failed to stream the request to proxy.");
+    } else {
+        char *buf = IOBuf_read_all(conn->iob, total_len, CLIENT_READ_RETRIES);
+        check(buf != NULL, "Failed to read from the client socket to proxy.");
+
+        rc = IOBuf_send(conn->proxy_iob, buf, total_len);
+        check(rc > 0, "Failed to send to proxy.");
+    }
 
     return REQ_SENT;
 
@@ -336,12 +387,21 @@ int connection_proxy_reply_parse(Connection *conn)
 {
     int rc = 0;
     int total = 0;
-    Proxy *proxy = Request_get_action(conn->req, proxy);
+    int keep_alive = 0;
+    ProxyUpstream *up = conn->upstream;
     httpclient_parser *client = conn->client;
 
     rc = Proxy_read_and_parse(conn);
+
+    if(rc == -1) ProxyUpstream_failed(up);
     check(rc != -1, "Failed to read from proxy server: %s:%d", 
-            bdata(proxy->server), proxy->port);
+            bdata(up->server), up->port);
+
+    ProxyUpstream_ok(up);
+
+    // chunk parsing resets client->close so remember it now, and 1.0
+    // backends close unless they say otherwise
+    keep_alive = !client->close && strncmp(IOBuf_start(conn->proxy_iob), "HTTP/1.0", 8) != 0;
 
     if(client->chunked) {
         // send the http header we have so far
@@ -373,6 +433,9 @@ int connection_proxy_reply_parse(Connection *conn)
 
     Log_request(conn, client->status, client->content_len);
 
+    Connection_proxy_done(conn);
+    conn->proxy_reusable = keep_alive && !client->close;
+
     if(client->close) {
         return REMOTE_CLOSE;
     } else {
@@ -406,10 +469,14 @@ int connection_proxy_req_parse(Connection *conn)
     if(found != req_action) {
         Request_set_action(conn->req, found);
         return Connection_backend_event(found, conn);
-    } else {
-        return HTTP_REQ;
     }
 
+    error_unless(Connection_proxy_upstream(conn, Request_get_action(conn->req, proxy)) == 0,
+            conn, 502, "No upstream for proxied request to %s",
+            bdata(Request_path(conn->req)));
+
+    return HTTP_REQ;
+
     error_response(conn, 500, "Invalid code branch, tell Zed.");
 error:
     return REMOTE_CLOSE;
@@ -427,17 +494,16 @@ int connection_proxy_failed(Connection *conn)
 
 int connection_proxy_close(Connection *conn)
 {
-    IOBuf_destroy(conn->proxy_iob);
-    conn->proxy_iob = NULL;
+    Connection_release_proxy(conn);
 
     return CLOSE;
 }
 
 static inline int close_or_error(Connection *conn, int next)
 {
+    if(!IOBuf_closed(conn->iob)) IOBuf_flush(conn->iob);
 
-    IOBuf_destroy(conn->proxy_iob);
-    conn->proxy_iob = NULL;
+    Connection_release_proxy(conn);
 
     check_debug(Register_disconnect(IOBuf_fd(conn->iob)) != -1,
             "Register disconnect didn't work for %d", IOBuf_fd(conn->iob));
@@ -535,7 +601,7 @@ void Connection_destroy(Connection *conn)
         Request_destroy(conn->req);
         conn->req = NULL;
         IOBuf_destroy(conn->iob);
-        IOBuf_destroy(conn->proxy_iob);
+        Connection_release_proxy(conn);
         h_free(conn);
     }
 }
@@ -651,7 +717,7 @@ static inline void check_should_close(Connection *conn, Request *req)
         debug("HTTP 1.0 request coming in from %s", conn->remote);
         conn->close = 1;
     } else {
-        bstring conn_close = Request_get(req, &HTTP_CONNECTION);
+        bstring conn_close = Request_known(req, HEADER_CONNECTION);
 
         if(conn_close && biseqcstrcaseless(conn_close, "close")) {
             conn->close = 1;
@@ -672,14 +738,19 @@ int Connection_read_header(Connection *conn, Request *req)
 
     Request_start(req);
 
-    for(tries = 0; rc == 0 && tries < CLIENT_READ_RETRIES; tries++) {
+    // pipelined requests are parsed straight out of what's already
+    // buffered, and only reads that bring in a small packet count as tries
+    while(rc == 0 && tries < CLIENT_READ_RETRIES) {
         if(avail > 0) {
             rc = Request_parse(req, data, avail, &nparsed);
         }
 
         if(rc == 0) {
+            int had = avail;
             data = IOBuf_read_some(conn->iob, &avail);
             check_debug(!IOBuf_closed(conn->iob), "Client closed during read.");
+
+            if(avail - had < CLIENT_SMALL_READ) tries++;
         }
     }
 
@@ -688,8 +759,9 @@ int Connection_read_header(Connection *conn, Request *req)
     error_unless(rc == 1, conn, 400, "Error parsing request.");
 
     // add the x-forwarded-for header
-    Request_set(conn->req, bstrcpy(&HTTP_X_FORWARDED_FOR),
-            bfromcstr(conn->remote), 1);
+    struct tagbstring remote;
+    btfromcstr(remote, conn->remote);
+    Request_set(conn->req, &HTTP_X_FORWARDED_FOR, &remote, 1);
 
     check_should_close(conn, conn->req);
 
@@ -718,6 +790,18 @@ void Connection_init()
 
     log_info("MAX limits.proxy_read_retries=%d, limits.proxy_read_retry_warn=%d",
             PROXY_READ_RETRIES, PROXY_READ_RETRY_WARN);
+
+    PROXY_POOL_IDLE = Setting_get_int("limits.proxy_pool_idle", 8);
+    PROXY_POOL_MAX_AGE = Setting_get_int("limits.proxy_pool_max_age", 60);
+
+    log_info("MAX limits.proxy_pool_idle=%d, limits.proxy_pool_max_age=%d",
+            PROXY_POOL_IDLE, PROXY_POOL_MAX_AGE);
+
+    PROXY_MAX_FAILS = Setting_get_int("limits.proxy_max_fails", 3);
+    PROXY_HEALTH_INTERVAL = Setting_get_int("limits.proxy_health_interval", 5);
+
+    log_info("MAX limits.proxy_max_fails=%d, limits.proxy_health_interval=%d",
+            PROXY_MAX_FAILS, PROXY_HEALTH_INTERVAL);
 }
 
 
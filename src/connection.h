@@ -59,6 +59,13 @@ typedef struct Connection {
     IOBuf *iob;
     IOBuf *proxy_iob;
 
+    // which upstream's pool proxy_iob goes back to, and whether it can
+    ProxyUpstream *upstream;
+    time_t proxy_connected;
+    int proxy_reusable;
+    // set while a request is counted in upstream->outstanding
+    int proxy_pending;
+
     int rport;
     State state;
     struct httpclient_parser *client;
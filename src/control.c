@@ -2,11 +2,15 @@
 #include "bstring.h"
 #include "task/task.h"
 #include "register.h"
+#include "cache.h"
+#include "proxy.h"
+#include "tls.h"
 #include "server.h"
 #include "dbg.h"
 #include <stdlib.h>
 #include <time.h>
 #include "setting.h"
+#include "worker.h"
 #include <signal.h>
 #include "tnetstrings.h"
 #include "tnetstrings_impl.h"
@@ -253,8 +257,17 @@ tns_value_t *status_cb(bstring name, hash_t *args)
     } else if(biseqcstr(what, "net")) {
         tns_value_destroy(result);
         return Register_info();
+    } else if(biseqcstr(what, "cache")) {
+        tns_value_destroy(result);
+        return Cache_info();
+    } else if(biseqcstr(what, "proxy")) {
+        tns_value_destroy(result);
+        return Proxy_info();
+    } else if(biseqcstr(what, "ssl")) {
+        tns_value_destroy(result);
+        return TLS_info();
     } else {
-        bstring err = bfromcstr("Expected argument what=['net'|'tasks'].");
+        bstring err = bfromcstr("Expected argument what=['net'|'tasks'|'cache'|'proxy'|'ssl'].");
         tns_dict_setcstr(result, "error", tns_parse_string(bdata(err), blength(err)));
         bdestroy(err);
     }
@@ -263,6 +276,42 @@ error: // fallthrough
     return result;
 }
 
+tns_value_t *upstream_cb(bstring name, hash_t *args)
+{
+    tns_value_t *result = tns_new_dict();
+    int port = 0;
+    int enabled = 1;
+    int count = 0;
+
+    tns_value_t *server = get_arg(args, "server");
+    check_control_err(server != NULL, &INVALID_ARGUMENT_ERR, "Missing argument 'server'.");
+    check_control_err(tns_get_type(server) == tns_tag_string, &INVALID_ARGUMENT_ERR, "Argument type error.");
+
+    tns_value_t *arg = get_arg(args, "port");
+    if(arg != NULL) {
+        check_control_err(tns_get_type(arg) == tns_tag_number, &INVALID_ARGUMENT_ERR, "Argument type error.");
+        port = arg->value.number;
+    }
+
+    arg = get_arg(args, "enabled");
+    if(arg != NULL) {
+        check_control_err(tns_get_type(arg) == tns_tag_number, &INVALID_ARGUMENT_ERR, "Argument type error.");
+        enabled = arg->value.number != 0;
+    }
+
+    count = Proxy_set_enabled(server->value.string, port, enabled);
+    check_control_err(count > 0, &INVALID_ARGUMENT_ERR, "No proxy upstream %s:%d.",
+            bdata(server->value.string), port);
+
+    tns_value_destroy(result);
+
+    return basic_response(bfromcstr("msg"), bformat("%s %d upstreams",
+                enabled ? "enabled" : "disabled", count));
+
+error: // fallthrough
+    return result;
+}
+
 struct tagbstring INFO_HEADERS = bsStatic("92:4:port,9:bind_addr,4:uuid,6:chroot,10:access_log,9:error_log,8:pid_file,16:default_hostname,]");
 
 tns_value_t *info_cb(bstring name, hash_t *args)
@@ -301,7 +350,9 @@ callback_list_t CALLBACKS[] = {
     {.name = bsStatic("kill"),
         .help = bsStatic("kill a connection"), .callback = kill_cb},
     {.name = bsStatic("status"),
-        .help = bsStatic("status, what=['net'|'tasks']"), .callback = status_cb},
+        .help = bsStatic("status, what=['net'|'tasks'|'cache'|'proxy'|'ssl']"), .callback = status_cb},
+    {.name = bsStatic("upstream"),
+        .help = bsStatic("take a proxy upstream in or out, server=host port=N enabled=1|0"), .callback = upstream_cb},
     {.name = bsStatic("terminate"),
         .help = bsStatic("terminate the server (SIGTERM)"), .callback = signal_server_cb},
     {.name = bsStatic("time"),
@@ -369,7 +420,7 @@ void Control_task(void *v)
     int rc = 0;
     tns_value_t *req = NULL;
     tns_value_t *rep = NULL;
-    bstring spec = Setting_get_str("control_port", &DEFAULT_CONTROL_SPEC);
+    bstring spec = Worker_spec(Setting_get_str("control_port", &DEFAULT_CONTROL_SPEC));
     taskname("control");
 
     log_info("Setting up control socket in at %s", bdata(spec));
@@ -402,16 +453,18 @@ void Control_task(void *v)
         tns_value_destroy(rep);
     }
 
-    rc = zmq_close(CONTROL_SOCKET);
+    rc = mqclose(CONTROL_SOCKET);
     check(rc == 0, "Failed to close control port socket.");
     CONTROL_SOCKET = NULL;
+    bdestroy(spec);
     log_info("Control port exiting.");
     taskexit(0);
 
 error:
     log_info("Control port exiting with error.");
-    zmq_close(CONTROL_SOCKET);
+    mqclose(CONTROL_SOCKET);
     CONTROL_SOCKET = NULL;
+    bdestroy(spec);
     taskexit(1);
 }
 
@@ -38,24 +38,73 @@
 #include <dbg.h>
 #include <task/task.h>
 #include <string.h>
+#include <ctype.h>
 #include <pattern.h>
 #include <assert.h>
 #include <mime.h>
 #include <response.h>
+#include <zlib.h>
+#include <sys/uio.h>
 #include "version.h"
 #include "setting.h"
 
 int MAX_DIR_PATH = 0;
 int MAX_SEND_BUFFER = 0;
+int MAX_DIR_GZIP = 0;
+int MAX_DIR_CACHE_SIZE = 0;
+int MAX_DIR_CACHE_FDS = 0;
+int MAX_DIR_CACHE_BYTES = 0;
+int MAX_DIR_MEMORY_FILE = 0;
+int MAX_DIR_MEMORY_TOTAL = 0;
+
+// bytes of small file bodies held in memory across every Dir
+static long DIR_MEMORY_USED = 0;
 
 struct tagbstring ETAG_PATTERN = bsStatic("[a-e0-9]+-[a-e0-9]+");
 
 const char *RESPONSE_FORMAT = "HTTP/1.1 200 OK\r\n"
     "Date: %s\r\n"
     "Content-Type: %s\r\n"
-    "Content-Length: %d\r\n"
+    "Content-Length: %lld\r\n"
+    "Last-Modified: %s\r\n"
+    "ETag: %s\r\n"
+    "%s"
+    "Accept-Ranges: bytes\r\n"
+    "Server: " VERSION
+    "\r\n\r\n";
+
+const char *RANGE_RESPONSE_FORMAT = "HTTP/1.1 206 Partial Content\r\n"
+    "Date: %s\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Length: %lld\r\n"
+    "Content-Range: bytes %lld-%lld/%lld\r\n"
+    "Last-Modified: %s\r\n"
+    "ETag: %s\r\n"
+    "%s"
+    "Accept-Ranges: bytes\r\n"
+    "Server: " VERSION
+    "\r\n\r\n";
+
+const char *MULTIPART_RESPONSE_FORMAT = "HTTP/1.1 206 Partial Content\r\n"
+    "Date: %s\r\n"
+    "Content-Type: multipart/byteranges; boundary=%s\r\n"
+    "Content-Length: %lld\r\n"
     "Last-Modified: %s\r\n"
     "ETag: %s\r\n"
+    "%s"
+    "Accept-Ranges: bytes\r\n"
+    "Server: " VERSION
+    "\r\n\r\n";
+
+const char *MULTIPART_PART_FORMAT = "\r\n--%s\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Range: bytes %lld-%lld/%lld\r\n\r\n";
+
+const char *MULTIPART_END_FORMAT = "\r\n--%s--\r\n";
+
+const char *RANGE_NOT_SATISFIABLE_FORMAT = "HTTP/1.1 416 Requested Range Not Satisfiable\r\n"
+    "Content-Range: bytes */%lld\r\n"
+    "Content-Length: 0\r\n"
     "Server: " VERSION
     "\r\n\r\n";
 
@@ -65,20 +114,148 @@ const char *DIR_REDIRECT_FORMAT = "HTTP/1.1 301 Moved Permanently\r\n"
     "Server: " VERSION
     "\r\n\r\n";
 
+struct tagbstring GZIP_HEADER = bsStatic("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+struct tagbstring DEFLATE_HEADER = bsStatic("Content-Encoding: deflate\r\nVary: Accept-Encoding\r\n");
+struct tagbstring VARY_HEADER = bsStatic("Vary: Accept-Encoding\r\n");
+struct tagbstring NO_HEADER = bsStatic("");
+
+// content types worth compressing on the fly, anything else has to have a .gz
+struct tagbstring COMPRESSIBLE_TYPES[] = {
+    bsStatic("text/"),
+    bsStatic("javascript"),
+    bsStatic("json"),
+    bsStatic("xml"),
+    bsStatic("svg")
+};
+
+#define COMPRESSIBLE_TYPES_COUNT (sizeof(COMPRESSIBLE_TYPES) / sizeof(struct tagbstring))
+
 // TODO: confirm that we are actually doing the GMT time right
 const char *RFC_822_TIME = "%a, %d %b %Y %H:%M:%S GMT";
 
+typedef struct FileRecordKey {
+    bstring request_path;
+    int encoding;
+} FileRecordKey;
+
 static int filerecord_cache_lookup(void *data, void *key) {
-    bstring request_path = (bstring) key;
+    FileRecordKey *frkey = (FileRecordKey *) key;
     FileRecord *fr = (FileRecord *) data;
 
-    return !bstrcmp(fr->request_path, request_path);
+    return fr->encoding == frkey->encoding && !bstrcmp(fr->request_path, frkey->request_path);
 }
 
 static void filerecord_cache_evict(void *data) {
     FileRecord_release((FileRecord *) data);
 }
 
+static uint32_t filerecord_key_hash(void *key) {
+    FileRecordKey *frkey = (FileRecordKey *) key;
+
+    return bstr_hash_fun(frkey->request_path) ^ frkey->encoding;
+}
+
+static uint32_t filerecord_data_hash(void *data) {
+    FileRecord *fr = (FileRecord *) data;
+
+    return bstr_hash_fun(fr->request_path) ^ fr->encoding;
+}
+
+static inline void FileRecord_cache_add(Dir *dir, FileRecord *fr)
+{
+    long bytes = blength(fr->header) + (fr->data ? blength(fr->data) : 0);
+
+    Cache_add_sized(dir->fr_cache, fr, bytes, fr->fd >= 0 ? 1 : 0);
+}
+
+
+static inline int Dir_compressible(bstring content_type)
+{
+    unsigned int i = 0;
+
+    for(i = 0; i < COMPRESSIBLE_TYPES_COUNT; i++) {
+        if(binstr(content_type, 0, &COMPRESSIBLE_TYPES[i]) != BSTR_ERR) return 1;
+    }
+
+    return 0;
+}
+
+// a .gz older than its file was made from an old copy, so it doesn't count
+static inline int Dir_precompressed_fresh(struct stat *gz_sb, struct stat *orig_sb)
+{
+    return S_ISREG(gz_sb->st_mode) && gz_sb->st_mtime >= orig_sb->st_mtime;
+}
+
+static inline int Dir_has_precompressed(bstring path, struct stat *orig_sb)
+{
+    struct stat sb;
+    bstring gz_path = bformat("%s.gz", bdata(path));
+    int rc = gz_path ? stat((const char *)gz_path->data, &sb) : -1;
+
+    bdestroy(gz_path);
+    return rc == 0 && Dir_precompressed_fresh(&sb, orig_sb);
+}
+
+static inline int FileRecord_build_header(FileRecord *fr)
+{
+    fr->header = bformat(RESPONSE_FORMAT,
+        bdata(fr->date),
+        bdata(fr->content_type),
+        (long long)FileRecord_size(fr),
+        bdata(fr->last_mod),
+        bdata(fr->etag),
+        bdata(fr->encoding_header));
+
+    return fr->header == NULL ? -1 : 0;
+}
+
+/**
+ * Pulls a small file's body into memory so it can go out with the header
+ * in one write instead of a send plus a sendfile.  The fd gets closed
+ * once it's loaded.  Files that are too big, or that would go over the
+ * global budget, just stay on the fd.  It's always a copy, since a mapped
+ * file that's truncated under us would SIGBUS the whole server.
+ */
+static void FileRecord_load_memory(FileRecord *fr)
+{
+    off_t size = fr->sb.st_size;
+    bstring data = NULL;
+    int rc = 0;
+
+    if(size <= 0 || size > MAX_DIR_MEMORY_FILE ||
+            DIR_MEMORY_USED + size > MAX_DIR_MEMORY_TOTAL) {
+        return;
+    }
+
+    data = bfromcstralloc(size + 1, "");
+    check_mem(data);
+
+    rc = pread(fr->fd, data->data, size, 0);
+    check(rc == size, "Came up short reading %s into memory.", bdata(fr->full_path));
+
+    data->slen = size;
+    data->data[size] = '\0';
+
+    fr->data = data;
+    DIR_MEMORY_USED += size;
+
+    fdclose(fr->fd);
+    fr->fd = -1;
+    return;
+
+error:
+    bdestroy(data);
+}
+
+static inline void FileRecord_free_memory(FileRecord *fr)
+{
+    if(fr->data && fr->encoding == DIR_IDENTITY) {
+        DIR_MEMORY_USED -= blength(fr->data);
+    }
+
+    bdestroy(fr->data);
+    fr->data = NULL;
+}
 
 FileRecord *Dir_find_file(bstring path, bstring default_type)
 {
@@ -89,6 +266,7 @@ FileRecord *Dir_find_file(bstring path, bstring default_type)
 
     // We set the number of users here.  If we cache it, we can add one later
     fr->users = 1;
+    fr->fd = -1;
 
     int rc = stat(p, &fr->sb);
     check(rc == 0, "File stat failed: %s", bdata(path));
@@ -120,14 +298,20 @@ FileRecord *Dir_find_file(bstring path, bstring default_type)
 
     fr->etag = bformat("%x-%x", fr->sb.st_mtime, fr->sb.st_size);
 
-    fr->header = bformat(RESPONSE_FORMAT,
-        bdata(fr->date),
-        bdata(fr->content_type),
-        fr->sb.st_size,
-        bdata(fr->last_mod),
-        bdata(fr->etag));
+    // caches need to know there's a compressed version of this too
+    if(Dir_compressible(fr->content_type)) {
+        fr->encoding_header = &VARY_HEADER;
+    } else if(Dir_has_precompressed(path, &fr->sb)) {
+        // only the .gz, so deflate isn't worth looking for
+        fr->encoding_header = &VARY_HEADER;
+        fr->no_variant = DIR_DEFLATE;
+    } else {
+        fr->encoding_header = &NO_HEADER;
+    }
+
+    check(FileRecord_build_header(fr) == 0, "Failed to create response header.");
 
-    check(fr->header != NULL, "Failed to create response header.");
+    FileRecord_load_memory(fr);
 
     return fr;
 
@@ -136,31 +320,327 @@ error:
     return NULL;
 }
 
+/**
+ * Makes a compressed variant of the given file record.  It shares the
+ * original's dates and content type but gets its own etag and headers.
+ */
+static FileRecord *FileRecord_variant(FileRecord *orig, int encoding)
+{
+    FileRecord *fr = calloc(sizeof(FileRecord), 1);
+    check_mem(fr);
+
+    fr->users = 1;
+    fr->fd = -1;
+    fr->encoding = encoding;
+    fr->loaded = orig->loaded;
+    fr->sb = orig->sb;
+    fr->date = bstrcpy(orig->date);
+    fr->last_mod = bstrcpy(orig->last_mod);
+    fr->content_type = orig->content_type;
+    fr->full_path = bstrcpy(orig->full_path);
+    fr->request_path = bstrcpy(orig->request_path);
+
+    if(encoding == DIR_GZIP) {
+        fr->encoding_header = &GZIP_HEADER;
+        fr->etag = bformat("%s-gzip", bdata(orig->etag));
+    } else {
+        fr->encoding_header = &DEFLATE_HEADER;
+        fr->etag = bformat("%s-deflate", bdata(orig->etag));
+    }
+
+    return fr;
+
+error:
+    return NULL;
+}
+
+static FileRecord *Dir_find_precompressed(FileRecord *orig)
+{
+    FileRecord *fr = NULL;
+    bstring gz_path = bformat("%s.gz", bdata(orig->full_path));
+    struct stat sb;
+
+    check_mem(gz_path);
+    check_debug(stat((const char *)gz_path->data, &sb) == 0 && Dir_precompressed_fresh(&sb, &orig->sb),
+            "No precompressed file at %s, or it's older than the file", bdata(gz_path));
+
+    fr = FileRecord_variant(orig, DIR_GZIP);
+    check(fr, "Failed to make the gzip variant of %s", bdata(orig->full_path));
+
+    // the .gz is what we send and what the cache checks for changes
+    fr->sb = sb;
+    bdestroy(fr->full_path);
+    fr->full_path = gz_path;
+    gz_path = NULL;
+
+    fr->fd = open((const char *)fr->full_path->data, O_RDONLY);
+    check(fr->fd >= 0, "Failed to open file but stat worked: %s", bdata(fr->full_path));
+
+    check(FileRecord_build_header(fr) == 0, "Failed to create response header.");
+
+    return fr;
+
+error:
+    bdestroy(gz_path);
+    FileRecord_destroy(fr);
+    return NULL;
+}
+
+static bstring Dir_compress(FileRecord *orig, int size, int encoding)
+{
+    z_stream zs;
+    bstring out = NULL;
+    char *in = NULL;
+    int rc = 0;
+
+    memset(&zs, 0, sizeof(zs));
+
+    // small files are already in memory and their fd is closed
+    if(orig->data) {
+        in = (char *)orig->data->data;
+    } else {
+        in = malloc(size);
+        check_mem(in);
+
+        rc = pread(orig->fd, in, size, 0);
+        check(rc == size, "Came up short reading %s to compress.", bdata(orig->full_path));
+    }
+
+    // windowBits + 16 makes zlib write a gzip wrapper instead of a zlib one
+    rc = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+            encoding == DIR_GZIP ? MAX_WBITS + 16 : MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    check(rc == Z_OK, "Failed to start zlib: %d", rc);
+
+    out = bfromcstralloc(deflateBound(&zs, size) + 1, "");
+    check_mem(out);
+
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = size;
+    zs.next_out = (Bytef *)bdata(out);
+    zs.avail_out = out->mlen - 1;
+
+    rc = deflate(&zs, Z_FINISH);
+    check(rc == Z_STREAM_END, "Failed to compress %s: %d", bdata(orig->full_path), rc);
+
+    out->slen = zs.total_out;
+    deflateEnd(&zs);
+    if(!orig->data) free(in);
+
+    return out;
+
+error:
+    deflateEnd(&zs);
+    if(in && !orig->data) free(in);
+    bdestroy(out);
+    return NULL;
+}
+
+static FileRecord *Dir_compress_file(FileRecord *orig, int encoding)
+{
+    FileRecord *fr = NULL;
+    bstring data = NULL;
+
+    if(!Dir_compressible(orig->content_type) ||
+            orig->sb.st_size < DIR_GZIP_MIN || orig->sb.st_size > MAX_DIR_GZIP) {
+        return NULL;
+    }
+
+    data = Dir_compress(orig, orig->sb.st_size, encoding);
+    check(data, "Failed to compress %s", bdata(orig->full_path));
+    check_debug(blength(data) < orig->sb.st_size, "Compressing %s doesn't make it smaller.",
+            bdata(orig->full_path));
+
+    fr = FileRecord_variant(orig, encoding);
+    check(fr, "Failed to make the compressed variant of %s", bdata(orig->full_path));
+
+    fr->data = data;
+    check(FileRecord_build_header(fr) == 0, "Failed to create response header.");
+
+    return fr;
+
+error:
+    if(fr) {
+        FileRecord_destroy(fr);
+    } else {
+        bdestroy(data);
+    }
+    return NULL;
+}
+
 static inline int Dir_send_header(FileRecord *file, Connection *conn)
 {
     return IOBuf_send(conn->iob, bdata(file->header), blength(file->header));
 }
 
+static inline int Dir_send_body(FileRecord *file, Connection *conn, off_t offset, int len)
+{
+    if(file->data) {
+        return IOBuf_send(conn->iob, bdataofs(file->data, offset), len);
+    } else {
+        return IOBuf_stream_file(conn->iob, file->fd, offset, len);
+    }
+}
+
 int Dir_stream_file(FileRecord *file, Connection *conn)
 {
     ssize_t sent = 0;
+    off_t size = FileRecord_size(file);
+    int rc = 0;
+
+    if(file->data) {
+        // in memory, so the header and body go out in one write
+        struct iovec iov[2] = {
+            {.iov_base = bdata(file->header), .iov_len = blength(file->header)},
+            {.iov_base = bdata(file->data), .iov_len = size}
+        };
 
-    int rc = Dir_send_header(file, conn);
-    check_debug(rc, "Failed to write header to socket.");
+        rc = IOBuf_sendv(conn->iob, iov, 2);
+        check_debug(rc >= blength(file->header), "Failed to write header to socket.");
 
-    sent = IOBuf_stream_file(conn->iob, file->fd, file->sb.st_size);
+        sent = rc - blength(file->header);
+    } else {
+        rc = Dir_send_header(file, conn);
+        check_debug(rc, "Failed to write header to socket.");
+
+        sent = Dir_send_body(file, conn, 0, size);
+    }
 
-    check(sent <= file->sb.st_size,
+    check(sent <= size,
             "Wrote way too much, wrote %d but size was %d",
-            (int)sent, (int)file->sb.st_size);
+            (int)sent, (int)size);
 
-    check(sent == file->sb.st_size,
+    check(sent == size,
             "Sent other than expected, sent: %d, but expected: %d",
-            (int)sent, (int)file->sb.st_size);
+            (int)sent, (int)size);
+
+    return sent;
+
+error:
+    return -1;
+}
+
+static inline int Dir_stream_range(FileRecord *file, Connection *conn, FileRange *range)
+{
+    off_t offset = range->start;
+    int len = 0;
+    int sent = 0;
+
+    // Dir_send_body takes an int, so ranges over 2G go out in pieces
+    while(offset <= range->end) {
+        len = range->end - offset + 1 > DIR_RANGE_CHUNK ? DIR_RANGE_CHUNK : range->end - offset + 1;
+        sent = Dir_send_body(file, conn, offset, len);
+
+        check_debug(sent == len, "Sent other than expected for range %lld-%lld at %lld, sent: %d",
+                (long long)range->start, (long long)range->end, (long long)offset, sent);
+
+        offset += len;
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Sends a 206 for the given ranges, either the single range with a
+ * Content-Range or a multipart/byteranges body with one part per range.
+ * The file data always goes out through IOBuf_stream_file starting at
+ * each range's offset.  Returns how much of the body was sent.
+ */
+long long Dir_stream_ranges(FileRecord *file, Connection *conn, FileRange *ranges, int nranges, int is_head)
+{
+    bstring header = NULL;
+    bstring boundary = NULL;
+    bstring parts[DIR_MAX_RANGES] = {NULL};
+    bstring end = NULL;
+    long long size = FileRecord_size(file);
+    long long total = 0;
+    long long sent = 0;
+    int rc = 0;
+    int i = 0;
+
+    check(nranges > 0 && nranges <= DIR_MAX_RANGES, "Invalid number of ranges: %d", nranges);
+
+    if(nranges == 1) {
+        total = ranges[0].end - ranges[0].start + 1;
+
+        header = bformat(RANGE_RESPONSE_FORMAT,
+            bdata(file->date),
+            bdata(file->content_type),
+            total,
+            (long long)ranges[0].start,
+            (long long)ranges[0].end,
+            size,
+            bdata(file->last_mod),
+            bdata(file->etag),
+            bdata(file->encoding_header));
+        check_mem(header);
+    } else {
+        boundary = bformat("MONGREL2-BYTERANGES-%s", bdata(file->etag));
+        check_mem(boundary);
+
+        for(i = 0; i < nranges; i++) {
+            parts[i] = bformat(MULTIPART_PART_FORMAT, bdata(boundary),
+                    bdata(file->content_type),
+                    (long long)ranges[i].start, (long long)ranges[i].end, size);
+            check_mem(parts[i]);
+
+            total += blength(parts[i]) + ranges[i].end - ranges[i].start + 1;
+        }
+
+        end = bformat(MULTIPART_END_FORMAT, bdata(boundary));
+        check_mem(end);
+        total += blength(end);
+
+        header = bformat(MULTIPART_RESPONSE_FORMAT,
+            bdata(file->date),
+            bdata(boundary),
+            total,
+            bdata(file->last_mod),
+            bdata(file->etag),
+            bdata(file->encoding_header));
+        check_mem(header);
+    }
+
+    rc = IOBuf_send(conn->iob, bdata(header), blength(header));
+    check_debug(rc == blength(header), "Failed to write range header to socket.");
+
+    if(!is_head) {
+        for(i = 0; i < nranges; i++) {
+            if(parts[i]) {
+                rc = IOBuf_send(conn->iob, bdata(parts[i]), blength(parts[i]));
+                check_debug(rc == blength(parts[i]), "Failed to write multipart header.");
+                sent += rc;
+            }
+
+            rc = Dir_stream_range(file, conn, &ranges[i]);
+            check_debug(rc != -1, "Failed to stream range %d of the file.", i);
+            sent += ranges[i].end - ranges[i].start + 1;
+        }
+
+        if(end) {
+            rc = IOBuf_send(conn->iob, bdata(end), blength(end));
+            check_debug(rc == blength(end), "Failed to write multipart end.");
+            sent += rc;
+        }
+
+        check(sent == total, "Sent other than expected, sent: %lld, but expected: %lld",
+                sent, total);
+    }
+
+    bdestroy(header);
+    bdestroy(boundary);
+    bdestroy(end);
+    for(i = 0; i < nranges; i++) bdestroy(parts[i]);
 
     return sent;
 
 error:
+    bdestroy(header);
+    bdestroy(boundary);
+    bdestroy(end);
+    for(i = 0; i < DIR_MAX_RANGES; i++) bdestroy(parts[i]);
     return -1;
 }
 
@@ -175,8 +655,28 @@ Dir *Dir_create(const char *base, const char *index_file, const char *default_ct
     if(!MAX_SEND_BUFFER || !MAX_DIR_PATH) {
         MAX_SEND_BUFFER = Setting_get_int("limits.dir_send_buffer", 16 * 1024);
         MAX_DIR_PATH = Setting_get_int("limits.dir_max_path", 256);
-        log_info("MAX limits.dir_send_buffer=%d, limits.dir_max_path=%d",
-                MAX_SEND_BUFFER, MAX_DIR_PATH);
+        MAX_DIR_GZIP = Setting_get_int("limits.dir_gzip_max", 64 * 1024);
+
+        if(MAX_DIR_GZIP > DIR_GZIP_MAX_INLINE) {
+            // compressing holds up every other connection, so it stays small
+            log_warn("limits.dir_gzip_max=%d is more than the %d max, using %d.",
+                    MAX_DIR_GZIP, DIR_GZIP_MAX_INLINE, DIR_GZIP_MAX_INLINE);
+            MAX_DIR_GZIP = DIR_GZIP_MAX_INLINE;
+        }
+
+        log_info("MAX limits.dir_send_buffer=%d, limits.dir_max_path=%d, limits.dir_gzip_max=%d",
+                MAX_SEND_BUFFER, MAX_DIR_PATH, MAX_DIR_GZIP);
+
+        MAX_DIR_CACHE_SIZE = Setting_get_int("limits.dir_cache_size", FR_CACHE_SIZE);
+        MAX_DIR_CACHE_FDS = Setting_get_int("limits.dir_cache_fds", FR_CACHE_SIZE / 2);
+        MAX_DIR_CACHE_BYTES = Setting_get_int("limits.dir_cache_bytes", 16 * 1024 * 1024);
+        log_info("MAX limits.dir_cache_size=%d, limits.dir_cache_fds=%d, limits.dir_cache_bytes=%d",
+                MAX_DIR_CACHE_SIZE, MAX_DIR_CACHE_FDS, MAX_DIR_CACHE_BYTES);
+
+        MAX_DIR_MEMORY_FILE = Setting_get_int("limits.dir_memory_file", 16 * 1024);
+        MAX_DIR_MEMORY_TOTAL = Setting_get_int("limits.dir_memory_total", 32 * 1024 * 1024);
+        log_info("MAX limits.dir_memory_file=%d, limits.dir_memory_total=%d",
+                MAX_DIR_MEMORY_FILE, MAX_DIR_MEMORY_TOTAL);
     }
 
     dir->base = bfromcstr(base);
@@ -187,10 +687,14 @@ Dir *Dir_create(const char *base, const char *index_file, const char *default_ct
     dir->index_file = bfromcstr(index_file);
     dir->default_ctype = bfromcstr(default_ctype);
 
-    dir->fr_cache = Cache_create(FR_CACHE_SIZE, filerecord_cache_lookup,
+    dir->fr_cache = Cache_create(MAX_DIR_CACHE_SIZE, filerecord_cache_lookup,
                                  filerecord_cache_evict);
     check(dir->fr_cache, "Failed to create FileRecord cache");
 
+    Cache_set_hash(dir->fr_cache, filerecord_key_hash, filerecord_data_hash);
+    Cache_set_limits(dir->fr_cache, MAX_DIR_CACHE_BYTES, MAX_DIR_CACHE_FDS);
+    dir->fr_cache->name = bstrcpy(dir->base);
+
     check(cache_ttl >= 0, "Invalid cache ttl, must be a positive integer");
     dir->cache_ttl = cache_ttl;
 
@@ -238,8 +742,10 @@ void FileRecord_destroy(FileRecord *file)
             bdestroy(file->last_mod);
             bdestroy(file->header);
             bdestroy(file->etag);
+            FileRecord_free_memory(file);
         }
         bdestroy(file->full_path);
+        bdestroy(file->request_path);
         // file->content_type is not owned by us
         free(file);
     }
@@ -283,9 +789,10 @@ error:
     return -1;
 }
 
-FileRecord *FileRecord_cache_check(Dir *dir, bstring path)
+FileRecord *FileRecord_cache_check(Dir *dir, bstring path, int encoding)
 {
-    FileRecord *file = Cache_lookup(dir->fr_cache, path);
+    FileRecordKey key = {.request_path = path, .encoding = encoding};
+    FileRecord *file = Cache_lookup(dir->fr_cache, &key);
 
     if(file) {
         time_t now = time(NULL);
@@ -308,7 +815,22 @@ FileRecord *FileRecord_cache_check(Dir *dir, bstring path)
 }
 
 
-FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path)
+static inline void FileRecord_cache_drop_variants(Dir *dir, bstring path)
+{
+    FileRecordKey gzip = {.request_path = path, .encoding = DIR_GZIP};
+    FileRecordKey deflate = {.request_path = path, .encoding = DIR_DEFLATE};
+    FileRecord *variant = NULL;
+
+    if((variant = Cache_lookup(dir->fr_cache, &gzip)) != NULL) {
+        Cache_evict_object(dir->fr_cache, variant);
+    }
+
+    if((variant = Cache_lookup(dir->fr_cache, &deflate)) != NULL) {
+        Cache_evict_object(dir->fr_cache, variant);
+    }
+}
+
+static FileRecord *Dir_resolve_identity(Dir *dir, bstring prefix, bstring path)
 {
     FileRecord *file = NULL;
     bstring target = NULL;
@@ -316,7 +838,7 @@ FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path)
     check(Dir_lazy_normalize_base(dir) == 0, "Failed to normalize base path when requesting %s",
             bdata(path));
 
-    file = FileRecord_cache_check(dir, path);
+    file = FileRecord_cache_check(dir, path, DIR_IDENTITY);
 
     if(file) {
         // TODO: double check this gives the right users count
@@ -359,10 +881,13 @@ FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path)
     file = Dir_find_file(target, dir->default_ctype);
     check_debug(file, "Error opening file: %s", bdata(target));
 
+    // anything compressed from the copy this replaces is stale
+    FileRecord_cache_drop_variants(dir, path);
+
     // Increment the user count because we're adding it to the cache
     file->users++;
     file->request_path = bstrcpy(path);
-    Cache_add(dir->fr_cache, file);
+    FileRecord_cache_add(dir, file);
 
     return file;
 
@@ -372,6 +897,132 @@ error:
     return NULL;
 }
 
+/**
+ * Finds a compressed version of file the client will take, preferring a
+ * .gz sitting next to it so that still goes out with sendfile, then
+ * compressing small text files in memory.  Either way it's cached beside
+ * the plain one.  When there's nothing for an encoding the plain file
+ * remembers it, so until it changes nobody stats or compresses again.
+ */
+static FileRecord *Dir_find_variant(Dir *dir, FileRecord *file, int accept)
+{
+    int encoding = accept & DIR_GZIP ? DIR_GZIP : DIR_DEFLATE;
+    FileRecord *variant = NULL;
+
+    if(file->no_variant & encoding) return NULL;
+
+    variant = FileRecord_cache_check(dir, file->request_path, encoding);
+
+    if(variant) {
+        variant->users++;
+        return variant;
+    }
+
+    if(encoding == DIR_GZIP) {
+        variant = Dir_find_precompressed(file);
+    }
+
+    if(variant == NULL) {
+        variant = Dir_compress_file(file, encoding);
+    }
+
+    if(variant) {
+        // one for the caller and one for the cache
+        variant->users++;
+        FileRecord_cache_add(dir, variant);
+    } else {
+        file->no_variant |= encoding;
+    }
+
+    return variant;
+}
+
+FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path, int accept)
+{
+    FileRecord *variant = NULL;
+    FileRecord *file = Dir_resolve_identity(dir, prefix, path);
+
+    // only files that got a Vary header have anything to look for
+    if(file && accept && !file->is_dir && file->encoding_header == &VARY_HEADER) {
+        variant = Dir_find_variant(dir, file, accept);
+
+        if(variant) {
+            FileRecord_release(file);
+            return variant;
+        }
+    }
+
+    return file;
+}
+
+/**
+ * Figures out which of gzip and deflate the client will take from its
+ * Accept-Encoding header, honoring q=0 and * the way RFC 2616 says to.
+ */
+int Dir_accept_encoding(bstring header)
+{
+    struct bstrList *codings = NULL;
+    struct tagbstring gzip = bsStatic("gzip");
+    struct tagbstring x_gzip = bsStatic("x-gzip");
+    struct tagbstring deflate = bsStatic("deflate");
+    struct tagbstring star = bsStatic("*");
+    struct tagbstring q_param = bsStatic("q=");
+    int accepted = 0;
+    int refused = 0;
+    int named = 0;
+    int wildcard = 0;
+    int coding = 0;
+    int i = 0;
+
+    if(header == NULL) return DIR_IDENTITY;
+
+    codings = bsplit(header, ',');
+    check_mem(codings);
+
+    for(i = 0; i < codings->qty; i++) {
+        bstring name = codings->entry[i];
+        int params = bstrchr(name, ';');
+        int q_zero = 0;
+
+        if(params != BSTR_ERR) {
+            int q = binstr(name, params, &q_param);
+            q_zero = q != BSTR_ERR && strtod((const char *)name->data + q + 2, NULL) == 0.0;
+            btrunc(name, params);
+        }
+
+        btrimws(name);
+
+        if(biseqcaseless(name, &gzip) || biseqcaseless(name, &x_gzip)) {
+            coding = DIR_GZIP;
+        } else if(biseqcaseless(name, &deflate)) {
+            coding = DIR_DEFLATE;
+        } else if(biseq(name, &star)) {
+            wildcard = !q_zero;
+            continue;
+        } else {
+            continue;
+        }
+
+        named |= coding;
+
+        if(q_zero) {
+            refused |= coding;
+        } else {
+            accepted |= coding;
+        }
+    }
+
+    if(wildcard) {
+        accepted |= (DIR_GZIP | DIR_DEFLATE) & ~named;
+    }
+
+    bstrListDestroy(codings);
+    return accepted & ~refused;
+
+error:
+    return DIR_IDENTITY;
+}
+
 
 static inline bstring Dir_if_modified_since(Request *req, FileRecord *file, int if_modified_since)
 {
@@ -403,6 +1054,143 @@ static inline bstring Dir_none_match(Request *req, FileRecord *file, int if_modi
     return &HTTP_500;
 }
 
+static inline const char *skip_space(const char *p)
+{
+    while(*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+/*
+ * Adds start-end to the ranges, merged with any it overlaps or touches so
+ * no byte goes out twice.  The merged range keeps the place of the first
+ * one it took in, so parts still come in the order they were asked for.
+ * Returns the new count, or -1 if it needs a slot and they're used up.
+ */
+static inline int Dir_add_range(FileRange *ranges, int count, int max, off_t start, off_t end)
+{
+    int keep = -1;
+    int i = 0;
+    int j = 0;
+
+    for(i = 0; i < count; i++) {
+        if(start <= ranges[i].end + 1 && ranges[i].start <= end + 1) {
+            if(ranges[i].start < start) start = ranges[i].start;
+            if(ranges[i].end > end) end = ranges[i].end;
+
+            if(keep != -1) continue; // folded into the kept one
+            keep = j;
+        }
+
+        ranges[j++] = ranges[i];
+    }
+
+    count = j;
+
+    if(keep == -1) {
+        if(count >= max) return -1;
+        keep = count++;
+    }
+
+    ranges[keep].start = start;
+    ranges[keep].end = end;
+
+    return count;
+}
+
+/**
+ * Parses a "bytes=" Range header into at most max ranges, clamped to the
+ * file's size.  Overlapping and adjacent ranges are merged, and ones
+ * that start past the end are dropped.  Returns how
+ * many ranges are left, 0 if none of them can be satisfied (so a 416),
+ * or -1 when the header is garbage or asks for too many ranges, in which
+ * case it should be ignored and the whole file sent.
+ */
+int Dir_parse_range(bstring header, off_t size, FileRange *ranges, int max)
+{
+    const char *p = bdata(header);
+    char *end = NULL;
+    long long start = 0;
+    long long last = 0;
+    int count = 0;
+    int specs = 0;
+
+    check_debug(p && strncmp(p, "bytes=", 6) == 0, "Range isn't in bytes: %s", p);
+    p += 6;
+
+    while(*p) {
+        p = skip_space(p);
+
+        if(*p == ',') {
+            // empty elements are allowed, "bytes=0-1,,5-6"
+            p++;
+            continue;
+        }
+
+        if(*p == '-') {
+            // suffix range, the last N bytes of the file
+            p++;
+            check_debug(isdigit(*p), "Invalid suffix range in: %s", bdata(header));
+            last = strtoll(p, &end, 10);
+            p = end;
+
+            start = last < size ? size - last : 0;
+            last = size - 1;
+
+            if(last < start) start = size; // zero length suffix, never satisfiable
+        } else {
+            check_debug(isdigit(*p), "Invalid range in: %s", bdata(header));
+            start = strtoll(p, &end, 10);
+            p = end;
+
+            check_debug(*p == '-', "Range missing the '-' in: %s", bdata(header));
+            p++;
+
+            if(isdigit(*p)) {
+                last = strtoll(p, &end, 10);
+                p = end;
+                check_debug(last >= start, "Range ends before it starts in: %s", bdata(header));
+            } else {
+                last = size - 1;
+            }
+
+            if(last >= size) last = size - 1;
+        }
+
+        p = skip_space(p);
+        check_debug(*p == ',' || *p == '\0', "Junk after range in: %s", bdata(header));
+        specs++;
+
+        if(start < size) {
+            count = Dir_add_range(ranges, count, max, start, last);
+            check_debug(count != -1, "Too many ranges requested, max is %d", max);
+        }
+    }
+
+    check_debug(specs > 0, "Range header has no ranges: %s", bdata(header));
+
+    return count;
+
+error:
+    return -1;
+}
+
+static inline int Dir_requested_ranges(Request *req, FileRecord *file, FileRange *ranges)
+{
+    bstring range = Request_known(req, HEADER_RANGE);
+    bstring if_range = NULL;
+
+    if(range == NULL) return -1;
+
+    if_range = Request_known(req, HEADER_IF_RANGE);
+
+    if(if_range && !biseq(if_range, file->etag) && !biseq(if_range, file->last_mod)) {
+        // their partial copy is stale, so they get the whole file
+        return -1;
+    }
+
+    return Dir_parse_range(range, FileRecord_size(file), ranges, DIR_MAX_RANGES);
+}
+
 static inline bstring Dir_calculate_response(Request *req, FileRecord *file)
 {
     int if_unmodified_since = 0;
@@ -415,12 +1203,12 @@ static inline bstring Dir_calculate_response(Request *req, FileRecord *file)
             return bformat(DIR_REDIRECT_FORMAT, bdata(req->host),
                            bdata(req->uri));
 
-        if_match = Request_get(req, &HTTP_IF_MATCH);
+        if_match = Request_known(req, HEADER_IF_MATCH);
 
         if(!if_match || biseqcstr(if_match, "*") || bstring_match(if_match, &ETAG_PATTERN)) {
-            if_none_match = Request_get(req, &HTTP_IF_NONE_MATCH);
-            if_unmodified_since = Request_get_date(req, &HTTP_IF_UNMODIFIED_SINCE, RFC_822_TIME);
-            if_modified_since = Request_get_date(req, &HTTP_IF_MODIFIED_SINCE, RFC_822_TIME);
+            if_none_match = Request_known(req, HEADER_IF_NONE_MATCH);
+            if_unmodified_since = Request_known_date(req, HEADER_IF_UNMODIFIED_SINCE, RFC_822_TIME);
+            if_modified_since = Request_known_date(req, HEADER_IF_MODIFIED_SINCE, RFC_822_TIME);
 
             debug("TESTING WITH: if_match: %s, if_none_match: %s, if_unmodified_since: %d, if_modified_since: %d",
                     bdata(if_match), bdata(if_none_match), if_unmodified_since, if_modified_since);
@@ -466,6 +1254,9 @@ int Dir_serve_file(Dir *dir, Request *req, Connection *conn)
     check(dir->running, "Directory is not running anymore.");
 
     int rc = 0;
+    long long sent = 0;
+    int nranges = 0;
+    FileRange ranges[DIR_MAX_RANGES];
     int is_get = biseq(req->request_method, &HTTP_GET);
     int is_head = is_get ? 0 : biseq(req->request_method, &HTTP_HEAD);
 
@@ -478,16 +1269,28 @@ int Dir_serve_file(Dir *dir, Request *req, Connection *conn)
         check_debug(rc == blength(&HTTP_405), "Failed to send 405 to client.");
         return -1;
     } else {
-        file = Dir_resolve_file(dir, prefix, path);
+        file = Dir_resolve_file(dir, prefix, path,
+                Dir_accept_encoding(Request_known(req, HEADER_ACCEPT_ENCODING)));
         resp = Dir_calculate_response(req, file);
 
         if(resp) {
             rc = Response_send_status(conn, resp);
             check_debug(rc == blength(resp), "Failed to send error response on file serving.");
+        } else if((nranges = Dir_requested_ranges(req, file, ranges)) == 0) {
+            req->status_code = 416;
+            resp = bformat(RANGE_NOT_SATISFIABLE_FORMAT, (long long)FileRecord_size(file));
+            rc = Response_send_status(conn, resp) == blength(resp);
+            bdestroy(resp);
+            check_debug(rc, "Failed to send 416 response on file serving.");
+        } else if(nranges > 0) {
+            req->status_code = 206;
+            sent = Dir_stream_ranges(file, conn, ranges, nranges, is_head);
+            req->response_size = sent;
+            check_debug(sent != -1, "Didn't send all the ranges of %s.", bdata(path));
         } else if(is_get) {
             rc = Dir_stream_file(file, conn);
             req->response_size = rc;
-            check_debug(rc == file->sb.st_size, "Didn't send all of the file, sent %d of %s.", rc, bdata(path));
+            check_debug(rc == FileRecord_size(file), "Didn't send all of the file, sent %d of %s.", rc, bdata(path));
         } else if(is_head) {
             rc = Dir_send_header(file, conn);
             check_debug(rc, "Failed to write header to socket.");
@@ -47,11 +47,22 @@
 
 extern int MAX_SEND_BUFFER;
 extern int MAX_DIR_PATH;
+extern int MAX_DIR_GZIP;
+extern int MAX_DIR_MEMORY_FILE;
+extern int MAX_DIR_MEMORY_TOTAL;
+
+enum {
+    DIR_IDENTITY = 0,
+    DIR_GZIP = 1 << 0,
+    DIR_DEFLATE = 1 << 1
+};
 
 typedef struct FileRecord {
     int is_dir;
     int fd;
     int users;
+    int encoding;
+    int no_variant; // encodings known to have nothing better, until the file changes
     time_t loaded;
     bstring date;
     bstring last_mod;
@@ -60,9 +71,18 @@ typedef struct FileRecord {
     bstring request_path;
     bstring full_path;
     bstring etag;
+    bstring encoding_header; // static, not owned
+    bstring data; // small or compressed bodies in memory, otherwise it's read from fd
     struct stat sb;
 } FileRecord;
 
+#define FileRecord_size(F) ((F)->data ? blength((F)->data) : (F)->sb.st_size)
+
+typedef struct FileRange {
+    off_t start;
+    off_t end; // inclusive, same as the Range header
+} FileRange;
+
 typedef struct Dir {
     int running;
     Cache *fr_cache;
@@ -84,11 +104,21 @@ int Dir_stream_file(FileRecord *file, Connection *conn);
 
 int Dir_serve_file(Dir *dir, Request *req, Connection *conn);
 
-FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path);
+FileRecord *Dir_resolve_file(Dir *dir, bstring prefix, bstring path, int accept);
+
+int Dir_accept_encoding(bstring header);
+
+int Dir_parse_range(bstring header, off_t size, FileRange *ranges, int max);
+
+long long Dir_stream_ranges(FileRecord *file, Connection *conn, FileRange *ranges, int nranges, int is_head);
 
 void FileRecord_release(FileRecord *file);
 void FileRecord_destroy(FileRecord *file);
 
-#define FR_CACHE_SIZE 32
+#define FR_CACHE_SIZE 256
+#define DIR_MAX_RANGES 16
+#define DIR_RANGE_CHUNK (1024 * 1024 * 1024)
+#define DIR_GZIP_MIN 256
+#define DIR_GZIP_MAX_INLINE (256 * 1024)
 
 #endif
@@ -42,6 +42,9 @@
 #include <connection.h>
 #include <assert.h>
 #include <register.h>
+#include <worker.h>
+#include <request.h>
+#include <response.h>
 
 #include "setting.h"
 
@@ -51,6 +54,14 @@ struct tagbstring LEAVE_MSG = bsStatic("{\"type\":\"disconnect\"}");
 
 
 int HANDLER_STACK;
+int HANDLER_SLAB_SIZE = 64 * 1024;
+int HANDLER_SLABS = 4;
+int HANDLER_SEND_QUEUE = 64;
+
+// all it does is wait in mqsend
+#define HANDLER_SEND_STACK (32 * 1024)
+
+static void Handler_send_task(void *v);
 
 static void cstr_free(void *data, void *hint)
 {
@@ -88,19 +99,46 @@ error: //fallthrough
 
 int Handler_setup(Handler *handler)
 {
+    bstring send_spec = NULL;
+    bstring recv_spec = NULL;
+    bstring subscribe = NULL;
+
     taskname("Handler_task");
 
     handler->task = taskself();
 
-    handler->send_socket = Handler_send_create(bdata(handler->send_spec), bdata(handler->send_ident));
+    send_spec = Worker_spec(handler->send_spec);
+    recv_spec = Worker_spec(handler->recv_spec);
+
+    if(WORKER_ID >= 0) {
+        // replies start with the ident we sent, so only take the ones for this worker
+        bstring ident = Worker_ident(handler->send_ident);
+        bdestroy(handler->send_ident);
+        handler->send_ident = ident;
+        subscribe = bformat("%s ", bdata(ident));
+    } else {
+        subscribe = bstrcpy(handler->recv_ident);
+    }
+
+    handler->send_socket = Handler_send_create(bdata(send_spec), bdata(handler->send_ident));
     check(handler->send_socket, "Failed to create handler socket.");
 
-    handler->recv_socket = Handler_recv_create(bdata(handler->recv_spec), bdata(handler->recv_ident));
+    handler->recv_socket = Handler_recv_create(bdata(recv_spec), bdata(subscribe));
     check(handler->recv_socket, "Failed to create listener socket.");
 
+    if(handler->queue) {
+        taskcreate(Handler_send_task, handler, HANDLER_SEND_STACK);
+    }
+
+    bdestroy(send_spec);
+    bdestroy(recv_spec);
+    bdestroy(subscribe);
     return 0;
 
 error:
+    bdestroy(send_spec);
+    bdestroy(recv_spec);
+    bdestroy(subscribe);
     return -1;
 
 }
@@ -239,15 +277,272 @@ void Handler_task(void *v)
 
     HandlerParser_destroy(parser);
     debug("HANDLER EXITED.");
+    taskwakeup(&handler->send_wait);
     taskexit(0);
 
 error:
     HandlerParser_destroy(parser);
     log_err("HANDLER TASK DIED");
+    taskwakeup(&handler->send_wait);
     taskexit(1);
 }
 
 
+static void handler_slab_free(void *data, void *hint)
+{
+    HandlerSlab *slab = (HandlerSlab *)hint;
+    __sync_fetch_and_sub(&slab->refs, 1);
+}
+
+static inline void handler_msg_release(HandlerMsg *msg)
+{
+    if(msg->slab) {
+        handler_slab_free(msg->data, msg->slab);
+    } else {
+        free(msg->data);
+    }
+}
+
+/*
+ * Gets len bytes out of the handler's slabs, bumping along the current
+ * one until it's full and then starting over on any slab 0mq is done
+ * with.  Payloads too big for a slab, or when every slab is still in
+ * flight, fall back to malloc.
+ */
+static char *Handler_slab_alloc(Handler *handler, size_t len, HandlerSlab **out_slab)
+{
+    HandlerSlab *slab = handler->slab;
+    char *data = NULL;
+    int i = 0;
+
+    *out_slab = NULL;
+
+    if(handler->slabs == NULL || len > (size_t)HANDLER_SLAB_SIZE) {
+        return malloc(len);
+    }
+
+    if(slab == NULL || slab->used + len > (size_t)HANDLER_SLAB_SIZE) {
+        for(slab = NULL, i = 0; i < HANDLER_SLABS; i++) {
+            if(handler->slabs[i].refs == 0) {
+                slab = &handler->slabs[i];
+                break;
+            }
+        }
+
+        if(slab == NULL) return malloc(len);
+
+        if(slab->data == NULL) {
+            slab->data = malloc(HANDLER_SLAB_SIZE);
+            if(slab->data == NULL) return malloc(len);
+        }
+
+        slab->used = 0;
+        handler->slab = slab;
+    }
+
+    data = slab->data + slab->used;
+    slab->used += len;
+    __sync_fetch_and_add(&slab->refs, 1);
+
+    *out_slab = slab;
+    return data;
+}
+
+static inline int handler_send_msg(Handler *handler, HandlerMsg *msg)
+{
+    int rc = 0;
+    zmq_msg_t outmsg;
+
+    rc = zmq_msg_init_data(&outmsg, msg->data, msg->len,
+            msg->slab ? handler_slab_free : cstr_free, msg->slab);
+    check(rc == 0, "Failed to init 0mq message data.");
+
+    rc = mqsend(handler->send_socket, &outmsg, 0);
+
+    if(rc != 0) {
+        // closing it hands the data back to the slab or free
+        zmq_msg_close(&outmsg);
+        log_err("Failed to deliver 0mq message to handler: %s", bdata(handler->send_spec));
+        return -1;
+    }
+
+    handler->sent++;
+    return 0;
+
+error:
+    handler_msg_release(msg);
+    return -1;
+}
+
+/*
+ * A queued request's connection has already gone on to wait for its
+ * reply, so when 0mq won't take the request the connection is failed
+ * here the way the direct send fails it: HTTP gets a 502, then it's
+ * closed.
+ */
+static inline void handler_send_failed(HandlerMsg *msg)
+{
+    int fd = Register_fd_for_id(msg->conn_id);
+    Connection *conn = fd >= 0 ? Register_fd_exists(fd) : NULL;
+
+    check_debug(conn != NULL, "Connection %d is already gone.", msg->conn_id);
+
+    if(conn->type == CONN_TYPE_HTTP) {
+        Response_send_status(conn, &HTTP_502);
+    }
+
+    Register_disconnect(fd);
+
+error: // fallthrough
+    return;
+}
+
+/**
+ * Sends everything that's queued for the handler, including anything
+ * queued while this was waiting on 0mq.  Each request that can't be sent
+ * fails its connection.
+ */
+int Handler_flush(Handler *handler)
+{
+    HandlerMsg msg;
+    int failed = 0;
+
+    if(handler->queued > 0) handler->batches++;
+
+    while(handler->queued > 0) {
+        msg = handler->queue[handler->queue_head];
+        handler->queue_head = (handler->queue_head + 1) % handler->queue_size;
+        handler->queued--;
+
+        taskwakeup(&handler->space_wait);
+
+        if(handler_send_msg(handler, &msg) == -1) {
+            handler_send_failed(&msg);
+            failed++;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+static void Handler_send_task(void *v)
+{
+    Handler *handler = (Handler *)v;
+
+    taskname("Handler_send");
+    handler->send_task = taskself();
+
+    while(handler->running) {
+        if(handler->queued == 0) {
+            taskstate("idle");
+            tasksleep(&handler->send_wait);
+        } else {
+            taskstate("sending");
+            Handler_flush(handler);
+        }
+    }
+
+    Handler_flush(handler);
+    handler->send_task = NULL;
+
+    // anyone waiting for room sends it themselves now
+    taskwakeupall(&handler->space_wait);
+    taskexit(0);
+}
+
+static inline int Handler_queue(Handler *handler, HandlerMsg *msg)
+{
+    while(handler->send_task != NULL && handler->queued == handler->queue_size) {
+        taskstate("queue full");
+        tasksleep(&handler->space_wait);
+    }
+
+    if(handler->send_task == NULL) {
+        // no send task to batch for us (yet), so just send it and the
+        // caller answers a failure with a 502
+        return handler_send_msg(handler, msg);
+    }
+
+    handler->queue[(handler->queue_head + handler->queued) % handler->queue_size] = *msg;
+    handler->queued++;
+
+    taskwakeup(&handler->send_wait);
+
+    return 0;
+}
+
+/*
+ * JSON has to be escaped before its size is known, so it's rendered into
+ * the handler's scratch buffer first and copied into the slab after.
+ */
+static inline size_t handler_render_json(Handler *handler, Request *req, int fd, size_t len)
+{
+    if(handler->scratch == NULL) {
+        handler->scratch = bfromcstralloc(1024, "");
+        check_mem(handler->scratch);
+    }
+
+    btrunc(handler->scratch, 0);
+
+    check(Request_render_payload(req, handler->scratch, handler->send_ident, fd, len) == 0,
+            "Failed to render the JSON payload.");
+
+    debug("HTTP TO HANDLER: %s", bdata(handler->scratch));
+
+    return blength(handler->scratch);
+
+error:
+    return 0;
+}
+
+/**
+ * Renders the request for this handler's protocol and queues it for the
+ * send task, which hands it to 0mq without another copy.  Tnetstrings
+ * are sized first and written straight into the slab, and the body is
+ * copied once right after, so once the slabs have warmed up nothing
+ * gets allocated.  If 0mq won't take it later on, Handler_flush fails
+ * the connection instead of this returning -1.
+ */
+int Handler_send_request(Handler *handler, Request *req, int fd,
+        const char *body, size_t len)
+{
+    size_t header_len = 0;
+    HandlerMsg msg = {.data = NULL};
+
+    if(handler->protocol == HANDLER_PROTO_TNET) {
+        header_len = Request_tnetstring_size(req, handler->send_ident, fd, len);
+    } else if(handler->protocol == HANDLER_PROTO_JSON) {
+        header_len = handler_render_json(handler, req, fd, len);
+    } else {
+        sentinel("Invalid protocol type: %d", handler->protocol);
+    }
+
+    check(header_len > 0, "Failed to create payload for request.");
+
+    msg.conn_id = Register_id_for_fd(fd);
+    msg.len = header_len + len + 1;
+    msg.data = Handler_slab_alloc(handler, msg.len, &msg.slab);
+    check_mem(msg.data);
+
+    if(handler->protocol == HANDLER_PROTO_TNET) {
+        if(Request_write_tnetstring(req, msg.data, handler->send_ident, fd, len) != msg.data + header_len) {
+            handler_msg_release(&msg);
+            sentinel("Tnetstring came out a different size than it should have, tell Zed.");
+        }
+    } else {
+        memcpy(msg.data, handler->scratch->data, header_len);
+    }
+
+    if(len > 0) memcpy(msg.data + header_len, body, len);
+    msg.data[msg.len - 1] = ',';
+
+    return Handler_queue(handler, &msg);
+
+error:
+    return -1;
+}
+
+
 int Handler_deliver(void *handler_socket, char *buffer, size_t len)
 {
     int rc = 0;
@@ -298,7 +593,8 @@ void *Handler_recv_create(const char *recv_spec, const char *uuid)
     void *listener_socket = mqsocket(ZMQ_SUB);
     check(listener_socket, "Can't create ZMQ_SUB socket.");
 
-    int rc = zmq_setsockopt(listener_socket, ZMQ_SUBSCRIBE, uuid, 0);
+    // workers only want replies for their own ident, otherwise take everything
+    int rc = zmq_setsockopt(listener_socket, ZMQ_SUBSCRIBE, uuid, WORKER_ID >= 0 ? strlen(uuid) : 0);
     check(rc == 0, "Failed to subscribe listener socket: %s", recv_spec);
     log_info("Binding listener SUB socket %s subscribed to: %s", recv_spec, uuid);
 
@@ -325,6 +621,12 @@ Handler *Handler_create(const char *send_spec, const char *send_ident,
     if(!HANDLER_STACK) {
         HANDLER_STACK = Setting_get_int("limits.handler_stack", DEFAULT_HANDLER_STACK);
         log_info("MAX limits.handler_stack=%d", HANDLER_STACK);
+
+        HANDLER_SLAB_SIZE = Setting_get_int("limits.handler_slab_size", 64 * 1024);
+        HANDLER_SLABS = Setting_get_int("limits.handler_slabs", 4);
+        HANDLER_SEND_QUEUE = Setting_get_int("limits.handler_send_queue", 64);
+        log_info("MAX limits.handler_slab_size=%d, limits.handler_slabs=%d, limits.handler_send_queue=%d",
+                HANDLER_SLAB_SIZE, HANDLER_SLABS, HANDLER_SEND_QUEUE);
     }
 
     Handler *handler = calloc(sizeof(Handler), 1);
@@ -338,24 +640,60 @@ Handler *Handler_create(const char *send_spec, const char *send_ident,
     handler->raw = 0;
     handler->protocol = HANDLER_PROTO_JSON;
 
+    if(HANDLER_SLABS > 0 && HANDLER_SLAB_SIZE > 0) {
+        handler->slabs = calloc(sizeof(HandlerSlab), HANDLER_SLABS);
+        check_mem(handler->slabs);
+    }
+
+    if(HANDLER_SEND_QUEUE > 0) {
+        handler->queue_size = HANDLER_SEND_QUEUE;
+        handler->queue = calloc(sizeof(HandlerMsg), handler->queue_size);
+        check_mem(handler->queue);
+    }
+
     return handler;
 error:
 
-    if(handler) free(handler);
+    if(handler) {
+        free(handler->slabs);
+        free(handler);
+    }
     return NULL;
 }
 
 
 void Handler_destroy(Handler *handler)
 {
+    int i = 0;
+
     if(handler) {
-        if(handler->recv_socket) zmq_close(handler->recv_socket);
-        if(handler->send_socket) zmq_close(handler->send_socket);
+        if(handler->recv_socket) mqclose(handler->recv_socket);
+        if(handler->send_socket) mqclose(handler->send_socket);
+
+        while(handler->queued > 0) {
+            handler_msg_release(&handler->queue[handler->queue_head]);
+            handler->queue_head = (handler->queue_head + 1) % handler->queue_size;
+            handler->queued--;
+        }
+
+        for(i = 0; handler->slabs && i < HANDLER_SLABS; i++) {
+            if(handler->slabs[i].refs > 0) {
+                // 0mq still has messages in them, so leak them rather than crash later
+                handler->slabs = NULL;
+            }
+        }
+
+        for(i = 0; handler->slabs && i < HANDLER_SLABS; i++) {
+            free(handler->slabs[i].data);
+        }
 
         bdestroy(handler->send_ident);
         bdestroy(handler->recv_ident);
         bdestroy(handler->send_spec);
         bdestroy(handler->recv_spec);
+        bdestroy(handler->scratch);
+        free(handler->queue);
+        free(handler->slabs);
         free(handler);
     }
 }
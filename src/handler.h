@@ -40,9 +40,27 @@
 #include <task/task.h>
 
 extern int HANDLER_STACK;
+extern int HANDLER_SLAB_SIZE;
+extern int HANDLER_SLABS;
+extern int HANDLER_SEND_QUEUE;
 
 typedef enum { HANDLER_PROTO_JSON, HANDLER_PROTO_TNET } handler_protocol_t;
 
+typedef struct HandlerSlab {
+    char *data;
+    size_t used;
+
+    // one per message 0mq still has, and 0mq drops them from its own thread
+    volatile int refs;
+} HandlerSlab;
+
+typedef struct HandlerMsg {
+    char *data;
+    size_t len;
+    HandlerSlab *slab; // NULL when data was malloc'd
+    int conn_id; // who gets told if 0mq won't take it
+} HandlerMsg;
+
 typedef struct Handler {
     void *send_socket;
     void *recv_socket;
@@ -54,12 +72,35 @@ typedef struct Handler {
     int running;
     int raw;
     handler_protocol_t protocol;
+
+    // payloads are rendered into scratch then copied into a slab for 0mq
+    bstring scratch;
+    HandlerSlab *slabs;
+    HandlerSlab *slab;
+
+    // requests waiting on the send task, which sends them all each time it wakes
+    Task *send_task;
+    HandlerMsg *queue;
+    int queue_head;
+    int queued;
+    int queue_size;
+    Rendez send_wait;
+    Rendez space_wait;
+
+    unsigned long batches;
+    unsigned long sent;
 } Handler;
 
 void Handler_task(void *v);
 
 int Handler_deliver(void *handler_socket, char *buffer, size_t len);
 
+struct Request;
+int Handler_send_request(Handler *handler, struct Request *req, int fd,
+        const char *body, size_t len);
+
+int Handler_flush(Handler *handler);
+
 Handler *Handler_create(const char *send_spec, const char *send_ident,
         const char *recv_spec, const char *recv_ident);
 
@@ -33,6 +33,7 @@
  */
 
 #include <headers.h>
+#include <strings.h>
 
 struct tagbstring HTTP_METHOD = bsStatic("METHOD");
 struct tagbstring HTTP_VERSION = bsStatic("VERSION");
@@ -60,7 +61,52 @@ struct tagbstring HTTP_IF_MATCH = bsStatic("if-match");
 struct tagbstring HTTP_IF_NONE_MATCH = bsStatic("if-none-match");
 struct tagbstring HTTP_IF_MODIFIED_SINCE = bsStatic("if-modified-since");
 struct tagbstring HTTP_IF_UNMODIFIED_SINCE = bsStatic("if-unmodified-since");
+struct tagbstring HTTP_RANGE = bsStatic("range");
+struct tagbstring HTTP_IF_RANGE = bsStatic("if-range");
+struct tagbstring HTTP_ACCEPT_ENCODING = bsStatic("accept-encoding");
 struct tagbstring HTTP_USER_AGENT = bsStatic("user-agent");
 struct tagbstring HTTP_CONNECTION = bsStatic("connection");
 
 struct tagbstring HTTP_X_FORWARDED_FOR = bsStatic("x-forwarded-for");
+struct tagbstring HTTP_UPGRADE = bsStatic("upgrade");
+
+#define KNOWN(N, ID) (strncasecmp(name, (N), len) == 0 ? (ID) : HEADER_UNKNOWN)
+
+/**
+ * A perfect hash over the known headers: the length and at most one
+ * character pick the only name it could be, then one compare (ignoring
+ * case) confirms it.  If you add a header here make sure it doesn't
+ * collide with another one of the same length on the character used.
+ */
+HeaderKnown Headers_known(const char *name, int len)
+{
+    switch(len) {
+        case 4: return KNOWN("host", HEADER_HOST);
+        case 5: return KNOWN("range", HEADER_RANGE);
+        case 7: return KNOWN("upgrade", HEADER_UPGRADE);
+        case 8:
+            switch(name[3] | 0x20) {
+                case 'm': return KNOWN("if-match", HEADER_IF_MATCH);
+                case 'r': return KNOWN("if-range", HEADER_IF_RANGE);
+            }
+            break;
+        case 10:
+            switch(name[0] | 0x20) {
+                case 'c': return KNOWN("connection", HEADER_CONNECTION);
+                case 'u': return KNOWN("user-agent", HEADER_USER_AGENT);
+            }
+            break;
+        case 13: return KNOWN("if-none-match", HEADER_IF_NONE_MATCH);
+        case 14: return KNOWN("content-length", HEADER_CONTENT_LENGTH);
+        case 15:
+            switch(name[0] | 0x20) {
+                case 'a': return KNOWN("accept-encoding", HEADER_ACCEPT_ENCODING);
+                case 'x': return KNOWN("x-forwarded-for", HEADER_X_FORWARDED_FOR);
+            }
+            break;
+        case 17: return KNOWN("if-modified-since", HEADER_IF_MODIFIED_SINCE);
+        case 19: return KNOWN("if-unmodified-since", HEADER_IF_UNMODIFIED_SINCE);
+    }
+
+    return HEADER_UNKNOWN;
+}
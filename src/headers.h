@@ -52,6 +52,9 @@ extern struct tagbstring HTTP_IF_MATCH;
 extern struct tagbstring HTTP_IF_NONE_MATCH;
 extern struct tagbstring HTTP_IF_MODIFIED_SINCE;
 extern struct tagbstring HTTP_IF_UNMODIFIED_SINCE;
+extern struct tagbstring HTTP_RANGE;
+extern struct tagbstring HTTP_IF_RANGE;
+extern struct tagbstring HTTP_ACCEPT_ENCODING;
 extern struct tagbstring HTTP_POST;
 extern struct tagbstring HTTP_GET;
 extern struct tagbstring HTTP_HEAD;
@@ -62,5 +65,30 @@ extern struct tagbstring HTTP_PATTERN;
 extern struct tagbstring HTTP_USER_AGENT;
 extern struct tagbstring HTTP_CONNECTION;
 extern struct tagbstring HTTP_X_FORWARDED_FOR;
+extern struct tagbstring HTTP_UPGRADE;
+
+/*
+ * Headers the server itself looks at.  The parser drops their values
+ * into Request->known by these so those lookups don't hash or compare.
+ */
+typedef enum HeaderKnown {
+    HEADER_UNKNOWN = -1,
+    HEADER_HOST = 0,
+    HEADER_RANGE,
+    HEADER_UPGRADE,
+    HEADER_IF_MATCH,
+    HEADER_IF_RANGE,
+    HEADER_CONNECTION,
+    HEADER_USER_AGENT,
+    HEADER_IF_NONE_MATCH,
+    HEADER_CONTENT_LENGTH,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_UNMODIFIED_SINCE,
+    HEADER_KNOWN_COUNT
+} HeaderKnown;
+
+HeaderKnown Headers_known(const char *name, int len);
 
 #endif
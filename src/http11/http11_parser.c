@@ -102,6 +102,14 @@ size_t http_parser_execute(http_parser *parser, const char *buffer, size_t len,
 
   assert(pe - p == (int)len - (int)off && "pointers aren't same distance");
 
+  // most requests never need the state machine
+  if(cs == http_parser_start && parser->nread == 0 &&
+      http_parser_scan(parser, buffer, len, off))
+  {
+    parser->cs = http_parser_first_final;
+    return parser->nread;
+  }
+
   
 #line 107 "src/http11/http11_parser.c"
 	{
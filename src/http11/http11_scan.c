@@ -0,0 +1,221 @@
+#include "http11_parser.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HTTP_SCAN_MAX_LINES 64
+
+/*
+ * Finds every \n up to the one ending the blank line after the headers
+ * and puts their offsets in ends, counting the \r it passes on the way.
+ * Returns how many lines there were, 0 if the header block isn't all
+ * in data yet, or -1 if there are more lines than ends has room for.
+ */
+static inline int http_scan_lines(const unsigned char *data, size_t len,
+        uint32_t *ends, size_t *crs)
+{
+    size_t i = 0;
+    size_t line_start = 0;
+    int lines = 0;
+
+#define HTTP_SCAN_LINE(AT) {\
+    if(lines == HTTP_SCAN_MAX_LINES) return -1;\
+    ends[lines++] = (AT);\
+    if((AT) == line_start + 1) return lines;\
+    line_start = (AT) + 1;\
+}
+
+#ifdef __SSE2__
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    for(; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned int lfs = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        unsigned int cr_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, cr));
+
+        while(lfs) {
+            int bit = __builtin_ctz(lfs);
+
+            // only count the \r up to here in case this is the last line
+            *crs += __builtin_popcount(cr_bits & ((2u << bit) - 1));
+            cr_bits &= ~((2u << bit) - 1);
+
+            HTTP_SCAN_LINE(i + bit);
+            lfs &= lfs - 1;
+        }
+
+        *crs += __builtin_popcount(cr_bits);
+    }
+#endif
+
+    for(; i < len; i++) {
+        if(data[i] == '\r') {
+            (*crs)++;
+        } else if(data[i] == '\n') {
+            HTTP_SCAN_LINE(i);
+        }
+    }
+
+#undef HTTP_SCAN_LINE
+
+    return 0;
+}
+
+static inline int http_scan_method(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        c == '$' || c == '-' || c == '_' || c == '.';
+}
+
+static inline int http_scan_token(unsigned char c)
+{
+    switch(c) {
+        case '(': case ')': case '<': case '>': case '@':
+        case ',': case ';': case ':': case '\\': case '"':
+        case '/': case '[': case ']': case '?': case '=':
+        case '{': case '}':
+            return 0;
+        default:
+            return c > ' ' && c < 127;
+    }
+}
+
+static inline int http_scan_xdigit(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+/*
+ * Everything the grammar allows in a URI or fragment except for #, which
+ * the caller deals with.  % has to be a proper escape.
+ */
+static inline int http_scan_uri_char(const unsigned char *at, const unsigned char *end)
+{
+    if(*at <= ' ' || *at == 127 || *at == '"' || *at == '<' || *at == '>') {
+        return 0;
+    } else if(*at == '%') {
+        return end - at > 2 && http_scan_xdigit(at[1]) && http_scan_xdigit(at[2]);
+    } else {
+        return 1;
+    }
+}
+
+/**
+ * The common case of a whole request line and headers sitting in the
+ * buffer, all with \r\n line endings.  This finds the lines with SSE2
+ * (when it can), checks them against the same grammar the ragel machine
+ * uses, and then hands everything to the callbacks in one go.  If it
+ * sees anything even slightly odd it returns 0 without calling anything
+ * and the ragel machine gets the request instead, so this never has to
+ * get the weird cases right.  Returns 1 if it parsed the request.
+ */
+int http_parser_scan(http_parser *parser, const char *buffer, size_t len, size_t off)
+{
+    const unsigned char *data = (const unsigned char *)buffer + off;
+    const unsigned char *p = data;
+    const unsigned char *end = NULL;
+    const unsigned char *method_end = NULL;
+    const unsigned char *uri = NULL;
+    const unsigned char *uri_end = NULL;
+    const unsigned char *path_end = NULL;
+    const unsigned char *query = NULL;
+    const unsigned char *fragment = NULL;
+    const unsigned char *version = NULL;
+    uint32_t ends[HTTP_SCAN_MAX_LINES];
+    size_t crs = 0;
+    int lines = http_scan_lines(data, len - off, ends, &crs);
+    int i = 0;
+
+    // every line has to end in exactly one \r\n
+    if(lines < 2 || crs != (size_t)lines || ends[0] == 0) return 0;
+
+    for(i = 0; i < lines; i++) {
+        if(data[ends[i] - 1] != '\r') return 0;
+    }
+
+    // Method " " Request_URI ("#" Fragment)? " " HTTP_Version
+    end = data + ends[0] - 1;
+
+    while(p < end && http_scan_method(*p)) p++;
+    if(p == data || p - data > 20 || p == end || *p != ' ') return 0;
+    method_end = p++;
+
+    if(p == end || *p != '/') return 0;
+    uri = p;
+
+    for(; p < end && *p != ' '; p++) {
+        if(*p == '#') {
+            if(fragment) return 0;
+            fragment = p + 1;
+            if(!uri_end) uri_end = p;
+        } else if(!http_scan_uri_char(p, end)) {
+            return 0;
+        } else if(!fragment) {
+            if(*p == '?' && !query) {
+                query = p + 1;
+                if(!path_end) path_end = p;
+            } else if(*p == ';' && !path_end) {
+                path_end = p;
+            }
+        }
+    }
+
+    if(!uri_end) uri_end = p;
+    if(!path_end) path_end = uri_end;
+
+    // ragel's idea of empty queries and fragments isn't worth copying
+    if(query == uri_end || (fragment && fragment == p)) return 0;
+
+    if(end - p != 9 || memcmp(p, " HTTP/1.", 8) != 0 || (p[8] != '0' && p[8] != '1')) return 0;
+    version = p + 1;
+
+    // field_name ":" " "* field_value, and the value can't be empty
+    for(i = 1; i < lines - 1; i++) {
+        p = data + ends[i - 1] + 1;
+        end = data + ends[i] - 1;
+
+        while(p < end && http_scan_token(*p)) p++;
+        if(p == data + ends[i - 1] + 1 || p == end || *p != ':') return 0;
+
+        for(p++; p < end && *p == ' '; p++) {}
+        if(p == end) return 0;
+    }
+
+    // it's good, so now the callbacks get it all
+    if(parser->request_method) parser->request_method(parser->data,
+            (const char *)data, method_end - data);
+    if(parser->request_path) parser->request_path(parser->data,
+            (const char *)uri, path_end - uri);
+    if(query && parser->query_string) parser->query_string(parser->data,
+            (const char *)query, uri_end - query);
+    if(parser->request_uri) parser->request_uri(parser->data,
+            (const char *)uri, uri_end - uri);
+    if(fragment && parser->fragment) parser->fragment(parser->data,
+            (const char *)fragment, version - 1 - fragment);
+    if(parser->http_version) parser->http_version(parser->data,
+            (const char *)version, 8);
+
+    for(i = 1; i < lines - 1 && parser->http_field; i++) {
+        const unsigned char *field = data + ends[i - 1] + 1;
+        const unsigned char *colon = memchr(field, ':', ends[i] - ends[i - 1]);
+
+        for(p = colon + 1; *p == ' '; p++) {}
+
+        parser->http_field(parser->data, (const char *)field, colon - field,
+                (const char *)p, data + ends[i] - 1 - p);
+    }
+
+    parser->body_start = off + ends[lines - 1] + 1;
+    parser->nread += ends[lines - 1] + 1;
+
+    if(parser->header_done) {
+        parser->header_done(parser->data, buffer + parser->body_start,
+                len - parser->body_start);
+    }
+
+    return 1;
+}
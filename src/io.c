@@ -7,8 +7,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
-#include <polarssl/havege.h>
+#include <string.h>
 #include <polarssl/ssl.h>
+#include "tls.h"
 #include <task/task.h>
 
 static ssize_t null_send(IOBuf *iob, char *buffer, int len)
@@ -21,7 +22,7 @@ static ssize_t null_recv(IOBuf *iob, char *buffer, int len)
     return len;
 }
 
-static ssize_t null_stream_file(IOBuf *iob, int fd, int len)
+static ssize_t null_stream_file(IOBuf *iob, int fd, off_t offset, int len)
 {
     return len;
 }
@@ -31,6 +32,11 @@ static ssize_t plaintext_send(IOBuf *iob, char *buffer, int len)
     return fdsend(iob->fd, buffer, len);
 }
 
+static ssize_t plaintext_sendv(IOBuf *iob, struct iovec *iov, int iovcnt)
+{
+    return fdsendv(iob->fd, iov, iovcnt);
+}
+
 static ssize_t plaintext_recv(IOBuf *iob, char *buffer, int len)
 {
     return fdrecv(iob->fd, buffer, len);
@@ -46,18 +52,26 @@ static ssize_t file_recv(IOBuf *iob, char *buffer, int len)
     return fdread(iob->fd, buffer, len);
 }
 
-static ssize_t plain_stream_file(IOBuf *iob, int fd, int len)
+static ssize_t plain_stream_file(IOBuf *iob, int fd, off_t offset, int len)
 {
     ssize_t sent = 0;
     ssize_t total = 0;
-    off_t offset = 0;
     size_t block_size = MAX_SEND_BUFFER;
     int conn_fd = IOBuf_fd(iob);
 
-    for(total = 0; fdwait(conn_fd, 'w') == 0 && total < len; total += sent) {
+    for(total = 0; total < len; total += sent) {
+        // sendfile moves offset along for us, just don't run past len
+        if((size_t)(len - total) < block_size) block_size = len - total;
 
         sent = IOBuf_sendfile(conn_fd, fd, &offset, block_size);
 
+        if(sent < 0 && errno == EAGAIN) {
+            // socket is full, wait for it to drain and go again
+            check(fdwait(conn_fd, 'w') == 0, "Failed waiting on socket: %d", conn_fd);
+            sent = 0;
+            continue;
+        }
+
         check(Register_write(iob->fd, sent) != -1, "Socket seems to be closed.");
 
         check_debug(sent > 0, "Client closed probably during sendfile on socket: %d from "
@@ -78,26 +92,66 @@ error:
     return -1;
 }
 
+static ssize_t uring_send(IOBuf *iob, char *buffer, int len)
+{
+    return uringsend(iob->fd, buffer, len);
+}
+
+static ssize_t uring_recv(IOBuf *iob, char *buffer, int len)
+{
+    return uringrecv(iob->fd, buffer, len);
+}
+
+static ssize_t uring_stream_file(IOBuf *iob, int fd, off_t offset, int len)
+{
+    ssize_t sent = uringstream(IOBuf_fd(iob), fd, offset, len);
+
+    if(sent == -2) {
+        // all the registered buffers are busy, sendfile it instead
+        return plain_stream_file(iob, fd, offset, len);
+    }
+
+    check_debug(sent == len, "Client closed probably during io_uring stream on socket: %d from "
+                "file %d", IOBuf_fd(iob), fd);
+    check(Register_write(iob->fd, sent) != -1, "Socket seems to be closed.");
+
+    return sent;
+
+error:
+    return -1;
+}
+
 static int ssl_fdsend_wrapper(void *p_iob, unsigned char *ubuffer, int len)
 {
     IOBuf *iob = (IOBuf *) p_iob;
-    return fdsend(iob->fd, (char *) ubuffer, len);
+
+    if(iob->use_uring) {
+        return uringsend(iob->fd, (char *) ubuffer, len);
+    } else {
+        return fdsend(iob->fd, (char *) ubuffer, len);
+    }
 }
 
 static int ssl_fdrecv_wrapper(void *p_iob, unsigned char *ubuffer, int len)
 {
     IOBuf *iob = (IOBuf *) p_iob;
-    return fdrecv1(iob->fd, (char *) ubuffer, len);
+
+    if(iob->use_uring) {
+        return uringrecv(iob->fd, (char *) ubuffer, len);
+    } else {
+        return fdrecv1(iob->fd, (char *) ubuffer, len);
+    }
 }
 
 static int ssl_do_handshake(IOBuf *iob)
 {
     int rcode;
     check(!iob->handshake_performed, "ssl_do_handshake called unnecessarily");
-    while((rcode = ssl_handshake(&iob->ssl)) != 0) {
-        check(rcode == POLARSSL_ERR_NET_TRY_AGAIN,
-              "handshake failed with error code %d", rcode);
-    }
+    while((rcode = ssl_handshake(&iob->ssl)) == POLARSSL_ERR_NET_TRY_AGAIN) {}
+
+    TLS_handshake_done(&iob->ssl, rcode);
+    check(rcode == 0, "handshake failed with error code %d", rcode);
+
     iob->handshake_performed = 1;
     return 0;
 error:
@@ -128,33 +182,44 @@ error:
     return -1;
 }
 
-static ssize_t ssl_stream_file(IOBuf *iob, int fd, int len)
+/*
+ * Sends the file as full size TLS records.  Each record's plaintext is
+ * pread straight into polarssl's output buffer and encrypted there, so
+ * there's no bounce buffer on the task stack and a record goes out in one
+ * send instead of one per 1k chunk.
+ */
+static ssize_t ssl_stream_file(IOBuf *iob, int fd, off_t offset, int len)
 {
-    ssize_t sent = 0;
+    ssl_context *ssl = &iob->ssl;
     ssize_t total = 0;
-    ssize_t amt = 0;
-    ssize_t tosend = 0;
-    int conn_fd = IOBuf_fd(iob);
-    char buff[1024];
-
-    for(total = 0; fdwait(conn_fd, 'w') == 0 && total < len; total += tosend) {
-        tosend = pread(fd, buff, sizeof(buff), total);
-        check_debug(tosend > 0, "Came up short in reading file %d\n", fd);
-
-        // We do this in case the file somehow lengthened on us.  In general,
-        // it shouldn't happen.
-        if(tosend + total > len)
-            tosend = len - total;
-
-        sent = 0;
-        while(sent < tosend) {
-            amt = ssl_send(iob, buff, tosend);
-            check_debug(amt > 0, "ssl_send failed in ssl_stream_file with "
-                        "return code %d", amt);
-            sent += amt;
-        }
+    ssize_t got = 0;
+    int want = 0;
+    int rc = 0;
 
-        check(Register_write(iob->fd, sent) != -1, "Failed to record write, must have died.");
+    if(!iob->handshake_performed) {
+        rc = ssl_do_handshake(iob);
+        check(rc == 0, "handshake failed");
+    }
+
+    // anything left over from a short send has to go before we reuse the buffer
+    rc = ssl_flush_output(ssl);
+    check_debug(rc == 0, "ssl_flush_output failed in ssl_stream_file with "
+                "return code %d", rc);
+
+    for(total = 0; total < len; total += got) {
+        want = len - total < SSL_MAX_CONTENT_LEN ? len - total : SSL_MAX_CONTENT_LEN;
+
+        got = pread(fd, ssl->out_msg, want, offset + total);
+        check_debug(got > 0, "Came up short in reading file %d\n", fd);
+
+        ssl->out_msglen = got;
+        ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
+
+        rc = ssl_write_record(ssl);
+        check_debug(rc == 0 && ssl->out_left == 0, "ssl_write_record failed in "
+                    "ssl_stream_file with return code %d", rc);
+
+        check(Register_write(iob->fd, got) != -1, "Failed to record write, must have died.");
     }
     
     check(total <= len,
@@ -190,6 +255,12 @@ IOBuf *IOBuf_create(size_t len, int fd, IOBufType type)
     hattach(buf->buf, buf);
 
     buf->type = type;
+    buf->splice_pipe[0] = buf->splice_pipe[1] = -1;
+
+    if((type == IOBUF_SSL || type == IOBUF_SOCKET) && uringenabled()) {
+        buf->use_uring = 1;
+        uringregister(fd);
+    }
 
     if(type == IOBUF_SSL) {
         buf->use_ssl = 1;
@@ -197,13 +268,12 @@ IOBuf *IOBuf_create(size_t len, int fd, IOBufType type)
         ssl_init(&buf->ssl);
         ssl_set_endpoint(&buf->ssl, SSL_IS_SERVER);
         ssl_set_authmode(&buf->ssl, SSL_VERIFY_NONE);
-        havege_init(&buf->hs);
-        ssl_set_rng(&buf->ssl, havege_rand, &buf->hs);
         ssl_set_dbg(&buf->ssl, ssl_debug, NULL);
         ssl_set_bio(&buf->ssl, ssl_fdrecv_wrapper, buf, 
                     ssl_fdsend_wrapper, buf);
         ssl_set_session(&buf->ssl, 1, 0, &buf->ssn);
         memset(&buf->ssn, 0, sizeof(buf->ssn));
+        TLS_setup(&buf->ssl);
 
         buf->send = ssl_send;
         buf->recv = ssl_recv;
@@ -216,8 +286,13 @@ IOBuf *IOBuf_create(size_t len, int fd, IOBufType type)
         buf->send = file_send;
         buf->recv = file_recv;
         buf->stream_file = plain_stream_file;
+    } else if(type == IOBUF_SOCKET && buf->use_uring) {
+        buf->send = uring_send;
+        buf->recv = uring_recv;
+        buf->stream_file = uring_stream_file;
     } else if(type == IOBUF_SOCKET) {
         buf->send = plaintext_send;
+        buf->sendv = plaintext_sendv;
         buf->recv = plaintext_recv;
         buf->stream_file = plain_stream_file;
     } else {
@@ -239,6 +314,11 @@ void IOBuf_destroy(IOBuf *buf)
             ssl_free(&buf->ssl);
         }
         
+        if(buf->splice_pipe[0] != -1) {
+            close(buf->splice_pipe[0]);
+            close(buf->splice_pipe[1]);
+        }
+
         fdclose(buf->fd);
         h_free(buf);
     }
@@ -289,6 +369,9 @@ char *IOBuf_read(IOBuf *buf, int need, int *out_len)
             return NULL;
         }
     } else if(buf->avail < need) {
+        // the client may be waiting on these before it sends more
+        if(buf->corked) IOBuf_flush(buf);
+
         if(buf->cur > 0 && IOBuf_compact_needed(buf, need)) {
             IOBuf_compact(buf);
         }
@@ -347,6 +430,59 @@ error:
     return -1;
 }
 
+/**
+ * Holds onto sends smaller than MAX_SEND_BUFFER so a run of responses to
+ * pipelined requests can go out in a few big writes.  They go out in the
+ * order they were sent once the pending buffer fills, a read has to wait
+ * on the client, or you call IOBuf_flush.
+ */
+int IOBuf_cork(IOBuf *buf)
+{
+    if(MAX_SEND_BUFFER <= 0) return 0;
+
+    if(buf->pending_buf == NULL) {
+        buf->pending_buf = h_malloc(MAX_SEND_BUFFER);
+        check_mem(buf->pending_buf);
+        hattach(buf->pending_buf, buf);
+    }
+
+    buf->corked = 1;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int IOBuf_send_pending(IOBuf *buf)
+{
+    int rc = 0;
+    int sent = 0;
+
+    while(sent < buf->pending) {
+        rc = buf->send(buf, buf->pending_buf + sent, buf->pending - sent);
+        check_debug(rc > 0, "Failed to send %d pending bytes.", buf->pending - sent);
+        check(Register_write(buf->fd, rc) != -1, "Failed to record write, must have died.");
+        sent += rc;
+    }
+
+    buf->pending = 0;
+    return sent;
+
+error:
+    buf->closed = 1;
+    buf->pending = 0;
+    return -1;
+}
+
+/**
+ * Uncorks the IOBuf and sends anything it was holding.
+ */
+int IOBuf_flush(IOBuf *buf)
+{
+    buf->corked = 0;
+    return buf->pending > 0 ? IOBuf_send_pending(buf) : 0;
+}
+
 /**
  * Wraps the usual send, so not much to it other than it'll avoid doing
  * any calls if the socket is already closed.
@@ -355,6 +491,18 @@ int IOBuf_send(IOBuf *buf, char *data, int len)
 {
     int rc = 0;
 
+    if(buf->corked && len <= MAX_SEND_BUFFER) {
+        if(buf->pending + len > MAX_SEND_BUFFER) {
+            check_debug(IOBuf_send_pending(buf) != -1, "Failed to send pending data.");
+        }
+
+        memcpy(buf->pending_buf + buf->pending, data, len);
+        buf->pending += len;
+        return len;
+    } else if(buf->pending > 0) {
+        check_debug(IOBuf_send_pending(buf) != -1, "Failed to send pending data.");
+    }
+
     rc = buf->send(buf, data, len);
 
     if(rc >= 0) {
@@ -369,6 +517,57 @@ error:
     return -1;
 }
 
+/**
+ * Sends all of the iov entries as one write.  Plain sockets do a real
+ * sendmsg, everything else (SSL, io_uring, files) gets them copied into
+ * one buffer so it's still one send, which is one ssl_write on TLS.
+ * Returns the total sent, and the iov can't be reused afterwards.
+ */
+int IOBuf_sendv(IOBuf *buf, struct iovec *iov, int iovcnt)
+{
+    int rc = 0;
+    int i = 0;
+    int total = 0;
+    char *gather = NULL;
+    char *at = NULL;
+
+    if(buf->corked) {
+        // it all ends up in the pending buffer anyway
+        for(i = 0; i < iovcnt; i++) {
+            rc = IOBuf_send(buf, iov[i].iov_base, iov[i].iov_len);
+            check_debug(rc == (int)iov[i].iov_len, "Failed to send corked iov %d.", i);
+            total += rc;
+        }
+
+        return total;
+    } else if(buf->sendv) {
+        rc = buf->sendv(buf, iov, iovcnt);
+    } else {
+        for(i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+        gather = malloc(total);
+        check_mem(gather);
+
+        for(i = 0, at = gather; i < iovcnt; at += iov[i].iov_len, i++) {
+            memcpy(at, iov[i].iov_base, iov[i].iov_len);
+        }
+
+        rc = buf->send(buf, gather, total);
+        free(gather);
+    }
+
+    if(rc >= 0) {
+        check(Register_write(buf->fd, rc) != -1, "Failed to record write, must have died.");
+    } else {
+        buf->closed = 1;
+    }
+
+    return rc;
+
+error:
+    return -1;
+}
+
 /**
  * Reads the entire amount requested into the IOBuf (as long as there's
  * space to hold it) and then commits that read in one shot.
@@ -396,8 +595,6 @@ char *IOBuf_read_all(IOBuf *buf, int len, int retries)
 
         if(nread == len) {
             break;
-        } else {
-            fdwait(buf->fd, 'r');
         }
     }
    
@@ -418,7 +615,8 @@ error:
 
 /**
  * Streams data out of the from IOBuf and into the to IOBuf
- * until it's moved total bytes between them.
+ * until it's moved total bytes between them.  Between plain sockets
+ * anything bigger than from's buffer is spliced instead of copied.
  */
 int IOBuf_stream(IOBuf *from, IOBuf *to, int total)
 {
@@ -428,6 +626,12 @@ int IOBuf_stream(IOBuf *from, IOBuf *to, int total)
     int rc = 0;
     char *data = NULL;
 
+    if(total > from->len && IOBuf_can_splice(from, to)) {
+        rc = IOBuf_splice(from, to, total);
+        check_debug(rc == total, "Splice came up short: %d of %d", rc, total);
+        return rc;
+    }
+
     if(from->len > to->len) IOBuf_resize(to, from->len);
 
     while(remain > 0) {
@@ -455,6 +659,58 @@ error:
 }
 
 
+/**
+ * Moves up to total bytes from one plain socket IOBuf to another.  What's
+ * already buffered in from goes first, and the rest is spliced through a
+ * pipe without coming into userspace.  Returns how much it moved, which
+ * is less than total if from closed, or -1 on errors.  Check
+ * IOBuf_can_splice first, this doesn't fall back to copying.
+ */
+int IOBuf_splice(IOBuf *from, IOBuf *to, int total)
+{
+    int moved = 0;
+    int rc = 0;
+
+    check(IOBuf_can_splice(from, to), "Can't splice between these IOBufs, use IOBuf_stream.");
+
+    if(IOBuf_avail(from) > 0) {
+        moved = IOBuf_avail(from) < total ? IOBuf_avail(from) : total;
+
+        rc = IOBuf_send_all(to, IOBuf_start(from), moved);
+        check_debug(rc == moved, "Failed to send the buffered data: %d of %d", rc, moved);
+        check(IOBuf_read_commit(from, moved) != -1, "Commit failed during splice.");
+    }
+
+    if(to->pending > 0) {
+        check_debug(IOBuf_send_pending(to) != -1, "Failed to send pending data.");
+    }
+
+    while(moved < total) {
+        rc = fdsplice(from->fd, to->fd, to->splice_pipe, total - moved);
+
+        if(rc == 0) {
+            from->closed = 1;
+            break;
+        }
+
+        check_debug(rc > 0, "Splice from %d to %d failed.", from->fd, to->fd);
+
+        check(Register_read(from->fd, rc) != -1, "Failed to record read, must have died.");
+        check(Register_write(to->fd, rc) != -1, "Failed to record write, must have died.");
+        moved += rc;
+    }
+
+    return moved;
+
+error:
+    // whatever's stuck in the pipe is garbage now
+    if(to->splice_pipe[0] != -1) {
+        close(to->splice_pipe[0]);
+        close(to->splice_pipe[1]);
+        to->splice_pipe[0] = to->splice_pipe[1] = -1;
+    }
+    return -1;
+}
 
 int IOBuf_send_all(IOBuf *buf, char *data, int len)
 {
@@ -475,18 +731,26 @@ error:
     return -1;
 }
 
-int IOBuf_stream_file(IOBuf *buf, int fd, int len)
+int IOBuf_stream_file(IOBuf *buf, int fd, off_t offset, int len)
 {
     int rc = 0;
 
+    // anything held back has to go first to keep responses in order
+    if(buf->pending > 0) {
+        check_debug(IOBuf_send_pending(buf) != -1, "Failed to send pending data.");
+    }
+
     // We depend on the stream_file callback to call Register_write.
     // Doing it here would make the connection look inactive for long periods
     // if we are streaming a large file.
-    rc = buf->stream_file(buf, fd, len);
+    rc = buf->stream_file(buf, fd, offset, len);
 
     if(rc < 0) buf->closed = 1;
 
     return rc;
+
+error:
+    return -1;
 }
 
 
@@ -2,10 +2,10 @@
 #define _io_h
 
 #include <stdlib.h>
+#include <sys/uio.h>
 #include <polarssl/x509.h>
 #include <polarssl/rsa.h>
 #include <polarssl/ssl.h>
-#include <polarssl/havege.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include "bsd_specific.h"
@@ -18,7 +18,8 @@ extern int MAX_SEND_BUFFER;
 struct IOBuf;
 
 typedef ssize_t (*io_cb)(struct IOBuf *, char *data, int len);
-typedef ssize_t (*io_stream_file_cb)(struct IOBuf *, int fd, int len);
+typedef ssize_t (*io_stream_file_cb)(struct IOBuf *, int fd, off_t offset, int len);
+typedef ssize_t (*io_sendv_cb)(struct IOBuf *, struct iovec *iov, int iovcnt);
 
 typedef enum IOBufType {
     IOBUF_SSL, IOBUF_SOCKET, IOBUF_FILE, IOBUF_NULL
@@ -39,19 +40,27 @@ typedef struct IOBuf {
     int mark;
 
     int closed;
+
+    // while corked small sends collect in pending and go out together
+    int corked;
+    int pending;
+    char *pending_buf;
+
     io_cb recv;
     io_cb send;
     io_stream_file_cb stream_file;
+    io_sendv_cb sendv; // NULL means gather into one send
     char *buf;
 
     int type;
 
     int fd;
+    int splice_pipe[2]; // for IOBuf_splice into this one, made lazily
+    int use_uring;
     int use_ssl;
     int handshake_performed;
     ssl_context ssl;
     ssl_session ssn;
-    havege_state hs;
 } IOBuf;
 
 IOBuf *IOBuf_create(size_t len, int fd, IOBufType type);
@@ -67,11 +76,19 @@ int IOBuf_send(IOBuf *buf, char *data, int len);
 
 int IOBuf_send_all(IOBuf *buf, char *data, int len);
 
+int IOBuf_sendv(IOBuf *buf, struct iovec *iov, int iovcnt);
+
+int IOBuf_cork(IOBuf *buf);
+
+int IOBuf_flush(IOBuf *buf);
+
 char *IOBuf_read_all(IOBuf *buf, int len, int retries);
 
 int IOBuf_stream(IOBuf *from, IOBuf *to, int total);
 
-int IOBuf_stream_file(IOBuf *buf, int fd, int len);
+int IOBuf_splice(IOBuf *from, IOBuf *to, int total);
+
+int IOBuf_stream_file(IOBuf *buf, int fd, off_t offset, int len);
 
 #define IOBuf_read_some(I,A) IOBuf_read((I), (I)->len, A)
 
@@ -90,6 +107,14 @@ int IOBuf_stream_file(IOBuf *buf, int fd, int len);
 
 #define IOBuf_fd(I) ((I)->fd)
 
+// only plain sockets can splice, TLS has to go through the buffer
+#ifdef __linux__
+#define IOBuf_can_splice(F, T) ((F)->type == IOBUF_SOCKET && (T)->type == IOBUF_SOCKET &&\
+        !(F)->use_uring && !(T)->use_uring)
+#else
+#define IOBuf_can_splice(F, T) 0
+#endif
+
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #define IOBuf_sendfile bsd_sendfile
 #else
@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <assert.h>
 
@@ -53,6 +54,8 @@
 #include "control.h"
 #include "log.h"
 #include "register.h"
+#include "worker.h"
+#include "proxy.h"
 
 FILE *LOG_FILE = NULL;
 
@@ -65,7 +68,15 @@ struct tagbstring PRIV_DIR = bsStatic("/");
 
 Server *SERVER = NULL;
 
+static int LISTEN_FDS[MAX_WORKERS];
 
+
+/*
+ * This can interrupt the scheduler anywhere, so it only sets flags and
+ * shuts the listen socket down, which wakes the parked accept with a
+ * hangup.  Closing it and logging happen in Server_start and
+ * complete_shutdown, back in task context.
+ */
 void terminate(int s)
 {
     MURDER = s == SIGTERM;
@@ -74,16 +85,13 @@ void terminate(int s)
         case SIGHUP:
             RELOAD = 1;
             RUNNING = 0;
-            log_info("RELOAD REQUESTED, I'll do it on the next request.");
             break;
         default:
             if(!RUNNING) {
-                log_info("SIGINT CAUGHT AGAIN, ASSUMING MURDER.");
                 MURDER = 1;
             } else {
                 RUNNING = 0;
-                log_info("SHUTDOWN REQUESTED: %s", MURDER ? "MURDER" : "GRACEFUL (SIGINT again to EXIT NOW)");
-                fdclose(SERVER->listen_fd);
+                if(SERVER) shutdown(SERVER->listen_fd, SHUT_RDWR);
             }
             break;
     }
@@ -133,7 +141,8 @@ Server *load_server(const char *db_file, const char *server_uuid, int reuse_fd)
     check(rc == 0, "Failed to load mime types.");
 
     if(reuse_fd == -1) {
-        srv->listen_fd = netannounce(TCP, bdata(srv->bind_addr), srv->port);
+        srv->listen_fd = netannounce(Worker_count() > 1 ? TCP_REUSEPORT : TCP,
+                bdata(srv->bind_addr), srv->port);
         check(srv->listen_fd >= 0, "Can't announce on TCP port %d", srv->port);
         check(fdnoblock(srv->listen_fd) == 0, "Failed to set listening port %d nonblocking.", srv->port);
     } else {
@@ -164,31 +173,44 @@ error:
     return -1;
 }
 
-void tickertask(void *v)
+int announce_workers(Server *srv, int count)
 {
-    while(1) {
-        THE_CURRENT_TIME_IS = time(NULL);
+    int i = 0;
 
-        int min_wait = Setting_get_int("limits.tick_timer", 10);
-        debug("Waiting to do timeout check for: %d", min_wait);
+    LISTEN_FDS[0] = srv->listen_fd;
 
-        taskdelay(min_wait * 1000);
+    // these have to be bound before we chroot and drop privileges
+    for(i = 1; i < count; i++) {
+        LISTEN_FDS[i] = netannounce(TCP_REUSEPORT, bdata(srv->bind_addr), srv->port);
+        check(LISTEN_FDS[i] >= 0, "Can't announce worker %d on TCP port %d", i, srv->port);
+        check(fdnoblock(LISTEN_FDS[i]) == 0, "Failed to set worker %d port %d nonblocking.", i, srv->port);
+    }
 
-        // don't bother if these are all 0
-        int min_ping = Setting_get_int("limits.min_ping", DEFAULT_MIN_PING);
-        int min_write_rate = Setting_get_int("limits.min_write_rate", DEFAULT_MIN_READ_RATE);
-        int min_read_rate = Setting_get_int("limits.min_read_rate", DEFAULT_MIN_WRITE_RATE);
+    return 0;
+error:
+    return -1;
+}
 
-        if(min_ping > 0 || min_write_rate > 0 || min_read_rate > 0) {
-            int cleared = Register_cleanout();
+int start_workers(Server *srv, int count)
+{
+    int i = 0;
+    int id = Worker_start(count);
 
-            if(cleared > 0) {
-                log_warn("Timeout task killed %d tasks, waiting %d seconds for more.", cleared, min_wait);
-            } else {
-                debug("No connections timed out.");
-            }
-        }
+    if(id == -1) {
+        log_info("Removing pid file %s", bdata(srv->pid_file));
+        unlink((const char *)srv->pid_file->data);
+        return -1;
     }
+
+    // each worker keeps just its own listen socket
+    for(i = 0; i < count; i++) {
+        if(i != id) fdclose(LISTEN_FDS[i]);
+    }
+
+    srv->listen_fd = LISTEN_FDS[id];
+    log_info("Worker %d running as pid %d.", id, getpid());
+
+    return id;
 }
 
 int attempt_chroot_drop(Server *srv)
@@ -260,6 +282,9 @@ Server *reload_server(Server *old_srv, const char *db_file, const char *server_u
     Server *srv = load_server(db_file, server_uuid, old_srv->listen_fd);
     check(srv, "Failed to load new server config.");
 
+    // connections already open pick these up the next time they do anything
+    Register_load_limits();
+
     RELOAD = 0;
     return srv;
 
@@ -270,6 +295,7 @@ error:
 
 void complete_shutdown(Server *srv)
 {
+    log_info("SHUTDOWN REQUESTED: %s", MURDER ? "MURDER" : "GRACEFUL (SIGINT again to EXIT NOW)");
     fdclose(srv->listen_fd);
     Config_stop_all();
     fdsignal();
@@ -280,13 +306,20 @@ void complete_shutdown(Server *srv)
         taskdelay(1000);
     }
 
+    if(MURDER && taskwaiting() > 0) {
+        log_info("MURDER requested, not waiting for %d connections.", taskwaiting());
+    }
+
     MIME_destroy();
     Control_port_stop();
     Log_term();
     Setting_destroy();
 
-    log_info("Removing pid file %s", bdata(srv->pid_file));
-    unlink((const char *)srv->pid_file->data);
+    if(WORKER_ID < 0) {
+        // the supervisor owns the pid file when there's workers
+        log_info("Removing pid file %s", bdata(srv->pid_file));
+        unlink((const char *)srv->pid_file->data);
+    }
 
     Server_destroy(srv);
 
@@ -308,16 +341,28 @@ void taskmain(int argc, char **argv)
 
     SuperPoll_get_max_fd();
 
+    int workers = Worker_count();
+
+    if(workers > 1) {
+        rc = announce_workers(SERVER, workers);
+        check(rc == 0, "Failed to announce all %d workers, aborting.", workers);
+    }
+
     rc = clear_pid_file(SERVER);
     check(rc == 0, "PID file failure, aborting rather than trying to start.");
 
     rc = attempt_chroot_drop(SERVER);
     check(rc == 0, "Major failure in chroot/droppriv, aborting."); 
 
+    if(workers > 1 && start_workers(SERVER, workers) == -1) {
+        // only the supervisor gets here, once all the workers are gone
+        taskexitall(0);
+    }
+
     final_setup();
 
     Control_port_start();
-    taskcreate(tickertask, NULL, 16 * 1024);
+    Proxy_health_start();
 
     while(1) {
         log_info("Starting " VERSION ". Copyright (C) Zed A. Shaw. Licensed BSD.");
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <mem/halloc.h>
 
 
 
@@ -235,3 +236,196 @@ const char *match(MatchState *ms, const char *s, const char *p) {
   }
 }
 
+
+/*
+ * Like classend but returns NULL for a malformed item instead of
+ * logging and carrying on past the end.
+ */
+static const char *pattern_classend(const char *p)
+{
+    switch(*p++) {
+        case L_ESC:
+            return *p == '\0' ? NULL : p + 1;
+        case '[':
+            if(*p == '^') p++;
+            do {
+                if(*p == '\0') return NULL;
+                if(*(p++) == L_ESC && *p != '\0') p++;
+            } while(*p != ']');
+            return p + 1;
+        default:
+            return p;
+    }
+}
+
+#define PATTERN_IN(I, C) ((I)->set[(unsigned char)(C) >> 5] & (1u << ((unsigned char)(C) & 31)))
+
+static void pattern_fill_set(PatternItem *item, const char *p, const char *ep, int bracket)
+{
+    int i = 0;
+
+    // ask the interpreter about every char so they can't disagree
+    for(i = 0; i < 256; i++) {
+        int c = (signed char)i;
+        int in = bracket ? matchbracketclass(c, p, ep - 1) : singlematch(c, p, ep);
+        if(in) item->set[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+/**
+ * Turns a pattern into a list of items, each char class flattened into
+ * a 256 bit set, so matching never has to parse the pattern again.
+ * Returns NULL for patterns pattern_match would choke on, and those
+ * should just keep using pattern_match.  Allocated with halloc so it
+ * can be hattached to whatever owns it.
+ */
+PatternProg *pattern_compile(const char *p)
+{
+    PatternProg *prog = h_calloc(sizeof(PatternProg) + sizeof(PatternItem) * (strlen(p) + 1), 1);
+    PatternItem *item = NULL;
+    const char *ep = NULL;
+    check_mem(prog);
+
+    for(item = prog->items; ; item++) {
+        while(*p == '(' || *p == ')') p++;
+
+        if(*p == '\0') {
+            item->op = PATTERN_DONE;
+            break;
+        } else if(*p == '$' && *(p + 1) == '\0') {
+            item->op = PATTERN_EOS;
+            break;
+        } else if(*p == L_ESC && *(p + 1) == 'b') {
+            check_debug(*(p + 2) != '\0' && *(p + 3) != '\0', "Unbalanced pattern.");
+            item->op = PATTERN_BALANCE;
+            item->open = *(p + 2);
+            item->close = *(p + 3);
+            p += 4;
+        } else if(*p == L_ESC && *(p + 1) == 'f') {
+            p += 2;
+            check_debug(*p == '[', "Missing [ after \\f in pattern.");
+            ep = pattern_classend(p);
+            check_debug(ep, "Malformed pattern.");
+
+            item->op = PATTERN_FRONTIER;
+            pattern_fill_set(item, p, ep, 1);
+            p = ep;
+        } else {
+            ep = pattern_classend(p);
+            check_debug(ep, "Malformed pattern.");
+
+            item->op = PATTERN_SET;
+            pattern_fill_set(item, p, ep, 0);
+
+            if(*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-') {
+                item->quant = *ep;
+                p = ep + 1;
+            } else {
+                p = ep;
+            }
+        }
+    }
+
+    prog->count = item - prog->items + 1;
+    return prog;
+
+error:
+    h_free(prog);
+    return NULL;
+}
+
+static const char *pattern_run(MatchState *ms, const char *s, PatternItem *item);
+
+static const char *pattern_max_expand(MatchState *ms, const char *s, PatternItem *item)
+{
+    int i = 0;
+
+    while((s + i) < ms->src_end && PATTERN_IN(item, *(s + i))) i++;
+
+    for(; i >= 0; i--) {
+        const char *res = pattern_run(ms, s + i, item + 1);
+        if(res) return res;
+    }
+
+    return NULL;
+}
+
+static const char *pattern_min_expand(MatchState *ms, const char *s, PatternItem *item)
+{
+    for(;;) {
+        const char *res = pattern_run(ms, s, item + 1);
+
+        if(res != NULL) {
+            return res;
+        } else if(s < ms->src_end && PATTERN_IN(item, *s)) {
+            s++;
+        } else {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Same moves as match() in the same order, just over compiled items.
+ */
+static const char *pattern_run(MatchState *ms, const char *s, PatternItem *item)
+{
+    const char *res = NULL;
+    int m = 0;
+
+    for(;;) {
+        switch(item->op) {
+            case PATTERN_DONE:
+                return s;
+            case PATTERN_EOS:
+                return s == ms->src_end ? s : NULL;
+            case PATTERN_BALANCE:
+                if(*s != item->open) return NULL;
+                {
+                    int cont = 1;
+                    while(++s < ms->src_end) {
+                        if(*s == item->close) {
+                            if(--cont == 0) break;
+                        } else if(*s == item->open) {
+                            cont++;
+                        }
+                    }
+                    if(s >= ms->src_end) return NULL;
+                    s++;
+                }
+                item++;
+                break;
+            case PATTERN_FRONTIER:
+                if(PATTERN_IN(item, s == ms->src_init ? '\0' : *(s - 1)) || !PATTERN_IN(item, *s)) {
+                    return NULL;
+                }
+                item++;
+                break;
+            default:
+                m = s < ms->src_end && PATTERN_IN(item, *s);
+
+                switch(item->quant) {
+                    case '?':
+                        if(m && (res = pattern_run(ms, s + 1, item + 1)) != NULL) return res;
+                        item++;
+                        break;
+                    case '*':
+                        return pattern_max_expand(ms, s, item);
+                    case '+':
+                        return m ? pattern_max_expand(ms, s + 1, item) : NULL;
+                    case '-':
+                        return pattern_min_expand(ms, s, item);
+                    default:
+                        if(!m) return NULL;
+                        s++;
+                        item++;
+                }
+        }
+    }
+}
+
+const char *pattern_exec(PatternProg *prog, const char *s, size_t len)
+{
+    MatchState ms = {.src_init = s, .src_end = s + len};
+    return pattern_run(&ms, s, prog->items);
+}
@@ -41,4 +41,29 @@ const char *pattern_match(const char *s, size_t len, const char *p);
 
 const char *bstring_match(bstring s, bstring pattern);
 
+enum {
+    PATTERN_DONE = 0,
+    PATTERN_EOS,
+    PATTERN_SET,
+    PATTERN_BALANCE,
+    PATTERN_FRONTIER
+};
+
+typedef struct PatternItem {
+    unsigned char op;
+    char quant;
+    char open;
+    char close;
+    unsigned int set[8];
+} PatternItem;
+
+typedef struct PatternProg {
+    int count;
+    PatternItem items[];
+} PatternProg;
+
+PatternProg *pattern_compile(const char *p);
+
+const char *pattern_exec(PatternProg *prog, const char *s, size_t len);
+
 #endif
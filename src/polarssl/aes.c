@@ -35,6 +35,7 @@
 
 #include "polarssl/aes.h"
 #include "polarssl/padlock.h"
+#include "polarssl/aesni.h"
 
 #include <string.h>
 
@@ -540,6 +541,11 @@ int aes_setkey_enc( aes_context *ctx, const unsigned char *key, int keysize )
             break;
     }
 
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( aesni_supports( AESNI_AES ) )
+        aesni_setkey_enc( ctx );
+#endif
+
     return( 0 );
 }
 
@@ -568,6 +574,16 @@ int aes_setkey_dec( aes_context *ctx, const unsigned char *key, int keysize )
     ctx->rk = RK = ctx->buf;
 #endif
 
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( aesni_supports( AESNI_AES ) )
+    {
+        if( ( ret = aes_setkey_enc( ctx, key, keysize ) ) == 0 )
+            aesni_setkey_dec( ctx );
+
+        return( ret );
+    }
+#endif
+
     ret = aes_setkey_enc( &cty, key, keysize );
     if( ret != 0 )
         return( ret );
@@ -669,6 +685,11 @@ int aes_crypt_ecb( aes_context *ctx,
     }
 #endif
 
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( aesni_supports( AESNI_AES ) )
+        return( aesni_crypt_ecb( ctx, mode, input, output ) );
+#endif
+
     RK = ctx->rk;
 
     GET_ULONG_LE( X0, input,  0 ); X0 ^= *RK++;
@@ -781,6 +802,11 @@ int aes_crypt_cbc( aes_context *ctx,
     }
 #endif
 
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( aesni_supports( AESNI_AES ) )
+        return( aesni_crypt_cbc( ctx, mode, length, iv, input, output ) );
+#endif
+
     if( mode == AES_DECRYPT )
     {
         while( length > 0 )
@@ -0,0 +1,451 @@
+/*
+ *  AES-NI support functions
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  This implementation is based on the Intel white papers:
+ *
+ *  "Intel Advanced Encryption Standard (AES) New Instructions Set"
+ *  "Intel Carry-Less Multiplication Instruction and its Usage for
+ *   Computing the GCM Mode"
+ *
+ *  The build doesn't turn on -maes, so only the functions here are
+ *  compiled for AES-NI and PCLMULQDQ and callers check aesni_supports()
+ *  before using them.
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_AESNI_C)
+
+#include "polarssl/aesni.h"
+
+#if defined(POLARSSL_HAVE_X86_64)
+
+#include <string.h>
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#define AESNI_TARGET __attribute__((target("sse2,ssse3,aes,pclmul")))
+
+#define LOAD(p)         _mm_loadu_si128( (const __m128i *) (p) )
+#define STORE(p, v)     _mm_storeu_si128( (__m128i *) (p), (v) )
+
+/*
+ * AES-NI detection routine
+ */
+int aesni_supports( unsigned int what )
+{
+    static int done = 0;
+    static unsigned int flags = 0;
+    unsigned int eax, ebx, ecx, edx;
+
+    if( done == 0 )
+    {
+        if( __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+            flags = ecx;
+
+        done = 1;
+    }
+
+    return( ( flags & what ) == what );
+}
+
+/*
+ * aes_setkey_enc() leaves each 32-bit round key word in an unsigned long,
+ * AESENC wants them packed four to a block.  Packing from the front never
+ * overwrites a word before it's been read.
+ */
+void aesni_setkey_enc( aes_context *ctx )
+{
+    int i;
+    unsigned int w;
+    unsigned char *p = (unsigned char *) ctx->rk;
+
+    for( i = 0; i < ( ctx->nr + 1 ) * 4; i++ )
+    {
+        w = (unsigned int) ctx->rk[i];
+        memcpy( p + i * 4, &w, 4 );
+    }
+}
+
+/*
+ * Equivalent inverse cipher: the encryption round keys in reverse with
+ * InvMixColumns applied to all but the first and last.
+ */
+AESNI_TARGET
+void aesni_setkey_dec( aes_context *ctx )
+{
+    int i;
+    __m128i ek[15];
+    unsigned char *rk = (unsigned char *) ctx->rk;
+
+    for( i = 0; i <= ctx->nr; i++ )
+        ek[i] = LOAD( rk + i * 16 );
+
+    STORE( rk, ek[ctx->nr] );
+
+    for( i = 1; i < ctx->nr; i++ )
+        STORE( rk + i * 16, _mm_aesimc_si128( ek[ctx->nr - i] ) );
+
+    STORE( rk + ctx->nr * 16, ek[0] );
+}
+
+AESNI_TARGET
+static inline void aesni_load_keys( aes_context *ctx, __m128i rk[15] )
+{
+    int i;
+    const unsigned char *p = (const unsigned char *) ctx->rk;
+
+    rk[0] = LOAD( p );
+
+    for( i = 1; i <= ctx->nr; i++ )
+        rk[i] = LOAD( p + i * 16 );
+}
+
+AESNI_TARGET
+static inline __m128i aesni_encrypt( const __m128i rk[15], int nr, __m128i b )
+{
+    int i;
+
+    b = _mm_xor_si128( b, rk[0] );
+
+    for( i = 1; i < nr; i++ )
+        b = _mm_aesenc_si128( b, rk[i] );
+
+    return( _mm_aesenclast_si128( b, rk[nr] ) );
+}
+
+AESNI_TARGET
+static inline __m128i aesni_decrypt( const __m128i rk[15], int nr, __m128i b )
+{
+    int i;
+
+    b = _mm_xor_si128( b, rk[0] );
+
+    for( i = 1; i < nr; i++ )
+        b = _mm_aesdec_si128( b, rk[i] );
+
+    return( _mm_aesdeclast_si128( b, rk[nr] ) );
+}
+
+/*
+ * AES-NI AES-ECB block en(de)cryption
+ */
+AESNI_TARGET
+int aesni_crypt_ecb( aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] )
+{
+    __m128i rk[15];
+
+    aesni_load_keys( ctx, rk );
+
+    if( mode == AES_DECRYPT )
+        STORE( output, aesni_decrypt( rk, ctx->nr, LOAD( input ) ) );
+    else
+        STORE( output, aesni_encrypt( rk, ctx->nr, LOAD( input ) ) );
+
+    return( 0 );
+}
+
+/*
+ * AES-NI AES-CBC buffer en(de)cryption.  Encryption has to chain one block
+ * at a time, decryption runs four blocks through the pipeline at once.
+ */
+AESNI_TARGET
+int aesni_crypt_cbc( aes_context *ctx,
+                     int mode,
+                     int length,
+                     unsigned char iv[16],
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    int i, nr = ctx->nr;
+    __m128i rk[15];
+    __m128i chain = LOAD( iv );
+    __m128i b0, b1, b2, b3, c0, c1, c2, c3;
+
+    aesni_load_keys( ctx, rk );
+
+    if( mode == AES_ENCRYPT )
+    {
+        for( ; length > 0; length -= 16, input += 16, output += 16 )
+        {
+            chain = aesni_encrypt( rk, nr, _mm_xor_si128( LOAD( input ), chain ) );
+            STORE( output, chain );
+        }
+
+        STORE( iv, chain );
+        return( 0 );
+    }
+
+    for( ; length >= 64; length -= 64, input += 64, output += 64 )
+    {
+        c0 = LOAD( input      );
+        c1 = LOAD( input + 16 );
+        c2 = LOAD( input + 32 );
+        c3 = LOAD( input + 48 );
+
+        b0 = _mm_xor_si128( c0, rk[0] );
+        b1 = _mm_xor_si128( c1, rk[0] );
+        b2 = _mm_xor_si128( c2, rk[0] );
+        b3 = _mm_xor_si128( c3, rk[0] );
+
+        for( i = 1; i < nr; i++ )
+        {
+            b0 = _mm_aesdec_si128( b0, rk[i] );
+            b1 = _mm_aesdec_si128( b1, rk[i] );
+            b2 = _mm_aesdec_si128( b2, rk[i] );
+            b3 = _mm_aesdec_si128( b3, rk[i] );
+        }
+
+        b0 = _mm_aesdeclast_si128( b0, rk[nr] );
+        b1 = _mm_aesdeclast_si128( b1, rk[nr] );
+        b2 = _mm_aesdeclast_si128( b2, rk[nr] );
+        b3 = _mm_aesdeclast_si128( b3, rk[nr] );
+
+        STORE( output,      _mm_xor_si128( b0, chain ) );
+        STORE( output + 16, _mm_xor_si128( b1, c0 ) );
+        STORE( output + 32, _mm_xor_si128( b2, c1 ) );
+        STORE( output + 48, _mm_xor_si128( b3, c2 ) );
+        chain = c3;
+    }
+
+    for( ; length > 0; length -= 16, input += 16, output += 16 )
+    {
+        c0 = LOAD( input );
+        STORE( output, _mm_xor_si128( aesni_decrypt( rk, nr, c0 ), chain ) );
+        chain = c0;
+    }
+
+    STORE( iv, chain );
+
+    return( 0 );
+}
+
+/*
+ * AES-NI counter mode, four blocks at a time.  The first 12 bytes of the
+ * counter block stay put and only the last word counts.
+ */
+AESNI_TARGET
+void aesni_crypt_ctr32( aes_context *ctx,
+                        int blocks,
+                        unsigned char counter[16],
+                        const unsigned char *input,
+                        unsigned char *output )
+{
+    int i, nr = ctx->nr;
+    unsigned int w0, w1, w2, c;
+    __m128i rk[15];
+    __m128i b0, b1, b2, b3;
+
+    aesni_load_keys( ctx, rk );
+
+    memcpy( &w0, counter,     4 );
+    memcpy( &w1, counter + 4, 4 );
+    memcpy( &w2, counter + 8, 4 );
+    c = ( (unsigned int) counter[12] << 24 ) | ( (unsigned int) counter[13] << 16 )
+      | ( (unsigned int) counter[14] <<  8 ) | ( (unsigned int) counter[15]       );
+
+#define CTR_BLOCK(n) _mm_set_epi32( (int) __builtin_bswap32( c + (n) ), \
+                                    (int) w2, (int) w1, (int) w0 )
+
+    for( ; blocks >= 4; blocks -= 4, input += 64, output += 64, c += 4 )
+    {
+        b0 = _mm_xor_si128( CTR_BLOCK( 0 ), rk[0] );
+        b1 = _mm_xor_si128( CTR_BLOCK( 1 ), rk[0] );
+        b2 = _mm_xor_si128( CTR_BLOCK( 2 ), rk[0] );
+        b3 = _mm_xor_si128( CTR_BLOCK( 3 ), rk[0] );
+
+        for( i = 1; i < nr; i++ )
+        {
+            b0 = _mm_aesenc_si128( b0, rk[i] );
+            b1 = _mm_aesenc_si128( b1, rk[i] );
+            b2 = _mm_aesenc_si128( b2, rk[i] );
+            b3 = _mm_aesenc_si128( b3, rk[i] );
+        }
+
+        b0 = _mm_xor_si128( _mm_aesenclast_si128( b0, rk[nr] ), LOAD( input      ) );
+        b1 = _mm_xor_si128( _mm_aesenclast_si128( b1, rk[nr] ), LOAD( input + 16 ) );
+        b2 = _mm_xor_si128( _mm_aesenclast_si128( b2, rk[nr] ), LOAD( input + 32 ) );
+        b3 = _mm_xor_si128( _mm_aesenclast_si128( b3, rk[nr] ), LOAD( input + 48 ) );
+
+        STORE( output,      b0 );
+        STORE( output + 16, b1 );
+        STORE( output + 32, b2 );
+        STORE( output + 48, b3 );
+    }
+
+    for( ; blocks > 0; blocks--, input += 16, output += 16, c++ )
+    {
+        b0 = aesni_encrypt( rk, nr, CTR_BLOCK( 0 ) );
+        STORE( output, _mm_xor_si128( b0, LOAD( input ) ) );
+    }
+
+#undef CTR_BLOCK
+
+    counter[12] = (unsigned char)( c >> 24 );
+    counter[13] = (unsigned char)( c >> 16 );
+    counter[14] = (unsigned char)( c >>  8 );
+    counter[15] = (unsigned char)( c       );
+}
+
+/*
+ * GHASH works on bit reflected values, so blocks are byte swapped going in
+ * and the 256-bit carry-less product is shifted left one bit before it's
+ * reduced mod x^128 + x^7 + x^2 + x + 1.
+ */
+AESNI_TARGET
+static inline __m128i gcm_bswap( __m128i x )
+{
+    return( _mm_shuffle_epi8( x, _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7,
+                                               8, 9, 10, 11, 12, 13, 14, 15 ) ) );
+}
+
+AESNI_TARGET
+static inline void gcm_clmul( __m128i a, __m128i b, __m128i *lo, __m128i *hi )
+{
+    __m128i t0, t1, t2, t3;
+
+    t0 = _mm_clmulepi64_si128( a, b, 0x00 );
+    t1 = _mm_clmulepi64_si128( a, b, 0x10 );
+    t2 = _mm_clmulepi64_si128( a, b, 0x01 );
+    t3 = _mm_clmulepi64_si128( a, b, 0x11 );
+
+    t1 = _mm_xor_si128( t1, t2 );
+    *lo = _mm_xor_si128( t0, _mm_slli_si128( t1, 8 ) );
+    *hi = _mm_xor_si128( t3, _mm_srli_si128( t1, 8 ) );
+}
+
+AESNI_TARGET
+static inline __m128i gcm_reduce( __m128i lo, __m128i hi )
+{
+    __m128i t2, t4, t5, t7, t8, t9;
+
+    /* shift the 256-bit product left by one */
+    t7 = _mm_srli_epi32( lo, 31 );
+    t8 = _mm_srli_epi32( hi, 31 );
+    lo = _mm_slli_epi32( lo, 1 );
+    hi = _mm_slli_epi32( hi, 1 );
+
+    t9 = _mm_srli_si128( t7, 12 );
+    t8 = _mm_slli_si128( t8, 4 );
+    t7 = _mm_slli_si128( t7, 4 );
+    lo = _mm_or_si128( lo, t7 );
+    hi = _mm_or_si128( hi, t8 );
+    hi = _mm_or_si128( hi, t9 );
+
+    /* first phase of the reduction */
+    t7 = _mm_slli_epi32( lo, 31 );
+    t8 = _mm_slli_epi32( lo, 30 );
+    t9 = _mm_slli_epi32( lo, 25 );
+
+    t7 = _mm_xor_si128( t7, t8 );
+    t7 = _mm_xor_si128( t7, t9 );
+    t8 = _mm_srli_si128( t7, 4 );
+    t7 = _mm_slli_si128( t7, 12 );
+    lo = _mm_xor_si128( lo, t7 );
+
+    /* second phase */
+    t2 = _mm_srli_epi32( lo, 1 );
+    t4 = _mm_srli_epi32( lo, 2 );
+    t5 = _mm_srli_epi32( lo, 7 );
+    t2 = _mm_xor_si128( t2, t4 );
+    t2 = _mm_xor_si128( t2, t5 );
+    t2 = _mm_xor_si128( t2, t8 );
+    lo = _mm_xor_si128( lo, t2 );
+
+    return( _mm_xor_si128( hi, lo ) );
+}
+
+AESNI_TARGET
+static inline __m128i gcm_mult( __m128i a, __m128i b )
+{
+    __m128i lo, hi;
+
+    gcm_clmul( a, b, &lo, &hi );
+
+    return( gcm_reduce( lo, hi ) );
+}
+
+AESNI_TARGET
+void aesni_gcm_powers( const unsigned char h[16], unsigned char powers[64] )
+{
+    __m128i h1 = gcm_bswap( LOAD( h ) );
+    __m128i h2 = gcm_mult( h1, h1 );
+    __m128i h3 = gcm_mult( h2, h1 );
+    __m128i h4 = gcm_mult( h3, h1 );
+
+    STORE( powers,      h1 );
+    STORE( powers + 16, h2 );
+    STORE( powers + 32, h3 );
+    STORE( powers + 48, h4 );
+}
+
+/*
+ * Four blocks at a time the multiplications are independent:
+ *   X' = (X + B0) H^4 + B1 H^3 + B2 H^2 + B3 H
+ * and only the sum needs reducing.
+ */
+AESNI_TARGET
+void aesni_gcm_ghash( const unsigned char powers[64],
+                      unsigned char x[16],
+                      const unsigned char *input,
+                      int length )
+{
+    __m128i h1 = LOAD( powers      );
+    __m128i h2 = LOAD( powers + 16 );
+    __m128i h3 = LOAD( powers + 32 );
+    __m128i h4 = LOAD( powers + 48 );
+    __m128i X = gcm_bswap( LOAD( x ) );
+    __m128i lo, hi, l, h;
+
+    for( ; length >= 64; length -= 64, input += 64 )
+    {
+        gcm_clmul( _mm_xor_si128( X, gcm_bswap( LOAD( input ) ) ), h4, &lo, &hi );
+
+        gcm_clmul( gcm_bswap( LOAD( input + 16 ) ), h3, &l, &h );
+        lo = _mm_xor_si128( lo, l );
+        hi = _mm_xor_si128( hi, h );
+
+        gcm_clmul( gcm_bswap( LOAD( input + 32 ) ), h2, &l, &h );
+        lo = _mm_xor_si128( lo, l );
+        hi = _mm_xor_si128( hi, h );
+
+        gcm_clmul( gcm_bswap( LOAD( input + 48 ) ), h1, &l, &h );
+        lo = _mm_xor_si128( lo, l );
+        hi = _mm_xor_si128( hi, h );
+
+        X = gcm_reduce( lo, hi );
+    }
+
+    for( ; length > 0; length -= 16, input += 16 )
+        X = gcm_mult( _mm_xor_si128( X, gcm_bswap( LOAD( input ) ) ), h1 );
+
+    STORE( x, gcm_bswap( X ) );
+}
+
+#endif /* HAVE_X86_64 */
+
+#endif /* POLARSSL_AESNI_C */
@@ -0,0 +1,148 @@
+/**
+ * \file aesni.h
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_AESNI_H
+#define POLARSSL_AESNI_H
+
+#include "polarssl/aes.h"
+
+#if defined(POLARSSL_HAVE_ASM) && defined(__GNUC__) && defined(__x86_64__)
+
+#ifndef POLARSSL_HAVE_X86_64
+#define POLARSSL_HAVE_X86_64
+#endif
+
+/*
+ * CPUID leaf 1 ECX feature bits
+ */
+#define AESNI_CLMUL 0x00000002
+#define AESNI_SSSE3 0x00000200
+#define AESNI_AES   0x02000000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          AES-NI detection routine
+ *
+ * \param what     The feature bits to detect (AESNI_AES, AESNI_CLMUL...)
+ *
+ * \return         1 if CPU has support for all of them, 0 otherwise
+ */
+int aesni_supports( unsigned int what );
+
+/**
+ * \brief          Repack the encryption round keys made by
+ *                 aes_setkey_enc() into the layout AESENC expects
+ *
+ * \param ctx      AES context
+ */
+void aesni_setkey_enc( aes_context *ctx );
+
+/**
+ * \brief          Turn round keys packed by aesni_setkey_enc() into
+ *                 decryption round keys for AESDEC
+ *
+ * \param ctx      AES context
+ */
+void aesni_setkey_dec( aes_context *ctx );
+
+/**
+ * \brief          AES-NI AES-ECB block en(de)cryption
+ *
+ * \param ctx      AES context
+ * \param mode     AES_ENCRYPT or AES_DECRYPT
+ * \param input    16-byte input block
+ * \param output   16-byte output block
+ *
+ * \return         0
+ */
+int aesni_crypt_ecb( aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] );
+
+/**
+ * \brief          AES-NI AES-CBC buffer en(de)cryption
+ *
+ * \param ctx      AES context
+ * \param mode     AES_ENCRYPT or AES_DECRYPT
+ * \param length   length of the input data (multiple of 16)
+ * \param iv       initialization vector (updated after use)
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ *
+ * \return         0
+ */
+int aesni_crypt_cbc( aes_context *ctx,
+                     int mode,
+                     int length,
+                     unsigned char iv[16],
+                     const unsigned char *input,
+                     unsigned char *output );
+
+/**
+ * \brief          AES-NI counter mode over whole blocks, counting in the
+ *                 last 32 bits of the counter block big endian (as GCM
+ *                 does).  output may be the same as input or start before
+ *                 it.
+ *
+ * \param ctx      AES context (encryption keys)
+ * \param blocks   number of 16-byte blocks
+ * \param counter  counter block of the first block (updated after use)
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ */
+void aesni_crypt_ctr32( aes_context *ctx,
+                        int blocks,
+                        unsigned char counter[16],
+                        const unsigned char *input,
+                        unsigned char *output );
+
+/**
+ * \brief          Precompute H, H^2, H^3 and H^4 for aesni_gcm_ghash()
+ *
+ * \param h        the GHASH key (the encrypted zero block)
+ * \param powers   64-byte output table
+ */
+void aesni_gcm_powers( const unsigned char h[16], unsigned char powers[64] );
+
+/**
+ * \brief          PCLMULQDQ GHASH over whole blocks, four at a time
+ *
+ * \param powers   table from aesni_gcm_powers()
+ * \param x        GHASH state (updated)
+ * \param input    data to hash
+ * \param length   length of the data (multiple of 16)
+ */
+void aesni_gcm_ghash( const unsigned char powers[64],
+                      unsigned char x[16],
+                      const unsigned char *input,
+                      int length );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAVE_X86_64 */
+
+#endif /* aesni.h */
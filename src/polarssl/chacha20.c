@@ -0,0 +1,338 @@
+/*
+ *  ChaCha20 stream cipher
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  ChaCha20 as specified for IETF protocols, with a 96-bit nonce and a
+ *  32-bit block counter:
+ *
+ *  http://tools.ietf.org/html/rfc7539
+ *
+ *  Where SSE2 is available four blocks are computed at once, one in each
+ *  lane of the vector registers.
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_CHACHA20_C)
+
+#include "polarssl/chacha20.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_ULONG_LE
+#define GET_ULONG_LE(n,b,i)                             \
+{                                                       \
+    (n) = ( (unsigned long) (b)[(i)    ]       )        \
+        | ( (unsigned long) (b)[(i) + 1] <<  8 )        \
+        | ( (unsigned long) (b)[(i) + 2] << 16 )        \
+        | ( (unsigned long) (b)[(i) + 3] << 24 );       \
+}
+#endif
+
+#ifndef PUT_ULONG_LE
+#define PUT_ULONG_LE(n,b,i)                             \
+{                                                       \
+    (b)[(i)    ] = (unsigned char) ( (n)       );       \
+    (b)[(i) + 1] = (unsigned char) ( (n) >>  8 );       \
+    (b)[(i) + 2] = (unsigned char) ( (n) >> 16 );       \
+    (b)[(i) + 3] = (unsigned char) ( (n) >> 24 );       \
+}
+#endif
+
+#define ROTL32(x,n) ( ( (x) << (n) ) | ( (x) >> ( 32 - (n) ) ) )
+
+#define QUARTERROUND(a,b,c,d)                           \
+{                                                       \
+    a += b; d ^= a; d = ROTL32( d, 16 );                \
+    c += d; b ^= c; b = ROTL32( b, 12 );                \
+    a += b; d ^= a; d = ROTL32( d,  8 );                \
+    c += d; b ^= c; b = ROTL32( b,  7 );                \
+}
+
+void chacha20_setkey( chacha20_context *ctx, const unsigned char key[32] )
+{
+    int i;
+    unsigned long k;
+
+    for( i = 0; i < 8; i++ )
+    {
+        GET_ULONG_LE( k, key, i * 4 );
+        ctx->key[i] = (uint32_t) k;
+    }
+}
+
+/*
+ * The initial state: constants, key, counter, nonce
+ */
+static void chacha20_init_state( chacha20_context *ctx, uint32_t s[16],
+                                 const unsigned char nonce[12],
+                                 uint32_t counter )
+{
+    int i;
+    unsigned long n;
+
+    s[0] = 0x61707865;
+    s[1] = 0x3320646e;
+    s[2] = 0x79622d32;
+    s[3] = 0x6b206574;
+
+    for( i = 0; i < 8; i++ )
+        s[4 + i] = ctx->key[i];
+
+    s[12] = counter;
+
+    for( i = 0; i < 3; i++ )
+    {
+        GET_ULONG_LE( n, nonce, i * 4 );
+        s[13 + i] = (uint32_t) n;
+    }
+}
+
+/*
+ * One 64-byte block of key stream
+ */
+static void chacha20_block( const uint32_t s[16], unsigned char out[64] )
+{
+    int i;
+    uint32_t x[16];
+
+    memcpy( x, s, sizeof( x ) );
+
+    for( i = 0; i < 10; i++ )
+    {
+        QUARTERROUND( x[0], x[4], x[ 8], x[12] );
+        QUARTERROUND( x[1], x[5], x[ 9], x[13] );
+        QUARTERROUND( x[2], x[6], x[10], x[14] );
+        QUARTERROUND( x[3], x[7], x[11], x[15] );
+        QUARTERROUND( x[0], x[5], x[10], x[15] );
+        QUARTERROUND( x[1], x[6], x[11], x[12] );
+        QUARTERROUND( x[2], x[7], x[ 8], x[13] );
+        QUARTERROUND( x[3], x[4], x[ 9], x[14] );
+    }
+
+    for( i = 0; i < 16; i++ )
+        PUT_ULONG_LE( x[i] + s[i], out, i * 4 );
+}
+
+#if defined(__SSE2__)
+
+#define VROTL(x,n) _mm_or_si128( _mm_slli_epi32( x, n ), _mm_srli_epi32( x, 32 - (n) ) )
+
+#define VQUARTERROUND(a,b,c,d)                                          \
+{                                                                       \
+    a = _mm_add_epi32( a, b ); d = _mm_xor_si128( d, a ); d = VROTL( d, 16 ); \
+    c = _mm_add_epi32( c, d ); b = _mm_xor_si128( b, c ); b = VROTL( b, 12 ); \
+    a = _mm_add_epi32( a, b ); d = _mm_xor_si128( d, a ); d = VROTL( d,  8 ); \
+    c = _mm_add_epi32( c, d ); b = _mm_xor_si128( b, c ); b = VROTL( b,  7 ); \
+}
+
+/*
+ * Four consecutive blocks, x[i] holding word i of each.  Words four at a
+ * time are transposed back into block order and xor'd with the input.
+ */
+static void chacha20_blocks4( uint32_t s[16], const unsigned char *input,
+                              unsigned char *output )
+{
+    int i, j;
+    __m128i x[16], t0, t1, t2, t3;
+    __m128i ctr = _mm_add_epi32( _mm_set1_epi32( (int) s[12] ),
+                                 _mm_set_epi32( 3, 2, 1, 0 ) );
+
+    for( i = 0; i < 16; i++ )
+        x[i] = ( i == 12 ) ? ctr : _mm_set1_epi32( (int) s[i] );
+
+    for( i = 0; i < 10; i++ )
+    {
+        VQUARTERROUND( x[0], x[4], x[ 8], x[12] );
+        VQUARTERROUND( x[1], x[5], x[ 9], x[13] );
+        VQUARTERROUND( x[2], x[6], x[10], x[14] );
+        VQUARTERROUND( x[3], x[7], x[11], x[15] );
+        VQUARTERROUND( x[0], x[5], x[10], x[15] );
+        VQUARTERROUND( x[1], x[6], x[11], x[12] );
+        VQUARTERROUND( x[2], x[7], x[ 8], x[13] );
+        VQUARTERROUND( x[3], x[4], x[ 9], x[14] );
+    }
+
+    for( i = 0; i < 16; i++ )
+        x[i] = _mm_add_epi32( x[i], ( i == 12 ) ? ctr : _mm_set1_epi32( (int) s[i] ) );
+
+    for( j = 0; j < 4; j++ )
+    {
+        const unsigned char *in = input + j * 16;
+        unsigned char *out = output + j * 16;
+
+        t0 = _mm_unpacklo_epi32( x[j * 4    ], x[j * 4 + 1] );
+        t1 = _mm_unpacklo_epi32( x[j * 4 + 2], x[j * 4 + 3] );
+        t2 = _mm_unpackhi_epi32( x[j * 4    ], x[j * 4 + 1] );
+        t3 = _mm_unpackhi_epi32( x[j * 4 + 2], x[j * 4 + 3] );
+
+#define XOR_STORE(o,v)                                                  \
+        _mm_storeu_si128( (__m128i *) ( out + (o) ), _mm_xor_si128( (v), \
+            _mm_loadu_si128( (const __m128i *) ( in + (o) ) ) ) )
+
+        XOR_STORE(   0, _mm_unpacklo_epi64( t0, t1 ) );
+        XOR_STORE(  64, _mm_unpackhi_epi64( t0, t1 ) );
+        XOR_STORE( 128, _mm_unpacklo_epi64( t2, t3 ) );
+        XOR_STORE( 192, _mm_unpackhi_epi64( t2, t3 ) );
+
+#undef XOR_STORE
+    }
+
+    s[12] += 4;
+}
+
+#endif /* __SSE2__ */
+
+void chacha20_crypt( chacha20_context *ctx,
+                     const unsigned char nonce[12],
+                     uint32_t counter,
+                     int length,
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    int i, n;
+    uint32_t s[16];
+    unsigned char stream[64];
+
+    chacha20_init_state( ctx, s, nonce, counter );
+
+#if defined(__SSE2__)
+    for( ; length >= 256; length -= 256, input += 256, output += 256 )
+        chacha20_blocks4( s, input, output );
+#endif
+
+    for( ; length > 0; length -= n, input += n, output += n )
+    {
+        n = ( length < 64 ) ? length : 64;
+
+        chacha20_block( s, stream );
+        s[12]++;
+
+        for( i = 0; i < n; i++ )
+            output[i] = input[i] ^ stream[i];
+    }
+
+    memset( s, 0, sizeof( s ) );
+    memset( stream, 0, sizeof( stream ) );
+}
+
+#if defined(POLARSSL_SELF_TEST)
+/*
+ * RFC 7539 test vector (section 2.4.2)
+ */
+static const unsigned char chacha20_test_nonce[12] =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A,
+    0x00, 0x00, 0x00, 0x00
+};
+
+static const char chacha20_test_pt[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.";
+
+static const unsigned char chacha20_test_ct[114] =
+{
+    0x6E, 0x2E, 0x35, 0x9A, 0x25, 0x68, 0xF9, 0x80,
+    0x41, 0xBA, 0x07, 0x28, 0xDD, 0x0D, 0x69, 0x81,
+    0xE9, 0x7E, 0x7A, 0xEC, 0x1D, 0x43, 0x60, 0xC2,
+    0x0A, 0x27, 0xAF, 0xCC, 0xFD, 0x9F, 0xAE, 0x0B,
+    0xF9, 0x1B, 0x65, 0xC5, 0x52, 0x47, 0x33, 0xAB,
+    0x8F, 0x59, 0x3D, 0xAB, 0xCD, 0x62, 0xB3, 0x57,
+    0x16, 0x39, 0xD6, 0x24, 0xE6, 0x51, 0x52, 0xAB,
+    0x8F, 0x53, 0x0C, 0x35, 0x9F, 0x08, 0x61, 0xD8,
+    0x07, 0xCA, 0x0D, 0xBF, 0x50, 0x0D, 0x6A, 0x61,
+    0x56, 0xA3, 0x8E, 0x08, 0x8A, 0x22, 0xB6, 0x5E,
+    0x52, 0xBC, 0x51, 0x4D, 0x16, 0xCC, 0xF8, 0x06,
+    0x81, 0x8C, 0xE9, 0x1A, 0xB7, 0x79, 0x37, 0x36,
+    0x5A, 0xF9, 0x0B, 0xBF, 0x74, 0xA3, 0x5B, 0xE6,
+    0xB4, 0x0B, 0x8E, 0xED, 0xF2, 0x78, 0x5E, 0x42,
+    0x87, 0x4D
+};
+
+/*
+ * Checkup routine
+ */
+int chacha20_self_test( int verbose )
+{
+    int i;
+    chacha20_context ctx;
+    unsigned char key[32];
+    unsigned char buf[512];
+    unsigned char ref[512];
+
+    if( verbose != 0 )
+        printf( "  ChaCha20 test #1: " );
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (unsigned char) i;
+
+    chacha20_setkey( &ctx, key );
+    chacha20_crypt( &ctx, chacha20_test_nonce, 1, 114,
+                    (const unsigned char *) chacha20_test_pt, buf );
+
+    if( memcmp( buf, chacha20_test_ct, 114 ) != 0 )
+    {
+        if( verbose != 0 )
+            printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        printf( "passed\n  ChaCha20 test #2: " );
+
+    /*
+     * The wide path has to produce the same stream as the block at a
+     * time one, which is what it falls back to for short buffers.
+     */
+    for( i = 0; i < 512; i++ )
+        buf[i] = (unsigned char) i;
+
+    chacha20_crypt( &ctx, chacha20_test_nonce, 7, 512, buf, ref );
+
+    for( i = 0; i < 512; i += 64 )
+        chacha20_crypt( &ctx, chacha20_test_nonce, 7 + i / 64, 64, buf + i, buf + i );
+
+    if( memcmp( buf, ref, 512 ) != 0 )
+    {
+        if( verbose != 0 )
+            printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        printf( "passed\n\n" );
+
+    return( 0 );
+}
+
+#endif
+
+#endif
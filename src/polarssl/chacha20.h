@@ -0,0 +1,77 @@
+/**
+ * \file chacha20.h
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_CHACHA20_H
+#define POLARSSL_CHACHA20_H
+
+#include <stdint.h>
+
+/**
+ * \brief          ChaCha20 context structure
+ */
+typedef struct
+{
+    uint32_t key[8];            /*!<  256-bit key as little endian words */
+}
+chacha20_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          ChaCha20 key setup
+ *
+ * \param ctx      ChaCha20 context to be initialized
+ * \param key      the 32-byte secret key
+ */
+void chacha20_setkey( chacha20_context *ctx, const unsigned char key[32] );
+
+/**
+ * \brief          ChaCha20 (RFC 7539) buffer encryption/decryption.
+ *                 output may be the same as input.
+ *
+ * \param ctx      ChaCha20 context
+ * \param nonce    12-byte nonce
+ * \param counter  block counter of the first 64 bytes
+ * \param length   length of the input data
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ */
+void chacha20_crypt( chacha20_context *ctx,
+                     const unsigned char nonce[12],
+                     uint32_t counter,
+                     int length,
+                     const unsigned char *input,
+                     unsigned char *output );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int chacha20_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* chacha20.h */
@@ -0,0 +1,241 @@
+/*
+ *  ChaCha20-Poly1305 AEAD construction
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  http://tools.ietf.org/html/rfc7539 (section 2.8)
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_CHACHAPOLY_C)
+
+#include "polarssl/chachapoly.h"
+#include "polarssl/poly1305.h"
+
+#include <string.h>
+#include <stdio.h>
+
+void chachapoly_setkey( chachapoly_context *ctx, const unsigned char key[32] )
+{
+    chacha20_setkey( &ctx->chacha, key );
+}
+
+/*
+ * Poly1305 keyed with the first half of block 0, over the additional data
+ * and ciphertext each padded to 16 bytes, then both lengths
+ */
+static void chachapoly_tag( chachapoly_context *ctx,
+                            const unsigned char nonce[12],
+                            const unsigned char *add, int add_len,
+                            const unsigned char *ct, int length,
+                            unsigned char tag[16] )
+{
+    int i;
+    poly1305_context poly;
+    unsigned char block[64];
+
+    memset( block, 0, 64 );
+    chacha20_crypt( &ctx->chacha, nonce, 0, 32, block, block );
+
+    poly1305_starts( &poly, block );
+    memset( block, 0, 64 );
+
+    poly1305_update( &poly, add, add_len );
+    poly1305_update( &poly, block, ( 16 - ( add_len & 15 ) ) & 15 );
+    poly1305_update( &poly, ct, length );
+    poly1305_update( &poly, block, ( 16 - ( length & 15 ) ) & 15 );
+
+    for( i = 0; i < 4; i++ )
+    {
+        block[i]     = (unsigned char)( add_len >> ( i * 8 ) );
+        block[8 + i] = (unsigned char)( length  >> ( i * 8 ) );
+    }
+
+    poly1305_update( &poly, block, 16 );
+    poly1305_finish( &poly, tag );
+}
+
+int chachapoly_crypt_and_tag( chachapoly_context *ctx,
+                              int mode,
+                              int length,
+                              const unsigned char nonce[12],
+                              const unsigned char *add,
+                              int add_len,
+                              const unsigned char *input,
+                              unsigned char *output,
+                              unsigned char tag[16] )
+{
+    if( length < 0 || add_len < 0 )
+        return( POLARSSL_ERR_CHACHAPOLY_BAD_INPUT );
+
+    if( mode == CHACHAPOLY_DECRYPT )
+        chachapoly_tag( ctx, nonce, add, add_len, input, length, tag );
+
+    chacha20_crypt( &ctx->chacha, nonce, 1, length, input, output );
+
+    if( mode == CHACHAPOLY_ENCRYPT )
+        chachapoly_tag( ctx, nonce, add, add_len, output, length, tag );
+
+    return( 0 );
+}
+
+int chachapoly_auth_decrypt( chachapoly_context *ctx,
+                             int length,
+                             const unsigned char nonce[12],
+                             const unsigned char *add,
+                             int add_len,
+                             const unsigned char tag[16],
+                             const unsigned char *input,
+                             unsigned char *output )
+{
+    int i, diff;
+    unsigned char check_tag[16];
+
+    if( length < 0 || add_len < 0 )
+        return( POLARSSL_ERR_CHACHAPOLY_BAD_INPUT );
+
+    chachapoly_tag( ctx, nonce, add, add_len, input, length, check_tag );
+
+    /* don't leak where the tags differ */
+    for( diff = 0, i = 0; i < 16; i++ )
+        diff |= tag[i] ^ check_tag[i];
+
+    if( diff != 0 )
+        return( POLARSSL_ERR_CHACHAPOLY_AUTH_FAILED );
+
+    chacha20_crypt( &ctx->chacha, nonce, 1, length, input, output );
+
+    return( 0 );
+}
+
+#if defined(POLARSSL_SELF_TEST)
+/*
+ * RFC 7539 test vector (section 2.8.2)
+ */
+static const unsigned char chachapoly_test_nonce[12] =
+{
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43,
+    0x44, 0x45, 0x46, 0x47
+};
+
+static const unsigned char chachapoly_test_add[12] =
+{
+    0x50, 0x51, 0x52, 0x53, 0xC0, 0xC1, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7
+};
+
+static const char chachapoly_test_pt[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only "
+    "one tip for the future, sunscreen would be it.";
+
+static const unsigned char chachapoly_test_ct[114] =
+{
+    0xD3, 0x1A, 0x8D, 0x34, 0x64, 0x8E, 0x60, 0xDB,
+    0x7B, 0x86, 0xAF, 0xBC, 0x53, 0xEF, 0x7E, 0xC2,
+    0xA4, 0xAD, 0xED, 0x51, 0x29, 0x6E, 0x08, 0xFE,
+    0xA9, 0xE2, 0xB5, 0xA7, 0x36, 0xEE, 0x62, 0xD6,
+    0x3D, 0xBE, 0xA4, 0x5E, 0x8C, 0xA9, 0x67, 0x12,
+    0x82, 0xFA, 0xFB, 0x69, 0xDA, 0x92, 0x72, 0x8B,
+    0x1A, 0x71, 0xDE, 0x0A, 0x9E, 0x06, 0x0B, 0x29,
+    0x05, 0xD6, 0xA5, 0xB6, 0x7E, 0xCD, 0x3B, 0x36,
+    0x92, 0xDD, 0xBD, 0x7F, 0x2D, 0x77, 0x8B, 0x8C,
+    0x98, 0x03, 0xAE, 0xE3, 0x28, 0x09, 0x1B, 0x58,
+    0xFA, 0xB3, 0x24, 0xE4, 0xFA, 0xD6, 0x75, 0x94,
+    0x55, 0x85, 0x80, 0x8B, 0x48, 0x31, 0xD7, 0xBC,
+    0x3F, 0xF4, 0xDE, 0xF0, 0x8E, 0x4B, 0x7A, 0x9D,
+    0xE5, 0x76, 0xD2, 0x65, 0x86, 0xCE, 0xC6, 0x4B,
+    0x61, 0x16
+};
+
+static const unsigned char chachapoly_test_tag[16] =
+{
+    0x1A, 0xE1, 0x0B, 0x59, 0x4F, 0x09, 0xE2, 0x6A,
+    0x7E, 0x90, 0x2E, 0xCB, 0xD0, 0x60, 0x06, 0x91
+};
+
+/*
+ * Checkup routine
+ */
+int chachapoly_self_test( int verbose )
+{
+    int i;
+    chachapoly_context ctx;
+    unsigned char key[32];
+    unsigned char buf[114];
+    unsigned char tag[16];
+
+    if( verbose != 0 )
+        printf( "  ChaCha20-Poly1305 (enc): " );
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (unsigned char)( 0x80 + i );
+
+    chachapoly_setkey( &ctx, key );
+    chachapoly_crypt_and_tag( &ctx, CHACHAPOLY_ENCRYPT, 114,
+                              chachapoly_test_nonce, chachapoly_test_add, 12,
+                              (const unsigned char *) chachapoly_test_pt,
+                              buf, tag );
+
+    if( memcmp( buf, chachapoly_test_ct, 114 ) != 0 ||
+        memcmp( tag, chachapoly_test_tag, 16 ) != 0 )
+    {
+        if( verbose != 0 )
+            printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        printf( "passed\n  ChaCha20-Poly1305 (dec): " );
+
+    if( chachapoly_auth_decrypt( &ctx, 114, chachapoly_test_nonce,
+                                 chachapoly_test_add, 12, chachapoly_test_tag,
+                                 buf, buf ) != 0 ||
+        memcmp( buf, chachapoly_test_pt, 114 ) != 0 )
+    {
+        if( verbose != 0 )
+            printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    memcpy( buf, chachapoly_test_ct, 114 );
+    buf[113] ^= 1;
+
+    if( chachapoly_auth_decrypt( &ctx, 114, chachapoly_test_nonce,
+                                 chachapoly_test_add, 12, chachapoly_test_tag,
+                                 buf, buf ) != POLARSSL_ERR_CHACHAPOLY_AUTH_FAILED )
+    {
+        if( verbose != 0 )
+            printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        printf( "passed\n\n" );
+
+    return( 0 );
+}
+
+#endif
+
+#endif
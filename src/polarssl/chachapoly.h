@@ -0,0 +1,116 @@
+/**
+ * \file chachapoly.h
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_CHACHAPOLY_H
+#define POLARSSL_CHACHAPOLY_H
+
+#include "polarssl/chacha20.h"
+
+#define CHACHAPOLY_ENCRYPT     1
+#define CHACHAPOLY_DECRYPT     0
+
+#define POLARSSL_ERR_CHACHAPOLY_AUTH_FAILED                 -0x0B20
+#define POLARSSL_ERR_CHACHAPOLY_BAD_INPUT                   -0x0B30
+
+/**
+ * \brief          ChaCha20-Poly1305 context structure
+ */
+typedef struct
+{
+    chacha20_context chacha;    /*!<  ChaCha20 context                */
+}
+chachapoly_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          ChaCha20-Poly1305 key setup
+ *
+ * \param ctx      context to be initialized
+ * \param key      the 32-byte secret key
+ */
+void chachapoly_setkey( chachapoly_context *ctx, const unsigned char key[32] );
+
+/**
+ * \brief          ChaCha20-Poly1305 (RFC 7539) encryption/decryption.
+ *                 output may be the same as input.
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param mode     CHACHAPOLY_ENCRYPT or CHACHAPOLY_DECRYPT
+ * \param length   length of the input data
+ * \param nonce    12-byte nonce
+ * \param add      additional data
+ * \param add_len  length of additional data
+ * \param input    buffer holding the input data
+ * \param output   buffer for holding the output data
+ * \param tag      buffer for holding the 16-byte tag (of the ciphertext)
+ *
+ * \return         0 if successful
+ */
+int chachapoly_crypt_and_tag( chachapoly_context *ctx,
+                              int mode,
+                              int length,
+                              const unsigned char nonce[12],
+                              const unsigned char *add,
+                              int add_len,
+                              const unsigned char *input,
+                              unsigned char *output,
+                              unsigned char tag[16] );
+
+/**
+ * \brief          ChaCha20-Poly1305 authenticated decryption.
+ *                 The tag is checked before anything is decrypted.
+ *
+ * \param ctx      ChaCha20-Poly1305 context
+ * \param length   length of the input data
+ * \param nonce    12-byte nonce
+ * \param add      additional data
+ * \param add_len  length of additional data
+ * \param tag      the 16-byte tag to check
+ * \param input    buffer holding the ciphertext
+ * \param output   buffer for holding the plaintext
+ *
+ * \return         0 if successful, POLARSSL_ERR_CHACHAPOLY_AUTH_FAILED if
+ *                 the tag doesn't match (output is left alone)
+ */
+int chachapoly_auth_decrypt( chachapoly_context *ctx,
+                             int length,
+                             const unsigned char nonce[12],
+                             const unsigned char *add,
+                             int add_len,
+                             const unsigned char tag[16],
+                             const unsigned char *input,
+                             unsigned char *output );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int chachapoly_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* chachapoly.h */
@@ -107,6 +107,16 @@
  */
 #define POLARSSL_AES_C
 
+/*
+ * Module:  library/aesni.c
+ * Caller:  library/aes.c
+ *          library/gcm.c
+ *
+ * This module adds support for the AES-NI and PCLMULQDQ instructions on
+ * x86-64, picked at runtime when the CPU has them.
+ */
+#define POLARSSL_AESNI_C
+
 /*
  * Module:  library/arc4.c
  * Caller:  library/ssl_tls.c
@@ -155,6 +165,25 @@
  */
 #define POLARSSL_CERTS_C
 
+/*
+ * Module:  library/chacha20.c
+ * Caller:  library/chachapoly.c
+ *
+ * This module enables the ChaCha20 stream cipher.
+ */
+#define POLARSSL_CHACHA20_C
+
+/*
+ * Module:  library/chachapoly.c
+ * Caller:  library/ssl_tls.c
+ *
+ * Requires: POLARSSL_CHACHA20_C, POLARSSL_POLY1305_C
+ *
+ * This module enables the following ciphersuites:
+ *      SSL_EDH_RSA_CHACHA20_POLY1305_SHA256
+ */
+#define POLARSSL_CHACHAPOLY_C
+
 /*
  * Module:  library/debug.c
  * Caller:  library/ssl_cli.c
@@ -187,6 +216,20 @@
  */
 #define POLARSSL_DHM_C
 
+/*
+ * Module:  library/gcm.c
+ * Caller:  library/ssl_tls.c
+ *
+ * Requires: POLARSSL_AES_C
+ *
+ * This module enables the following ciphersuites:
+ *      SSL_RSA_AES_128_GCM_SHA256
+ *      SSL_RSA_AES_256_GCM_SHA384
+ *      SSL_EDH_RSA_AES_128_GCM_SHA256
+ *      SSL_EDH_RSA_AES_256_GCM_SHA384
+ */
+#define POLARSSL_GCM_C
+
 /*
  * Module:  library/havege.c
  * Caller:
@@ -238,6 +281,14 @@
  */
 #define POLARSSL_PADLOCK_C
 
+/*
+ * Module:  library/poly1305.c
+ * Caller:  library/chachapoly.c
+ *
+ * This module enables the Poly1305 one-time authenticator.
+ */
+#define POLARSSL_POLY1305_C
+
 /*
  * Module:  library/rsa.c
  * Caller:  library/ssl_cli.c
@@ -0,0 +1,504 @@
+/*
+ *  NIST SP800-38D compliant GCM implementation
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  http://csrc.nist.gov/publications/nistpubs/800-38D/SP-800-38D.pdf
+ *
+ *  The software GHASH uses 4-bit tables as described in the original GCM
+ *  paper (Shoup's method).  When the CPU has AES-NI and PCLMULQDQ both the
+ *  counter mode and GHASH are handed to aesni.c.
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_GCM_C)
+
+#include "polarssl/gcm.h"
+#include "polarssl/aesni.h"
+
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * 32-bit integer manipulation macros (big endian)
+ */
+#ifndef GET_ULONG_BE
+#define GET_ULONG_BE(n,b,i)                             \
+{                                                       \
+    (n) = ( (unsigned long) (b)[(i)    ] << 24 )        \
+        | ( (unsigned long) (b)[(i) + 1] << 16 )        \
+        | ( (unsigned long) (b)[(i) + 2] <<  8 )        \
+        | ( (unsigned long) (b)[(i) + 3]       );       \
+}
+#endif
+
+#ifndef PUT_ULONG_BE
+#define PUT_ULONG_BE(n,b,i)                             \
+{                                                       \
+    (b)[(i)    ] = (unsigned char) ( (n) >> 24 );       \
+    (b)[(i) + 1] = (unsigned char) ( (n) >> 16 );       \
+    (b)[(i) + 2] = (unsigned char) ( (n) >>  8 );       \
+    (b)[(i) + 3] = (unsigned char) ( (n)       );       \
+}
+#endif
+
+/*
+ * Precompute the multiples of H for the 4-bit table GHASH:
+ * HL/HH[i] = i * H, with i's bits in GCM's reflected order.
+ */
+static void gcm_gen_table( gcm_context *ctx, const unsigned char h[16] )
+{
+    int i, j;
+    unsigned long hi, lo;
+    uint64_t vh, vl;
+
+    GET_ULONG_BE( hi, h,  0 );
+    GET_ULONG_BE( lo, h,  4 );
+    vh = (uint64_t) hi << 32 | lo;
+
+    GET_ULONG_BE( hi, h,  8 );
+    GET_ULONG_BE( lo, h, 12 );
+    vl = (uint64_t) hi << 32 | lo;
+
+    ctx->HL[8] = vl;
+    ctx->HH[8] = vh;
+    ctx->HL[0] = 0;
+    ctx->HH[0] = 0;
+
+    for( i = 4; i > 0; i >>= 1 )
+    {
+        uint32_t T = (uint32_t)( vl & 1 ) * 0xe1000000U;
+        vl  = ( vh << 63 ) | ( vl >> 1 );
+        vh  = ( vh >> 1 ) ^ ( (uint64_t) T << 32 );
+
+        ctx->HL[i] = vl;
+        ctx->HH[i] = vh;
+    }
+
+    for( i = 2; i < 16; i <<= 1 )
+    {
+        uint64_t *HiL = ctx->HL + i, *HiH = ctx->HH + i;
+        vh = *HiH;
+        vl = *HiL;
+
+        for( j = 1; j < i; j++ )
+        {
+            HiH[j] = vh ^ ctx->HH[j];
+            HiL[j] = vl ^ ctx->HL[j];
+        }
+    }
+}
+
+int gcm_setkey( gcm_context *ctx, const unsigned char *key, int keysize )
+{
+    int ret;
+    unsigned char h[16];
+
+    memset( ctx, 0, sizeof( gcm_context ) );
+
+    if( ( ret = aes_setkey_enc( &ctx->aes, key, keysize ) ) != 0 )
+        return( ret );
+
+    memset( h, 0, 16 );
+    aes_crypt_ecb( &ctx->aes, AES_ENCRYPT, h, h );
+
+    gcm_gen_table( ctx, h );
+
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( aesni_supports( AESNI_AES | AESNI_CLMUL | AESNI_SSSE3 ) )
+    {
+        aesni_gcm_powers( h, ctx->H );
+        ctx->clmul = 1;
+    }
+#endif
+
+    return( 0 );
+}
+
+/*
+ * Reduction of the 4 bits shifted out at each step of gcm_mult()
+ */
+static const uint64_t last4[16] =
+{
+    0x0000, 0x1c20, 0x3840, 0x2460,
+    0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560,
+    0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/*
+ * x = x * H in GF(2^128), a nibble at a time
+ */
+static void gcm_mult( gcm_context *ctx, unsigned char x[16] )
+{
+    int i;
+    unsigned char lo, hi, rem;
+    uint64_t zh, zl;
+
+    lo = x[15] & 0x0f;
+
+    zh = ctx->HH[lo];
+    zl = ctx->HL[lo];
+
+    for( i = 15; i >= 0; i-- )
+    {
+        lo = x[i] & 0x0f;
+        hi = x[i] >> 4;
+
+        if( i != 15 )
+        {
+            rem = (unsigned char) zl & 0x0f;
+            zl = ( zh << 60 ) | ( zl >> 4 );
+            zh = ( zh >> 4 );
+            zh ^= (uint64_t) last4[rem] << 48;
+            zh ^= ctx->HH[lo];
+            zl ^= ctx->HL[lo];
+        }
+
+        rem = (unsigned char) zl & 0x0f;
+        zl = ( zh << 60 ) | ( zl >> 4 );
+        zh = ( zh >> 4 );
+        zh ^= (uint64_t) last4[rem] << 48;
+        zh ^= ctx->HH[hi];
+        zl ^= ctx->HL[hi];
+    }
+
+    PUT_ULONG_BE( zh >> 32, x,  0 );
+    PUT_ULONG_BE( zh,       x,  4 );
+    PUT_ULONG_BE( zl >> 32, x,  8 );
+    PUT_ULONG_BE( zl,       x, 12 );
+}
+
+/*
+ * Fold a buffer into the GHASH state, the last partial block zero padded
+ */
+static void gcm_ghash( gcm_context *ctx, unsigned char x[16],
+                       const unsigned char *input, int length )
+{
+    int i, n;
+
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( ctx->clmul )
+    {
+        n = length & ~15;
+        aesni_gcm_ghash( ctx->H, x, input, n );
+        input  += n;
+        length -= n;
+    }
+#endif
+
+    for( ; length > 0; length -= n, input += n )
+    {
+        n = ( length < 16 ) ? length : 16;
+
+        for( i = 0; i < n; i++ )
+            x[i] ^= input[i];
+
+        gcm_mult( ctx, x );
+    }
+}
+
+/*
+ * GCTR from the counter block y, which is incremented for each block
+ */
+static void gcm_ctr( gcm_context *ctx, unsigned char y[16], int length,
+                     const unsigned char *input, unsigned char *output )
+{
+    int i, n;
+    unsigned char ectr[16];
+
+#if defined(POLARSSL_AESNI_C) && defined(POLARSSL_HAVE_X86_64)
+    if( ctx->clmul )
+    {
+        n = length >> 4;
+        aesni_crypt_ctr32( &ctx->aes, n, y, input, output );
+        input  += n << 4;
+        output += n << 4;
+        length -= n << 4;
+    }
+#endif
+
+    for( ; length > 0; length -= n, input += n, output += n )
+    {
+        n = ( length < 16 ) ? length : 16;
+
+        aes_crypt_ecb( &ctx->aes, AES_ENCRYPT, y, ectr );
+
+        for( i = 16; i > 12; i-- )
+            if( ++y[i - 1] != 0 )
+                break;
+
+        for( i = 0; i < n; i++ )
+            output[i] = input[i] ^ ectr[i];
+    }
+}
+
+/*
+ * GHASH over the additional data and ciphertext, finished off with their
+ * bit lengths and encrypted with the pre-counter block
+ */
+static void gcm_tag( gcm_context *ctx, const unsigned char iv[12],
+                     const unsigned char *add, int add_len,
+                     const unsigned char *ct, int length,
+                     unsigned char tag[16] )
+{
+    int i;
+    unsigned char x[16];
+    unsigned char lens[16];
+    unsigned char y[16];
+
+    memset( x, 0, 16 );
+    gcm_ghash( ctx, x, add, add_len );
+    gcm_ghash( ctx, x, ct, length );
+
+    memset( lens, 0, 16 );
+    PUT_ULONG_BE( (unsigned long) add_len >> 29, lens,  0 );
+    PUT_ULONG_BE( (unsigned long) add_len <<  3, lens,  4 );
+    PUT_ULONG_BE( (unsigned long) length  >> 29, lens,  8 );
+    PUT_ULONG_BE( (unsigned long) length  <<  3, lens, 12 );
+    gcm_ghash( ctx, x, lens, 16 );
+
+    memcpy( y, iv, 12 );
+    y[12] = y[13] = y[14] = 0;
+    y[15] = 1;
+    aes_crypt_ecb( &ctx->aes, AES_ENCRYPT, y, tag );
+
+    for( i = 0; i < 16; i++ )
+        tag[i] ^= x[i];
+}
+
+int gcm_crypt_and_tag( gcm_context *ctx,
+                       int mode,
+                       int length,
+                       const unsigned char iv[12],
+                       const unsigned char *add,
+                       int add_len,
+                       const unsigned char *input,
+                       unsigned char *output,
+                       unsigned char tag[16] )
+{
+    unsigned char y[16];
+
+    if( length < 0 || add_len < 0 )
+        return( POLARSSL_ERR_GCM_BAD_INPUT );
+
+    if( mode == GCM_DECRYPT )
+        gcm_tag( ctx, iv, add, add_len, input, length, tag );
+
+    memcpy( y, iv, 12 );
+    y[12] = y[13] = y[14] = 0;
+    y[15] = 2;
+    gcm_ctr( ctx, y, length, input, output );
+
+    if( mode == GCM_ENCRYPT )
+        gcm_tag( ctx, iv, add, add_len, output, length, tag );
+
+    return( 0 );
+}
+
+int gcm_auth_decrypt( gcm_context *ctx,
+                      int length,
+                      const unsigned char iv[12],
+                      const unsigned char *add,
+                      int add_len,
+                      const unsigned char tag[16],
+                      const unsigned char *input,
+                      unsigned char *output )
+{
+    int i, diff;
+    unsigned char check_tag[16];
+    unsigned char y[16];
+
+    if( length < 0 || add_len < 0 )
+        return( POLARSSL_ERR_GCM_BAD_INPUT );
+
+    gcm_tag( ctx, iv, add, add_len, input, length, check_tag );
+
+    /* don't leak where the tags differ */
+    for( diff = 0, i = 0; i < 16; i++ )
+        diff |= tag[i] ^ check_tag[i];
+
+    if( diff != 0 )
+        return( POLARSSL_ERR_GCM_AUTH_FAILED );
+
+    memcpy( y, iv, 12 );
+    y[12] = y[13] = y[14] = 0;
+    y[15] = 2;
+    gcm_ctr( ctx, y, length, input, output );
+
+    return( 0 );
+}
+
+#if defined(POLARSSL_SELF_TEST)
+/*
+ * GCM test vectors from the GCM spec (test cases 2, 4 and 16)
+ */
+static const unsigned char gcm_test_key[2][32] =
+{
+    { 0 },
+    { 0xFE, 0xFF, 0xE9, 0x92, 0x86, 0x65, 0x73, 0x1C,
+      0x6D, 0x6A, 0x8F, 0x94, 0x67, 0x30, 0x83, 0x08,
+      0xFE, 0xFF, 0xE9, 0x92, 0x86, 0x65, 0x73, 0x1C,
+      0x6D, 0x6A, 0x8F, 0x94, 0x67, 0x30, 0x83, 0x08 }
+};
+
+static const unsigned char gcm_test_iv[12] =
+{
+    0xCA, 0xFE, 0xBA, 0xBE, 0xFA, 0xCE, 0xDB, 0xAD,
+    0xDE, 0xCA, 0xF8, 0x88
+};
+
+static const unsigned char gcm_test_pt[60] =
+{
+    0xD9, 0x31, 0x32, 0x25, 0xF8, 0x84, 0x06, 0xE5,
+    0xA5, 0x59, 0x09, 0xC5, 0xAF, 0xF5, 0x26, 0x9A,
+    0x86, 0xA7, 0xA9, 0x53, 0x15, 0x34, 0xF7, 0xDA,
+    0x2E, 0x4C, 0x30, 0x3D, 0x8A, 0x31, 0x8A, 0x72,
+    0x1C, 0x3C, 0x0C, 0x95, 0x95, 0x68, 0x09, 0x53,
+    0x2F, 0xCF, 0x0E, 0x24, 0x49, 0xA6, 0xB5, 0x25,
+    0xB1, 0x6A, 0xED, 0xF5, 0xAA, 0x0D, 0xE6, 0x57,
+    0xBA, 0x63, 0x7B, 0x39
+};
+
+static const unsigned char gcm_test_add[20] =
+{
+    0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF,
+    0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF,
+    0xAB, 0xAD, 0xDA, 0xD2
+};
+
+static const int gcm_test_keysize[3] = { 128, 128, 256 };
+static const int gcm_test_len[3] = { 16, 60, 60 };
+static const int gcm_test_add_len[3] = { 0, 20, 20 };
+
+static const unsigned char gcm_test_ct[3][60] =
+{
+    { 0x03, 0x88, 0xDA, 0xCE, 0x60, 0xB6, 0xA3, 0x92,
+      0xF3, 0x28, 0xC2, 0xB9, 0x71, 0xB2, 0xFE, 0x78 },
+    { 0x42, 0x83, 0x1E, 0xC2, 0x21, 0x77, 0x74, 0x24,
+      0x4B, 0x72, 0x21, 0xB7, 0x84, 0xD0, 0xD4, 0x9C,
+      0xE3, 0xAA, 0x21, 0x2F, 0x2C, 0x02, 0xA4, 0xE0,
+      0x35, 0xC1, 0x7E, 0x23, 0x29, 0xAC, 0xA1, 0x2E,
+      0x21, 0xD5, 0x14, 0xB2, 0x54, 0x66, 0x93, 0x1C,
+      0x7D, 0x8F, 0x6A, 0x5A, 0xAC, 0x84, 0xAA, 0x05,
+      0x1B, 0xA3, 0x0B, 0x39, 0x6A, 0x0A, 0xAC, 0x97,
+      0x3D, 0x58, 0xE0, 0x91 },
+    { 0x52, 0x2D, 0xC1, 0xF0, 0x99, 0x56, 0x7D, 0x07,
+      0xF4, 0x7F, 0x37, 0xA3, 0x2A, 0x84, 0x42, 0x7D,
+      0x64, 0x3A, 0x8C, 0xDC, 0xBF, 0xE5, 0xC0, 0xC9,
+      0x75, 0x98, 0xA2, 0xBD, 0x25, 0x55, 0xD1, 0xAA,
+      0x8C, 0xB0, 0x8E, 0x48, 0x59, 0x0D, 0xBB, 0x3D,
+      0xA7, 0xB0, 0x8B, 0x10, 0x56, 0x82, 0x88, 0x38,
+      0xC5, 0xF6, 0x1E, 0x63, 0x93, 0xBA, 0x7A, 0x0A,
+      0xBC, 0xC9, 0xF6, 0x62 }
+};
+
+static const unsigned char gcm_test_tag[3][16] =
+{
+    { 0xAB, 0x6E, 0x47, 0xD4, 0x2C, 0xEC, 0x13, 0xBD,
+      0xF5, 0x3A, 0x67, 0xB2, 0x12, 0x57, 0xBD, 0xDF },
+    { 0x5B, 0xC9, 0x4F, 0xBC, 0x32, 0x21, 0xA5, 0xDB,
+      0x94, 0xFA, 0xE9, 0x5A, 0xE7, 0x12, 0x1A, 0x47 },
+    { 0x76, 0xFC, 0x6E, 0xCE, 0x0F, 0x4E, 0x17, 0x68,
+      0xCD, 0xDF, 0x88, 0x53, 0xBB, 0x2D, 0x55, 0x1B }
+};
+
+/*
+ * Checkup routine
+ */
+int gcm_self_test( int verbose )
+{
+    int i;
+    gcm_context ctx;
+    unsigned char buf[72];
+    unsigned char tag[16];
+    unsigned char zero_iv[12];
+    const unsigned char *iv;
+    const unsigned char *pt;
+
+    memset( zero_iv, 0, 12 );
+
+    for( i = 0; i < 3; i++ )
+    {
+        if( verbose != 0 )
+            printf( "  AES-GCM-%3d #%d (enc): ", gcm_test_keysize[i], i );
+
+        iv = ( i == 0 ) ? zero_iv : gcm_test_iv;
+        pt = ( i == 0 ) ? gcm_test_key[0] : gcm_test_pt;
+
+        gcm_setkey( &ctx, gcm_test_key[i > 0], gcm_test_keysize[i] );
+        gcm_crypt_and_tag( &ctx, GCM_ENCRYPT, gcm_test_len[i], iv,
+                           gcm_test_add, gcm_test_add_len[i],
+                           pt, buf, tag );
+
+        if( memcmp( buf, gcm_test_ct[i], gcm_test_len[i] ) != 0 ||
+            memcmp( tag, gcm_test_tag[i], 16 ) != 0 )
+        {
+            if( verbose != 0 )
+                printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        if( verbose != 0 )
+            printf( "passed\n  AES-GCM-%3d #%d (dec): ", gcm_test_keysize[i], i );
+
+        /* decrypt in place from 8 bytes further in, the way TLS does */
+        memcpy( buf + 8, gcm_test_ct[i], gcm_test_len[i] );
+
+        if( gcm_auth_decrypt( &ctx, gcm_test_len[i], iv,
+                              gcm_test_add, gcm_test_add_len[i],
+                              gcm_test_tag[i], buf + 8, buf ) != 0 ||
+            memcmp( buf, pt, gcm_test_len[i] ) != 0 )
+        {
+            if( verbose != 0 )
+                printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        memcpy( buf + 8, gcm_test_ct[i], gcm_test_len[i] );
+        buf[8 + gcm_test_len[i] - 1] ^= 1;
+
+        if( gcm_auth_decrypt( &ctx, gcm_test_len[i], iv,
+                              gcm_test_add, gcm_test_add_len[i],
+                              gcm_test_tag[i], buf + 8, buf ) !=
+            POLARSSL_ERR_GCM_AUTH_FAILED )
+        {
+            if( verbose != 0 )
+                printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        if( verbose != 0 )
+            printf( "passed\n" );
+    }
+
+    if( verbose != 0 )
+        printf( "\n" );
+
+    return( 0 );
+}
+
+#endif
+
+#endif
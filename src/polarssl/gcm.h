@@ -0,0 +1,126 @@
+/**
+ * \file gcm.h
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_GCM_H
+#define POLARSSL_GCM_H
+
+#include <stdint.h>
+
+#include "polarssl/aes.h"
+
+#define GCM_ENCRYPT     1
+#define GCM_DECRYPT     0
+
+#define POLARSSL_ERR_GCM_AUTH_FAILED                        -0x0B00
+#define POLARSSL_ERR_GCM_BAD_INPUT                          -0x0B10
+
+/**
+ * \brief          GCM context structure
+ */
+typedef struct
+{
+    aes_context aes;            /*!<  AES context (encryption keys)   */
+    uint64_t HL[16];            /*!<  GHASH table, low halves         */
+    uint64_t HH[16];            /*!<  GHASH table, high halves        */
+    unsigned char H[64];        /*!<  H^1..H^4 for PCLMULQDQ          */
+    int clmul;                  /*!<  use the PCLMULQDQ GHASH         */
+}
+gcm_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          GCM key schedule
+ *
+ * \param ctx      GCM context to be initialized
+ * \param key      encryption key
+ * \param keysize  must be 128, 192 or 256
+ *
+ * \return         0 if successful, or POLARSSL_ERR_AES_INVALID_KEY_LENGTH
+ */
+int gcm_setkey( gcm_context *ctx, const unsigned char *key, int keysize );
+
+/**
+ * \brief          GCM buffer encryption/decryption with a 96-bit IV.
+ *                 output may be the same as input, or start before it
+ *                 (decrypting an explicit nonce record in place).
+ *
+ * \param ctx      GCM context
+ * \param mode     GCM_ENCRYPT or GCM_DECRYPT
+ * \param length   length of the input data
+ * \param iv       12-byte initialization vector
+ * \param add      additional data
+ * \param add_len  length of additional data
+ * \param input    buffer holding the input data
+ * \param output   buffer for holding the output data
+ * \param tag      buffer for holding the 16-byte tag (of the ciphertext)
+ *
+ * \return         0 if successful
+ */
+int gcm_crypt_and_tag( gcm_context *ctx,
+                       int mode,
+                       int length,
+                       const unsigned char iv[12],
+                       const unsigned char *add,
+                       int add_len,
+                       const unsigned char *input,
+                       unsigned char *output,
+                       unsigned char tag[16] );
+
+/**
+ * \brief          GCM buffer authenticated decryption with a 96-bit IV.
+ *                 The tag is checked before anything is decrypted.
+ *
+ * \param ctx      GCM context
+ * \param length   length of the input data
+ * \param iv       12-byte initialization vector
+ * \param add      additional data
+ * \param add_len  length of additional data
+ * \param tag      the 16-byte tag to check
+ * \param input    buffer holding the ciphertext
+ * \param output   buffer for holding the plaintext
+ *
+ * \return         0 if successful, POLARSSL_ERR_GCM_AUTH_FAILED if the
+ *                 tag doesn't match (output is left alone)
+ */
+int gcm_auth_decrypt( gcm_context *ctx,
+                      int length,
+                      const unsigned char iv[12],
+                      const unsigned char *add,
+                      int add_len,
+                      const unsigned char tag[16],
+                      const unsigned char *input,
+                      unsigned char *output );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int gcm_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* gcm.h */
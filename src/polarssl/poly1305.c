@@ -0,0 +1,299 @@
+/*
+ *  Poly1305 one-time authenticator
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ *  http://cr.yp.to/mac/poly1305-20050329.pdf
+ *  http://tools.ietf.org/html/rfc7539
+ *
+ *  The accumulator and key are kept in five 26-bit limbs so every product
+ *  fits in 64 bits without needing a 128-bit type.
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_POLY1305_C)
+
+#include "polarssl/poly1305.h"
+
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * 32-bit integer manipulation macros (little endian)
+ */
+#ifndef GET_ULONG_LE
+#define GET_ULONG_LE(n,b,i)                             \
+{                                                       \
+    (n) = ( (unsigned long) (b)[(i)    ]       )        \
+        | ( (unsigned long) (b)[(i) + 1] <<  8 )        \
+        | ( (unsigned long) (b)[(i) + 2] << 16 )        \
+        | ( (unsigned long) (b)[(i) + 3] << 24 );       \
+}
+#endif
+
+#ifndef PUT_ULONG_LE
+#define PUT_ULONG_LE(n,b,i)                             \
+{                                                       \
+    (b)[(i)    ] = (unsigned char) ( (n)       );       \
+    (b)[(i) + 1] = (unsigned char) ( (n) >>  8 );       \
+    (b)[(i) + 2] = (unsigned char) ( (n) >> 16 );       \
+    (b)[(i) + 3] = (unsigned char) ( (n) >> 24 );       \
+}
+#endif
+
+static uint32_t poly1305_get( const unsigned char *b, int i )
+{
+    unsigned long n;
+
+    GET_ULONG_LE( n, b, i );
+
+    return( (uint32_t) n );
+}
+
+void poly1305_starts( poly1305_context *ctx, const unsigned char key[32] )
+{
+    /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+    ctx->r[0] = ( poly1305_get( key,  0 )      ) & 0x3ffffff;
+    ctx->r[1] = ( poly1305_get( key,  3 ) >> 2 ) & 0x3ffff03;
+    ctx->r[2] = ( poly1305_get( key,  6 ) >> 4 ) & 0x3ffc0ff;
+    ctx->r[3] = ( poly1305_get( key,  9 ) >> 6 ) & 0x3f03fff;
+    ctx->r[4] = ( poly1305_get( key, 12 ) >> 8 ) & 0x00fffff;
+
+    memset( ctx->h, 0, sizeof( ctx->h ) );
+
+    ctx->pad[0] = poly1305_get( key, 16 );
+    ctx->pad[1] = poly1305_get( key, 20 );
+    ctx->pad[2] = poly1305_get( key, 24 );
+    ctx->pad[3] = poly1305_get( key, 28 );
+
+    ctx->left = 0;
+}
+
+/*
+ * h = (h + m) * r mod 2^130 - 5 for each whole block, hibit being the
+ * 2^128 bit that's set on all but a padded final block
+ */
+static void poly1305_blocks( poly1305_context *ctx, const unsigned char *m,
+                             int length, uint32_t hibit )
+{
+    uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    uint32_t r3 = ctx->r[3], r4 = ctx->r[4];
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    uint32_t h3 = ctx->h[3], h4 = ctx->h[4];
+    uint64_t d0, d1, d2, d3, d4;
+    uint32_t c;
+
+    for( ; length >= 16; length -= 16, m += 16 )
+    {
+        h0 += ( poly1305_get( m,  0 )      ) & 0x3ffffff;
+        h1 += ( poly1305_get( m,  3 ) >> 2 ) & 0x3ffffff;
+        h2 += ( poly1305_get( m,  6 ) >> 4 ) & 0x3ffffff;
+        h3 += ( poly1305_get( m,  9 ) >> 6 ) & 0x3ffffff;
+        h4 += ( poly1305_get( m, 12 ) >> 8 ) | hibit;
+
+        d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 +
+             (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 +
+             (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 +
+             (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 +
+             (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 +
+             (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        c = (uint32_t)( d0 >> 26 ); h0 = (uint32_t) d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)( d1 >> 26 ); h1 = (uint32_t) d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)( d2 >> 26 ); h2 = (uint32_t) d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)( d3 >> 26 ); h3 = (uint32_t) d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)( d4 >> 26 ); h4 = (uint32_t) d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+    ctx->h[3] = h3;
+    ctx->h[4] = h4;
+}
+
+void poly1305_update( poly1305_context *ctx, const unsigned char *input, int ilen )
+{
+    int n;
+
+    if( ctx->left > 0 )
+    {
+        n = 16 - ctx->left;
+        if( n > ilen )
+            n = ilen;
+
+        memcpy( ctx->buffer + ctx->left, input, n );
+        ctx->left += n;
+        input += n;
+        ilen  -= n;
+
+        if( ctx->left < 16 )
+            return;
+
+        poly1305_blocks( ctx, ctx->buffer, 16, 1 << 24 );
+        ctx->left = 0;
+    }
+
+    n = ilen & ~15;
+    poly1305_blocks( ctx, input, n, 1 << 24 );
+
+    if( ilen > n )
+    {
+        memcpy( ctx->buffer, input + n, ilen - n );
+        ctx->left = ilen - n;
+    }
+}
+
+void poly1305_finish( poly1305_context *ctx, unsigned char output[16] )
+{
+    uint32_t h0, h1, h2, h3, h4, c;
+    uint32_t g0, g1, g2, g3, g4, mask;
+    uint64_t f;
+
+    if( ctx->left > 0 )
+    {
+        ctx->buffer[ctx->left] = 1;
+        memset( ctx->buffer + ctx->left + 1, 0, 15 - ctx->left );
+        poly1305_blocks( ctx, ctx->buffer, 16, 0 );
+    }
+
+    h0 = ctx->h[0]; h1 = ctx->h[1]; h2 = ctx->h[2];
+    h3 = ctx->h[3]; h4 = ctx->h[4];
+
+    /* fully carry h */
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    /* g = h + -p, use it if h >= p, without branching */
+    g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    g4 = h4 + c - ( 1 << 26 );
+
+    mask = ( g4 >> 31 ) - 1;
+    g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+    mask = ~mask;
+    h0 = ( h0 & mask ) | g0;
+    h1 = ( h1 & mask ) | g1;
+    h2 = ( h2 & mask ) | g2;
+    h3 = ( h3 & mask ) | g3;
+    h4 = ( h4 & mask ) | g4;
+
+    /* h = h % 2^128, then + s */
+    h0 = ( ( h0       ) | ( h1 << 26 ) );
+    h1 = ( ( h1 >>  6 ) | ( h2 << 20 ) );
+    h2 = ( ( h2 >> 12 ) | ( h3 << 14 ) );
+    h3 = ( ( h3 >> 18 ) | ( h4 <<  8 ) );
+
+    f = (uint64_t) h0 + ctx->pad[0];             h0 = (uint32_t) f;
+    f = (uint64_t) h1 + ctx->pad[1] + ( f >> 32 ); h1 = (uint32_t) f;
+    f = (uint64_t) h2 + ctx->pad[2] + ( f >> 32 ); h2 = (uint32_t) f;
+    f = (uint64_t) h3 + ctx->pad[3] + ( f >> 32 ); h3 = (uint32_t) f;
+
+    PUT_ULONG_LE( h0, output,  0 );
+    PUT_ULONG_LE( h1, output,  4 );
+    PUT_ULONG_LE( h2, output,  8 );
+    PUT_ULONG_LE( h3, output, 12 );
+
+    memset( ctx, 0, sizeof( poly1305_context ) );
+}
+
+#if defined(POLARSSL_SELF_TEST)
+/*
+ * RFC 7539 test vector (section 2.5.2)
+ */
+static const unsigned char poly1305_test_key[32] =
+{
+    0x85, 0xD6, 0xBE, 0x78, 0x57, 0x55, 0x6D, 0x33,
+    0x7F, 0x44, 0x52, 0xFE, 0x42, 0xD5, 0x06, 0xA8,
+    0x01, 0x03, 0x80, 0x8A, 0xFB, 0x0D, 0xB2, 0xFD,
+    0x4A, 0xBF, 0xF6, 0xAF, 0x41, 0x49, 0xF5, 0x1B
+};
+
+static const char poly1305_test_msg[] = "Cryptographic Forum Research Group";
+
+static const unsigned char poly1305_test_tag[16] =
+{
+    0xA8, 0x06, 0x1D, 0xC1, 0x30, 0x51, 0x36, 0xC6,
+    0xC2, 0x2B, 0x8B, 0xAF, 0x0C, 0x01, 0x27, 0xA9
+};
+
+/*
+ * Checkup routine
+ */
+int poly1305_self_test( int verbose )
+{
+    int i;
+    poly1305_context ctx;
+    unsigned char mac[16];
+
+    for( i = 0; i < 2; i++ )
+    {
+        if( verbose != 0 )
+            printf( "  Poly1305 test #%d: ", i + 1 );
+
+        poly1305_starts( &ctx, poly1305_test_key );
+
+        if( i == 0 )
+            poly1305_update( &ctx, (const unsigned char *) poly1305_test_msg, 34 );
+        else
+        {
+            /* same message fed through the partial block buffer */
+            poly1305_update( &ctx, (const unsigned char *) poly1305_test_msg, 5 );
+            poly1305_update( &ctx, (const unsigned char *) poly1305_test_msg + 5, 20 );
+            poly1305_update( &ctx, (const unsigned char *) poly1305_test_msg + 25, 9 );
+        }
+
+        poly1305_finish( &ctx, mac );
+
+        if( memcmp( mac, poly1305_test_tag, 16 ) != 0 )
+        {
+            if( verbose != 0 )
+                printf( "failed\n" );
+
+            return( 1 );
+        }
+
+        if( verbose != 0 )
+            printf( "passed\n" );
+    }
+
+    if( verbose != 0 )
+        printf( "\n" );
+
+    return( 0 );
+}
+
+#endif
+
+#endif
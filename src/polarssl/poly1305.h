@@ -0,0 +1,80 @@
+/**
+ * \file poly1305.h
+ *
+ *  This file is part of PolarSSL (http://www.polarssl.org)
+ *
+ *  All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef POLARSSL_POLY1305_H
+#define POLARSSL_POLY1305_H
+
+#include <stdint.h>
+
+/**
+ * \brief          Poly1305 context structure
+ */
+typedef struct
+{
+    uint32_t r[5];              /*!<  clamped key, 26-bit limbs       */
+    uint32_t h[5];              /*!<  accumulator, 26-bit limbs       */
+    uint32_t pad[4];            /*!<  s, added at the end             */
+    int left;                   /*!<  bytes waiting in buffer         */
+    unsigned char buffer[16];   /*!<  partial block being processed   */
+}
+poly1305_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Poly1305 context setup
+ *
+ * \param ctx      context to be initialized
+ * \param key      the 32-byte one-time key (r || s)
+ */
+void poly1305_starts( poly1305_context *ctx, const unsigned char key[32] );
+
+/**
+ * \brief          Poly1305 process buffer
+ *
+ * \param ctx      Poly1305 context
+ * \param input    buffer holding the data
+ * \param ilen     length of the input data
+ */
+void poly1305_update( poly1305_context *ctx, const unsigned char *input, int ilen );
+
+/**
+ * \brief          Poly1305 final tag
+ *
+ * \param ctx      Poly1305 context
+ * \param output   16-byte tag
+ */
+void poly1305_finish( poly1305_context *ctx, unsigned char output[16] );
+
+/**
+ * \brief          Checkup routine
+ *
+ * \return         0 if successful, or 1 if the test failed
+ */
+int poly1305_self_test( int verbose );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* poly1305.h */
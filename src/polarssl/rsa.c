@@ -232,17 +232,76 @@ cleanup:
     return( 0 );
 }
 
+#if defined(POLARSSL_GENPRIME)
+/*
+ * Pick a random unit Vf < N and set Vi = Vf^-E mod N, so that
+ * (input * Vi)^D * Vf = input^D and the exponentiation never sees
+ * the real input (Kocher's blinding).  A negative f_rng return
+ * means it has run dry.
+ */
+static int rsa_blinding( rsa_context *ctx, mpi *Vi, mpi *Vf,
+                         int (*f_rng)(void *), void *p_rng )
+{
+    int ret = 0, i, c, count = 0;
+    unsigned char buf[1024];
+
+    if( ctx->len - 1 > (int) sizeof( buf ) )
+        return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
+
+    do
+    {
+        if( count++ > 10 )
+            return( POLARSSL_ERR_RSA_RNG_FAILED );
+
+        for( i = 0; i < ctx->len - 1; i++ )
+        {
+            if( ( c = f_rng( p_rng ) ) < 0 )
+            {
+                ret = POLARSSL_ERR_RSA_RNG_FAILED;
+                goto cleanup;
+            }
+
+            buf[i] = (unsigned char) c;
+        }
+
+        MPI_CHK( mpi_read_binary( Vf, buf, ctx->len - 1 ) );
+
+        if( mpi_cmp_int( Vf, 1 ) <= 0 )
+            continue;
+
+        ret = mpi_inv_mod( Vi, Vf, &ctx->N );
+        if( ret != 0 && ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+            goto cleanup;
+    }
+    while( ret != 0 || mpi_cmp_int( Vf, 1 ) <= 0 );
+
+    /*
+     * No cached R^2 mod N here: ctx->RN would be filled in on first
+     * use, and this may run on several threads at once
+     */
+    MPI_CHK( mpi_exp_mod( Vi, Vi, &ctx->E, &ctx->N, NULL ) );
+
+cleanup:
+
+    memset( buf, 0, sizeof( buf ) );
+
+    return( ret );
+}
+#endif
+
 /*
  * Do an RSA private key operation
  */
 int rsa_private( rsa_context *ctx,
+                 int (*f_rng)(void *),
+                 void *p_rng,
                  const unsigned char *input,
                  unsigned char *output )
 {
     int ret, olen;
-    mpi T, T1, T2;
+    mpi T, T1, T2, Vi, Vf;
 
-    mpi_init( &T, &T1, &T2, NULL );
+    mpi_init( &T, &T1, &T2, &Vi, &Vf, NULL );
 
     MPI_CHK( mpi_read_binary( &T, input, ctx->len ) );
 
@@ -252,6 +311,18 @@ int rsa_private( rsa_context *ctx,
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
     }
 
+#if defined(POLARSSL_GENPRIME)
+    if( f_rng != NULL )
+    {
+        /*
+         * T = T * Vi mod N
+         */
+        MPI_CHK( rsa_blinding( ctx, &Vi, &Vf, f_rng, p_rng ) );
+        MPI_CHK( mpi_mul_mpi( &T, &T, &Vi ) );
+        MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
+    }
+#endif
+
 #if 0
     MPI_CHK( mpi_exp_mod( &T, &T, &ctx->D, &ctx->N, &ctx->RN ) );
 #else
@@ -278,12 +349,23 @@ int rsa_private( rsa_context *ctx,
     MPI_CHK( mpi_add_mpi( &T, &T2, &T1 ) );
 #endif
 
+#if defined(POLARSSL_GENPRIME)
+    if( f_rng != NULL )
+    {
+        /*
+         * output = T * Vf mod N
+         */
+        MPI_CHK( mpi_mul_mpi( &T, &T, &Vf ) );
+        MPI_CHK( mpi_mod_mpi( &T, &T, &ctx->N ) );
+    }
+#endif
+
     olen = ctx->len;
     MPI_CHK( mpi_write_binary( &T, output, olen ) );
 
 cleanup:
 
-    mpi_free( &T, &T1, &T2, NULL );
+    mpi_free( &T, &T1, &T2, &Vi, &Vf, NULL );
 
     if( ret != 0 )
         return( POLARSSL_ERR_RSA_PRIVATE_FAILED | ret );
@@ -344,13 +426,15 @@ int rsa_pkcs1_encrypt( rsa_context *ctx,
 
     return( ( mode == RSA_PUBLIC )
             ? rsa_public(  ctx, output, output )
-            : rsa_private( ctx, output, output ) );
+            : rsa_private( ctx, f_rng, p_rng, output, output ) );
 }
 
 /*
  * Do an RSA operation, then remove the message padding
  */
 int rsa_pkcs1_decrypt( rsa_context *ctx,
+                       int (*f_rng)(void *),
+                       void *p_rng,
                        int mode, int *olen,
                        const unsigned char *input,
                        unsigned char *output,
@@ -367,7 +451,7 @@ int rsa_pkcs1_decrypt( rsa_context *ctx,
 
     ret = ( mode == RSA_PUBLIC )
           ? rsa_public(  ctx, input, buf )
-          : rsa_private( ctx, input, buf );
+          : rsa_private( ctx, f_rng, p_rng, input, buf );
 
     if( ret != 0 )
         return( ret );
@@ -408,6 +492,8 @@ int rsa_pkcs1_decrypt( rsa_context *ctx,
  * Do an RSA operation to sign the message digest
  */
 int rsa_pkcs1_sign( rsa_context *ctx,
+                    int (*f_rng)(void *),
+                    void *p_rng,
                     int mode,
                     int hash_id,
                     int hashlen,
@@ -527,7 +613,7 @@ int rsa_pkcs1_sign( rsa_context *ctx,
 
     return( ( mode == RSA_PUBLIC )
             ? rsa_public(  ctx, sig, sig )
-            : rsa_private( ctx, sig, sig ) );
+            : rsa_private( ctx, f_rng, p_rng, sig, sig ) );
 }
 
 /*
@@ -551,7 +637,7 @@ int rsa_pkcs1_verify( rsa_context *ctx,
 
     ret = ( mode == RSA_PUBLIC )
           ? rsa_public(  ctx, sig, buf )
-          : rsa_private( ctx, sig, buf );
+          : rsa_private( ctx, NULL, NULL, sig, buf );
 
     if( ret != 0 )
         return( ret );
@@ -766,7 +852,7 @@ int rsa_self_test( int verbose )
     if( verbose != 0 )
         printf( "passed\n  PKCS#1 decryption : " );
 
-    if( rsa_pkcs1_decrypt( &rsa, RSA_PRIVATE, &len,
+    if( rsa_pkcs1_decrypt( &rsa, &myrand, NULL, RSA_PRIVATE, &len,
                            rsa_ciphertext, rsa_decrypted,
 			   sizeof(rsa_decrypted) ) != 0 )
     {
@@ -789,7 +875,7 @@ int rsa_self_test( int verbose )
 
     sha1( rsa_plaintext, PT_LEN, sha1sum );
 
-    if( rsa_pkcs1_sign( &rsa, RSA_PRIVATE, SIG_RSA_SHA1, 20,
+    if( rsa_pkcs1_sign( &rsa, &myrand, NULL, RSA_PRIVATE, SIG_RSA_SHA1, 20,
                         sha1sum, rsa_ciphertext ) != 0 )
     {
         if( verbose != 0 )
@@ -229,6 +229,9 @@ int rsa_public( rsa_context *ctx,
  * \brief          Do an RSA private key operation
  *
  * \param ctx      RSA context
+ * \param f_rng    RNG function for blinding, or NULL for none;
+ *                 a negative return fails with POLARSSL_ERR_RSA_RNG_FAILED
+ * \param p_rng    RNG parameter
  * \param input    input buffer
  * \param output   output buffer
  *
@@ -238,6 +241,8 @@ int rsa_public( rsa_context *ctx,
  *                 enough (eg. 128 bytes if RSA-1024 is used).
  */
 int rsa_private( rsa_context *ctx,
+                 int (*f_rng)(void *),
+                 void *p_rng,
                  const unsigned char *input,
                  unsigned char *output );
 
@@ -268,6 +273,8 @@ int rsa_pkcs1_encrypt( rsa_context *ctx,
  * \brief          Do an RSA operation, then remove the message padding
  *
  * \param ctx      RSA context
+ * \param f_rng    RNG function for blinding (RSA_PRIVATE), or NULL
+ * \param p_rng    RNG parameter
  * \param mode     RSA_PUBLIC or RSA_PRIVATE
  * \param input    buffer holding the encrypted data
  * \param output   buffer that will hold the plaintext
@@ -281,6 +288,8 @@ int rsa_pkcs1_encrypt( rsa_context *ctx,
  *                 an error is thrown.
  */
 int rsa_pkcs1_decrypt( rsa_context *ctx,
+                       int (*f_rng)(void *),
+                       void *p_rng,
                        int mode, int *olen,
                        const unsigned char *input,
                        unsigned char *output,
@@ -290,6 +299,8 @@ int rsa_pkcs1_decrypt( rsa_context *ctx,
  * \brief          Do a private RSA to sign a message digest
  *
  * \param ctx      RSA context
+ * \param f_rng    RNG function for blinding (RSA_PRIVATE), or NULL
+ * \param p_rng    RNG parameter
  * \param mode     RSA_PUBLIC or RSA_PRIVATE
  * \param hash_id  SIG_RSA_RAW, SIG_RSA_MD{2,4,5} or SIG_RSA_SHA{1,224,256,384,512}
  * \param hashlen  message digest length (for SIG_RSA_RAW only)
@@ -303,6 +314,8 @@ int rsa_pkcs1_decrypt( rsa_context *ctx,
  *                 of ctx->N (eg. 128 bytes if RSA-1024 is used).
  */
 int rsa_pkcs1_sign( rsa_context *ctx,
+                    int (*f_rng)(void *),
+                    void *p_rng,
                     int mode,
                     int hash_id,
                     int hashlen,
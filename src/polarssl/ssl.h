@@ -32,6 +32,8 @@
 #include "polarssl/rsa.h"
 #include "polarssl/md5.h"
 #include "polarssl/sha1.h"
+#include "polarssl/sha2.h"
+#include "polarssl/sha4.h"
 #include "polarssl/x509.h"
 
 /*
@@ -72,6 +74,7 @@
 #define SSL_MINOR_VERSION_0             0   /*!< SSL v3.0 */
 #define SSL_MINOR_VERSION_1             1   /*!< TLS v1.0 */
 #define SSL_MINOR_VERSION_2             2   /*!< TLS v1.1 */
+#define SSL_MINOR_VERSION_3             3   /*!< TLS v1.2 */
 
 #define SSL_IS_CLIENT                   0
 #define SSL_IS_SERVER                   1
@@ -106,6 +109,26 @@
 #define SSL_RSA_CAMELLIA_256_SHA     0x84
 #define SSL_EDH_RSA_CAMELLIA_256_SHA 0x88
 
+/*
+ * AEAD ciphersuites, TLS v1.2 only
+ */
+#define SSL_RSA_AES_128_GCM_SHA256           0x9C
+#define SSL_RSA_AES_256_GCM_SHA384           0x9D
+#define SSL_EDH_RSA_AES_128_GCM_SHA256       0x9E
+#define SSL_EDH_RSA_AES_256_GCM_SHA384       0x9F
+#define SSL_EDH_RSA_CHACHA20_POLY1305_SHA256 0xCCAA
+
+/*
+ * Signalling cipher value for secure renegotiation (RFC 5746)
+ */
+#define SSL_EMPTY_RENEGOTIATION_INFO    0xFF
+
+/*
+ * TLS v1.2 SignatureAndHashAlgorithm values
+ */
+#define SSL_HASH_SHA256                 4
+#define SSL_SIG_RSA                     1
+
 /*
  * Message, alert and handshake types
  */
@@ -158,6 +181,7 @@
  */
 #define TLS_EXT_SERVERNAME              0
 #define TLS_EXT_SERVERNAME_HOSTNAME     0
+#define TLS_EXT_RENEGOTIATION_INFO      0xFF01
 
 /*
  * SSL state machine
@@ -207,23 +231,25 @@ struct _ssl_context
     int state;                  /*!< SSL handshake: current state     */
 
     int major_ver;              /*!< equal to  SSL_MAJOR_VERSION_3    */
-    int minor_ver;              /*!< either 0 (SSL3) or 1 (TLS1.0)    */
+    int minor_ver;              /*!< 0 (SSL3) up to 3 (TLS1.2)        */
 
     int max_major_ver;          /*!< max. major version from client   */
     int max_minor_ver;          /*!< max. minor version from client   */
 
     /*
-     * Callbacks (RNG, debug, I/O)
+     * Callbacks (RNG, debug, I/O, private key operations)
      */
     int  (*f_rng)(void *);
     void (*f_dbg)(void *, int, const char *);
     int (*f_recv)(void *, unsigned char *, int);
     int (*f_send)(void *, unsigned char *, int);
+    int (*f_async)(void *, int (*)(void *), void *);
 
     void *p_rng;                /*!< context for the RNG function     */
     void *p_dbg;                /*!< context for the debug function   */
     void *p_recv;               /*!< context for reading operations   */
     void *p_send;               /*!< context for writing operations   */
+    void *p_async;              /*!< context for the async function   */
 
     /*
      * Session layer
@@ -281,6 +307,8 @@ struct _ssl_context
     dhm_context dhm_ctx;                /*!<  DHM key exchange        */
     md5_context fin_md5;                /*!<  Finished MD5 checksum   */
     sha1_context fin_sha1;              /*!<  Finished SHA-1 checksum */
+    sha2_context fin_sha2;              /*!<  Finished SHA-256 (v1.2) */
+    sha4_context fin_sha4;              /*!<  Finished SHA-384 (v1.2) */
 
     int do_crypt;                       /*!<  en(de)cryption flag     */
     int *ciphers;                       /*!<  allowed ciphersuites    */
@@ -299,14 +327,15 @@ struct _ssl_context
     unsigned char mac_enc[32];          /*!<  MAC (encryption)        */
     unsigned char mac_dec[32];          /*!<  MAC (decryption)        */
 
-    unsigned long ctx_enc[128];         /*!<  encryption context      */
-    unsigned long ctx_dec[128];         /*!<  decryption context      */
+    unsigned long ctx_enc[160];         /*!<  encryption context      */
+    unsigned long ctx_dec[160];         /*!<  decryption context      */
 
     /*
      * TLS extensions
      */
     unsigned char *hostname;
     unsigned long  hostname_len;
+    int secure_renegotiation;           /*!<  peer supports RFC 5746  */
 };
 
 #ifdef __cplusplus
@@ -386,6 +415,21 @@ void ssl_set_bio( ssl_context *ssl,
         int (*f_recv)(void *, unsigned char *, int), void *p_recv,
         int (*f_send)(void *, unsigned char *, int), void *p_send );
 
+/**
+ * \brief          Set the callback that runs the expensive private key
+ *                 steps of the handshake (RSA decrypt/sign and DHM).
+ *                 f_async( p_async, f, arg ) has to return f( arg ),
+ *                 but may call it on another thread: nothing else uses
+ *                 the context until it returns, and f never calls the
+ *                 RNG or debug callbacks.  Without one they run inline.
+ *
+ * \param ssl      SSL context
+ * \param f_async  async function
+ * \param p_async  async parameter
+ */
+void ssl_set_async( ssl_context *ssl,
+        int (*f_async)(void *, int (*)(void *), void *), void *p_async );
+
 /**
  * \brief          Set the session callbacks (server-side only)
  *
@@ -553,6 +597,8 @@ int ssl_handshake_server( ssl_context *ssl );
 
 int ssl_derive_keys( ssl_context *ssl );
 void ssl_calc_verify( ssl_context *ssl, unsigned char hash[36] );
+void ssl_update_checksum( ssl_context *ssl, unsigned char *buf, int len );
+int ssl_cipher_is_tls12( int cipher );
 
 int ssl_read_record( ssl_context *ssl );
 int ssl_fetch_input( ssl_context *ssl, int nb_want );
@@ -103,14 +103,23 @@ static int ssl_write_client_hello( ssl_context *ssl )
     SSL_DEBUG_MSG( 3, ( "client hello, session id len.: %d", n ) );
     SSL_DEBUG_BUF( 3,   "client hello, session id", buf + 39, n );
 
-    for( n = 0; ssl->ciphers[n] != 0; n++ );
+    /*
+     * The client stops at TLSv1.1, so leave out the TLSv1.2 ciphersuites
+     */
+    for( i = n = 0; ssl->ciphers[i] != 0; i++ )
+        if( !ssl_cipher_is_tls12( ssl->ciphers[i] ) )
+            n++;
+
     *p++ = (unsigned char)( n >> 7 );
     *p++ = (unsigned char)( n << 1 );
 
     SSL_DEBUG_MSG( 3, ( "client hello, got %d ciphers", n ) );
 
-    for( i = 0; i < n; i++ )
+    for( i = 0; ssl->ciphers[i] != 0; i++ )
     {
+        if( ssl_cipher_is_tls12( ssl->ciphers[i] ) )
+            continue;
+
         SSL_DEBUG_MSG( 3, ( "client hello, add cipher: %2d",
                        ssl->ciphers[i] ) );
 
@@ -648,8 +657,8 @@ static int ssl_write_certificate_verify( ssl_context *ssl )
     ssl->out_msg[4] = (unsigned char)( n >> 8 );
     ssl->out_msg[5] = (unsigned char)( n      );
 
-    if( ( ret = rsa_pkcs1_sign( ssl->rsa_key, RSA_PRIVATE, SIG_RSA_RAW,
-                                36, hash, ssl->out_msg + 6 ) ) != 0 )
+    if( ( ret = rsa_pkcs1_sign( ssl->rsa_key, ssl->f_rng, ssl->p_rng,
+                                RSA_PRIVATE, SIG_RSA_RAW, 36, hash, ssl->out_msg + 6 ) ) != 0 )
     {
         SSL_DEBUG_RET( 1, "rsa_pkcs1_sign", ret );
         return( ret );
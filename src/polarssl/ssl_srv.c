@@ -1,5 +1,5 @@
 /*
- *  SSLv3/TLSv1 server-side functions
+ *  SSLv3/TLSv1/TLSv1.2 server-side functions
  *
  *  Copyright (C) 2006-2010, Brainspark B.V.
  *
@@ -35,6 +35,199 @@
 #include <stdio.h>
 #include <time.h>
 
+/*
+ * The ciphersuites picked here that exchange keys with ephemeral DH
+ */
+static int ssl_cipher_is_edh( int cipher )
+{
+    return( cipher == SSL_EDH_RSA_DES_168_SHA ||
+            cipher == SSL_EDH_RSA_AES_128_SHA ||
+            cipher == SSL_EDH_RSA_AES_256_SHA ||
+            cipher == SSL_EDH_RSA_CAMELLIA_128_SHA ||
+            cipher == SSL_EDH_RSA_CAMELLIA_256_SHA ||
+            cipher == SSL_EDH_RSA_AES_128_GCM_SHA256 ||
+            cipher == SSL_EDH_RSA_AES_256_GCM_SHA384 ||
+            cipher == SSL_EDH_RSA_CHACHA20_POLY1305_SHA256 );
+}
+
+/*
+ * The private key operations of the handshake go through f_async, which
+ * may run them on another thread.  They only touch the context (left
+ * alone until they're done) and get their random bytes drawn up front.
+ */
+typedef struct
+{
+    ssl_context *ssl;
+    unsigned char *buf;         /*!<  input or output of the op   */
+    int len;                    /*!<  its length                  */
+    int hash_id;                /*!<  SIG_RSA_XXX to sign with    */
+    int hashlen;                /*!<  length of the hash to sign  */
+    unsigned char *hash;        /*!<  hash to sign                */
+    int used;                   /*!<  random bytes used so far    */
+    unsigned char rand[512];    /*!<  random bytes from f_rng     */
+}
+ssl_async_job;
+
+/*
+ * Hands out the drawn bytes once each; past the end it returns -1
+ * (which RSA blinding fails on) and leaves used over the size, so
+ * the callers can tell the bytes ran out
+ */
+static int ssl_async_rng( void *p_rng )
+{
+    ssl_async_job *job = (ssl_async_job *) p_rng;
+
+    if( job->used >= (int) sizeof( job->rand ) )
+    {
+        job->used = sizeof( job->rand ) + 1;
+        return( -1 );
+    }
+
+    return( job->rand[job->used++] );
+}
+
+static int ssl_async_rng_failed( ssl_async_job *job )
+{
+    return( job->used > (int) sizeof( job->rand ) );
+}
+
+/*
+ * Refill the job's random bytes; RSA blinding takes up to the size
+ * of the modulus, DH up to 256
+ */
+static void ssl_async_draw( ssl_context *ssl, ssl_async_job *job )
+{
+    int i;
+
+    job->used = 0;
+
+    for( i = 0; i < (int) sizeof( job->rand ); i++ )
+        job->rand[i] = (unsigned char) ssl->f_rng( ssl->p_rng );
+}
+
+static int ssl_async( ssl_context *ssl, int (*f)(void *), ssl_async_job *job )
+{
+    job->ssl = ssl;
+
+    /*
+     * The first operation with the key fills in its cached Montgomery
+     * values, which mustn't happen on two threads at once
+     */
+    if( ssl->f_async == NULL ||
+        ssl->rsa_key->RP.p == NULL ||
+        ssl->rsa_key->RQ.p == NULL )
+        return( f( job ) );
+
+    return( ssl->f_async( ssl->p_async, f, job ) );
+}
+
+#if defined(POLARSSL_DHM_C)
+static int ssl_async_dhm_make_params( void *arg )
+{
+    ssl_async_job *job = (ssl_async_job *) arg;
+
+    int ret;
+
+    ret = dhm_make_params( &job->ssl->dhm_ctx, 256, job->buf, &job->len,
+                           ssl_async_rng, job );
+
+    if( ret == 0 && ssl_async_rng_failed( job ) )
+        ret = POLARSSL_ERR_DHM_MAKE_PARAMS_FAILED;
+
+    return( ret );
+}
+
+static int ssl_async_dhm_calc_secret( void *arg )
+{
+    ssl_async_job *job = (ssl_async_job *) arg;
+
+    return( dhm_calc_secret( &job->ssl->dhm_ctx,
+                             job->ssl->premaster, &job->ssl->pmslen ) );
+}
+#endif
+
+static int ssl_async_rsa_sign( void *arg )
+{
+    ssl_async_job *job = (ssl_async_job *) arg;
+
+    int ret;
+
+    ret = rsa_pkcs1_sign( job->ssl->rsa_key, ssl_async_rng, job,
+                          RSA_PRIVATE, job->hash_id,
+                          job->hashlen, job->hash, job->buf );
+
+    if( ret == 0 && ssl_async_rng_failed( job ) )
+        ret = POLARSSL_ERR_RSA_RNG_FAILED;
+
+    return( ret );
+}
+
+static int ssl_async_rsa_decrypt( void *arg )
+{
+    ssl_async_job *job = (ssl_async_job *) arg;
+
+    int ret;
+
+    ret = rsa_pkcs1_decrypt( job->ssl->rsa_key, ssl_async_rng, job,
+                             RSA_PRIVATE,
+                             &job->ssl->pmslen, job->buf,
+                             job->ssl->premaster,
+                             sizeof( job->ssl->premaster ) );
+
+    if( ret == 0 && ssl_async_rng_failed( job ) )
+        ret = POLARSSL_ERR_RSA_RNG_FAILED;
+
+    return( ret );
+}
+
+/*
+ * Look through the ClientHello extensions for renegotiation_info
+ * (RFC 5746); anything else is ignored.
+ */
+static int ssl_parse_hello_extensions( ssl_context *ssl,
+                                       unsigned char *buf, int len )
+{
+    int ext_id, ext_len;
+
+    if( len == 0 )
+        return( 0 );
+
+    if( len < 2 || len != 2 + ( ( buf[0] << 8 ) | buf[1] ) )
+        return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+
+    buf += 2;
+    len -= 2;
+
+    while( len > 0 )
+    {
+        if( len < 4 )
+            return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+
+        ext_id  = ( buf[0] << 8 ) | buf[1];
+        ext_len = ( buf[2] << 8 ) | buf[3];
+
+        if( ext_len + 4 > len )
+            return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+
+        if( ext_id == TLS_EXT_RENEGOTIATION_INFO )
+        {
+            /*
+             * This is the initial handshake, so the client's
+             * renegotiated_connection must be empty
+             */
+            if( ext_len != 1 || buf[4] != 0 )
+                return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+
+            ssl->secure_renegotiation = 1;
+        }
+
+        buf += 4 + ext_len;
+        len -= 4 + ext_len;
+    }
+
+    return( 0 );
+}
+
 static int ssl_parse_client_hello( ssl_context *ssl )
 {
     int ret, i, j, n;
@@ -92,8 +285,8 @@ static int ssl_parse_client_hello( ssl_context *ssl )
         ssl->max_minor_ver = buf[4];
 
         ssl->major_ver = SSL_MAJOR_VERSION_3;
-        ssl->minor_ver = ( buf[4] <= SSL_MINOR_VERSION_2 )
-                         ? buf[4]  : SSL_MINOR_VERSION_2;
+        ssl->minor_ver = ( buf[4] <= SSL_MINOR_VERSION_3 )
+                         ? buf[4]  : SSL_MINOR_VERSION_3;
 
         if( ( ret = ssl_fetch_input( ssl, 2 + n ) ) != 0 )
         {
@@ -101,8 +294,7 @@ static int ssl_parse_client_hello( ssl_context *ssl )
             return( ret );
         }
 
-         md5_update( &ssl->fin_md5 , buf + 2, n );
-        sha1_update( &ssl->fin_sha1, buf + 2, n );
+        ssl_update_checksum( ssl, buf + 2, n );
 
         buf = ssl->in_msg;
         n = ssl->in_left - 5;
@@ -167,13 +359,23 @@ static int ssl_parse_client_hello( ssl_context *ssl )
         memset( ssl->randbytes, 0, 64 );
         memcpy( ssl->randbytes + 32 - chal_len, p, chal_len );
 
+        for( j = 0, p = buf + 6; j < ciph_len; j += 3, p += 3 )
+        {
+            if( p[0] == 0 && p[1] == 0 && p[2] == SSL_EMPTY_RENEGOTIATION_INFO )
+                ssl->secure_renegotiation = 1;
+        }
+
         for( i = 0; ssl->ciphers[i] != 0; i++ )
         {
+            if( ssl->minor_ver < SSL_MINOR_VERSION_3 &&
+                ssl_cipher_is_tls12( ssl->ciphers[i] ) )
+                continue;
+
             for( j = 0, p = buf + 6; j < ciph_len; j += 3, p += 3 )
             {
                 if( p[0] == 0 &&
-                    p[1] == 0 &&
-                    p[2] == ssl->ciphers[i] )
+                    p[1] == ( ( ssl->ciphers[i] >> 8 ) & 0xFF ) &&
+                    p[2] == ( ( ssl->ciphers[i]      ) & 0xFF ) )
                     goto have_cipher;
             }
         }
@@ -206,7 +408,7 @@ static int ssl_parse_client_hello( ssl_context *ssl )
 
         n = ( buf[3] << 8 ) | buf[4];
 
-        if( n < 45 || n > 512 )
+        if( n < 45 || n > SSL_MAX_CONTENT_LEN )
         {
             SSL_DEBUG_MSG( 1, ( "bad client hello message" ) );
             return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
@@ -221,8 +423,7 @@ static int ssl_parse_client_hello( ssl_context *ssl )
         buf = ssl->in_msg;
         n = ssl->in_left - 5;
 
-         md5_update( &ssl->fin_md5 , buf, n );
-        sha1_update( &ssl->fin_sha1, buf, n );
+        ssl_update_checksum( ssl, buf, n );
 
         /*
          * SSL layer:
@@ -258,8 +459,8 @@ static int ssl_parse_client_hello( ssl_context *ssl )
         }
 
         ssl->major_ver = SSL_MAJOR_VERSION_3;
-        ssl->minor_ver = ( buf[5] <= SSL_MINOR_VERSION_2 )
-                         ? buf[5]  : SSL_MINOR_VERSION_2;
+        ssl->minor_ver = ( buf[5] <= SSL_MINOR_VERSION_3 )
+                         ? buf[5]  : SSL_MINOR_VERSION_3;
 
         ssl->max_major_ver = buf[4];
         ssl->max_minor_ver = buf[5];
@@ -296,7 +497,8 @@ static int ssl_parse_client_hello( ssl_context *ssl )
         ciph_len = ( buf[39 + sess_len] << 8 )
                  | ( buf[40 + sess_len]      );
 
-        if( ciph_len < 2 || ciph_len > 256 || ( ciph_len % 2 ) != 0 )
+        if( ciph_len < 2 || ciph_len > 256 || ( ciph_len % 2 ) != 0 ||
+            n < 42 + sess_len + ciph_len )
         {
             SSL_DEBUG_MSG( 1, ( "bad client hello message" ) );
             return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
@@ -307,12 +509,30 @@ static int ssl_parse_client_hello( ssl_context *ssl )
          */
         comp_len = buf[41 + sess_len + ciph_len];
 
-        if( comp_len < 1 || comp_len > 16 )
+        if( comp_len < 1 || comp_len > 16 ||
+            n < 42 + sess_len + ciph_len + comp_len )
+        {
+            SSL_DEBUG_MSG( 1, ( "bad client hello message" ) );
+            return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+        }
+
+        /*
+         * Check the extensions, and the renegotiation SCSV
+         */
+        p = buf + 42 + sess_len + ciph_len + comp_len;
+
+        if( ssl_parse_hello_extensions( ssl, p, buf + n - p ) != 0 )
         {
             SSL_DEBUG_MSG( 1, ( "bad client hello message" ) );
             return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
         }
 
+        for( j = 0, p = buf + 41 + sess_len; j < ciph_len; j += 2, p += 2 )
+        {
+            if( p[0] == 0 && p[1] == SSL_EMPTY_RENEGOTIATION_INFO )
+                ssl->secure_renegotiation = 1;
+        }
+
         SSL_DEBUG_BUF( 3, "client hello, random bytes",
                        buf +  6,  32 );
         SSL_DEBUG_BUF( 3, "client hello, session id",
@@ -327,10 +547,15 @@ static int ssl_parse_client_hello( ssl_context *ssl )
          */
         for( i = 0; ssl->ciphers[i] != 0; i++ )
         {
+            if( ssl->minor_ver < SSL_MINOR_VERSION_3 &&
+                ssl_cipher_is_tls12( ssl->ciphers[i] ) )
+                continue;
+
             for( j = 0, p = buf + 41 + sess_len; j < ciph_len;
                 j += 2, p += 2 )
             {
-                if( p[0] == 0 && p[1] == ssl->ciphers[i] )
+                if( p[0] == ( ( ssl->ciphers[i] >> 8 ) & 0xFF ) &&
+                    p[1] == ( ( ssl->ciphers[i]      ) & 0xFF ) )
                     goto have_cipher;
             }
         }
@@ -395,6 +620,8 @@ static int ssl_write_server_hello( ssl_context *ssl )
      *    39  . 38+n  session id
      *   39+n . 40+n  chosen cipher
      *   41+n . 41+n  chosen compression alg.
+     *   42+n . 43+n  extensions length
+     *   44+n .  ..   extensions
      */
     ssl->session->length = n = 32;
     *p++ = (unsigned char) ssl->session->length;
@@ -443,6 +670,20 @@ static int ssl_write_server_hello( ssl_context *ssl )
                    ssl->session->cipher ) );
     SSL_DEBUG_MSG( 3, ( "server hello, compress alg.: %d", 0 ) );
 
+    /*
+     * An empty renegotiation_info, since we never renegotiate
+     */
+    if( ssl->secure_renegotiation )
+    {
+        *p++ = 0x00;
+        *p++ = 0x05;
+        *p++ = (unsigned char)( TLS_EXT_RENEGOTIATION_INFO >> 8 );
+        *p++ = (unsigned char)( TLS_EXT_RENEGOTIATION_INFO      );
+        *p++ = 0x00;
+        *p++ = 0x01;
+        *p++ = 0x00;
+    }
+
     ssl->out_msglen  = p - buf;
     ssl->out_msgtype = SSL_MSG_HANDSHAKE;
     ssl->out_msg[0]  = SSL_HS_SERVER_HELLO;
@@ -457,7 +698,7 @@ static int ssl_write_server_hello( ssl_context *ssl )
 static int ssl_write_certificate_request( ssl_context *ssl )
 {
     int ret, n;
-    unsigned char *buf, *p;
+    unsigned char *buf, *p, *dn;
     const x509_cert *crt;
 
     SSL_DEBUG_MSG( 2, ( "=> write certificate request" ) );
@@ -475,6 +716,8 @@ static int ssl_write_certificate_request( ssl_context *ssl )
      *     1  .   3   handshake length
      *     4  .   4   cert type count
      *     5  .. n-1  cert types
+     *   ( n  .. n+1  length of the signature algorithms,
+     *    n+2 .. m-1  signature algorithms, TLSv1.2 only )
      *     n  .. n+1  length of all DNs
      *    n+2 .. n+3  length of DN 1
      *    n+4 .. ...  Distinguished Name #1
@@ -489,6 +732,15 @@ static int ssl_write_certificate_request( ssl_context *ssl )
     *p++ = 1;
     *p++ = 1;
 
+    if( ssl->minor_ver == SSL_MINOR_VERSION_3 )
+    {
+        *p++ = 0;
+        *p++ = 2;
+        *p++ = SSL_HASH_SHA256;
+        *p++ = SSL_SIG_RSA;
+    }
+
+    dn = p;
     p += 2;
     crt = ssl->ca_chain;
 
@@ -509,8 +761,8 @@ static int ssl_write_certificate_request( ssl_context *ssl )
     ssl->out_msglen  = n = p - buf;
     ssl->out_msgtype = SSL_MSG_HANDSHAKE;
     ssl->out_msg[0]  = SSL_HS_CERTIFICATE_REQUEST;
-    ssl->out_msg[6]  = (unsigned char)( ( n - 8 ) >> 8 );
-    ssl->out_msg[7]  = (unsigned char)( ( n - 8 )      );
+    dn[0] = (unsigned char)( ( p - dn - 2 ) >> 8 );
+    dn[1] = (unsigned char)( ( p - dn - 2 )      );
 
     ret = ssl_write_record( ssl );
 
@@ -521,18 +773,16 @@ static int ssl_write_certificate_request( ssl_context *ssl )
 
 static int ssl_write_server_key_exchange( ssl_context *ssl )
 {
-    int ret, n;
+    int ret, n, hashlen, hash_id;
     unsigned char hash[36];
+    ssl_async_job job;
     md5_context md5;
     sha1_context sha1;
+    sha2_context sha2;
 
     SSL_DEBUG_MSG( 2, ( "=> write server key exchange" ) );
 
-    if( ssl->session->cipher != SSL_EDH_RSA_DES_168_SHA &&
-        ssl->session->cipher != SSL_EDH_RSA_AES_128_SHA &&
-        ssl->session->cipher != SSL_EDH_RSA_AES_256_SHA &&
-        ssl->session->cipher != SSL_EDH_RSA_CAMELLIA_128_SHA &&
-	    ssl->session->cipher != SSL_EDH_RSA_CAMELLIA_256_SHA)
+    if( !ssl_cipher_is_edh( ssl->session->cipher ) )
     {
         SSL_DEBUG_MSG( 2, ( "<= skip write server key exchange" ) );
         ssl->state++;
@@ -552,48 +802,88 @@ static int ssl_write_server_key_exchange( ssl_context *ssl )
      *     opaque dh_Ys<1..2^16-1>;
      * } ServerDHParams;
      */
-    if( ( ret = dhm_make_params( &ssl->dhm_ctx, 256, ssl->out_msg + 4,
-                                 &n, ssl->f_rng, ssl->p_rng ) ) != 0 )
+    memset( &job, 0, sizeof( job ) );
+    ssl_async_draw( ssl, &job );
+
+    job.buf = ssl->out_msg + 4;
+
+    if( ( ret = ssl_async( ssl, ssl_async_dhm_make_params, &job ) ) != 0 )
     {
         SSL_DEBUG_RET( 1, "dhm_make_params", ret );
         return( ret );
     }
 
+    n = job.len;
+
     SSL_DEBUG_MPI( 3, "DHM: X ", &ssl->dhm_ctx.X  );
     SSL_DEBUG_MPI( 3, "DHM: P ", &ssl->dhm_ctx.P  );
     SSL_DEBUG_MPI( 3, "DHM: G ", &ssl->dhm_ctx.G  );
     SSL_DEBUG_MPI( 3, "DHM: GX", &ssl->dhm_ctx.GX );
 
-    /*
-     * digitally-signed struct {
-     *     opaque md5_hash[16];
-     *     opaque sha_hash[20];
-     * };
-     *
-     * md5_hash
-     *     MD5(ClientHello.random + ServerHello.random
-     *                            + ServerParams);
-     * sha_hash
-     *     SHA(ClientHello.random + ServerHello.random
-     *                            + ServerParams);
-     */
-    md5_starts( &md5 );
-    md5_update( &md5, ssl->randbytes,  64 );
-    md5_update( &md5, ssl->out_msg + 4, n );
-    md5_finish( &md5, hash );
+    if( ssl->minor_ver == SSL_MINOR_VERSION_3 )
+    {
+        /*
+         * TLSv1.2 digitally-signed struct {
+         *     SignatureAndHashAlgorithm algorithm;
+         *     opaque signature<0..2^16-1>;
+         * };
+         *
+         * signing SHA256(ClientHello.random + ServerHello.random
+         *                                   + ServerParams);
+         */
+        sha2_starts( &sha2, 0 );
+        sha2_update( &sha2, ssl->randbytes,  64 );
+        sha2_update( &sha2, ssl->out_msg + 4, n );
+        sha2_finish( &sha2, hash );
 
-    sha1_starts( &sha1 );
-    sha1_update( &sha1, ssl->randbytes,  64 );
-    sha1_update( &sha1, ssl->out_msg + 4, n );
-    sha1_finish( &sha1, hash + 16 );
+        hashlen = 32;
+        hash_id = SIG_RSA_SHA256;
 
-    SSL_DEBUG_BUF( 3, "parameters hash", hash, 36 );
+        ssl->out_msg[4 + n] = SSL_HASH_SHA256;
+        ssl->out_msg[5 + n] = SSL_SIG_RSA;
+        n += 2;
+    }
+    else
+    {
+        /*
+         * digitally-signed struct {
+         *     opaque md5_hash[16];
+         *     opaque sha_hash[20];
+         * };
+         *
+         * md5_hash
+         *     MD5(ClientHello.random + ServerHello.random
+         *                            + ServerParams);
+         * sha_hash
+         *     SHA(ClientHello.random + ServerHello.random
+         *                            + ServerParams);
+         */
+        md5_starts( &md5 );
+        md5_update( &md5, ssl->randbytes,  64 );
+        md5_update( &md5, ssl->out_msg + 4, n );
+        md5_finish( &md5, hash );
+
+        sha1_starts( &sha1 );
+        sha1_update( &sha1, ssl->randbytes,  64 );
+        sha1_update( &sha1, ssl->out_msg + 4, n );
+        sha1_finish( &sha1, hash + 16 );
+
+        hashlen = 36;
+        hash_id = SIG_RSA_RAW;
+    }
+
+    SSL_DEBUG_BUF( 3, "parameters hash", hash, hashlen );
 
     ssl->out_msg[4 + n] = (unsigned char)( ssl->rsa_key->len >> 8 );
     ssl->out_msg[5 + n] = (unsigned char)( ssl->rsa_key->len      );
 
-    ret = rsa_pkcs1_sign( ssl->rsa_key, RSA_PRIVATE,
-                          SIG_RSA_RAW, 36, hash, ssl->out_msg + 6 + n );
+    job.hash_id = hash_id;
+    job.hashlen = hashlen;
+    job.hash    = hash;
+    job.buf     = ssl->out_msg + 6 + n;
+    ssl_async_draw( ssl, &job );
+
+    ret = ssl_async( ssl, ssl_async_rsa_sign, &job );
     if( ret != 0 )
     {
         SSL_DEBUG_RET( 1, "rsa_pkcs1_sign", ret );
@@ -647,6 +937,7 @@ static int ssl_write_server_hello_done( ssl_context *ssl )
 static int ssl_parse_client_key_exchange( ssl_context *ssl )
 {
     int ret, i, n;
+    ssl_async_job job;
 
     SSL_DEBUG_MSG( 2, ( "=> parse client key exchange" ) );
 
@@ -668,11 +959,7 @@ static int ssl_parse_client_key_exchange( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE );
     }
 
-    if( ssl->session->cipher == SSL_EDH_RSA_DES_168_SHA ||
-        ssl->session->cipher == SSL_EDH_RSA_AES_128_SHA ||
-        ssl->session->cipher == SSL_EDH_RSA_AES_256_SHA ||
-        ssl->session->cipher == SSL_EDH_RSA_CAMELLIA_128_SHA ||
-	    ssl->session->cipher == SSL_EDH_RSA_CAMELLIA_256_SHA)
+    if( ssl_cipher_is_edh( ssl->session->cipher ) )
     {
 #if !defined(POLARSSL_DHM_C)
         SSL_DEBUG_MSG( 1, ( "support for dhm is not available" ) );
@@ -701,8 +988,9 @@ static int ssl_parse_client_key_exchange( ssl_context *ssl )
 
         ssl->pmslen = ssl->dhm_ctx.len;
 
-        if( ( ret = dhm_calc_secret( &ssl->dhm_ctx,
-                     ssl->premaster, &ssl->pmslen ) ) != 0 )
+        memset( &job, 0, sizeof( job ) );
+
+        if( ( ret = ssl_async( ssl, ssl_async_dhm_calc_secret, &job ) ) != 0 )
         {
             SSL_DEBUG_RET( 1, "dhm_calc_secret", ret );
             return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE | ret );
@@ -737,9 +1025,11 @@ static int ssl_parse_client_key_exchange( ssl_context *ssl )
             return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE );
         }
 
-        ret = rsa_pkcs1_decrypt( ssl->rsa_key, RSA_PRIVATE, &ssl->pmslen,
-                                 ssl->in_msg + i, ssl->premaster,
-				 sizeof(ssl->premaster) );
+        memset( &job, 0, sizeof( job ) );
+        ssl_async_draw( ssl, &job );
+        job.buf = ssl->in_msg + i;
+
+        ret = ssl_async( ssl, ssl_async_rsa_decrypt, &job );
 
         if( ret != 0 || ssl->pmslen != 48 ||
             ssl->premaster[0] != ssl->max_major_ver ||
@@ -778,7 +1068,7 @@ static int ssl_parse_client_key_exchange( ssl_context *ssl )
 
 static int ssl_parse_certificate_verify( ssl_context *ssl )
 {
-    int n1, n2, ret;
+    int n1, n2, ret, i, hashlen, hash_id;
     unsigned char hash[36];
 
     SSL_DEBUG_MSG( 2, ( "=> parse certificate verify" ) );
@@ -812,17 +1102,39 @@ static int ssl_parse_certificate_verify( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY );
     }
 
+    i = 4;
+    hashlen = 36;
+    hash_id = SIG_RSA_RAW;
+
+    /*
+     * TLSv1.2 names the algorithm, which has to be the one we asked for
+     */
+    if( ssl->minor_ver == SSL_MINOR_VERSION_3 )
+    {
+        if( ssl->in_hslen < 6 ||
+            ssl->in_msg[4] != SSL_HASH_SHA256 ||
+            ssl->in_msg[5] != SSL_SIG_RSA )
+        {
+            SSL_DEBUG_MSG( 1, ( "bad certificate verify message" ) );
+            return( POLARSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY );
+        }
+
+        i += 2;
+        hashlen = 32;
+        hash_id = SIG_RSA_SHA256;
+    }
+
     n1 = ssl->peer_cert->rsa.len;
-    n2 = ( ssl->in_msg[4] << 8 ) | ssl->in_msg[5];
+    n2 = ( ssl->in_msg[i] << 8 ) | ssl->in_msg[i + 1];
 
-    if( n1 + 6 != ssl->in_hslen || n1 != n2 )
+    if( n1 + i + 2 != ssl->in_hslen || n1 != n2 )
     {
         SSL_DEBUG_MSG( 1, ( "bad certificate verify message" ) );
         return( POLARSSL_ERR_SSL_BAD_HS_CERTIFICATE_VERIFY );
     }
 
     ret = rsa_pkcs1_verify( &ssl->peer_cert->rsa, RSA_PUBLIC,
-                            SIG_RSA_RAW, 36, hash, ssl->in_msg + 6 );
+                            hash_id, hashlen, hash, ssl->in_msg + i + 2 );
     if( ret != 0 )
     {
         SSL_DEBUG_RET( 1, "rsa_pkcs1_verify", ret );
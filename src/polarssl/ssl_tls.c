@@ -29,6 +29,7 @@
  *  http://wp.netscape.com/eng/ssl3/
  *  http://www.ietf.org/rfc/rfc2246.txt
  *  http://www.ietf.org/rfc/rfc4346.txt
+ *  http://www.ietf.org/rfc/rfc5246.txt
  */
 
 #include "polarssl/config.h"
@@ -38,8 +39,10 @@
 #include "polarssl/aes.h"
 #include "polarssl/arc4.h"
 #include "polarssl/camellia.h"
+#include "polarssl/chachapoly.h"
 #include "polarssl/des.h"
 #include "polarssl/debug.h"
+#include "polarssl/gcm.h"
 #include "polarssl/ssl.h"
 
 #include <string.h>
@@ -109,6 +112,96 @@ static int tls1_prf( unsigned char *secret, int slen, char *label,
     return( 0 );
 }
 
+/*
+ * TLSv1.2 PRF: P_SHA256( secret, label + random ), or P_SHA384 for the
+ * ciphersuites that ask for it
+ */
+static int tls_prf_sha2( unsigned char *secret, int slen, char *label,
+                         unsigned char *random, int rlen,
+                         unsigned char *dstbuf, int dlen, int is384 )
+{
+    int nb, hlen;
+    int i, j, k;
+    unsigned char tmp[128];
+    unsigned char h_i[64];
+
+    hlen = ( is384 != 0 ) ? 48 : 32;
+
+    if( sizeof( tmp ) < hlen + strlen( label ) + rlen )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    nb = strlen( label );
+    memcpy( tmp + hlen, label, nb );
+    memcpy( tmp + hlen + nb, random, rlen );
+    nb += rlen;
+
+    /*
+     * A(1) = HMAC( secret, label + random ), A(i) = HMAC( secret, A(i-1) )
+     */
+    if( is384 != 0 )
+        sha4_hmac( secret, slen, tmp + hlen, nb, tmp, 1 );
+    else
+        sha2_hmac( secret, slen, tmp + hlen, nb, tmp, 0 );
+
+    for( i = 0; i < dlen; i += hlen )
+    {
+        if( is384 != 0 )
+        {
+            sha4_hmac( secret, slen, tmp, hlen + nb, h_i, 1 );
+            sha4_hmac( secret, slen, tmp, hlen,      tmp, 1 );
+        }
+        else
+        {
+            sha2_hmac( secret, slen, tmp, hlen + nb, h_i, 0 );
+            sha2_hmac( secret, slen, tmp, hlen,      tmp, 0 );
+        }
+
+        k = ( i + hlen > dlen ) ? dlen % hlen : hlen;
+
+        for( j = 0; j < k; j++ )
+            dstbuf[i + j]  = h_i[j];
+    }
+
+    memset( tmp, 0, sizeof( tmp ) );
+    memset( h_i, 0, sizeof( h_i ) );
+
+    return( 0 );
+}
+
+static int ssl_cipher_is_gcm( int cipher )
+{
+    return( cipher == SSL_RSA_AES_128_GCM_SHA256 ||
+            cipher == SSL_RSA_AES_256_GCM_SHA384 ||
+            cipher == SSL_EDH_RSA_AES_128_GCM_SHA256 ||
+            cipher == SSL_EDH_RSA_AES_256_GCM_SHA384 );
+}
+
+static int ssl_cipher_is_sha384( int cipher )
+{
+    return( cipher == SSL_RSA_AES_256_GCM_SHA384 ||
+            cipher == SSL_EDH_RSA_AES_256_GCM_SHA384 );
+}
+
+/*
+ * The AEAD ciphersuites can only be used with TLSv1.2
+ */
+int ssl_cipher_is_tls12( int cipher )
+{
+    return( ssl_cipher_is_gcm( cipher ) ||
+            cipher == SSL_EDH_RSA_CHACHA20_POLY1305_SHA256 );
+}
+
+static int ssl_prf( ssl_context *ssl, unsigned char *secret, int slen,
+                    char *label, unsigned char *random, int rlen,
+                    unsigned char *dstbuf, int dlen )
+{
+    if( ssl->minor_ver != SSL_MINOR_VERSION_3 )
+        return( tls1_prf( secret, slen, label, random, rlen, dstbuf, dlen ) );
+
+    return( tls_prf_sha2( secret, slen, label, random, rlen, dstbuf, dlen,
+                          ssl_cipher_is_sha384( ssl->session->cipher ) ) );
+}
+
 int ssl_derive_keys( ssl_context *ssl )
 {
     int i;
@@ -132,6 +225,8 @@ int ssl_derive_keys( ssl_context *ssl )
      *
      * TLSv1:
      *   master = PRF( premaster, "master secret", randbytes )[0..47]
+     *
+     * (TLSv1.2 has its own PRF, see ssl_prf())
      */
     if( ssl->resume == 0 )
     {
@@ -158,8 +253,8 @@ int ssl_derive_keys( ssl_context *ssl )
             }
         }
         else
-            tls1_prf( ssl->premaster, len, "master secret",
-                      ssl->randbytes, 64, ssl->session->master, 48 );
+            ssl_prf( ssl, ssl->premaster, len, "master secret",
+                     ssl->randbytes, 64, ssl->session->master, 48 );
 
         memset( ssl->premaster, 0, sizeof( ssl->premaster ) );
     }
@@ -211,8 +306,8 @@ int ssl_derive_keys( ssl_context *ssl )
         memset( sha1sum, 0, sizeof( sha1sum ) );
     }
     else
-        tls1_prf( ssl->session->master, 48, "key expansion",
-                  ssl->randbytes, 64, keyblk, 256 );
+        ssl_prf( ssl, ssl->session->master, 48, "key expansion",
+                 ssl->randbytes, 64, keyblk, 256 );
 
     SSL_DEBUG_MSG( 3, ( "cipher = %s", ssl_get_cipher( ssl ) ) );
     SSL_DEBUG_BUF( 3, "master secret", ssl->session->master, 48 );
@@ -274,6 +369,31 @@ int ssl_derive_keys( ssl_context *ssl )
             break;
 #endif
 
+        /*
+         * The AEAD ciphers have no MAC key, and ivlen is the implicit
+         * part of the nonce taken from the key block
+         */
+#if defined(POLARSSL_GCM_C)
+        case SSL_RSA_AES_128_GCM_SHA256:
+        case SSL_EDH_RSA_AES_128_GCM_SHA256:
+            ssl->keylen = 16; ssl->minlen = 24;
+            ssl->ivlen  =  4; ssl->maclen =  0;
+            break;
+
+        case SSL_RSA_AES_256_GCM_SHA384:
+        case SSL_EDH_RSA_AES_256_GCM_SHA384:
+            ssl->keylen = 32; ssl->minlen = 24;
+            ssl->ivlen  =  4; ssl->maclen =  0;
+            break;
+#endif
+
+#if defined(POLARSSL_CHACHAPOLY_C)
+        case SSL_EDH_RSA_CHACHA20_POLY1305_SHA256:
+            ssl->keylen = 32; ssl->minlen = 16;
+            ssl->ivlen  = 12; ssl->maclen =  0;
+            break;
+#endif
+
         default:
             SSL_DEBUG_MSG( 1, ( "cipher %s is not available",
                            ssl_get_cipher( ssl ) ) );
@@ -363,6 +483,27 @@ int ssl_derive_keys( ssl_context *ssl )
             break;
 #endif
 
+#if defined(POLARSSL_GCM_C)
+        case SSL_RSA_AES_128_GCM_SHA256:
+        case SSL_EDH_RSA_AES_128_GCM_SHA256:
+            gcm_setkey( (gcm_context *) ssl->ctx_enc, key1, 128 );
+            gcm_setkey( (gcm_context *) ssl->ctx_dec, key2, 128 );
+            break;
+
+        case SSL_RSA_AES_256_GCM_SHA384:
+        case SSL_EDH_RSA_AES_256_GCM_SHA384:
+            gcm_setkey( (gcm_context *) ssl->ctx_enc, key1, 256 );
+            gcm_setkey( (gcm_context *) ssl->ctx_dec, key2, 256 );
+            break;
+#endif
+
+#if defined(POLARSSL_CHACHAPOLY_C)
+        case SSL_EDH_RSA_CHACHA20_POLY1305_SHA256:
+            chachapoly_setkey( (chachapoly_context *) ssl->ctx_enc, key1 );
+            chachapoly_setkey( (chachapoly_context *) ssl->ctx_dec, key2 );
+            break;
+#endif
+
         default:
             return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
     }
@@ -378,6 +519,7 @@ void ssl_calc_verify( ssl_context *ssl, unsigned char hash[36] )
 {
     md5_context md5;
     sha1_context sha1;
+    sha2_context sha2;
     unsigned char pad_1[48];
     unsigned char pad_2[48];
 
@@ -411,6 +553,14 @@ void ssl_calc_verify( ssl_context *ssl, unsigned char hash[36] )
         sha1_update( &sha1, hash + 16, 20 );
         sha1_finish( &sha1, hash + 16 );
     }
+    else if( ssl->minor_ver == SSL_MINOR_VERSION_3 )
+    {
+        /*
+         * TLSv1.2: SHA-256, the only hash offered in CertificateRequest
+         */
+        memcpy( &sha2, &ssl->fin_sha2, sizeof( sha2_context ) );
+        sha2_finish( &sha2, hash );
+    }
     else /* TLSv1 */
     {
          md5_finish( &md5,  hash );
@@ -484,6 +634,120 @@ static void ssl_mac_sha1( unsigned char *secret,
     sha1_finish( &sha1, buf + len );
 }
 
+/*
+ * AEAD record protection (TLSv1.2).  The additional data is the sequence
+ * number and the record header with the plaintext length.  GCM sends the
+ * sequence number as the explicit part of the nonce, ChaCha20-Poly1305
+ * xors it into the implicit one (RFC 7905).
+ */
+static int ssl_encrypt_aead( ssl_context *ssl )
+{
+    int i, len = ssl->out_msglen;
+    unsigned char nonce[12];
+
+    SSL_DEBUG_MSG( 3, ( "before encrypt: msglen = %d", len ) );
+
+#if defined(POLARSSL_GCM_C)
+    if( ssl_cipher_is_gcm( ssl->session->cipher ) )
+    {
+        memcpy( nonce, ssl->iv_enc, 4 );
+        memcpy( nonce + 4, ssl->out_ctr, 8 );
+
+        memmove( ssl->out_msg + 8, ssl->out_msg, len );
+        memcpy( ssl->out_msg, ssl->out_ctr, 8 );
+
+        gcm_crypt_and_tag( (gcm_context *) ssl->ctx_enc, GCM_ENCRYPT, len,
+                           nonce, ssl->out_ctr, 13,
+                           ssl->out_msg + 8, ssl->out_msg + 8,
+                           ssl->out_msg + 8 + len );
+
+        ssl->out_msglen = 8 + len + 16;
+    }
+    else
+#endif
+#if defined(POLARSSL_CHACHAPOLY_C)
+    if( ssl->session->cipher == SSL_EDH_RSA_CHACHA20_POLY1305_SHA256 )
+    {
+        memcpy( nonce, ssl->iv_enc, 12 );
+
+        for( i = 0; i < 8; i++ )
+            nonce[4 + i] ^= ssl->out_ctr[i];
+
+        chachapoly_crypt_and_tag( (chachapoly_context *) ssl->ctx_enc,
+                                  CHACHAPOLY_ENCRYPT, len,
+                                  nonce, ssl->out_ctr, 13,
+                                  ssl->out_msg, ssl->out_msg,
+                                  ssl->out_msg + len );
+
+        ssl->out_msglen = len + 16;
+    }
+    else
+#endif
+        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+
+    for( i = 7; i >= 0; i-- )
+        if( ++ssl->out_ctr[i] != 0 )
+            break;
+
+    return( 0 );
+}
+
+static int ssl_decrypt_aead( ssl_context *ssl )
+{
+    int i, ret, len;
+    unsigned char nonce[12];
+
+#if defined(POLARSSL_GCM_C)
+    if( ssl_cipher_is_gcm( ssl->session->cipher ) )
+    {
+        len = ssl->in_msglen - 24;
+
+        memcpy( nonce, ssl->iv_dec, 4 );
+        memcpy( nonce + 4, ssl->in_msg, 8 );
+
+        ssl->in_hdr[3] = (unsigned char)( len >> 8 );
+        ssl->in_hdr[4] = (unsigned char)( len      );
+
+        ret = gcm_auth_decrypt( (gcm_context *) ssl->ctx_dec, len,
+                                nonce, ssl->in_ctr, 13,
+                                ssl->in_msg + 8 + len,
+                                ssl->in_msg + 8, ssl->in_msg );
+    }
+    else
+#endif
+#if defined(POLARSSL_CHACHAPOLY_C)
+    if( ssl->session->cipher == SSL_EDH_RSA_CHACHA20_POLY1305_SHA256 )
+    {
+        len = ssl->in_msglen - 16;
+
+        memcpy( nonce, ssl->iv_dec, 12 );
+
+        for( i = 0; i < 8; i++ )
+            nonce[4 + i] ^= ssl->in_ctr[i];
+
+        ssl->in_hdr[3] = (unsigned char)( len >> 8 );
+        ssl->in_hdr[4] = (unsigned char)( len      );
+
+        ret = chachapoly_auth_decrypt( (chachapoly_context *) ssl->ctx_dec,
+                                       len, nonce, ssl->in_ctr, 13,
+                                       ssl->in_msg + len,
+                                       ssl->in_msg, ssl->in_msg );
+    }
+    else
+#endif
+        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+
+    if( ret != 0 )
+    {
+        SSL_DEBUG_MSG( 1, ( "message authentication failed" ) );
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
+    }
+
+    ssl->in_msglen = len;
+
+    return( 0 );
+}
+
 /*
  * Encryption/decryption functions
  */ 
@@ -493,6 +757,19 @@ static int ssl_encrypt_buf( ssl_context *ssl )
 
     SSL_DEBUG_MSG( 2, ( "=> encrypt buf" ) );
 
+    /*
+     * Only the AEAD ciphersuites come without a MAC
+     */
+    if( ssl->maclen == 0 )
+    {
+        if( ( i = ssl_encrypt_aead( ssl ) ) != 0 )
+            return( i );
+
+        SSL_DEBUG_MSG( 2, ( "<= encrypt buf" ) );
+
+        return( 0 );
+    }
+
     /*
      * Add MAC then encrypt
      */
@@ -567,10 +844,10 @@ static int ssl_encrypt_buf( ssl_context *ssl )
         enc_msg = ssl->out_msg;
 
         /*
-         * Prepend per-record IV for block cipher in TLS v1.1 as per
-         * Method 1 (6.2.3.2. in RFC4346)
+         * Prepend per-record IV for block cipher in TLS v1.1 and up as
+         * per Method 1 (6.2.3.2. in RFC4346)
          */
-        if( ssl->minor_ver == SSL_MINOR_VERSION_2 )
+        if( ssl->minor_ver >= SSL_MINOR_VERSION_2 )
         {
             /*
              * Generate IV
@@ -660,6 +937,14 @@ static int ssl_decrypt_buf( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_INVALID_MAC );
     }
 
+    if( ssl->maclen == 0 )
+    {
+        if( ( i = ssl_decrypt_aead( ssl ) ) != 0 )
+            return( i );
+
+        goto check_empty;
+    }
+
     if( ssl->ivlen == 0 )
     {
 #if defined(POLARSSL_ARC4_C)
@@ -692,9 +977,9 @@ static int ssl_decrypt_buf( ssl_context *ssl )
         dec_msg_result = ssl->in_msg;
 
         /*
-         * Initialize for prepended IV for block cipher in TLS v1.1
+         * Initialize for prepended IV for block cipher in TLS v1.1 and up
          */
-        if( ssl->minor_ver == SSL_MINOR_VERSION_2 )
+        if( ssl->minor_ver >= SSL_MINOR_VERSION_2 )
         {
             dec_msg += ssl->ivlen;
             dec_msglen -= ssl->ivlen;
@@ -829,6 +1114,8 @@ static int ssl_decrypt_buf( ssl_context *ssl )
     if( ssl->ivlen != 0 && padlen == 0 )
         return( POLARSSL_ERR_SSL_INVALID_MAC );
 
+check_empty:
+
     if( ssl->in_msglen == 0 )
     {
         ssl->nb_zero++;
@@ -915,6 +1202,18 @@ int ssl_flush_output( ssl_context *ssl )
     return( 0 );
 }
 
+/*
+ * Add a handshake message to the Finished checksums.  Which of them gets
+ * used isn't known until the version and ciphersuite are agreed on.
+ */
+void ssl_update_checksum( ssl_context *ssl, unsigned char *buf, int len )
+{
+     md5_update( &ssl->fin_md5 , buf, len );
+    sha1_update( &ssl->fin_sha1, buf, len );
+    sha2_update( &ssl->fin_sha2, buf, len );
+    sha4_update( &ssl->fin_sha4, buf, len );
+}
+
 /*
  * Record layer functions
  */
@@ -936,8 +1235,7 @@ int ssl_write_record( ssl_context *ssl )
         ssl->out_msg[2] = (unsigned char)( ( len - 4 ) >>  8 );
         ssl->out_msg[3] = (unsigned char)( ( len - 4 )       );
 
-         md5_update( &ssl->fin_md5 , ssl->out_msg, len );
-        sha1_update( &ssl->fin_sha1, ssl->out_msg, len );
+        ssl_update_checksum( ssl, ssl->out_msg, len );
     }
 
     if( ssl->do_crypt != 0 )
@@ -1010,8 +1308,7 @@ int ssl_read_record( ssl_context *ssl )
             return( POLARSSL_ERR_SSL_INVALID_RECORD );
         }
 
-         md5_update( &ssl->fin_md5 , ssl->in_msg, ssl->in_hslen );
-        sha1_update( &ssl->fin_sha1, ssl->in_msg, ssl->in_hslen );
+        ssl_update_checksum( ssl, ssl->in_msg, ssl->in_hslen );
 
         return( 0 );
     }
@@ -1077,7 +1374,7 @@ int ssl_read_record( ssl_context *ssl )
         /*
          * TLS encrypted messages can have up to 256 bytes of padding
          */
-        if( ssl->minor_ver == SSL_MINOR_VERSION_1 &&
+        if( ssl->minor_ver >= SSL_MINOR_VERSION_1 &&
             ssl->in_msglen > ssl->minlen + SSL_MAX_CONTENT_LEN + 256 )
         {
             SSL_DEBUG_MSG( 1, ( "bad message length" ) );
@@ -1139,8 +1436,7 @@ int ssl_read_record( ssl_context *ssl )
             return( POLARSSL_ERR_SSL_INVALID_RECORD );
         }
 
-         md5_update( &ssl->fin_md5 , ssl->in_msg, ssl->in_hslen );
-        sha1_update( &ssl->fin_sha1, ssl->in_msg, ssl->in_hslen );
+        ssl_update_checksum( ssl, ssl->in_msg, ssl->in_hslen );
     }
 
     if( ssl->in_msgtype == SSL_MSG_ALERT )
@@ -1477,11 +1773,12 @@ int ssl_parse_change_cipher_spec( ssl_context *ssl )
 
 static void ssl_calc_finished(
                 ssl_context *ssl, unsigned char *buf, int from,
-                md5_context *md5, sha1_context *sha1 )
+                md5_context *md5, sha1_context *sha1,
+                sha2_context *sha2, sha4_context *sha4 )
 {
-    int len = 12;
+    int len = 12, hlen;
     char *sender;
-    unsigned char padbuf[48];
+    unsigned char padbuf[64];
     unsigned char md5sum[16];
     unsigned char sha1sum[20];
 
@@ -1498,6 +1795,11 @@ static void ssl_calc_finished(
      * TLSv1:
      *   hash = PRF( master, finished_label,
      *               MD5( handshake ) + SHA1( handshake ) )[0..11]
+     *
+     * TLSv1.2:
+     *   hash = PRF( master, finished_label,
+     *               SHA256( handshake ) )[0..11]
+     *   (SHA384 with the SHA384 PRF)
      */
 
     SSL_DEBUG_BUF( 4, "finished  md5 state", (unsigned char *)
@@ -1539,6 +1841,26 @@ static void ssl_calc_finished(
 
         len += 24;
     }
+    else if( ssl->minor_ver == SSL_MINOR_VERSION_3 )
+    {
+        sender = ( from == SSL_IS_CLIENT )
+                 ? (char *) "client finished"
+                 : (char *) "server finished";
+
+        if( ssl_cipher_is_sha384( ssl->session->cipher ) )
+        {
+            sha4_finish( sha4, padbuf );
+            hlen = 48;
+        }
+        else
+        {
+            sha2_finish( sha2, padbuf );
+            hlen = 32;
+        }
+
+        ssl_prf( ssl, ssl->session->master, 48, sender,
+                 padbuf, hlen, buf, len );
+    }
     else
     {
         sender = ( from == SSL_IS_CLIENT )
@@ -1556,6 +1878,8 @@ static void ssl_calc_finished(
 
     memset(  md5, 0, sizeof(  md5_context ) );
     memset( sha1, 0, sizeof( sha1_context ) );
+    memset( sha2, 0, sizeof( sha2_context ) );
+    memset( sha4, 0, sizeof( sha4_context ) );
 
     memset(  padbuf, 0, sizeof(  padbuf ) );
     memset(  md5sum, 0, sizeof(  md5sum ) );
@@ -1569,14 +1893,18 @@ int ssl_write_finished( ssl_context *ssl )
     int ret, hash_len;
      md5_context  md5;
     sha1_context sha1;
+    sha2_context sha2;
+    sha4_context sha4;
 
     SSL_DEBUG_MSG( 2, ( "=> write finished" ) );
 
     memcpy( &md5 , &ssl->fin_md5 , sizeof(  md5_context ) );
     memcpy( &sha1, &ssl->fin_sha1, sizeof( sha1_context ) );
+    memcpy( &sha2, &ssl->fin_sha2, sizeof( sha2_context ) );
+    memcpy( &sha4, &ssl->fin_sha4, sizeof( sha4_context ) );
 
     ssl_calc_finished( ssl, ssl->out_msg + 4,
-                       ssl->endpoint, &md5, &sha1 );
+                       ssl->endpoint, &md5, &sha1, &sha2, &sha4 );
 
     hash_len = ( ssl->minor_ver == SSL_MINOR_VERSION_0 ) ? 36 : 12;
 
@@ -1616,12 +1944,16 @@ int ssl_parse_finished( ssl_context *ssl )
     int ret, hash_len;
      md5_context  md5;
     sha1_context sha1;
+    sha2_context sha2;
+    sha4_context sha4;
     unsigned char buf[36];
 
     SSL_DEBUG_MSG( 2, ( "=> parse finished" ) );
 
     memcpy( &md5 , &ssl->fin_md5 , sizeof(  md5_context ) );
     memcpy( &sha1, &ssl->fin_sha1, sizeof( sha1_context ) );
+    memcpy( &sha2, &ssl->fin_sha2, sizeof( sha2_context ) );
+    memcpy( &sha4, &ssl->fin_sha4, sizeof( sha4_context ) );
 
     ssl->do_crypt = 1;
 
@@ -1646,7 +1978,8 @@ int ssl_parse_finished( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_HS_FINISHED );
     }
 
-    ssl_calc_finished( ssl, buf, ssl->endpoint ^ 1, &md5, &sha1 );
+    ssl_calc_finished( ssl, buf, ssl->endpoint ^ 1,
+                       &md5, &sha1, &sha2, &sha4 );
 
     if( memcmp( ssl->in_msg + 4, buf, hash_len ) != 0 )
     {
@@ -1708,6 +2041,8 @@ int ssl_init( ssl_context *ssl )
 
      md5_starts( &ssl->fin_md5  );
     sha1_starts( &ssl->fin_sha1 );
+    sha2_starts( &ssl->fin_sha2, 0 );
+    sha4_starts( &ssl->fin_sha4, 1 );
 
     return( 0 );
 }
@@ -1751,6 +2086,13 @@ void ssl_set_bio( ssl_context *ssl,
     ssl->p_send     = p_send;
 }
 
+void ssl_set_async( ssl_context *ssl,
+        int (*f_async)(void *, int (*)(void *), void *), void *p_async )
+{
+    ssl->f_async    = f_async;
+    ssl->p_async    = p_async;
+}
+
 void ssl_set_scb( ssl_context *ssl,
                   int (*s_get)(ssl_context *),
                   int (*s_set)(ssl_context *) )
@@ -1883,6 +2225,25 @@ const char *ssl_get_cipher( const ssl_context *ssl )
             return( "SSL_EDH_RSA_CAMELLIA_256_SHA" );
 #endif
 
+#if defined(POLARSSL_GCM_C)
+        case SSL_RSA_AES_128_GCM_SHA256:
+            return( "SSL_RSA_AES_128_GCM_SHA256" );
+
+        case SSL_RSA_AES_256_GCM_SHA384:
+            return( "SSL_RSA_AES_256_GCM_SHA384" );
+
+        case SSL_EDH_RSA_AES_128_GCM_SHA256:
+            return( "SSL_EDH_RSA_AES_128_GCM_SHA256" );
+
+        case SSL_EDH_RSA_AES_256_GCM_SHA384:
+            return( "SSL_EDH_RSA_AES_256_GCM_SHA384" );
+#endif
+
+#if defined(POLARSSL_CHACHAPOLY_C)
+        case SSL_EDH_RSA_CHACHA20_POLY1305_SHA256:
+            return( "SSL_EDH_RSA_CHACHA20_POLY1305_SHA256" );
+#endif
+
     default:
         break;
     }
@@ -1893,6 +2254,13 @@ const char *ssl_get_cipher( const ssl_context *ssl )
 int ssl_default_ciphers[] =
 {
 #if defined(POLARSSL_DHM_C)
+#if defined(POLARSSL_GCM_C)
+    SSL_EDH_RSA_AES_128_GCM_SHA256,
+    SSL_EDH_RSA_AES_256_GCM_SHA384,
+#endif
+#if defined(POLARSSL_CHACHAPOLY_C)
+    SSL_EDH_RSA_CHACHA20_POLY1305_SHA256,
+#endif
 #if defined(POLARSSL_AES_C)
     SSL_EDH_RSA_AES_128_SHA,
     SSL_EDH_RSA_AES_256_SHA,
@@ -1906,6 +2274,10 @@ int ssl_default_ciphers[] =
 #endif
 #endif
 
+#if defined(POLARSSL_GCM_C)
+    SSL_RSA_AES_128_GCM_SHA256,
+    SSL_RSA_AES_256_GCM_SHA384,
+#endif
 #if defined(POLARSSL_AES_C)
     SSL_RSA_AES_256_SHA,
 #endif
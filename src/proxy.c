@@ -33,26 +33,82 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <netdb.h>
 #include <dbg.h>
 #include <proxy.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <mem/halloc.h>
 #include <connection.h>
+#include <request.h>
 #include <http11/httpclient_parser.h>
+#include <task/task.h>
+#include <adt/wheel.h>
+#include "tnetstrings.h"
+#include "tnetstrings_impl.h"
 
 int PROXY_READ_RETRIES = 100;
 int PROXY_READ_RETRY_WARN = 10;
+int PROXY_POOL_IDLE = 8;
+int PROXY_POOL_MAX_AGE = 60;
+int PROXY_MAX_FAILS = 3;
+int PROXY_HEALTH_INTERVAL = 5;
+
+static Proxy *PROXIES = NULL;
+
+#define PROXY_PROBE_STACK (16 * 1024)
+
+struct tagbstring PROXY_HEADERS = bsStatic("86:6:server,4:port,5:state,11:outstanding,4:idle,5:dials,6:reuses,9:evictions,8:failures,]");
+
+struct tagbstring PROXY_HASH_PATH = bsStatic("path");
+
+#define ProxyUpstream_usable(U) ((U)->enabled && (U)->healthy)
+
+static inline void ProxyUpstream_drop_idle(ProxyUpstream *up)
+{
+    int i = 0;
+
+    for(i = 0; i < up->idle_count; i++) {
+        IOBuf_destroy(up->idle[i].iob);
+    }
+
+    up->idle_count = 0;
+}
+
+static inline void Proxy_unlink(Proxy *proxy)
+{
+    if(proxy->prev_proxy) {
+        proxy->prev_proxy->next_proxy = proxy->next_proxy;
+    } else if(PROXIES == proxy) {
+        PROXIES = proxy->next_proxy;
+    }
+
+    if(proxy->next_proxy) proxy->next_proxy->prev_proxy = proxy->prev_proxy;
+
+    proxy->next_proxy = proxy->prev_proxy = NULL;
+}
 
 void Proxy_destroy(Proxy *proxy)
 {
+    int i = 0;
+
     if(proxy) {
+        for(i = 0; i < proxy->upstream_count; i++) {
+            ProxyUpstream_drop_idle(proxy->upstreams[i]);
+            bdestroy(proxy->upstreams[i]->server);
+            if(proxy->upstreams[i]->addrs) freeaddrinfo(proxy->upstreams[i]->addrs);
+        }
+
+        Proxy_unlink(proxy);
+
         if(proxy->server) bdestroy(proxy->server);
+        if(proxy->hash_on) bdestroy(proxy->hash_on);
         h_free(proxy);
     }
 }
@@ -64,7 +120,12 @@ Proxy *Proxy_create(bstring server, int port)
     
     proxy->server = server;
     proxy->port = port;
-    proxy->running = 1;
+    proxy->balance = PROXY_ROUND_ROBIN;
+
+    check(Proxy_add_upstream(proxy, bstrcpy(server), port) == 0,
+            "Failed to add %s:%d as an upstream.", bdata(server), port);
+
+    Proxy_start(proxy);
 
     return proxy;
 
@@ -73,6 +134,674 @@ error:
     return NULL;
 }
 
+/**
+ * Puts the proxy (back) on the list that status, the upstream command
+ * and the health checks go through.
+ */
+void Proxy_start(Proxy *proxy)
+{
+    proxy->running = 1;
+
+    if(PROXIES != proxy && proxy->prev_proxy == NULL) {
+        proxy->next_proxy = PROXIES;
+        if(PROXIES) PROXIES->prev_proxy = proxy;
+        PROXIES = proxy;
+    }
+}
+
+/**
+ * Takes a proxy a reload has dropped off that list.  Connections still
+ * on it finish normally, and it goes back with Proxy_start if a later
+ * config has it again.
+ */
+void Proxy_stop(Proxy *proxy)
+{
+    proxy->running = 0;
+    Proxy_unlink(proxy);
+}
+
+/*
+ * FNV alone hardly moves for keys that only differ at the end, like the
+ * ring points and most paths, so they'd bunch up on a few spots of the
+ * ring.  Murmur3's finalizer spreads them back out.
+ */
+static inline uint32_t Proxy_hash(bstring key)
+{
+    uint32_t hash = bstr_hash_fun(key);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static int ProxyRingPoint_compare(const void *a, const void *b)
+{
+    uint32_t ha = ((ProxyRingPoint *)a)->hash;
+    uint32_t hb = ((ProxyRingPoint *)b)->hash;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+/*
+ * Every upstream gets PROXY_RING_POINTS spots on the ring so that taking
+ * one out only moves the keys that landed on it.
+ */
+static int Proxy_build_ring(Proxy *proxy)
+{
+    int i = 0;
+    int j = 0;
+    ProxyRingPoint *ring = NULL;
+    ProxyUpstream *up = NULL;
+
+    ring = h_realloc(proxy->ring, sizeof(ProxyRingPoint) * PROXY_RING_POINTS * proxy->upstream_count);
+    check_mem(ring);
+    if(proxy->ring == NULL) hattach(ring, proxy);
+    proxy->ring = ring;
+    proxy->ring_count = 0;
+
+    for(i = 0; i < proxy->upstream_count; i++) {
+        up = proxy->upstreams[i];
+
+        for(j = 0; j < PROXY_RING_POINTS; j++) {
+            bstring point = bformat("%s:%d-%d", bdata(up->server), up->port, j);
+            check_mem(point);
+
+            ring[proxy->ring_count].hash = Proxy_hash(point);
+            ring[proxy->ring_count].upstream = up;
+            proxy->ring_count++;
+
+            bdestroy(point);
+        }
+    }
+
+    qsort(ring, proxy->ring_count, sizeof(ProxyRingPoint), ProxyRingPoint_compare);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Adds another upstream that requests for this proxy are balanced over.
+ * The proxy owns the server string after this.
+ */
+int Proxy_add_upstream(Proxy *proxy, bstring server, int port)
+{
+    ProxyUpstream *up = NULL;
+    ProxyUpstream **upstreams = NULL;
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+    char service[6] = {0};
+    int rc = 0;
+
+    check(server != NULL, "Upstream needs a server.");
+    check(port > 0, "Invalid port %d for upstream %s.", port, bdata(server));
+
+    up = h_calloc(sizeof(ProxyUpstream), 1);
+    check_mem(up);
+    hattach(up, proxy);
+
+    up->server = server;
+    up->port = port;
+    up->enabled = 1;
+    up->healthy = 1;
+
+    // this happens while loading the config, which blocks anyway
+    snprintf(service, sizeof(service), "%d", port);
+    rc = getaddrinfo(bdata(server), service, &hints, &up->addrs);
+    if(rc != 0) {
+        log_warn("Can't look up proxy upstream %s:%d (%s), its health checks will fail.",
+                bdata(server), port, gai_strerror(rc));
+        up->addrs = NULL;
+    }
+
+    upstreams = h_realloc(proxy->upstreams, sizeof(ProxyUpstream *) * (proxy->upstream_count + 1));
+    check_mem(upstreams);
+    if(proxy->upstreams == NULL) hattach(upstreams, proxy);
+    proxy->upstreams = upstreams;
+    proxy->upstreams[proxy->upstream_count++] = up;
+
+    return Proxy_build_ring(proxy);
+
+error:
+    if(up) h_free(up);
+    bdestroy(server);
+    return -1;
+}
+
+/**
+ * Adds a comma separated list of host:port upstreams, where a missing
+ * port means the same port as the proxy.
+ */
+int Proxy_add_upstreams(Proxy *proxy, const char *upstreams)
+{
+    struct bstrList *list = NULL;
+    bstring server = NULL;
+    int i = 0;
+    int port = 0;
+    int colon = 0;
+
+    if(upstreams == NULL || upstreams[0] == '\0') return 0;
+
+    server = bfromcstr(upstreams);
+    list = bsplit(server, ',');
+    bdestroy(server);
+    check_mem(list);
+
+    for(i = 0; i < list->qty; i++) {
+        btrimws(list->entry[i]);
+        if(blength(list->entry[i]) == 0) continue;
+
+        colon = bstrrchr(list->entry[i], ':');
+        port = colon == BSTR_ERR ? proxy->port : atoi((char *)list->entry[i]->data + colon + 1);
+        server = colon == BSTR_ERR ? bstrcpy(list->entry[i]) : bmidstr(list->entry[i], 0, colon);
+
+        check(Proxy_add_upstream(proxy, server, port) == 0,
+                "Invalid upstream '%s'.", bdata(list->entry[i]));
+    }
+
+    bstrListDestroy(list);
+    return 0;
+
+error:
+    bstrListDestroy(list);
+    return -1;
+}
+
+/**
+ * Sets how upstreams are picked: roundrobin (the default), least (fewest
+ * outstanding requests), or hash (consistent hash of the path, or of the
+ * header named by hash_on).
+ */
+int Proxy_set_balance(Proxy *proxy, const char *balance, const char *hash_on)
+{
+    if(balance == NULL || balance[0] == '\0' || strcmp(balance, "roundrobin") == 0) {
+        proxy->balance = PROXY_ROUND_ROBIN;
+    } else if(strcmp(balance, "least") == 0) {
+        proxy->balance = PROXY_LEAST_CONN;
+    } else if(strcmp(balance, "hash") == 0) {
+        proxy->balance = PROXY_HASH;
+    } else {
+        sentinel("Invalid proxy balance '%s', expected roundrobin, least or hash.", balance);
+    }
+
+    if(proxy->hash_on) bdestroy(proxy->hash_on);
+    proxy->hash_on = bfromcstr(hash_on != NULL && hash_on[0] != '\0' ? hash_on : "path");
+    check_mem(proxy->hash_on);
+
+    // headers are stored lower case
+    btolower(proxy->hash_on);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+static inline ProxyUpstream *Proxy_next_usable(Proxy *proxy, ProxyUpstream *avoid, int healthy)
+{
+    int i = 0;
+    ProxyUpstream *up = NULL;
+
+    for(i = 0; i < proxy->upstream_count; i++) {
+        up = proxy->upstreams[proxy->next++ % proxy->upstream_count];
+
+        if(up != avoid && up->enabled && (up->healthy || !healthy)) return up;
+    }
+
+    return NULL;
+}
+
+static inline ProxyUpstream *Proxy_least_outstanding(Proxy *proxy, ProxyUpstream *avoid)
+{
+    int i = 0;
+    ProxyUpstream *up = NULL;
+    ProxyUpstream *best = NULL;
+
+    // start where the last pick left off so ties get spread around
+    unsigned int start = proxy->next++;
+
+    for(i = 0; i < proxy->upstream_count; i++) {
+        up = proxy->upstreams[(start + i) % proxy->upstream_count];
+
+        if(up != avoid && ProxyUpstream_usable(up) &&
+                (best == NULL || up->outstanding < best->outstanding))
+        {
+            best = up;
+        }
+    }
+
+    return best;
+}
+
+static inline ProxyUpstream *Proxy_hashed(Proxy *proxy, struct Request *req, ProxyUpstream *avoid)
+{
+    bstring key = NULL;
+    uint32_t hash = 0;
+    int low = 0;
+    int high = proxy->ring_count;
+    int mid = 0;
+    int i = 0;
+    ProxyUpstream *up = NULL;
+
+    if(req == NULL) return NULL;
+
+    key = biseq(proxy->hash_on, &PROXY_HASH_PATH) ? Request_path(req) : Request_get(req, proxy->hash_on);
+    if(key == NULL) return NULL;
+
+    hash = Proxy_hash(key);
+
+    // first point at or after the hash, wrapping around the end
+    while(low < high) {
+        mid = (low + high) / 2;
+
+        if(proxy->ring[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for(i = 0; i < proxy->ring_count; i++) {
+        up = proxy->ring[(low + i) % proxy->ring_count].upstream;
+        if(up != avoid && ProxyUpstream_usable(up)) return up;
+    }
+
+    return NULL;
+}
+
+/**
+ * Picks the upstream for this request, skipping avoid (the one that just
+ * failed to connect) and anything that's down or disabled.  If every
+ * enabled upstream is down it fails open and tries them anyway, since
+ * a health check that's wrong shouldn't take the whole proxy out.
+ */
+ProxyUpstream *Proxy_select(Proxy *proxy, struct Request *req, ProxyUpstream *avoid)
+{
+    ProxyUpstream *up = NULL;
+
+    if(proxy->upstream_count == 1) {
+        up = proxy->upstreams[0];
+        return up != avoid && up->enabled ? up : NULL;
+    }
+
+    switch(proxy->balance) {
+        case PROXY_LEAST_CONN:
+            up = Proxy_least_outstanding(proxy, avoid);
+            break;
+        case PROXY_HASH:
+            up = Proxy_hashed(proxy, req, avoid);
+            break;
+        default:
+            break;
+    }
+
+    if(up == NULL) up = Proxy_next_usable(proxy, avoid, 1);
+    if(up == NULL) up = Proxy_next_usable(proxy, avoid, 0);
+
+    return up;
+}
+
+/*
+ * An idle backend connection is only good if there's nothing waiting on
+ * it.  A 0 means the backend closed it, and data means it's confused.
+ */
+static inline int Proxy_idle_healthy(IOBuf *iob)
+{
+    char c = 0;
+    int rc = 0;
+
+    if(IOBuf_closed(iob) || IOBuf_avail(iob) > 0) return 0;
+
+    rc = recv(IOBuf_fd(iob), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/**
+ * Gets a connection to the upstream, reusing the most recently released
+ * idle one that's still healthy and not too old, or dialing a new one.
+ * Sets connected to when the socket was first dialed, which you hand
+ * back to ProxyUpstream_release.
+ */
+IOBuf *ProxyUpstream_connect(ProxyUpstream *up, time_t *connected)
+{
+    time_t now = time(NULL);
+    ProxyIdle *top = NULL;
+    IOBuf *iob = NULL;
+    int fd = -1;
+
+    while(up->idle_count > 0) {
+        top = &up->idle[--up->idle_count];
+
+        if(difftime(now, top->connected) <= PROXY_POOL_MAX_AGE && Proxy_idle_healthy(top->iob)) {
+            up->reuses++;
+            *connected = top->connected;
+            return top->iob;
+        }
+
+        debug("Evicting stale connection to proxy %s:%d", bdata(up->server), up->port);
+        up->evictions++;
+        IOBuf_destroy(top->iob);
+    }
+
+    fd = netdial(1, bdata(up->server), up->port);
+    check(fd != -1, "Failed to connect to proxy backend %s:%d",
+            bdata(up->server), up->port);
+
+    iob = IOBuf_create(BUFFER_SIZE, fd, IOBUF_SOCKET);
+    check_mem(iob);
+
+    up->dials++;
+    *connected = now;
+    return iob;
+
+error:
+    if(!iob && fd != -1) fdclose(fd);
+    return NULL;
+}
+
+/**
+ * Hands a backend connection back.  If it's reusable (the response was
+ * keep-alive and fully read) it goes on the idle pool, otherwise or if
+ * the pool is full it's closed.
+ */
+void ProxyUpstream_release(ProxyUpstream *up, IOBuf *iob, time_t connected, int reusable)
+{
+    if(!iob) return;
+
+    reusable = reusable && up->enabled && PROXY_POOL_IDLE > 0 && !IOBuf_closed(iob) &&
+        IOBuf_avail(iob) == 0 && difftime(time(NULL), connected) <= PROXY_POOL_MAX_AGE;
+
+    if(reusable && up->idle == NULL) {
+        up->idle = h_calloc(sizeof(ProxyIdle), PROXY_POOL_IDLE);
+        check_mem(up->idle);
+        hattach(up->idle, up);
+    }
+
+    if(reusable && up->idle_count < PROXY_POOL_IDLE) {
+        up->idle[up->idle_count].iob = iob;
+        up->idle[up->idle_count].connected = connected;
+        up->idle_count++;
+        return;
+    }
+
+    if(reusable) up->evictions++;
+
+error: // fallthrough
+    IOBuf_destroy(iob);
+}
+
+/**
+ * Passive health: an upstream that fails PROXY_MAX_FAILS times in a row
+ * is taken out of rotation until a request or health check gets through.
+ */
+void ProxyUpstream_failed(ProxyUpstream *up)
+{
+    up->failures++;
+
+    if(up->healthy && up->failures >= PROXY_MAX_FAILS) {
+        log_warn("Proxy upstream %s:%d failed %d times, taking it out of rotation.",
+                bdata(up->server), up->port, up->failures);
+        up->healthy = 0;
+        ProxyUpstream_drop_idle(up);
+    }
+}
+
+void ProxyUpstream_ok(ProxyUpstream *up)
+{
+    up->failures = 0;
+
+    if(!up->healthy) {
+        log_info("Proxy upstream %s:%d is back, putting it in rotation.",
+                bdata(up->server), up->port);
+        up->healthy = 1;
+    }
+}
+
+/**
+ * Takes every upstream matching server and port (0 for any port) in or
+ * out of rotation, and returns how many matched.  Requests already on a
+ * disabled upstream finish, but its connections aren't pooled anymore.
+ */
+int Proxy_set_enabled(bstring server, int port, int enabled)
+{
+    Proxy *proxy = NULL;
+    ProxyUpstream *up = NULL;
+    int i = 0;
+    int count = 0;
+
+    for(proxy = PROXIES; proxy != NULL; proxy = proxy->next_proxy) {
+        for(i = 0; i < proxy->upstream_count; i++) {
+            up = proxy->upstreams[i];
+
+            if(biseq(up->server, server) && (port <= 0 || up->port == port)) {
+                up->enabled = enabled;
+                if(!enabled) ProxyUpstream_drop_idle(up);
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+typedef struct ProxyCheck {
+    Rendez done;
+    int pending;
+    int timeout_ms;
+} ProxyCheck;
+
+typedef struct ProxyProbe {
+    ProxyUpstream *up;
+    ProxyCheck *check;
+    wheel_timer_t timer;
+    int fd;
+    int ok;
+} ProxyProbe;
+
+/*
+ * Starts a non-blocking connect to the probe's upstream, trying each of
+ * its addresses like netdial does.  Leaves fd -1 if it already failed,
+ * and sets ok if it got through right away.
+ */
+static void ProxyProbe_connect(ProxyProbe *probe)
+{
+    struct addrinfo *addr = NULL;
+    int rc = 0;
+
+    probe->fd = -1;
+    probe->ok = 0;
+
+    for(addr = probe->up->addrs; addr != NULL && probe->fd == -1; addr = addr->ai_next) {
+        probe->fd = socket(addr->ai_family, SOCK_STREAM, addr->ai_protocol);
+        if(probe->fd == -1) continue;
+
+        fdnoblock(probe->fd);
+        rc = connect(probe->fd, addr->ai_addr, addr->ai_addrlen);
+
+        if(rc == 0) {
+            probe->ok = 1;
+        } else if(errno != EINPROGRESS) {
+            close(probe->fd);
+            probe->fd = -1;
+        }
+    }
+}
+
+// a hangup wakes the probe's fdwait, and the connect comes out failed
+static void ProxyProbe_timeout(wheel_timer_t *timer)
+{
+    ProxyProbe *probe = timer->data;
+
+    if(probe->fd != -1) shutdown(probe->fd, SHUT_RDWR);
+}
+
+static void ProxyProbe_task(void *v)
+{
+    ProxyProbe *probe = v;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    taskname("ProxyProbe");
+
+    wheel_timer_init(&probe->timer, ProxyProbe_timeout, probe);
+    tasktimer(&probe->timer, probe->check->timeout_ms);
+
+    if(fdwait(probe->fd, 'w') == 0) {
+        probe->ok = getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+    }
+
+    tasktimercancel(&probe->timer);
+    fdclose(probe->fd);
+    probe->fd = -1;
+
+    if(--probe->check->pending == 0) taskwakeup(&probe->check->done);
+}
+
+static inline int Proxy_has_upstream(ProxyUpstream *up)
+{
+    Proxy *proxy = NULL;
+    int i = 0;
+
+    for(proxy = PROXIES; proxy != NULL; proxy = proxy->next_proxy) {
+        for(i = 0; i < proxy->upstream_count; i++) {
+            if(proxy->upstreams[i] == up) return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Dials every enabled upstream at once, each from its own task, and gives
+ * them all timeout_ms to answer, so a blackholed one only costs its own
+ * probe the timeout instead of holding up everyone else's.  Returns how
+ * many it probed.
+ */
+int Proxy_health_check(int timeout_ms)
+{
+    Proxy *proxy = NULL;
+    ProxyUpstream *up = NULL;
+    ProxyProbe *probes = NULL;
+    ProxyCheck check;
+    int count = 0;
+    int i = 0;
+
+    memset(&check, 0, sizeof(check));
+    check.timeout_ms = timeout_ms;
+
+    for(proxy = PROXIES; proxy != NULL; proxy = proxy->next_proxy) {
+        count += proxy->upstream_count;
+    }
+
+    if(count == 0) return 0;
+
+    probes = calloc(count, sizeof(ProxyProbe));
+    check_mem(probes);
+    count = 0;
+
+    for(proxy = PROXIES; proxy != NULL; proxy = proxy->next_proxy) {
+        if(!proxy->running) continue;
+
+        for(i = 0; i < proxy->upstream_count; i++) {
+            if(!proxy->upstreams[i]->enabled) continue;
+
+            probes[count].up = proxy->upstreams[i];
+            probes[count].check = &check;
+            ProxyProbe_connect(&probes[count]);
+            count++;
+        }
+    }
+
+    // only the ones still connecting need a task to wait on them
+    for(i = 0; i < count; i++) {
+        if(probes[i].fd != -1 && !probes[i].ok) {
+            check.pending++;
+            taskcreate(ProxyProbe_task, &probes[i], PROXY_PROBE_STACK);
+        } else if(probes[i].fd != -1) {
+            close(probes[i].fd);
+            probes[i].fd = -1;
+        }
+    }
+
+    while(check.pending > 0) {
+        tasksleep(&check.done);
+    }
+
+    for(i = 0; i < count; i++) {
+        // a reload can take the upstream away while we wait
+        up = probes[i].up;
+        if(!Proxy_has_upstream(up)) continue;
+
+        if(probes[i].ok) {
+            ProxyUpstream_ok(up);
+        } else {
+            // one failed probe is enough to take it out
+            if(up->failures < PROXY_MAX_FAILS) up->failures = PROXY_MAX_FAILS - 1;
+            ProxyUpstream_failed(up);
+        }
+    }
+
+    free(probes);
+    return count;
+
+error:
+    return -1;
+}
+
+static void Proxy_health_task(void *v)
+{
+    while(1) {
+        taskdelay(PROXY_HEALTH_INTERVAL * 1000);
+        Proxy_health_check(PROXY_HEALTH_INTERVAL * 1000);
+    }
+}
+
+/**
+ * Starts the task that dials every upstream each limits.proxy_health_interval
+ * seconds, which is how a downed upstream gets back into rotation.  A probe
+ * that hasn't connected within the interval counts as a failure.
+ */
+void Proxy_health_start()
+{
+    if(PROXY_HEALTH_INTERVAL > 0) {
+        taskcreate(Proxy_health_task, NULL, 32 * 1024);
+    }
+}
+
+tns_value_t *Proxy_info()
+{
+    Proxy *proxy = NULL;
+    ProxyUpstream *up = NULL;
+    int i = 0;
+    tns_value_t *rows = tns_new_list();
+
+    for(proxy = PROXIES; proxy != NULL; proxy = proxy->next_proxy) {
+        for(i = 0; i < proxy->upstream_count; i++) {
+            tns_value_t *data = tns_new_list();
+            up = proxy->upstreams[i];
+
+            tns_list_addstr(data, up->server);
+            tns_add_to_list(data, tns_new_integer(up->port));
+            tns_add_to_list(data, tns_parse_string(!up->enabled ? "disabled" : up->healthy ? "up" : "down",
+                        !up->enabled ? 8 : up->healthy ? 2 : 4));
+            tns_add_to_list(data, tns_new_integer(up->outstanding));
+            tns_add_to_list(data, tns_new_integer(up->idle_count));
+            tns_add_to_list(data, tns_new_integer(up->dials));
+            tns_add_to_list(data, tns_new_integer(up->reuses));
+            tns_add_to_list(data, tns_new_integer(up->evictions));
+            tns_add_to_list(data, tns_new_integer(up->failures));
+            tns_add_to_list(rows, data);
+        }
+    }
+
+    return tns_standard_table(&PROXY_HEADERS, rows);
+}
+
 int Proxy_read_and_parse(Connection *conn)
 {
     int avail = 0;
@@ -95,9 +824,7 @@ int Proxy_read_and_parse(Connection *conn)
         check(nparsed != -1, "Major parsing failure from proxy backend, Tell Zed.");
         check(!httpclient_parser_has_error(conn->client), "Parsing error from server.");
 
-        if(httpclient_parser_finish(conn->client) == 0) {
-            fdwait(conn->proxy_iob->fd, 'r');
-        } else {
+        if(httpclient_parser_finish(conn->client) != 0) {
             break;
         }
     }
@@ -169,6 +896,13 @@ int Proxy_stream_to_close(Connection *conn)
 {
     conn->client->close = 1;
 
+    if(IOBuf_can_splice(conn->proxy_iob, conn->iob)) {
+        // runs until the backend closes, without copying any of it
+        check_debug(IOBuf_splice(conn->proxy_iob, conn->iob, INT_MAX) != -1,
+                "Failure splicing proxy stream until closed.");
+        return 0;
+    }
+
     int total = conn->iob->len <= conn->proxy_iob->len ? 
         conn->iob->len : conn->proxy_iob->len;
 
@@ -36,17 +36,106 @@
 #define _proxy_h
 
 #include <bstring.h>
+#include <time.h>
+#include <stdint.h>
+#include <io.h>
+
+enum {
+    PROXY_ROUND_ROBIN = 0,
+    PROXY_LEAST_CONN,
+    PROXY_HASH
+};
+
+#define PROXY_RING_POINTS 64
+
+typedef struct ProxyIdle {
+    IOBuf *iob;
+    time_t connected;
+} ProxyIdle;
+
+struct addrinfo;
+
+typedef struct ProxyUpstream {
+    bstring server;
+    int port;
+    // looked up once when it's added, so the health checks never block on DNS
+    struct addrinfo *addrs;
+
+    // enabled is flipped from the control port, healthy by the checks
+    int enabled;
+    int healthy;
+    int failures;
+    // requests sent to it that haven't had their whole response back
+    int outstanding;
+
+    // keep-alive connections to this upstream, most recently used on top
+    ProxyIdle *idle;
+    int idle_count;
+
+    unsigned long dials;
+    unsigned long reuses;
+    unsigned long evictions;
+} ProxyUpstream;
+
+typedef struct ProxyRingPoint {
+    uint32_t hash;
+    ProxyUpstream *upstream;
+} ProxyRingPoint;
 
 typedef struct Proxy {
     bstring server;
     int port;
     int running;
+
+    int balance;
+    bstring hash_on;
+    unsigned int next;
+
+    ProxyUpstream **upstreams;
+    int upstream_count;
+
+    // consistent hash ring for PROXY_HASH, sorted by hash
+    ProxyRingPoint *ring;
+    int ring_count;
+
+    // every running proxy is on this list for Proxy_info and the health task
+    struct Proxy *next_proxy;
+    struct Proxy *prev_proxy;
 } Proxy;
 
 Proxy *Proxy_create(bstring server, int port);
 
 void Proxy_destroy(Proxy *proxy);
 
+void Proxy_start(Proxy *proxy);
+
+void Proxy_stop(Proxy *proxy);
+
+int Proxy_add_upstream(Proxy *proxy, bstring server, int port);
+
+int Proxy_add_upstreams(Proxy *proxy, const char *upstreams);
+
+int Proxy_set_balance(Proxy *proxy, const char *balance, const char *hash_on);
+
+struct Request;
+ProxyUpstream *Proxy_select(Proxy *proxy, struct Request *req, ProxyUpstream *avoid);
+
+IOBuf *ProxyUpstream_connect(ProxyUpstream *up, time_t *connected);
+
+void ProxyUpstream_release(ProxyUpstream *up, IOBuf *iob, time_t connected, int reusable);
+
+void ProxyUpstream_failed(ProxyUpstream *up);
+
+void ProxyUpstream_ok(ProxyUpstream *up);
+
+int Proxy_set_enabled(bstring server, int port, int enabled);
+
+int Proxy_health_check(int timeout_ms);
+
+void Proxy_health_start();
+
+struct tns_value_t *Proxy_info();
+
 struct Connection;
 int Proxy_stream_response(struct Connection *conn, int total, int nread);
 
@@ -58,5 +147,9 @@ int Proxy_stream_to_close(struct Connection *conn);
 
 extern int PROXY_READ_RETRIES;
 extern int PROXY_READ_RETRY_WARN;
+extern int PROXY_POOL_IDLE;
+extern int PROXY_POOL_MAX_AGE;
+extern int PROXY_MAX_FAILS;
+extern int PROXY_HEALTH_INTERVAL;
 
 #endif
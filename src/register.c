@@ -54,15 +54,153 @@ static darray_t *REG_ID_TO_FD = NULL;
 static uint16_t REG_COUNT = 0;
 static int NUM_REG_FD = 0;
 
+static int MIN_PING = DEFAULT_MIN_PING;
+static int MIN_READ_RATE = DEFAULT_MIN_READ_RATE;
+static int MIN_WRITE_RATE = DEFAULT_MIN_WRITE_RATE;
+static int KILL_LIMIT = DEFAULT_KILL_LIMIT;
+
+static void Register_timeout(wheel_timer_t *timer);
+
+void Register_load_limits()
+{
+    MIN_PING = Setting_get_int("limits.min_ping", DEFAULT_MIN_PING);
+    MIN_READ_RATE = Setting_get_int("limits.min_read_rate", DEFAULT_MIN_READ_RATE);
+    MIN_WRITE_RATE = Setting_get_int("limits.min_write_rate", DEFAULT_MIN_WRITE_RATE);
+    KILL_LIMIT = Setting_get_int("limits.kill_limit", DEFAULT_KILL_LIMIT);
+
+    log_info("MAX limits.min_ping=%d, limits.min_read_rate=%d, limits.min_write_rate=%d, limits.kill_limit=%d",
+            MIN_PING, MIN_READ_RATE, MIN_WRITE_RATE, KILL_LIMIT);
+}
+
 void Register_init()
 {
     THE_CURRENT_TIME_IS = time(NULL);
     REGISTRATIONS = darray_create(sizeof(Registration), MAX_REGISTERED_FDS);
     REG_ID_TO_FD = darray_create(0, MAX_REGISTERED_FDS);
+    Register_load_limits();
+}
+
+#define ZERO_OR_DELTA(N, T) (T == 0 ? T : N - T)
+
+/*
+ * The rules Register_cleanout kills connections with: each of these that
+ * a connection breaks counts, and it dies when more than limits.kill_limit
+ * of them count.
+ */
+static inline int Register_should_kill(Registration *reg, uint32_t now)
+{
+    int last_ping = ZERO_OR_DELTA(now, reg->last_ping);
+    int read_rate = reg->bytes_read / (ZERO_OR_DELTA(now, reg->last_read) + 1);
+    int write_rate = reg->bytes_written / (ZERO_OR_DELTA(now, reg->last_write) + 1);
+    int should_kill = 0;
+
+    debug("Checking fd=%d:conn_id=%d against last_ping: %d, read_rate: %d, write_rate: %d",
+            reg->fd, reg->id, last_ping, read_rate, write_rate);
+
+    // these are weighted so they are not if-else statements
+    if(MIN_PING != 0 && last_ping > MIN_PING) {
+        debug("Connection fd=%d:conn_id=%d over limits.min_ping time: %d < %d",
+                reg->fd, reg->id, MIN_PING, last_ping);
+        should_kill++;
+    }
+
+    if(MIN_READ_RATE != 0 && read_rate < MIN_READ_RATE) {
+        debug("Connection fd=%d:conn_id=%d read rate lower than allowed: %d < %d",
+                reg->fd, reg->id, read_rate, MIN_READ_RATE);
+        should_kill++;
+    }
+
+    if(MIN_WRITE_RATE != 0 && write_rate < MIN_WRITE_RATE) {
+        debug("Connection fd=%d:conn_id=%d write rate lower than allowed: %d < %d",
+                reg->fd, reg->id, write_rate, MIN_WRITE_RATE);
+        should_kill++;
+    }
+
+    return should_kill > KILL_LIMIT;
+}
+
+/*
+ * When a rate of bytes since last (in seconds) first drops under min.
+ * bytes / (now - last + 1) < min works out to now >= last + bytes / min.
+ */
+static inline uint32_t Register_rate_deadline(uint32_t last, uint32_t bytes, int min, uint32_t now)
+{
+    if(min <= 0) {
+        return UINT32_MAX;
+    } else if(last == 0) {
+        // never happened, so the rate is just the bytes and doesn't change
+        return bytes < (uint32_t)min ? now : UINT32_MAX;
+    } else {
+        return last + bytes / min;
+    }
+}
+
+/*
+ * Works out the second Register_should_kill turns true if nothing else
+ * happens on the connection.  Each rule only gets worse as time goes by,
+ * so it's when the kill_limit+1'th of them kicks in.
+ */
+static inline uint32_t Register_deadline(Registration *reg, uint32_t now)
+{
+    uint32_t when[3] = {UINT32_MAX, UINT32_MAX, UINT32_MAX};
+    uint32_t tmp = 0;
+    int limit = KILL_LIMIT < 0 ? 0 : KILL_LIMIT;
+
+    if(limit >= 3) return 0;
+
+    if(MIN_PING != 0 && reg->last_ping != 0) when[0] = reg->last_ping + MIN_PING + 1;
+    when[1] = Register_rate_deadline(reg->last_read, reg->bytes_read, MIN_READ_RATE, now);
+    when[2] = Register_rate_deadline(reg->last_write, reg->bytes_written, MIN_WRITE_RATE, now);
+
+#define SWAP_IF(A, B) if(when[A] > when[B]) { tmp = when[A]; when[A] = when[B]; when[B] = tmp; }
+    SWAP_IF(0, 1); SWAP_IF(1, 2); SWAP_IF(0, 1);
+#undef SWAP_IF
+
+    return when[limit] == UINT32_MAX ? 0 : when[limit];
+}
+
+/*
+ * Moves the connection's timer to its deadline, which every read, write
+ * and ping pushes back.  Most of the time it's the same second as last
+ * time and the timer stays where it is.
+ */
+static inline void Register_arm(Registration *reg)
+{
+    uint32_t now = THE_CURRENT_TIME_IS;
+    uint32_t deadline = Register_deadline(reg, now);
+
+    if(deadline == reg->deadline && wheel_timer_pending(&reg->timer)) return;
+
+    reg->deadline = deadline;
+
+    if(deadline == 0) {
+        tasktimercancel(&reg->timer);
+    } else {
+        tasktimer(&reg->timer, deadline > now ? (deadline - now) * 1000 : 0);
+    }
+}
+
+static void Register_timeout(wheel_timer_t *timer)
+{
+    Registration *reg = timer->data;
+
+    if(!Register_valid(reg)) return;
+
+    if(Register_should_kill(reg, THE_CURRENT_TIME_IS)) {
+        log_warn("Killed fd=%d:conn_id=%d according to min_ping: %d, min_write_rate: %d, min_read_rate: %d",
+                reg->fd, reg->id, MIN_PING, MIN_WRITE_RATE, MIN_READ_RATE);
+        Register_disconnect(reg->fd);
+    } else {
+        // the clock's only good to the second, so it can be a bit early
+        reg->deadline = 0;
+        Register_arm(reg);
+    }
 }
 
 static inline void Register_clear(Registration *reg)
 {
+    tasktimercancel(&reg->timer);
+    reg->deadline = 0;
     reg->data = NULL;
     reg->last_ping = 0;
     reg->bytes_read = 0;
@@ -97,6 +235,9 @@ int Register_connect(int fd, Connection* data)
     reg->data = data;
     reg->last_ping = THE_CURRENT_TIME_IS;
     reg->fd = fd;
+
+    wheel_timer_init(&reg->timer, Register_timeout, reg);
+    Register_arm(reg);
     
     // purposefully want overflow on these
     reg->id = REG_COUNT++;
@@ -147,6 +288,7 @@ int Register_ping(int fd)
     check_debug(Register_valid(reg), "Attempt to ping an FD that isn't registered: %d", fd);
 
     reg->last_ping = THE_CURRENT_TIME_IS;
+    Register_arm(reg);
     return reg->last_ping;
 
 error:
@@ -163,6 +305,7 @@ int Register_read(int fd, uint32_t bytes)
     if(Register_valid(reg)) {
         reg->last_read = THE_CURRENT_TIME_IS;
         reg->bytes_read += bytes;
+        Register_arm(reg);
         return reg->last_read;
     } else {
         return 0;
@@ -182,6 +325,7 @@ int Register_write(int fd, uint32_t bytes)
     if(Register_valid(reg)) {
         reg->last_write = THE_CURRENT_TIME_IS;
         reg->bytes_written += bytes;
+        Register_arm(reg);
         return reg->last_write;
     } else {
         return 0;
@@ -228,9 +372,6 @@ error:
     return -1;
 }
 
-#define ZERO_OR_DELTA(N, T) (T == 0 ? T : N - T)
-
-
 struct tagbstring REGISTER_HEADERS = bsStatic("86:2:id,2:fd,4:type,9:last_ping,9:last_read,10:last_write,10:bytes_read,13:bytes_written,]");
 
 tns_value_t *Register_info()
@@ -264,16 +405,17 @@ tns_value_t *Register_info()
     return tns_standard_table(&REGISTER_HEADERS, rows);
 }
 
+/**
+ * Connections are killed by their timers as soon as they break the rules,
+ * so this is only for when accept is overloaded and wants to clear out
+ * anything it can right now.
+ */
 int Register_cleanout()
 {
     int i = 0;
     int nkilled = 0;
     int nscanned = 0;
-    time_t now = THE_CURRENT_TIME_IS;
-    int min_ping = Setting_get_int("limits.min_ping", DEFAULT_MIN_PING);
-    int min_write_rate = Setting_get_int("limits.min_write_rate", DEFAULT_MIN_READ_RATE);
-    int min_read_rate = Setting_get_int("limits.min_read_rate", DEFAULT_MIN_WRITE_RATE);
-    int kill_limit = Setting_get_int("limits.kill_limit", DEFAULT_KILL_LIMIT);
+    uint32_t now = THE_CURRENT_TIME_IS;
 
     for(i = 0, nscanned = 0; i < darray_max(REGISTRATIONS) && nscanned < NUM_REG_FD; i++) {
         Registration *reg = darray_get(REGISTRATIONS, i);
@@ -281,34 +423,7 @@ int Register_cleanout()
         if(Register_valid(reg)) {
             nscanned++; // avoid scanning the whole array if we've found them all
 
-            int last_ping = ZERO_OR_DELTA(now, reg->last_ping);
-            int read_rate = reg->bytes_read / (ZERO_OR_DELTA(now, reg->last_read) + 1);
-            int write_rate = reg->bytes_written / (ZERO_OR_DELTA(now, reg->last_write) + 1);
-            int should_kill = 0;
-
-            debug("Checking fd=%d:conn_id=%d against last_ping: %d, read_rate: %d, write_rate: %d",
-                    i, reg->id, last_ping, read_rate, write_rate);
-
-            // these are weighted so they are not if-else statements
-            if(min_ping != 0 && last_ping > min_ping) {
-                debug("Connection fd=%d:conn_id=%d over limits.min_ping time: %d < %d",
-                        i, reg->id, min_ping, last_ping);
-                should_kill++;
-            }
-            
-            if(min_read_rate != 0 && read_rate < min_read_rate) {
-                debug("Connection fd=%d:conn_id=%d read rate lower than allowed: %d < %d",
-                        i, reg->id, read_rate, min_read_rate);
-                should_kill++;
-            } 
-
-            if(min_write_rate != 0 && write_rate < min_write_rate) {
-                debug("Connection fd=%d:conn_id=%d write rate lower than allowed: %d < %d",
-                        i, reg->id, write_rate, min_write_rate);
-                should_kill++;
-            }
-
-            if(should_kill > kill_limit) {
+            if(Register_should_kill(reg, now)) {
                 nkilled++;
                 Register_disconnect(i);
             }
@@ -316,7 +431,7 @@ int Register_cleanout()
     }
 
     if(nkilled) {
-        log_warn("Killed %d connections according to min_ping: %d, min_write_rate: %d, min_read_rate: %d", nkilled, min_ping, min_write_rate, min_read_rate);
+        log_warn("Killed %d connections according to min_ping: %d, min_write_rate: %d, min_read_rate: %d", nkilled, MIN_PING, MIN_WRITE_RATE, MIN_READ_RATE);
     }
 
     return nkilled;
@@ -38,6 +38,7 @@
 #include <time.h>
 #include <stdint.h>
 #include <bstring.h>
+#include <adt/wheel.h>
 
 #define MAX_REGISTERED_FDS  64 * 1024
 #define DEFAULT_MIN_PING 120
@@ -57,6 +58,10 @@ typedef struct Registration {
     uint32_t last_write;
     uint32_t bytes_read;
     uint32_t bytes_written;
+
+    // when Register_cleanout's rules would kill it, 0 for never
+    uint32_t deadline;
+    wheel_timer_t timer;
 } Registration;
 
 int Register_connect(int fd, struct Connection *data);
@@ -71,6 +76,8 @@ int Register_write(int fd, uint32_t bytes);
 
 void Register_init();
 
+void Register_load_limits();
+
 struct Connection *Register_fd_exists(int fd);
 
 int Register_id_for_fd(int fd);
@@ -37,8 +37,13 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "setting.h"
 #include "register.h"
 #include "headers.h"
@@ -57,35 +62,135 @@ void Request_init()
 }
 
 
-static hnode_t *req_alloc_hash(void *notused)
+/*
+ * Everything a request parses out lives in its arena, which is just
+ * bumped along while parsing and reset between keep-alive requests.
+ * The first block stays for the life of the Request, more only show up
+ * for huge headers and get freed on the next reset.
+ */
+static void *Request_arena_alloc(Request *req, size_t len)
+{
+    RequestArena *arena = req->arena;
+    void *mem = NULL;
+
+    len = (len + 7) & ~(size_t)7;
+
+    if(arena == NULL || arena->used + len > arena->size) {
+        size_t size = len > REQUEST_ARENA_SIZE ? len : REQUEST_ARENA_SIZE;
+
+        arena = malloc(sizeof(RequestArena) + size);
+        check_mem(arena);
+
+        arena->next = req->arena;
+        arena->used = 0;
+        arena->size = size;
+        req->arena = arena;
+    }
+
+    mem = arena->data + arena->used;
+    arena->used += len;
+    return mem;
+
+error:
+    return NULL;
+}
+
+static inline void Request_arena_reset(Request *req)
+{
+    RequestArena *arena = req->arena;
+
+    while(arena && arena->next) {
+        req->arena = arena->next;
+        free(arena);
+        arena = req->arena;
+    }
+
+    if(arena) arena->used = 0;
+}
+
+/*
+ * Copies the block into the arena as a read only bstring, lowercasing
+ * it on the way if asked.  They can't be bdestroyed or written to.
+ */
+static bstring request_slice(Request *req, const char *at, size_t len, int lower)
+{
+    struct tagbstring *str = Request_arena_alloc(req, sizeof(struct tagbstring) + len + 1);
+    size_t i = 0;
+    check_mem(str);
+
+    str->mlen = -1;
+    str->slen = len;
+    str->data = (unsigned char *)(str + 1);
+
+    if(lower) {
+        for(i = 0; i < len; i++) str->data[i] = tolower((unsigned char)at[i]);
+    } else {
+        memcpy(str->data, at, len);
+    }
+
+    str->data[len] = '\0';
+    return str;
+
+error:
+    return NULL;
+}
+
+/*
+ * Header names are compared without case, so the hash has to fold case
+ * too.  Goes by blength since lookups can use keys pointing into the
+ * middle of the parse buffer.
+ */
+static hash_val_t request_hash_caseless(const void *kv)
+{
+    bstring key = (bstring)kv;
+    const unsigned char *str = key->data;
+    hash_val_t acc = 2166136261U;
+    int i = 0;
+
+    for(i = 0; i < blength(key); i++) {
+        acc ^= tolower(str[i]);
+        acc *= 16777619U;
+    }
+
+    return acc;
+}
+
+static hnode_t *req_alloc_hash(void *req)
 {
-    return (hnode_t *)malloc(sizeof(hnode_t));
+    return Request_arena_alloc((Request *)req, sizeof(hnode_t));
 }
 
 static void req_free_hash(hnode_t *node, void *notused)
 {
-    bstrListDestroy((struct bstrList *)hnode_get(node));
-    bdestroy((bstring)hnode_getkey(node));
-    free(node);
+    // it's in the arena
+}
+
+static inline void Request_headers_reset(hash_t *headers)
+{
+    // the nodes and values are all in the arena so just forget them
+    if(hash_count(headers) > 0) {
+        memset(headers->hash_table, 0, sizeof(hnode_t *) * headers->hash_nchains);
+        headers->hash_nodecount = 0;
+    }
 }
 
 
 static void request_method_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
-    req->request_method = blk2bstr(at, length);
+    req->request_method = request_slice(req, at, length, 0);
 }
 
 static void fragment_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
-    req->fragment = blk2bstr(at, length);
+    req->fragment = request_slice(req, at, length, 0);
 }
 
 static void http_version_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
-    req->version = blk2bstr(at, length);
+    req->version = request_slice(req, at, length, 0);
 }
 
 
@@ -94,93 +199,96 @@ static void header_done_cb(void *data, const char *at, size_t length)
     Request *req = (Request *)data;
 
     // extract content_len
-    const char *clen = bdata(Request_get(req, &HTTP_CONTENT_LENGTH));
+    const char *clen = bdata(Request_known(req, HEADER_CONTENT_LENGTH));
     if(clen) req->parser.content_len = atoi(clen);
 
     // extract host header
-    req->host = Request_get(req, &HTTP_HOST);
+    req->host = Request_known(req, HEADER_HOST);
     int colon = bstrchr(req->host, ':');
     if(req->host) {
-        req->host_name = colon > 0 ? bHead(req->host, colon) : bstrcpy(req->host);
+        req->host_name = colon > 0 ? request_slice(req, bdata(req->host), colon, 0) : req->host;
     }
 }
 
 static void uri_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
-    req->uri = blk2bstr(at, length);
+    req->uri = request_slice(req, at, length, 0);
 }
 
 static void path_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
     assert(req->path == NULL && "This should not happen, Tell Zed.");
-    req->path = blk2bstr(at, length);
+    req->path = request_slice(req, at, length, 0);
 }
 
 static void query_string_cb(void *data, const char *at, size_t length)
 {
     Request *req = (Request *)data;
-    req->query_string = blk2bstr(at, length);
+    req->query_string = request_slice(req, at, length, 0);
 }
 
 
-static void header_field_cb(void *data, const char *field, size_t flen,
-        const char *value, size_t vlen)
+static void request_add_header(Request *req, bstring key,
+        const char *value, size_t vlen, int replace)
 {
-    Request *req = (Request *)data;
+    hnode_t *n = hash_lookup(req->headers, key);
+    struct bstrList *val_list = NULL;
+    bstring val = NULL;
+    HeaderKnown id = Headers_known(bdata(key), blength(key));
 
-    if(hash_isfull(req->headers)) {
-        log_err("Request had more than %d headers allowed by limits.header_count.",
+    if(n == NULL) {
+        check(!hash_isfull(req->headers),
+                "Request had more than %d headers allowed by limits.header_count.",
                 MAX_HEADER_COUNT);
+
+        // room for the dupes goes right after the list in the arena
+        val_list = Request_arena_alloc(req,
+                sizeof(struct bstrList) + sizeof(bstring) * MAX_DUPE_HEADERS);
+        check_mem(val_list);
+        val_list->entry = (bstring *)(val_list + 1);
+        val_list->mlen = MAX_DUPE_HEADERS;
+        val_list->qty = 0;
+
+        key = request_slice(req, bdata(key), blength(key), 1);
+        check_mem(key);
+        check(hash_alloc_insert(req->headers, key, val_list),
+                "Failed to add header %s.", bdata(key));
     } else {
-        bstring vstr = blk2bstr(value, vlen);
-        bstring fstr = blk2bstr(field, flen);
-        btolower(fstr);
+        val_list = hnode_get(n);
+
+        // destroy ALL old ones and put this in their place
+        if(replace) val_list->qty = 0;
 
-        Request_set(req, fstr, vstr, 0);
+        check(val_list->qty < MAX_DUPE_HEADERS, 
+                "Header %s duplicated more than %d times allowed.", 
+                bdata(key), MAX_DUPE_HEADERS);
     }
-}
 
+    val = request_slice(req, value, vlen, 0);
+    check_mem(val);
+    val_list->entry[val_list->qty++] = val;
 
-void Request_set(Request *req, bstring key, bstring val, int replace)
-{
-    hnode_t *n = hash_lookup(req->headers, key);
-    struct bstrList *val_list = NULL;
-    int rc = 0;
-    int i = 0;
+    if(id != HEADER_UNKNOWN) req->known[id] = val_list->entry[0];
 
-    if(n == NULL) {
-        // make a new bstring list to use as our storage
-        val_list = bstrListCreate();
-        rc = bstrListAlloc(val_list, MAX_DUPE_HEADERS);
-        check(rc == BSTR_OK, "Couldn't allocate space for header values.");
-
-        val_list->entry[0] = val;
-        val_list->qty = 1;
-        hash_alloc_insert(req->headers, key, val_list);
-    } else {
-        val_list = hnode_get(n);
-        bdestroy(key); // don't need the key anymore since we already have it
+error: return;
+}
 
-        if(replace) {
-            // destroy ALL old ones and put this in their place
-            for(i = 0; i < val_list->qty; i++) {
-                bdestroy(val_list->entry[i]);
-            }
+static void header_field_cb(void *data, const char *field, size_t flen,
+        const char *value, size_t vlen)
+{
+    Request *req = (Request *)data;
+    struct tagbstring key;
 
-            val_list->entry[0] = val;
-            val_list->qty = 1;
-        } else {
-            check(val_list->qty < MAX_DUPE_HEADERS, 
-                    "Header %s duplicated more than %d times allowed.", 
-                    bdata(key), MAX_DUPE_HEADERS);
+    blk2tbstr(key, field, flen);
+    request_add_header(req, &key, value, vlen, 0);
+}
 
-            val_list->entry[val_list->qty++] = val;
-        }
-    }
 
-error: return;
+void Request_set(Request *req, bstring key, bstring val, int replace)
+{
+    request_add_header(req, key, bdata(val), blength(val), replace);
 }
 
 Request *Request_create()
@@ -197,9 +305,12 @@ Request *Request_create()
     req->parser.http_version = http_version_cb;
     req->parser.header_done = header_done_cb;
 
-    req->headers = hash_create(MAX_HEADER_COUNT, (hash_comp_t)bstrcmp, bstr_hash_fun);
+    req->headers = hash_create(MAX_HEADER_COUNT, (hash_comp_t)bstricmp, request_hash_caseless);
     check_mem(req->headers);
-    hash_set_allocator(req->headers, req_alloc_hash, req_free_hash, NULL);
+    hash_set_allocator(req->headers, req_alloc_hash, req_free_hash, req);
+
+    // get the first arena block now so parsing doesn't have to
+    check_mem(Request_arena_alloc(req, 0));
 
     req->parser.data = req;  // for the http callbacks
 
@@ -212,19 +323,20 @@ error:
 
 static inline void Request_nuke_parts(Request *req)
 {
-    bdestroy(req->request_method); req->request_method = NULL;
-    bdestroy(req->version); req->version = NULL;
-    bdestroy(req->uri); req->uri = NULL;
-    bdestroy(req->path); req->path = NULL;
-    bdestroy(req->query_string); req->query_string = NULL;
-    bdestroy(req->fragment); req->fragment = NULL;
-    bdestroy(req->host_name); req->host_name = NULL;
-
-    // not owned by us: host, pattern, prefix
+    // all of these are in the arena or not owned by us
+    req->request_method = NULL;
+    req->version = NULL;
+    req->uri = NULL;
+    req->path = NULL;
+    req->query_string = NULL;
+    req->fragment = NULL;
+    req->host_name = NULL;
     req->pattern = NULL;
     req->prefix = NULL;
     req->host = NULL;
 
+    memset(req->known, 0, sizeof(req->known));
+
     req->status_code = 0;
     req->response_size = 0;
     req->parser.json_sent = 0;
@@ -235,8 +347,14 @@ void Request_destroy(Request *req)
 {
     if(req) {
         Request_nuke_parts(req);
-        hash_free_nodes(req->headers);
-        hash_destroy(req->headers);
+
+        if(req->headers) {
+            Request_headers_reset(req->headers);
+            hash_destroy(req->headers);
+        }
+
+        Request_arena_reset(req);
+        free(req->arena);
         free(req);
     }
 }
@@ -250,8 +368,10 @@ void Request_start(Request *req)
     Request_nuke_parts(req);
 
     if(req->headers) {
-        hash_free_nodes(req->headers);
+        Request_headers_reset(req->headers);
     }
+
+    Request_arena_reset(req);
 }
 
 int Request_parse(Request *req, char *buf, size_t nread, size_t *out_nparsed)
@@ -268,8 +388,13 @@ int Request_parse(Request *req, char *buf, size_t nread, size_t *out_nparsed)
 
 bstring Request_get(Request *req, bstring field)
 {
-    hnode_t *node = hash_lookup(req->headers, field);
+    hnode_t *node = NULL;
     struct bstrList *vals = NULL;
+    HeaderKnown id = Headers_known(bdata(field), blength(field));
+
+    if(id != HEADER_UNKNOWN) return Request_known(req, id);
+
+    node = hash_lookup(req->headers, field);
 
     if(node == NULL) {
         return NULL;
@@ -280,10 +405,9 @@ bstring Request_get(Request *req, bstring field)
 }
 
 
-int Request_get_date(Request *req, bstring field, const char *format)
+static inline int request_parse_date(bstring value, const char *format)
 {
     struct tm tm_val;
-    bstring value = Request_get(req, field);
 
     if(value) {
         memset(&tm_val, 0, sizeof(struct tm));
@@ -297,29 +421,109 @@ int Request_get_date(Request *req, bstring field, const char *format)
     }
 }
 
-static inline bstring json_escape(bstring in)
+int Request_get_date(Request *req, bstring field, const char *format)
 {
-    if(in == NULL) return NULL;
+    return request_parse_date(Request_get(req, field), format);
+}
 
-    // Slightly better than the old solution.
-    bstring vstr = bstrcpy(in);
-    
-    int i;
-    for(i = 0; i < blength(vstr); i++)
-    {
-        if(bdata(vstr)[i] == '\\')
-        {
-            binsertch(vstr, i, 1, '\\');
-            i++;
-        }
-        else if(bdata(vstr)[i] == '"')
-        {
-            binsertch(vstr, i, 1, '\\');
-            i++;
+int Request_known_date(Request *req, HeaderKnown id, const char *format)
+{
+    return request_parse_date(Request_known(req, id), format);
+}
+
+static const char JSON_HEX[] = "0123456789abcdef";
+
+/*
+ * Returns where the next byte at or after start that JSON needs escaped
+ * is: a quote, a backslash, or a control character.  Returns len if
+ * there isn't one.  Checks 16 bytes at a time with SSE2 when it has it.
+ */
+static inline int json_escape_scan(const unsigned char *data, int start, int len)
+{
+    int i = start;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    for(; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                _mm_cmpeq_epi8(chunk, slash));
+        // unsigned chunk <= 0x1f is the same as max(chunk, 0x1f) == 0x1f
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+
+        int mask = _mm_movemask_epi8(hits);
+        if(mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for(; i < len; i++) {
+        if(data[i] < 0x20 || data[i] == '"' || data[i] == '\\') return i;
+    }
+
+    return len;
+}
+
+/*
+ * Appends in to out as the inside of a JSON string.  Most header values
+ * don't need anything escaped so those are one scan and one bcatblk.
+ * Otherwise out is grown once for the worst case and the escaped runs
+ * are written straight into it.
+ */
+static inline int json_escape_cat(bstring out, bstring in)
+{
+    if(in == NULL) return BSTR_ERR;
+
+    const unsigned char *data = in->data;
+    int len = blength(in);
+    int start = 0;
+    int i = json_escape_scan(data, 0, len);
+    unsigned char *w = NULL;
+
+    if(i == len) return bcatblk(out, data, len);
+
+    // worst case everything after i turns into \u00XX
+    check(balloc(out, blength(out) + i + (len - i) * 6 + 1) == BSTR_OK,
+            "Failed to grow the JSON payload for escaping.");
+    w = out->data + blength(out);
+
+    while(i < len) {
+        memcpy(w, data + start, i - start);
+        w += i - start;
+        *w++ = '\\';
+
+        switch(data[i]) {
+            case '"':
+            case '\\': *w++ = data[i]; break;
+            case '\b': *w++ = 'b'; break;
+            case '\f': *w++ = 'f'; break;
+            case '\n': *w++ = 'n'; break;
+            case '\r': *w++ = 'r'; break;
+            case '\t': *w++ = 't'; break;
+            default:
+                *w++ = 'u';
+                *w++ = '0';
+                *w++ = '0';
+                *w++ = JSON_HEX[data[i] >> 4];
+                *w++ = JSON_HEX[data[i] & 0xf];
         }
+
+        start = i + 1;
+        i = json_escape_scan(data, start, len);
     }
 
-    return vstr;
+    memcpy(w, data + start, len - start);
+    w += len - start;
+
+    out->slen = w - out->data;
+    out->data[out->slen] = '\0';
+
+    return BSTR_OK;
+
+error:
+    return BSTR_ERR;
 }
 
 struct tagbstring JSON_LISTSEP = bsStatic("\",\"");
@@ -335,12 +539,8 @@ static inline void B(bstring headers, const bstring k, const bstring v)
         bcatcstr(headers, ",\"");
         bconcat(headers, k);
         bconcat(headers, &JSON_OBJSEP);
-
-        bstring vstr = json_escape(v);
-        bconcat(headers, vstr);
-        bcatcstr(headers, "\"");
-
-        bdestroy(vstr);
+        json_escape_cat(headers, v);
+        bconchar(headers, '"');
     }
 }
 
@@ -355,56 +555,171 @@ static inline bstring request_determine_method(Request *req)
     }
 }
 
-bstring Request_to_tnetstring(Request *req, bstring uuid, int fd, const char *buf, size_t len)
+static inline int request_cat_num(bstring out, size_t n, char sep)
+{
+    char num[32];
+    int len = snprintf(num, sizeof(num), "%zu%c", n, sep);
+    return bcatblk(out, num, len);
+}
+
+static inline size_t request_tns_dict_size(Request *req, bstring method)
+{
+    size_t len = tns_request_headers_size(req->headers);
+
+    if(req->path) len += tns_hash_pair_size(&HTTP_PATH, req->path);
+    if(req->version) len += tns_hash_pair_size(&HTTP_VERSION, req->version);
+    if(req->uri) len += tns_hash_pair_size(&HTTP_URI, req->uri);
+    if(req->query_string) len += tns_hash_pair_size(&HTTP_QUERY, req->query_string);
+    if(req->fragment) len += tns_hash_pair_size(&HTTP_FRAGMENT, req->fragment);
+    if(req->pattern) len += tns_hash_pair_size(&HTTP_PATTERN, req->pattern);
+
+    return len + tns_hash_pair_size(&HTTP_METHOD, method);
+}
+
+static inline char *request_write_bstr(char *out, bstring str)
+{
+    if(str) {
+        memcpy(out, str->data, blength(str));
+        out += blength(str);
+    }
+
+    return out;
+}
+
+/**
+ * How many bytes Request_write_tnetstring will write for req, or 0 if
+ * it can't be rendered.
+ */
+size_t Request_tnetstring_size(Request *req, bstring uuid, int fd, size_t len)
+{
+    bstring method = request_determine_method(req);
+    check(method, "Impossible, got an invalid request method.");
+
+    int id = Register_id_for_fd(fd);
+    check(id != -1, "Asked to generate a payload for a fd that doesn't exist: %d", fd);
+
+    size_t dict = request_tns_dict_size(req, method);
+
+    return blength(uuid) + 1 + tns_number_size(id) + 1 + blength(Request_path(req)) + 1 +
+        tns_number_size(dict) + 1 + dict + 1 + tns_number_size(len) + 1;
+
+error:
+    return 0;
+}
+
+/**
+ * Writes the tnetstring payload for req front to back into out, which
+ * needs room for Request_tnetstring_size bytes.  It stops after the
+ * length prefix of a body that's len long, so the caller adds the body
+ * and the closing ',' wherever it's going without another copy.
+ * Returns the end of what was written.
+ */
+char *Request_write_tnetstring(Request *req, char *out, bstring uuid, int fd, size_t len)
 {
-    tns_outbuf outbuf = {.buffer = NULL};
     bstring method = request_determine_method(req);
     check(method, "Impossible, got an invalid request method.");
 
     int id = Register_id_for_fd(fd);
     check(id != -1, "Asked to generate a payload for a fd that doesn't exist: %d", fd);
 
-    int header_start = tns_render_request_start(&outbuf);
-    check(header_start != -1, "Failed to initialize outbuf.");
+    out = request_write_bstr(out, uuid);
+    *out++ = ' ';
+    out = tns_write_number(out, id);
+    *out++ = ' ';
+    out = request_write_bstr(out, Request_path(req));
+    *out++ = ' ';
 
-    check(tns_render_request_headers(&outbuf, req->headers) == 0,
-            "Failed to render headers to a tnetstring.");
+    out = tns_write_number(out, request_tns_dict_size(req, method));
+    *out++ = ':';
 
-    if(req->path) tns_render_hash_pair(&outbuf, &HTTP_PATH, req->path);
-    if(req->version) tns_render_hash_pair(&outbuf, &HTTP_VERSION, req->version);
-    if(req->uri) tns_render_hash_pair(&outbuf, &HTTP_URI, req->uri);
-    if(req->query_string) tns_render_hash_pair(&outbuf, &HTTP_QUERY, req->query_string);
-    if(req->fragment) tns_render_hash_pair(&outbuf, &HTTP_FRAGMENT, req->fragment);
-    if(req->pattern) tns_render_hash_pair(&outbuf, &HTTP_PATTERN, req->pattern);
+    // ours go after the headers, same as the JSON payloads
+    out = tns_write_request_headers(out, req->headers);
 
-    tns_render_hash_pair(&outbuf, &HTTP_METHOD, method);
+    if(req->path) out = tns_write_hash_pair(out, &HTTP_PATH, req->path);
+    if(req->version) out = tns_write_hash_pair(out, &HTTP_VERSION, req->version);
+    if(req->uri) out = tns_write_hash_pair(out, &HTTP_URI, req->uri);
+    if(req->query_string) out = tns_write_hash_pair(out, &HTTP_QUERY, req->query_string);
+    if(req->fragment) out = tns_write_hash_pair(out, &HTTP_FRAGMENT, req->fragment);
+    if(req->pattern) out = tns_write_hash_pair(out, &HTTP_PATTERN, req->pattern);
 
-    check(tns_render_request_end(&outbuf, header_start, uuid, id, Request_path(req)) != -1, "Failed to finalize request.");
+    out = tns_write_hash_pair(out, &HTTP_METHOD, method);
+    *out++ = '}';
 
-    // header now owns the outbuf buffer
-    bstring headers = tns_outbuf_to_bstring(&outbuf);
-    bformata(headers, "%d:", len);
-    bcatblk(headers, buf, len);
-    bconchar(headers, ',');
+    out = tns_write_number(out, len);
+    *out++ = ':';
+
+    return out;
 
-    return headers;
 error:
-    if(outbuf.buffer) free(outbuf.buffer);
     return NULL;
 }
 
-bstring Request_to_payload(Request *req, bstring uuid, int fd, const char *buf, size_t len)
+/**
+ * Appends the tnetstring payload for req to out, up to and including the
+ * length prefix of the body, like Request_write_tnetstring.
+ */
+int Request_render_tnetstring(Request *req, bstring out, bstring uuid, int fd, size_t len)
+{
+    char *start = NULL;
+    size_t size = Request_tnetstring_size(req, uuid, fd, len);
+    check(size > 0, "Failed to size the request's tnetstring.");
+
+    check(balloc(out, blength(out) + size + 1) == BSTR_OK, "Failed to make room for the request.");
+
+    start = (char *)out->data + out->slen;
+    check(Request_write_tnetstring(req, start, uuid, fd, len) == start + size,
+            "Tnetstring came out a different size than it should have, tell Zed.");
+
+    out->slen += size;
+    out->data[out->slen] = '\0';
+
+    return 0;
+
+error:
+    return -1;
+}
+
+bstring Request_to_tnetstring(Request *req, bstring uuid, int fd, const char *buf, size_t len)
 {
-    bstring headers = NULL;
-    bstring result = NULL;
+    bstring result = bfromcstralloc(PAYLOAD_GUESS + len, "");
+    check_mem(result);
+
+    check(Request_render_tnetstring(req, result, uuid, fd, len) == 0,
+            "Failed to render request as a tnetstring.");
+
+    bcatblk(result, buf, len);
+    bconchar(result, ',');
+
+    return result;
+
+error:
+    bdestroy(result);
+    return NULL;
+}
+
+/**
+ * The JSON version of Request_render_tnetstring, which has the same deal
+ * with the body.
+ */
+int Request_render_payload(Request *req, bstring out, bstring uuid, int fd, size_t len)
+{
+    // the headers have to be rendered before we know their length
+    static bstring headers = NULL;
+    int x = 0;
 
     int id = Register_id_for_fd(fd);
     check(id != -1, "Asked to generate a payload for a fd that doesn't exist: %d", fd);
 
-    headers = bfromcstralloc(PAYLOAD_GUESS, "{\"");
+    if(headers == NULL) {
+        headers = bfromcstralloc(PAYLOAD_GUESS, "");
+        check_mem(headers);
+    }
+
+    btrunc(headers, 0);
+    bcatcstr(headers, "{\"");
     bconcat(headers, &HTTP_PATH);
     bconcat(headers, &JSON_OBJSEP);
-    bconcat(headers, req->path);
+    json_escape_cat(headers, req->path);
     bconchar(headers, '"');
 
     hscan_t scan;
@@ -417,23 +732,16 @@ bstring Request_to_payload(Request *req, bstring uuid, int fd, const char *buf,
 
         if(val_list->qty > 1)
         {
-            struct bstrList *escaped = bstrListCreate();
-            bstrListAlloc(escaped, val_list->qty);
-            escaped->qty = val_list->qty;
+            bcatcstr(headers, ",\"");
+            bconcat(headers, key);
+            bcatcstr(headers, "\":[\"");
 
-            int x = 0;
             for(x = 0; x < val_list->qty; x++) {
-                escaped->entry[x] = json_escape(val_list->entry[x]);
+                if(x > 0) bconcat(headers, &JSON_LISTSEP);
+                json_escape_cat(headers, val_list->entry[x]);
             }
 
-            bstring list = bjoin(escaped, &JSON_LISTSEP);
-            bcatcstr(headers, ",\"");
-            bconcat(headers, key);
-            bcatcstr(headers, "\":[\"");
-            bconcat(headers, list);
             bcatcstr(headers, "\"]");
-            bdestroy(list);
-            bstrListDestroy(escaped);
         }
         else
         {
@@ -460,24 +768,37 @@ bstring Request_to_payload(Request *req, bstring uuid, int fd, const char *buf,
 
     bconchar(headers, '}');
 
-    result = bformat("%s %d %s %d:%s,%d:", bdata(uuid), id, 
-            bdata(Request_path(req)),
-            blength(headers),
-            bdata(headers),
-            len);
+    bconcat(out, uuid);
+    bconchar(out, ' ');
+    request_cat_num(out, id, ' ');
+    bconcat(out, Request_path(req));
+    bconchar(out, ' ');
+    request_cat_num(out, blength(headers), ':');
+    bconcat(out, headers);
+    bconchar(out, ',');
+    check(request_cat_num(out, len, ':') == BSTR_OK, "Failed to construct payload result.");
+
+    return 0;
 
-    bdestroy(headers);
+error:
+    return -1;
+}
+
+bstring Request_to_payload(Request *req, bstring uuid, int fd, const char *buf, size_t len)
+{
+    bstring result = bfromcstralloc(PAYLOAD_GUESS + len, "");
+    check_mem(result);
+
+    check(Request_render_payload(req, result, uuid, fd, len) == 0,
+            "Failed to render request as a payload.");
 
     bcatblk(result, buf, len);
     bconchar(result, ',');
 
-    check(result, "Failed to construct payload result.");
-
     return result;
 
 error:
-    bdestroy(headers);
     bdestroy(result);
-
     return NULL;
 }
+
@@ -43,9 +43,17 @@
 #include <host.h>
 
 enum {
-    REQUEST_EXTRA_HEADERS = 6
+    REQUEST_EXTRA_HEADERS = 6,
+    REQUEST_ARENA_SIZE = 4096
 };
 
+typedef struct RequestArena {
+    struct RequestArena *next;
+    size_t used;
+    size_t size;
+    char data[];
+} RequestArena;
+
 typedef struct Request {
     bstring request_method;
     bstring version;
@@ -63,6 +71,8 @@ typedef struct Request {
     int status_code;
     int response_size;
     http_parser parser;
+    RequestArena *arena;
+    bstring known[HEADER_KNOWN_COUNT];
 } Request;
 
 Request *Request_create();
@@ -75,10 +85,18 @@ void Request_destroy(Request *req);
 
 bstring Request_get(Request *req, bstring field);
 
+/**
+ * Copies the key and value into the request, the caller still owns
+ * both.  The header sticks around until the next Request_start.
+ */
 void Request_set(Request *req, bstring key, bstring val, int replace);
 
 int Request_get_date(Request *req, bstring field, const char *format);
 
+int Request_known_date(Request *req, HeaderKnown id, const char *format);
+
+#define Request_known(R, ID) ((R)->known[(ID)])
+
 #define Request_parser(R) (&((R)->parser))
 
 #define Request_is_json(R) ((R)->parser.json_sent == 1)
@@ -99,6 +117,14 @@ int Request_get_date(Request *req, bstring field, const char *format);
 
 bstring Request_to_tnetstring(Request *req, bstring uuid, int fd, const char *buf, size_t len);
 
+size_t Request_tnetstring_size(Request *req, bstring uuid, int fd, size_t len);
+
+char *Request_write_tnetstring(Request *req, char *out, bstring uuid, int fd, size_t len);
+
+int Request_render_tnetstring(Request *req, bstring out, bstring uuid, int fd, size_t len);
+
+int Request_render_payload(Request *req, bstring out, bstring uuid, int fd, size_t len);
+
 bstring Request_to_payload(Request *req, bstring uuid, int fd, const char *buf, size_t len);
 
 void Request_init();
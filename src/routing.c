@@ -41,7 +41,13 @@
 #include <mem/halloc.h>
 #include <bstring.h>
 
+// bumped on every insert into any map so caches of match results know
+static unsigned int ROUTE_GENERATION = 1;
 
+unsigned int RouteMap_generation()
+{
+    return ROUTE_GENERATION;
+}
 
 RouteMap *RouteMap_create(routemap_destroy_cb destroy)
 {
@@ -74,6 +80,8 @@ void RouteMap_destroy(RouteMap *map)
     if(map) {
         tst_traverse(map->routes, RouteMap_cleanup, map);
         tst_destroy(map->routes);
+        free(map->nodes);
+        free(map->labels);
         h_free(map);
     }
 }
@@ -92,6 +100,8 @@ Route *RouteMap_insert_base(RouteMap *map, bstring prefix, bstring pattern)
     debug("ADDING prefix: %s, pattern: %s", bdata(prefix), bdata(pattern));
 
     map->routes = tst_insert(map->routes, bdata(prefix), blength(prefix), route);
+    map->compiled = 0;
+    ROUTE_GENERATION++;
 
     hattach(route, map);
 
@@ -125,6 +135,13 @@ int RouteMap_insert(RouteMap *map, bstring pattern, void *data)
     route->has_pattern = first_paren >= 0;
     route->first_paren = first_paren;
     route->data = data;
+    route->prog = NULL;
+
+    if(route->has_pattern) {
+        // a bad pattern just means it keeps using pattern_match
+        route->prog = pattern_compile(bdataofs(pattern, first_paren));
+        if(route->prog) hattach(route->prog, route);
+    }
 
     return 0;
 
@@ -155,6 +172,7 @@ int RouteMap_insert_reversed(RouteMap *map, bstring pattern, void *data)
     route->has_pattern = last_paren >= 0;
     route->prefix = reversed_prefix;
     route->data = data;
+    route->prog = NULL;
 
     return 0;
   
@@ -168,7 +186,10 @@ int RouteMap_collect_match(void *value, const char *key, size_t len)
     assert(value && "NULL value from TST.");
     Route *route = (Route *)value;
 
-    if(route->has_pattern) {
+    if(route->prog) {
+        return pattern_exec(route->prog, key + route->first_paren,
+                len - route->first_paren) != NULL;
+    } else if(route->has_pattern) {
         return pattern_match(key + route->first_paren,
                 len - route->first_paren,
                 bdataofs(route->pattern, route->first_paren)) != NULL;
@@ -189,7 +210,14 @@ static inline Route *match_route_pattern(bstring target, Route *route)
     int source_length = blength(target) - blength(route->prefix);
     const char *pattern = bdataofs(route->pattern, route->first_paren);
 
-    return pattern_match(source, source_length, pattern) ? route : NULL;
+    // a short target can land on a longer route, see RouteMap_search_prefix
+    if(source_length < 0) return NULL;
+
+    if(route->prog) {
+        return pattern_exec(route->prog, source, source_length) ? route : NULL;
+    } else {
+        return pattern_match(source, source_length, pattern) ? route : NULL;
+    }
 }
 
 Route *RouteMap_match_suffix(RouteMap *map, bstring target)
@@ -210,10 +238,169 @@ Route *RouteMap_match_suffix(RouteMap *map, bstring target)
 }
 
 
+static int RouteMap_count_siblings(tst_t *p)
+{
+    return p ? 1 + RouteMap_count_siblings(p->low) + RouteMap_count_siblings(p->high) : 0;
+}
+
+static void RouteMap_collect_siblings(tst_t *p, tst_t **list, int *at)
+{
+    if(p) {
+        list[(*at)++] = p;
+        RouteMap_collect_siblings(p->low, list, at);
+        RouteMap_collect_siblings(p->high, list, at);
+    }
+}
+
+static int RouteMap_count_nodes(tst_t *p)
+{
+    return p ? 1 + RouteMap_count_nodes(p->low) +
+        RouteMap_count_nodes(p->equal) + RouteMap_count_nodes(p->high) : 0;
+}
+
+/*
+ * Gives the node at parent every TST node in the sibling tree under
+ * set as a child.  The root of set goes first since that's the one the
+ * TST's equal links point at.  Each child soaks up the single child,
+ * valueless TST nodes below it into its label.
+ */
+static int RouteMap_compile_children(RouteMap *map, int parent, tst_t *set)
+{
+    int count = RouteMap_count_siblings(set);
+    int start = map->node_count;
+    tst_t **list = calloc(sizeof(tst_t *), count);
+    int i = 0;
+    check_mem(list);
+
+    map->node_count += count;
+    map->nodes[parent].children = start;
+    map->nodes[parent].nchildren = count;
+    RouteMap_collect_siblings(set, list, &i);
+
+    for(i = 0; i < count; i++) {
+        tst_t *p = list[i];
+        RouteNode *node = &map->nodes[start + i];
+
+        node->first = p->splitchar;
+        node->label = map->labels_len;
+        node->label_len = 1;
+        map->labels[map->labels_len++] = p->splitchar;
+
+        while(!p->value && p->equal && !p->equal->low && !p->equal->high) {
+            p = p->equal;
+            map->labels[map->labels_len++] = p->splitchar;
+            node->label_len++;
+        }
+
+        node->route = p->value;
+        list[i] = p;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(list[i]->equal) {
+            check(RouteMap_compile_children(map, start + i, list[i]->equal) == 0,
+                    "Failed to compile the route trie.");
+        }
+    }
+
+    free(list);
+    return 0;
+
+error:
+    free(list);
+    return -1;
+}
+
+/**
+ * Flattens the TST into a radix trie in one array so prefix matches
+ * walk a few contiguous nodes instead of a pointer per character.  It's
+ * done when the first match after an insert needs it, which is after
+ * the config is loaded.
+ */
+int RouteMap_compile(RouteMap *map)
+{
+    // every TST node is at most one trie node and one label char
+    int count = RouteMap_count_nodes(map->routes);
+
+    free(map->nodes);
+    free(map->labels);
+    map->node_count = 1;
+    map->labels_len = 0;
+
+    map->nodes = calloc(sizeof(RouteNode), count + 1);
+    map->labels = malloc(count + 1);
+    check_mem(map->nodes);
+    check_mem(map->labels);
+
+    if(map->routes) {
+        check(RouteMap_compile_children(map, 0, map->routes) == 0,
+                "Failed to compile routes.");
+    }
+
+    map->compiled = 1;
+    return 0;
+
+error:
+    map->compiled = 0;
+    return -1;
+}
+
+static inline Route *RouteMap_first_route(RouteMap *map, RouteNode *node)
+{
+    while(node->route == NULL && node->nchildren > 0) {
+        node = &map->nodes[node->children];
+    }
+
+    return node->route;
+}
+
+/*
+ * Same answers as tst_search_prefix: the longest route that's a prefix
+ * of the target, or if the target runs out partway into some routes,
+ * the first of those along the first children.
+ */
+static inline Route *RouteMap_search_prefix(RouteMap *map, const char *s, int len)
+{
+    RouteNode *node = map->nodes;
+    Route *last = NULL;
+    int i = 0;
+    int k = 0;
+
+    if(len == 0) return NULL;
+
+    for(;;) {
+        if(i == len) return RouteMap_first_route(map, node);
+        if(node->route) last = node->route;
+
+        RouteNode *child = &map->nodes[node->children];
+        RouteNode *end = child + node->nchildren;
+        while(child < end && child->first != s[i]) child++;
+        if(child == end) return last;
+
+        const char *label = map->labels + child->label;
+        for(k = 1; k < child->label_len && i + k < len && label[k] == s[i + k]; k++) {}
+
+        if(k == child->label_len) {
+            node = child;
+            i += k;
+        } else if(i + k == len) {
+            return RouteMap_first_route(map, child);
+        } else {
+            return last;
+        }
+    }
+}
+
 Route *RouteMap_simple_prefix_match(RouteMap *map, bstring target)
 { 
+    Route *route = NULL;
     debug("Searching for route: %s in map: %p", bdata(target), map);
-    Route *route = tst_search_prefix(map->routes, bdata(target), blength(target));
+
+    if(map->compiled || RouteMap_compile(map) == 0) {
+        route = RouteMap_search_prefix(map, bdata(target), blength(target));
+    } else {
+        route = tst_search_prefix(map->routes, bdata(target), blength(target));
+    }
 
     if(route) {
         debug("Found simple prefix: %s", bdata(route->pattern));
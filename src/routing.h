@@ -40,21 +40,46 @@
 #include <adt/list.h>
 #include <bstring.h>
 
+struct PatternProg;
+
 typedef struct Route {
     bstring pattern;
     bstring prefix;
     void *data;
     int has_pattern;
     int first_paren;
+    struct PatternProg *prog;
 } Route;
 
 struct RouteMap;
 
 typedef void (*routemap_destroy_cb)(Route *route, struct RouteMap *map);
 
+/*
+ * One node of the compiled radix trie.  The children of a node are next
+ * to each other in RouteMap->nodes, and the first one is always the one
+ * the TST would follow, so a target that stops short of every route
+ * still ends up on the same route it used to.
+ */
+typedef struct RouteNode {
+    char first;
+    int label;
+    int label_len;
+    int children;
+    int nchildren;
+    Route *route;
+} RouteNode;
+
 typedef struct RouteMap {
     tst_t *routes;
     routemap_destroy_cb destroy;
+
+    // compiled from routes on the first prefix match after an insert
+    int compiled;
+    RouteNode *nodes;
+    int node_count;
+    char *labels;
+    int labels_len;
 } RouteMap;
 
 RouteMap *RouteMap_create(routemap_destroy_cb destroy);
@@ -71,4 +96,8 @@ Route *RouteMap_match_suffix(RouteMap *map, bstring target);
 
 Route *RouteMap_simple_prefix_match(RouteMap *map, bstring target);
 
+int RouteMap_compile(RouteMap *map);
+
+unsigned int RouteMap_generation();
+
 #endif
@@ -44,6 +44,7 @@
 #include "routing.h"
 #include "setting.h"
 #include "pattern.h"
+#include "tls.h"
 #include "config/config.h"
 
 int RUNNING=1;
@@ -60,6 +61,8 @@ static char *ssl_default_dhm_P =
 
 static char *ssl_default_dhm_G = "4";
 
+#define Server_route_cache_slot(S, H) (&(S)->route_cache[(H) & (S)->route_cache_mask])
+
 void host_destroy_cb(Route *r, RouteMap *map)
 {
     if(r->data) {
@@ -135,6 +138,16 @@ static int Server_init_ssl(Server *srv)
                 ciphers[i] = SSL_RSA_CAMELLIA_256_SHA;
             else if(!strcmp("SSL_EDH_RSA_CAMELLIA_256_SHA", s))
                 ciphers[i] = SSL_EDH_RSA_CAMELLIA_256_SHA;
+            else if(!strcmp("SSL_RSA_AES_128_GCM_SHA256", s))
+                ciphers[i] = SSL_RSA_AES_128_GCM_SHA256;
+            else if(!strcmp("SSL_RSA_AES_256_GCM_SHA384", s))
+                ciphers[i] = SSL_RSA_AES_256_GCM_SHA384;
+            else if(!strcmp("SSL_EDH_RSA_AES_128_GCM_SHA256", s))
+                ciphers[i] = SSL_EDH_RSA_AES_128_GCM_SHA256;
+            else if(!strcmp("SSL_EDH_RSA_AES_256_GCM_SHA384", s))
+                ciphers[i] = SSL_EDH_RSA_AES_256_GCM_SHA384;
+            else if(!strcmp("SSL_EDH_RSA_CHACHA20_POLY1305_SHA256", s))
+                ciphers[i] = SSL_EDH_RSA_CHACHA20_POLY1305_SHA256;
             else
                 check(0, "Unrecognized cipher: %s", s);
             s = strtok_r(NULL, ", ", &last);
@@ -156,6 +169,9 @@ static int Server_init_ssl(Server *srv)
     srv->dhm_P = ssl_default_dhm_P;
     srv->dhm_G = ssl_default_dhm_G;
 
+    rcode = TLS_init();
+    check(rcode == 0, "Failed to set up the TLS session cache.");
+
     srv->use_ssl = 1;
 
     bdestroy(certpath); certpath = NULL;
@@ -171,6 +187,28 @@ error:
     return -1;
 }
 
+static int Server_init_route_cache(Server *srv)
+{
+    int size = Setting_get_int("limits.route_cache_size", 256);
+    uint32_t slots = 1;
+
+    log_info("MAX limits.route_cache_size=%d", size);
+    if(size <= 0) return 0;
+
+    while(slots < (uint32_t)size) slots <<= 1;
+
+    srv->route_cache = h_calloc(sizeof(RouteCacheEntry), slots);
+    check_mem(srv->route_cache);
+    hattach(srv->route_cache, srv);
+
+    srv->route_cache_mask = slots - 1;
+
+    return 0;
+
+error:
+    return -1;
+}
+
 Server *Server_create(const char *uuid, const char *default_host,
         const char *bind_addr, const char *port, const char *chroot, const char *access_log,
         const char *error_log, const char *pid_file)
@@ -199,6 +237,9 @@ Server *Server_create(const char *uuid, const char *default_host,
     srv->default_hostname = bfromcstr(default_host);
     srv->use_ssl = 0;
 
+    rcode = Server_init_route_cache(srv);
+    check(rcode == 0, "Failed to make the route cache for server %s", uuid);
+
     use_ssl_key = bfromcstr(uuid);
     check_mem(use_ssl_key);
     bcatcstr(use_ssl_key, ".use_ssl");
@@ -283,6 +324,9 @@ void Server_start(Server *srv)
             } else {
                 accept_good = 1;
             }
+        } else if(!RUNNING) {
+            // terminate() shut the listen socket down to get us here
+            break;
         } else {
             log_err("Failed to accept, probably overloaded, will try clear some dead connections.");
             accept_good = 0;
@@ -318,6 +362,11 @@ int Server_add_host(Server *srv, bstring pattern, Host *host)
 void Server_set_default_host(Server *srv, Host *host)
 {
     srv->default_host = host;
+
+    // anything that fell back to the old default is wrong now
+    if(srv->route_cache) {
+        memset(srv->route_cache, 0, sizeof(RouteCacheEntry) * (srv->route_cache_mask + 1));
+    }
 }
 
 
@@ -342,3 +391,105 @@ Host *Server_match_backend(Server *srv, bstring target)
 error: // fallthrough
     return NULL;
 }
+
+
+
+static inline uint32_t Server_route_hash(bstring host_name, bstring path)
+{
+    uint32_t hash = 2166136261u;
+    int i = 0;
+
+    if(host_name) {
+        for(i = 0; i < blength(host_name); i++) {
+            hash = (hash ^ (unsigned char)bchar(host_name, i)) * 16777619u;
+        }
+    }
+
+    // keeps "a" + "bc" away from "ab" + "c"
+    hash = (hash ^ (host_name ? 0xff : 0xfe)) * 16777619u;
+
+    for(i = 0; i < blength(path); i++) {
+        hash = (hash ^ (unsigned char)bchar(path, i)) * 16777619u;
+    }
+
+    return hash;
+}
+
+static inline int Server_route_cached(RouteCacheEntry *entry, uint32_t hash,
+        bstring host_name, bstring path)
+{
+    int host_len = host_name ? blength(host_name) : -1;
+
+    return entry->generation == RouteMap_generation() &&
+        entry->hash == hash &&
+        entry->host_len == host_len &&
+        entry->path_len == blength(path) &&
+        (host_len <= 0 || memcmp(entry->key, host_name->data, host_len) == 0) &&
+        memcmp(entry->key + (host_len > 0 ? host_len : 0), path->data, blength(path)) == 0;
+}
+
+/**
+ * Finds the host and then the backend for a request in one go, which is
+ * Server_match_backend followed by Host_match_backend.  Keep-alive clients
+ * tend to ask for the same things over and over, so the answers are kept
+ * in a small direct mapped cache keyed on the host_name and path, tagged
+ * with RouteMap_generation() so any route inserted anywhere (which is what
+ * a reload does to the new server) makes every entry stale.  Misses aren't
+ * cached, they're 404s and not worth the slot.
+ */
+Backend *Server_match_route(Server *srv, bstring host_name, bstring path,
+        Host **out_host, Route **out_route)
+{
+    RouteCacheEntry *entry = NULL;
+    uint32_t hash = 0;
+    Host *host = NULL;
+    Route *route = NULL;
+    Backend *found = NULL;
+    int host_len = host_name ? blength(host_name) : 0;
+
+    check(srv != NULL, "Server is NULL?!");
+    check(path != NULL, "Can't match a NULL path.");
+
+    if(srv->route_cache && host_len + blength(path) <= ROUTE_CACHE_KEY_SIZE) {
+        hash = Server_route_hash(host_name, path);
+        entry = Server_route_cache_slot(srv, hash);
+
+        if(Server_route_cached(entry, hash, host_name, path)) {
+            srv->route_cache_hits++;
+            host = entry->host;
+            route = entry->route;
+            found = route->data;
+            goto done;
+        }
+
+        srv->route_cache_misses++;
+    }
+
+    host = host_name ? Server_match_backend(srv, host_name) : srv->default_host;
+
+    if(host) {
+        found = Host_match_backend(host, path, &route);
+    }
+
+    if(found && entry) {
+        entry->generation = RouteMap_generation();
+        entry->hash = hash;
+        entry->host_len = host_name ? host_len : -1;
+        entry->path_len = blength(path);
+        entry->host = host;
+        entry->route = route;
+
+        if(host_len) memcpy(entry->key, host_name->data, host_len);
+        memcpy(entry->key + host_len, path->data, blength(path));
+    }
+
+done:
+    if(out_host) *out_host = host;
+    if(out_route) *out_route = route;
+    return found;
+
+error:
+    if(out_host) *out_host = NULL;
+    if(out_route) *out_route = NULL;
+    return NULL;
+}
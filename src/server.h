@@ -35,6 +35,7 @@
 #ifndef _server_h
 #define _server_h
 
+#include <stdint.h>
 #include <adt/tst.h>
 #include <adt/list.h>
 #include <host.h>
@@ -48,6 +49,21 @@ enum {
     IPADDR_SIZE = 40
 };
 
+enum {
+    /* host and path have to fit in here together to get cached */
+    ROUTE_CACHE_KEY_SIZE = 176
+};
+
+typedef struct RouteCacheEntry {
+    unsigned int generation;
+    uint32_t hash;
+    short host_len;
+    short path_len;
+    Host *host;
+    Route *route;
+    char key[ROUTE_CACHE_KEY_SIZE];
+} RouteCacheEntry;
+
 typedef struct Server {
     int port;
     int listen_fd;
@@ -66,6 +82,12 @@ typedef struct Server {
     int *ciphers;
     char *dhm_P;
     char *dhm_G;
+
+    // (host_name, path) -> route decisions, see Server_match_route
+    RouteCacheEntry *route_cache;
+    uint32_t route_cache_mask;
+    unsigned long route_cache_hits;
+    unsigned long route_cache_misses;
 } Server;
 
 Server *Server_create(const char *uuid, const char *default_host,
@@ -84,4 +106,7 @@ void Server_set_default_host(Server *srv, Host *host);
 
 Host *Server_match_backend(Server *srv, bstring target);
 
+Backend *Server_match_route(Server *srv, bstring host_name, bstring path,
+        Host **out_host, Route **out_route);
+
 #endif
@@ -48,16 +48,27 @@
 #define HAS_EPOLL 0
 #endif
 
+// edge triggered mode needs epoll plus a 0MQ that can hand out its ZMQ_FD
+#if HAS_EPOLL && defined(ZMQ_FD)
+#define HAS_EDGE_POLL 1
+#else
+#define HAS_EDGE_POLL 0
+#endif
+
 static int MAXFD = 0;
 
 enum {
     MAX_NOFILE = 1024 * 10
 };
 
+static inline void SuperPoll_destroy_edge(SuperPoll *sp);
+
 void SuperPoll_destroy(SuperPoll *sp)
 {
     if(sp) {
-        if(HAS_EPOLL) {
+        if(sp->edge) {
+            SuperPoll_destroy_edge(sp);
+        } else if(HAS_EPOLL) {
             if(sp->idle_fd > 0) close(sp->idle_fd);
             if(sp->idle_active) {
                 list_destroy_nodes(sp->idle_active);
@@ -80,6 +91,12 @@ static inline int SuperPoll_setup_idle(SuperPoll *sp, int total_open_fd);
 static inline int SuperPoll_add_idle(SuperPoll *sp, void *data, int fd, int rw);
 static inline int SuperPoll_add_idle_hits(SuperPoll *sp, PollResult *result);
 
+static inline int SuperPoll_setup_edge(SuperPoll *sp, int total_open_fd);
+static inline int SuperPoll_add_edge(SuperPoll *sp, void *data, void *socket, int fd, int rw);
+static inline int SuperPoll_del_edge(SuperPoll *sp, void *socket, int fd);
+static inline int SuperPoll_poll_edge(SuperPoll *sp, PollResult *result, int ms);
+static inline int SuperPoll_drain_edge(SuperPoll *sp, PollResult *result);
+
 
 SuperPoll *SuperPoll_create()
 {
@@ -89,8 +106,15 @@ SuperPoll *SuperPoll_create()
 
     int total_open_fd = SuperPoll_get_max_fd();
     sp->nfd_hot = 0;
+    sp->edge = HAS_EDGE_POLL && Setting_get_int("superpoll.edge_triggered", 1);
 
-    if(HAS_EPOLL) {
+    if(sp->edge) {
+        rc = SuperPoll_setup_edge(sp, total_open_fd);
+        check(rc == 0, "Failed to configure edge triggered epoll.");
+
+        log_info("Allowing for %d file descriptors through edge triggered epoll.", sp->max_fd);
+        return sp;
+    } else if(HAS_EPOLL) {
         int hot_dividend = Setting_get_int("superpoll.hot_dividend", 4);
 
         sp->max_hot = total_open_fd / hot_dividend;
@@ -163,7 +187,9 @@ error:
 
 int SuperPoll_add(SuperPoll *sp, void *data, void *socket, int fd, int rw, int hot)
 {
-    if(socket || hot || !HAS_EPOLL) {
+    if(sp->edge) {
+        return SuperPoll_add_edge(sp, data, socket, fd, rw);
+    } else if(socket || hot || !HAS_EPOLL) {
         return SuperPoll_add_poll(sp, data, socket, fd, rw);
     } else {
         assert(!socket && "Cannot add a 0MQ socket to the idle (!hot) set.");
@@ -195,6 +221,10 @@ int SuperPoll_poll(SuperPoll *sp, PollResult *result, int ms)
     int rc = 0;
     int hit_idle = 0;
 
+    if(sp->edge) {
+        return SuperPoll_poll_edge(sp, result, ms);
+    }
+
     result->nhits = 0;
 
     // do the regular poll, with idlefd inside if available
@@ -230,6 +260,33 @@ error:
 
 }
 
+int SuperPoll_del(SuperPoll *sp, void *socket, int fd)
+{
+    // the hot and idle sets forget an fd as soon as it fires
+    return sp->edge ? SuperPoll_del_edge(sp, socket, fd) : 0;
+}
+
+int SuperPoll_drain(SuperPoll *sp, PollResult *result)
+{
+    int i = 0;
+
+    if(sp->edge) {
+        return SuperPoll_drain_edge(sp, result);
+    }
+
+    result->nhits = 0;
+
+    for(i = sp->nfd_hot - 1; i >= 0; i--) {
+        if(sp->hot_data[i]) {
+            SuperPoll_add_hit(result, &sp->pollfd[i], sp->hot_data[i]);
+        }
+
+        SuperPoll_compact_down(sp, i);
+    }
+
+    return result->nhits;
+}
+
 int SuperPoll_get_max_fd()
 {
     int rc = 0;
@@ -268,7 +325,8 @@ error:
 int PollResult_init(SuperPoll *p, PollResult *result)
 {
     memset(result, 0, sizeof(PollResult));
-    result->hits = h_calloc(sizeof(PollEvent), SuperPoll_max_hot(p) + SuperPoll_max_idle(p));
+    result->max_hits = SuperPoll_max_hits(p);
+    result->hits = h_calloc(sizeof(PollEvent), result->max_hits);
     hattach(result->hits, p);
     check_mem(result->hits);
 
@@ -315,7 +373,48 @@ static inline int SuperPoll_add_idle_hits(SuperPoll *sp, PollResult *result)
     return 0;
 }
 
-#else
+#endif  // HAS_EPOLL
+
+
+#if defined HAS_EDGE_POLL && HAS_EDGE_POLL == 0
+
+static inline void SuperPoll_destroy_edge(SuperPoll *sp)
+{
+}
+
+static inline int SuperPoll_setup_edge(SuperPoll *sp, int total_open_fd)
+{
+    assert(0 && "Should not get called.");
+    return -1;
+}
+
+static inline int SuperPoll_add_edge(SuperPoll *sp, void *data, void *socket, int fd, int rw)
+{
+    assert(0 && "Should not get called.");
+    return -1;
+}
+
+static inline int SuperPoll_del_edge(SuperPoll *sp, void *socket, int fd)
+{
+    return 0;
+}
+
+static inline int SuperPoll_poll_edge(SuperPoll *sp, PollResult *result, int ms)
+{
+    assert(0 && "Should not get called.");
+    return -1;
+}
+
+static inline int SuperPoll_drain_edge(SuperPoll *sp, PollResult *result)
+{
+    assert(0 && "Should not get called.");
+    return -1;
+}
+
+#endif  // HAS_EDGE_POLL
+
+
+#if HAS_EPOLL
 
 #include <sys/epoll.h>
 
@@ -460,3 +559,367 @@ error:
 }
 
 #endif  // HAS_EPOLL
+
+
+#if HAS_EDGE_POLL
+
+/*
+ * The edge triggered mode registers each fd with epoll once, the first time
+ * somebody waits on it, and leaves it there until SuperPoll_del is called
+ * right before the fd is closed.  The interest mask only grows, so a read
+ * then a write wait costs one ADD and one MOD for the life of the socket.
+ *
+ * Since edges are only reported once, an edge that shows up when nobody is
+ * waiting is remembered in PollFd.ready, and the next SuperPoll_add for that
+ * direction returns 0 instead of parking the task.  That means callers have
+ * to try their read/write first and only wait after they get EAGAIN, which
+ * is what fdread, fdsend, mqrecv, and friends already do.
+ */
+
+enum {
+    EDGE_READ = 0,
+    EDGE_WRITE = 1
+};
+
+#define EDGE_BIT(D) (1 << (D))
+
+static inline void SuperPoll_destroy_edge(SuperPoll *sp)
+{
+    int fd = 0;
+    int dir = 0;
+    lnode_t *node = NULL;
+
+    if(sp->idle_fd > 0) close(sp->idle_fd);
+
+    if(sp->fds) {
+        for(fd = 0; fd < sp->max_fd; fd++) {
+            for(dir = EDGE_READ; dir <= EDGE_WRITE; dir++) {
+                if(sp->fds[fd].more_waiters[dir]) {
+                    list_destroy_nodes(sp->fds[fd].more_waiters[dir]);
+                    list_destroy(sp->fds[fd].more_waiters[dir]);
+                }
+            }
+        }
+    }
+
+    if(sp->pending) {
+        for(node = list_first(sp->pending); node != NULL; node = list_next(sp->pending, node)) {
+            free(lnode_get(node));
+        }
+
+        list_destroy_nodes(sp->pending);
+        list_destroy(sp->pending);
+    }
+}
+
+static inline int SuperPoll_setup_edge(SuperPoll *sp, int total_open_fd)
+{
+    sp->max_fd = total_open_fd;
+    sp->max_hot = 0;
+    sp->max_idle = 0;
+    sp->nwaiting = 0;
+
+    sp->events = h_calloc(sizeof(struct epoll_event), sp->max_fd);
+    check_mem(sp->events);
+    hattach(sp->events, sp);
+
+    sp->fds = h_calloc(sizeof(PollFd), sp->max_fd);
+    check_mem(sp->fds);
+    hattach(sp->fds, sp);
+
+    sp->idle_fd = epoll_create(sp->max_fd);
+    check(sp->idle_fd != -1, "Failed to create the epoll structure.");
+
+    sp->pending = list_create(LISTCOUNT_T_MAX);
+    check_mem(sp->pending);
+
+    return 0;
+error:
+    return -1;
+}
+
+static inline int SuperPoll_zmq_fd(void *socket)
+{
+    int fd = -1;
+    size_t len = sizeof(fd);
+
+    int rc = zmq_getsockopt(socket, ZMQ_FD, &fd, &len);
+    check(rc == 0, "Failed to get the ZMQ_FD of socket %p.", socket);
+
+    return fd;
+error:
+    return -1;
+}
+
+static inline int SuperPoll_zmq_ready(void *socket, int dir)
+{
+    uint32_t events = 0;
+    size_t len = sizeof(events);
+
+    int rc = zmq_getsockopt(socket, ZMQ_EVENTS, &events, &len);
+    check(rc == 0, "Failed to get the ZMQ_EVENTS of socket %p.", socket);
+
+    return (events & (dir == EDGE_READ ? ZMQ_POLLIN : ZMQ_POLLOUT)) != 0;
+error:
+    return -1;
+}
+
+static inline int SuperPoll_register_edge(SuperPoll *sp, PollFd *pfd, int fd, int wanted)
+{
+    int rc = 0;
+    struct epoll_event event = {.data = {.fd = fd}, .events = pfd->events | wanted | EPOLLET};
+
+    rc = epoll_ctl(sp->idle_fd, pfd->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+
+    if(rc == -1 && errno == EEXIST) {
+        // somebody closed it without telling us and got the same fd back
+        rc = epoll_ctl(sp->idle_fd, EPOLL_CTL_MOD, fd, &event);
+    } else if(rc == -1 && errno == ENOENT) {
+        // closed without SuperPoll_del, the kernel already dropped it
+        rc = epoll_ctl(sp->idle_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    check(rc != -1, "Failed to register fd %d with epoll.", fd);
+
+    pfd->events |= wanted;
+    return 0;
+
+error:
+    return -1;
+}
+
+static inline int SuperPoll_add_edge(SuperPoll *sp, void *data, void *socket, int fd, int rw)
+{
+    int dir = 0;
+    int wanted = 0;
+    int rc = 0;
+
+    assert(data && "Edge triggered poll needs data to hand back when the fd fires.");
+
+    if(rw == 'r') {
+        dir = EDGE_READ;
+    } else if(rw == 'w') {
+        dir = EDGE_WRITE;
+    } else {
+        sentinel("Invalid event %c handed to superpoll.  r/w only.", rw);
+    }
+
+    if(socket) {
+        // 0MQ only signals its fd when the socket's state changes, so ask first
+        rc = SuperPoll_zmq_ready(socket, dir);
+        check(rc != -1, "Failed to check 0MQ socket %p for events.", socket);
+        if(rc) return 0;
+
+        fd = SuperPoll_zmq_fd(socket);
+        wanted = EPOLLIN;
+    } else {
+        wanted = dir == EDGE_READ ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+    }
+
+    check(fd >= 0 && fd < sp->max_fd, "Attempt to %s from invalid file descriptor: %d",
+            rw == 'r' ? "read" : "write", fd);
+
+    PollFd *pfd = &sp->fds[fd];
+
+    if(pfd->socket != socket) {
+        // fd got reused between a 0MQ socket and a regular one
+        pfd->socket = socket;
+        pfd->ready = 0;
+    }
+
+    if(!socket && (pfd->ready & EDGE_BIT(dir))) {
+        pfd->ready &= ~EDGE_BIT(dir);
+        return 0;
+    }
+
+    if((pfd->events & wanted) != wanted) {
+        rc = SuperPoll_register_edge(sp, pfd, fd, wanted);
+        check(rc == 0, "Failed to add fd %d to the edge triggered poll.", fd);
+    }
+
+    if(pfd->waiter[dir] == NULL) {
+        pfd->waiter[dir] = data;
+    } else {
+        // several tasks can wait on one fd, usually a shared handler socket
+        if(pfd->more_waiters[dir] == NULL) {
+            pfd->more_waiters[dir] = list_create(LISTCOUNT_T_MAX);
+            check_mem(pfd->more_waiters[dir]);
+        }
+
+        lnode_t *node = lnode_create(data);
+        check_mem(node);
+        list_append(pfd->more_waiters[dir], node);
+    }
+
+    sp->nwaiting++;
+    return sp->nwaiting;
+
+error:
+    return -1;
+}
+
+static inline void SuperPoll_edge_hit(SuperPoll *sp, PollResult *result, void *socket, int fd, int revents, void *data)
+{
+    zmq_pollitem_t ev = {.socket = socket, .fd = fd, .events = revents, .revents = revents};
+
+    if(result && result->nhits < result->max_hits) {
+        SuperPoll_add_hit(result, &ev, data);
+        sp->nwaiting--;
+    } else {
+        // too many for this round, they go out first thing next poll
+        PollEvent *later = malloc(sizeof(PollEvent));
+        check_mem(later);
+        later->ev = ev;
+        later->data = data;
+
+        lnode_t *node = lnode_create(later);
+        check_mem(node);
+        list_append(sp->pending, node);
+    }
+
+    return;
+
+error:
+    log_err("Lost a task waiting on fd %d, out of memory.", fd);
+}
+
+static inline int SuperPoll_wake_edge(SuperPoll *sp, PollResult *result, int fd, int dir, int revents)
+{
+    PollFd *pfd = &sp->fds[fd];
+    lnode_t *node = NULL;
+    int woke = 0;
+
+    if(pfd->waiter[dir]) {
+        SuperPoll_edge_hit(sp, result, pfd->socket, fd, revents, pfd->waiter[dir]);
+        pfd->waiter[dir] = NULL;
+        woke++;
+    }
+
+    if(pfd->more_waiters[dir]) {
+        while(!list_isempty(pfd->more_waiters[dir])) {
+            node = list_del_first(pfd->more_waiters[dir]);
+            SuperPoll_edge_hit(sp, result, pfd->socket, fd, revents, lnode_get(node));
+            lnode_destroy(node);
+            woke++;
+        }
+    }
+
+    return woke;
+}
+
+static inline int SuperPoll_add_pending_hits(SuperPoll *sp, PollResult *result)
+{
+    lnode_t *node = NULL;
+
+    while(result->nhits < result->max_hits && !list_isempty(sp->pending)) {
+        node = list_del_first(sp->pending);
+        PollEvent *later = lnode_get(node);
+        SuperPoll_add_hit(result, &later->ev, later->data);
+        sp->nwaiting--;
+        free(later);
+        lnode_destroy(node);
+    }
+
+    return result->nhits;
+}
+
+static inline int SuperPoll_poll_edge(SuperPoll *sp, PollResult *result, int ms)
+{
+    int i = 0;
+    int nfds = 0;
+    int fd = 0;
+    struct epoll_event *events = SuperPoll_epoll_events(sp);
+
+    result->nhits = 0;
+
+    if(!list_isempty(sp->pending)) {
+        // closed fds and overflow from last time, don't make them wait
+        SuperPoll_add_pending_hits(sp, result);
+        ms = 0;
+    }
+
+    nfds = epoll_wait(sp->idle_fd, events, sp->max_fd, ms);
+    check(nfds >= 0 || errno == EINTR, "epoll_wait failed.");
+
+    result->hot_fds = nfds;
+
+    for(i = 0; i < nfds; i++) {
+        fd = events[i].data.fd;
+        PollFd *pfd = &sp->fds[fd];
+        uint32_t fired = events[i].events;
+
+        if(pfd->socket) {
+            // ZMQ_FD only says something changed, everybody rechecks ZMQ_EVENTS
+            SuperPoll_wake_edge(sp, result, fd, EDGE_READ, ZMQ_POLLIN);
+            SuperPoll_wake_edge(sp, result, fd, EDGE_WRITE, ZMQ_POLLOUT);
+            continue;
+        }
+
+        if(fired & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            if(!SuperPoll_wake_edge(sp, result, fd, EDGE_READ, ZMQ_POLLIN)) {
+                pfd->ready |= EDGE_BIT(EDGE_READ);
+            }
+        }
+
+        if(fired & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            if(!SuperPoll_wake_edge(sp, result, fd, EDGE_WRITE, ZMQ_POLLOUT)) {
+                pfd->ready |= EDGE_BIT(EDGE_WRITE);
+            }
+        }
+    }
+
+    return result->nhits;
+
+error:
+    return -1;
+}
+
+static inline int SuperPoll_del_edge(SuperPoll *sp, void *socket, int fd)
+{
+    int rc = 0;
+
+    if(socket) {
+        fd = SuperPoll_zmq_fd(socket);
+    }
+
+    check(fd >= 0 && fd < sp->max_fd, "Attempt to remove invalid file descriptor: %d", fd);
+
+    PollFd *pfd = &sp->fds[fd];
+
+    // anyone still parked on it gets woken up on the next poll to find it closed
+    SuperPoll_wake_edge(sp, NULL, fd, EDGE_READ, ZMQ_POLLIN);
+    SuperPoll_wake_edge(sp, NULL, fd, EDGE_WRITE, ZMQ_POLLOUT);
+
+    if(pfd->events) {
+        // explicit DEL since a dup of this fd would keep the registration alive
+        rc = epoll_ctl(sp->idle_fd, EPOLL_CTL_DEL, fd, NULL);
+        check(rc != -1 || errno == ENOENT || errno == EBADF,
+                "Failed to remove fd %d from epoll.", fd);
+    }
+
+    pfd->socket = NULL;
+    pfd->events = 0;
+    pfd->ready = 0;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+static inline int SuperPoll_drain_edge(SuperPoll *sp, PollResult *result)
+{
+    int fd = 0;
+
+    result->nhits = 0;
+    SuperPoll_add_pending_hits(sp, result);
+
+    for(fd = 0; fd < sp->max_fd && sp->nwaiting > 0; fd++) {
+        SuperPoll_wake_edge(sp, result, fd, EDGE_READ, ZMQ_POLLIN);
+        SuperPoll_wake_edge(sp, result, fd, EDGE_WRITE, ZMQ_POLLOUT);
+    }
+
+    return result->nhits;
+}
+
+#endif  // HAS_EDGE_POLL
@@ -43,6 +43,17 @@ typedef struct IdleData {
     void *data;
 } IdleData;
 
+typedef struct PollFd {
+    // 0MQ socket that owns this fd through ZMQ_FD, or NULL
+    void *socket;
+    // tasks parked on this fd, [0] is reading and [1] is writing
+    void *waiter[2];
+    list_t *more_waiters[2];
+    // what epoll currently has registered and what fired with nobody waiting
+    int events;
+    int ready;
+} PollFd;
+
 typedef struct SuperPoll {
 
     // poll information
@@ -60,6 +71,13 @@ typedef struct SuperPoll {
     IdleData *idle_data;
     list_t *idle_active;
     list_t *idle_free;
+
+    // edge triggered mode, fds stay registered for their whole life
+    int edge;
+    int max_fd;
+    int nwaiting;
+    PollFd *fds;
+    list_t *pending;
 } SuperPoll;
 
 
@@ -77,6 +95,7 @@ typedef struct PollResult {
     int idle_atr;
 
     int nhits;
+    int max_hits;
     PollEvent *hits;
 } PollResult;
 
@@ -90,16 +109,21 @@ void SuperPoll_compact_down(SuperPoll *sp, int i);
 
 int SuperPoll_poll(SuperPoll *sp, PollResult *result, int ms);
 
+int SuperPoll_del(SuperPoll *sp, void *socket, int fd);
+
+int SuperPoll_drain(SuperPoll *sp, PollResult *result);
+
 int SuperPoll_get_max_fd();
 
 #define SuperPoll_active_hot(S) ((S)->nfd_hot)
 
 #define SuperPoll_active_idle(S) ((S)->idle_active ? list_count((S)->idle_active)  :0)
 
-#define SuperPoll_active_count(S) (SuperPoll_active_hot(S) + SuperPoll_active_idle(S))
+#define SuperPoll_active_count(S) ((S)->edge ? (S)->nwaiting : (SuperPoll_active_hot(S) + SuperPoll_active_idle(S)))
 
 #define SuperPoll_max_hot(S) ((S)->max_hot)
 #define SuperPoll_max_idle(S) ((S)->max_idle)
+#define SuperPoll_max_hits(S) ((S)->edge ? (S)->max_fd * 2 : SuperPoll_max_hot(S) + SuperPoll_max_idle(S))
 
 #define SuperPoll_data(S, I) ((S)->hot_data[(I)])
 
@@ -5,19 +5,39 @@
 #include <stdio.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <string.h>
 
 #include "superpoll.h"
 #include "dbg.h"
 #include "setting.h"
 #include "register.h"
+#include "adt/wheel.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_NONBLOCK 2
+#endif
+#endif
+
+// the default pipe capacity, more than this would just block
+#define FDSPLICE_CHUNK (64 * 1024)
 
 
 static int STARTED_FDTASK = 0;
-static Tasklist sleeping;
 static int sleepingcounted;
 static uvlong nsec(void);
+
+// rounded up so timers never go off early
+#define NOW_MS() ((nsec() + 999999) / 1000000)
 SuperPoll *POLL = NULL;
 
+// taskdelay sleepers and tasktimer alarms, in milliseconds
+static wheel_t *TIMERS = NULL;
+
 void *ZMQ_CTX = NULL;
 
 int FDSTACK= 100 * 1024;
@@ -40,42 +60,29 @@ void mqinit(int threads)
     }
 }
 
-static inline int next_task_sleeptime(int min)
+/*
+ * How long the poll can wait before the next timer is due, -1 for as
+ * long as it likes when there aren't any.
+ */
+static inline int next_task_sleeptime()
 {
-    Task *t;
-    uvlong now = 0;
-    int ms = 0;
-
-    if((t=sleeping.head) == NULL)
-        ms = -1;
-    else{
-        now = nsec();
-        if(now >= t->alarmtime) {
-            ms = 0;
-        } else {
-            ms = (t->alarmtime - now) / 1000000;
-        }
+    int64_t ms = wheel_next(TIMERS);
+    int64_t behind = 0;
 
-        if(ms % min != 0) ms = ms - (ms % min);
-    }
+    if(ms <= 0) return ms;
 
-    if(ms == 0) ms = min;
+    // the wheel only knows the time it was last advanced to
+    behind = (int64_t)(nsec() / 1000000) - (int64_t)TIMERS->now;
 
-    return ms;
+    return behind >= ms ? 0 : ms - behind;
 }
 
 static inline void wake_sleepers()
 {
-    Task *t;
-    uvlong now = nsec();
-
-    while((t =sleeping.head) && now >= t->alarmtime){
-        deltask(&sleeping, t);
+    uvlong now = nsec() / 1000000;
 
-        if(!t->system && --sleepingcounted == 0) taskcount--;
-
-        taskready(t);
-    }
+    THE_CURRENT_TIME_IS = now / 1000;
+    wheel_advance(TIMERS, now);
 }
 
 void
@@ -99,21 +106,26 @@ fdtask(void *v)
         errno = 0;
         taskstate("poll");
 
-        ms = next_task_sleeptime(500);
+        if(SIGNALED) uringcancelall();
+
+        // everything queued on io_uring this round goes in with one syscall
+        uringsubmit();
+
+        ms = next_task_sleeptime();
+
+        // don't block in the poll if there's finished io_uring work to hand out
+        if(uringreap() > 0) ms = 0;
 
         if(SIGNALED) {
-            for(i = 0; i < SuperPoll_active_hot(POLL); i++) {
-                Task *target = (Task *)SuperPoll_data(POLL, i);
-                if(target) taskready(target);
-                SuperPoll_compact_down(POLL, i);
-            }
+            rc = SuperPoll_drain(POLL, &result);
         } else {
             rc = SuperPoll_poll(POLL, &result, ms);
-            check(rc != -1, "SuperPoll failure, aborting.");
+        }
 
-            for(i = 0; i < rc; i++) {
-                taskready(result.hits[i].data); 
-            }
+        check(rc != -1, "SuperPoll failure, aborting.");
+
+        for(i = 0; i < rc; i++) {
+            if(result.hits[i].data) taskready(result.hits[i].data); 
         }
 
         wake_sleepers();
@@ -135,6 +147,7 @@ static inline void startfdtask()
         log_info("MAX limits.fdtask_stack=%d", FDSTACK);
 
         POLL = SuperPoll_create();
+        TIMERS = wheel_create(nsec() / 1000000);
         STARTED_FDTASK = 1;
         taskcreate(fdtask, 0, FDSTACK);
     }
@@ -144,47 +157,32 @@ int taskwaiting()
 {
     startfdtask();
 
-    return SuperPoll_active_count(POLL);
+    return SuperPoll_active_count(POLL) + uringwaiting();
 }
 
 
+static void taskdelay_fire(wheel_timer_t *timer)
+{
+    Task *t = timer->data;
+
+    if(!t->system && --sleepingcounted == 0) taskcount--;
+
+    taskready(t);
+}
+
 uint taskdelay(uint ms)
 {
-    uvlong when = 0L;
     uvlong now = 0L;
-    Task *t = NULL;
-   
+    wheel_timer_t timer;
+
     startfdtask();
 
+    // the timer lives on our stack, which stays put while we're asleep
     now = nsec();
-    when = now + (uvlong)ms * 1000000;
-    for(t=sleeping.head; t != NULL && t->alarmtime < when; t=t->next)
-        ;
+    wheel_timer_init(&timer, taskdelay_fire, taskrunning);
+    wheel_add(TIMERS, &timer, (now + 999999) / 1000000 + ms);
 
-    if(t) {
-        taskrunning->prev = t->prev;
-        taskrunning->next = t;
-    } else {
-        taskrunning->prev = sleeping.tail;
-        taskrunning->next = NULL;
-    }
-    
-    t = taskrunning;
-    t->alarmtime = when;
-
-    if(t->prev) {
-        t->prev->next = t;
-    } else {
-        sleeping.head = t;
-    }
-
-    if(t->next) {
-        t->next->prev = t;
-    } else {
-        sleeping.tail = t;
-    }
-
-    if(!t->system && sleepingcounted++ == 0) {
+    if(!taskrunning->system && sleepingcounted++ == 0) {
         taskcount++;
     }
 
@@ -193,6 +191,22 @@ uint taskdelay(uint ms)
     return (nsec() - now) / 1000000;
 }
 
+/**
+ * Arms timer to have its fire callback run from fdtask in ms milliseconds,
+ * moving it if it's already armed.  Nothing waits on it, so unlike
+ * taskdelay it doesn't keep the process alive.
+ */
+void tasktimer(wheel_timer_t *timer, uint ms)
+{
+    startfdtask();
+    wheel_add(TIMERS, timer, NOW_MS() + ms);
+}
+
+void tasktimercancel(wheel_timer_t *timer)
+{
+    if(TIMERS) wheel_cancel(TIMERS, timer);
+}
+
 int _wait(void *socket, int fd, int rw)
 {
     startfdtask();
@@ -212,7 +226,10 @@ int _wait(void *socket, int fd, int rw)
     max = SuperPoll_add(POLL, (void *)taskrunning, socket, fd, rw, hot_add);
     check(max != -1, "Error adding fd: %d or socket: %p to task wait list.", fd, socket);
 
-    taskswitch();
+    // edge triggered poll returns 0 when it already saw the fd become ready
+    if(max > 0) {
+        taskswitch();
+    }
 
     if(SIGNALED) {
         return -1;
@@ -250,6 +267,15 @@ error:
     return NULL;
 }
 
+int mqclose(void *socket)
+{
+    if(POLL && socket) {
+        SuperPoll_del(POLL, socket, -1);
+    }
+
+    return zmq_close(socket);
+}
+
 int mqwait(void *socket, int rw)
 {
     return _wait(socket, -1, rw);
@@ -294,31 +320,18 @@ int mqsend(void *socket, zmq_msg_t *msg, int flags)
 }
 
 
-/* Like fdread but always calls fdwait before reading. */
+/*
+ * These used to fdwait before reading, but the edge triggered poll only
+ * wakes a task for new data, so now they try first just like fdread/fdrecv.
+ */
 int fdread1(int fd, void *buf, int n)
 {
-    int m;
-    
-    do {
-        if(fdwait(fd, 'r') == -1) {
-            return -1;
-        }
-    } while((m = read(fd, buf, n)) < 0 && errno == EAGAIN);
-
-    return m;
+    return fdread(fd, buf, n);
 }
 
 int fdrecv1(int fd, void *buf, int n)
 {
-    int m;
-    
-    do {
-        if(fdwait(fd, 'r') == -1) {
-            return -1;
-        }
-    } while((m = recv(fd, buf, n, MSG_NOSIGNAL)) < 0 && errno == EAGAIN);
-
-    return m;
+    return fdrecv(fd, buf, n);
 }
 
 int fdread(int fd, void *buf, int n)
@@ -382,6 +395,105 @@ int fdsend(int fd, void *buf, int n)
     return tot;
 }
 
+/*
+ * Same as fdsend but gathers from an iovec, so a header and a body can
+ * go out in one system call.  It advances the iov entries as it goes,
+ * so don't reuse them after this.
+ */
+int fdsendv(int fd, struct iovec *iov, int iovcnt)
+{
+    int m = 0;
+    int tot = 0;
+    struct msghdr msg;
+
+    while(iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        while((m=sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EAGAIN) {
+            if(fdwait(fd, 'w') == -1) {
+                return -1;
+            }
+        }
+
+        if(m < 0) return m;
+        if(m == 0) break;
+        tot += m;
+
+        // skip past whatever fully went out, then trim the partial one
+        while(iovcnt > 0 && m >= (int)iov->iov_len) {
+            m -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + m;
+            iov->iov_len -= m;
+        }
+    }
+
+    return tot;
+}
+
+/*
+ * Moves up to len bytes from one socket to another through pipefd with
+ * splice, so they never get copied into userspace.  The pipe gets made
+ * the first time, and it moves at most one pipe full per call so loop
+ * on it.  Returns 0 when from is closed and -1 on errors (or when this
+ * isn't Linux), and the pipe may have junk in it after an error.
+ */
+int fdsplice(int from, int to, int pipefd[2], int len)
+{
+#ifdef __linux__
+    int n = 0;
+    int m = 0;
+    int moved = 0;
+
+    if(pipefd[0] == -1) {
+        if(syscall(SYS_pipe2, pipefd, O_NONBLOCK | O_CLOEXEC) == -1) return -1;
+    }
+
+    if(len > FDSPLICE_CHUNK) len = FDSPLICE_CHUNK;
+
+    while((n=syscall(SYS_splice, from, NULL, pipefd[1], NULL, len,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 && errno == EAGAIN) {
+        if(fdwait(from, 'r') == -1) {
+            return -1;
+        }
+    }
+
+    if(n <= 0) return n;
+
+    while(moved < n) {
+        while((m=syscall(SYS_splice, pipefd[0], NULL, to, NULL, n - moved,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 && errno == EAGAIN) {
+            if(fdwait(to, 'w') == -1) {
+                return -1;
+            }
+        }
+
+        if(m <= 0) return -1;
+        moved += m;
+    }
+
+    return moved;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void fdclose(int fd)
+{
+    if(fd >= 0) {
+        uringclose(fd);
+        if(POLL) SuperPoll_del(POLL, NULL, fd);
+        close(fd);
+    }
+}
+
 int fdnoblock(int fd)
 {
 #ifdef SO_NOSIGPIPE
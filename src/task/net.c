@@ -56,6 +56,15 @@ static int cb_bind(int fd, int istcp, struct sockaddr *psa, size_t sz)
         n = 1;
         rc = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&n, sizeof n);
         check(rc != -1, "Failed to set bind socket to SO_REUSEADDR, that's messed up.");
+
+        if(istcp == TCP_REUSEPORT) {
+#ifdef SO_REUSEPORT
+            rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char*)&n, sizeof n);
+            check(rc != -1, "Failed to set bind socket to SO_REUSEPORT.");
+#else
+            sentinel("Your OS doesn't have SO_REUSEPORT, you can't run more than one worker.");
+#endif
+        }
     }
 
     rc = bind(fd, psa, sz);
@@ -227,13 +236,14 @@ int netaccept(int fd, char *server, int *port)
    
     cfd = accept(fd, (void*)&addr_converter, &len);
 
-    if(cfd == -1) {
+    while(cfd == -1) {
         if(errno == EAGAIN || errno == EWOULDBLOCK) {
             rc = fdwait(fd, 'r');
             check(rc != -1, "Failed waiting on non-block accept.");
 
+            // another worker may have taken it, so keep going until we get one
+            len = sizeof(addr_converter);
             cfd = accept(fd, (void*)&addr_converter, &len);
-            check(cfd != -1, "Failed to accept after doing a poll on the socket.");
         } else {
             sentinel("Failed calling accept on socket that was ready: %d, %d", cfd, errno == EAGAIN);
         }
@@ -10,9 +10,11 @@ extern "C" {
 #include <stdarg.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 #include <zmq.h>
 
 struct tns_value_t;
+struct wheel_timer_t;
 
 /*
  * basic procs and threads
@@ -38,6 +40,8 @@ char*    taskgetstate(void);
 struct tns_value_t *taskgetinfo(void);
 void    tasksystem(void);
 unsigned int  taskdelay(unsigned int);
+void    tasktimer(struct wheel_timer_t *timer, unsigned int ms);
+void    tasktimercancel(struct wheel_timer_t *timer);
 unsigned int  taskid(void);
 unsigned int  taskgetid(Task *task);
 int taskwaiting();
@@ -108,19 +112,35 @@ int taskbarrier(Rendez *r);
  * Threaded I/O.
  */
 int fdread(int, void*, int);
-int fdread1(int, void*, int);  /* always uses fdwait */
-int fdrecv1(int, void*, int);  /* always uses fdwait */
+int fdread1(int, void*, int);  /* same as fdread */
+int fdrecv1(int, void*, int);  /* same as fdrecv */
 int fdwrite(int, void*, int);
 int fdsend(int, void*, int);
+int fdsendv(int, struct iovec*, int);
+int fdsplice(int, int, int[2], int);
 int fdrecv(int, void*, int);
 int fdwait(int, int);
 int fdnoblock(int);
 void fdsignal();
 
-#define fdclose(fd) if(fd >= 0) close(fd)
+void fdclose(int fd);
 
 void    fdtask(void*);
 
+/*
+ * Optional io_uring engine, see io_uring.enabled.
+ */
+int uringenabled();
+int uringsubmit();
+int uringreap();
+int uringwaiting();
+int uringrecv(int fd, void *buf, int n);
+int uringsend(int fd, void *buf, int n);
+int uringstream(int fd, int file_fd, off_t offset, int len);
+void uringregister(int fd);
+void uringclose(int fd);
+void uringcancelall();
+
 /*
  * 0mq Integration.
  */
@@ -129,6 +149,7 @@ void *mqsocket(int type);
 int mqwait(void *socket, int rw);
 int mqrecv(void *socket, zmq_msg_t *msg, int flags);
 int mqsend(void *socket, zmq_msg_t *msg, int flags);
+int mqclose(void *socket);
 
 extern void *ZMQ_CTX;
 
@@ -139,6 +160,7 @@ enum
 {
   UDP = 0,
   TCP = 1,
+  TCP_REUSEPORT = 2, /* TCP listener other processes can bind too */
 };
 
 int    netannounce(int, char*, int);
@@ -0,0 +1,627 @@
+#include "taskimpl.h"
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "dbg.h"
+#include "setting.h"
+#include "superpoll.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Optional io_uring engine for socket I/O.  Tasks queue their recv/send
+ * (or read+send pairs for files) and park, fdtask submits everything queued
+ * that round with one io_uring_enter right before it polls, and the
+ * completions wake the tasks back up.  Sockets are kept in a fixed file
+ * table and file streaming reads into registered buffers.
+ *
+ * It's off unless io_uring.enabled=1, and builds without io_uring headers
+ * get the stubs at the bottom so everything stays on the poll path.
+ */
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef IORING_FEAT_FAST_POLL
+#define HAS_IO_URING 1
+#else
+#define HAS_IO_URING 0
+#endif
+
+
+#if HAS_IO_URING
+
+#include <sys/mman.h>
+
+typedef struct UringOp {
+    Task *task;
+    int fd;
+    int res;
+    int done;
+} UringOp;
+
+typedef struct Ring {
+    int fd;
+    unsigned entries;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;
+    unsigned to_submit;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // ops in flight, indexed by fd*2 for reads and fd*2+1 for writes
+    UringOp **inflight;
+    int max_fd;
+    int waiting;
+
+    int fixed_files;
+    unsigned char *registered;
+
+    char *buffers;
+    int buffer_size;
+    int nbuffers;
+    int *free_buffers;
+    int nfree;
+} Ring;
+
+static Ring RING = {.fd = -1};
+static int URING_CHECKED = 0;
+
+extern int SIGNALED;
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+static int uring_map(struct io_uring_params *p)
+{
+    size_t sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    size_t cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    char *sq = NULL;
+    char *cq = NULL;
+
+    if(p->features & IORING_FEAT_SINGLE_MMAP) {
+        if(cq_size > sq_size) sq_size = cq_size;
+    }
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            RING.fd, IORING_OFF_SQ_RING);
+    check(sq != MAP_FAILED, "Failed to map the io_uring submission ring.");
+
+    if(p->features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                RING.fd, IORING_OFF_CQ_RING);
+        check(cq != MAP_FAILED, "Failed to map the io_uring completion ring.");
+    }
+
+    RING.sqes = mmap(NULL, p->sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING.fd, IORING_OFF_SQES);
+    check(RING.sqes != MAP_FAILED, "Failed to map the io_uring sqes.");
+
+    RING.entries = p->sq_entries;
+    RING.sq_head = (unsigned *)(sq + p->sq_off.head);
+    RING.sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    RING.sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    RING.sq_array = (unsigned *)(sq + p->sq_off.array);
+    RING.sqe_tail = *RING.sq_tail;
+
+    RING.cq_head = (unsigned *)(cq + p->cq_off.head);
+    RING.cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    RING.cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    RING.cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    return 0;
+error:
+    return -1;
+}
+
+static void uring_register_files()
+{
+    int i = 0;
+    int rc = 0;
+    int *files = calloc(sizeof(int), RING.max_fd);
+    check_mem(files);
+
+    for(i = 0; i < RING.max_fd; i++) files[i] = -1;
+
+    rc = io_uring_register(RING.fd, IORING_REGISTER_FILES, files, RING.max_fd);
+    check(rc == 0, "Couldn't register a fixed file table, using plain fds: %s", strerror(errno));
+
+    RING.registered = calloc(1, RING.max_fd);
+    check_mem(RING.registered);
+
+    RING.fixed_files = 1;
+
+error: // fallthrough
+    free(files);
+}
+
+static void uring_register_buffers()
+{
+    int i = 0;
+    int rc = 0;
+    struct iovec *iov = NULL;
+
+    RING.nbuffers = Setting_get_int("io_uring.buffers", 32);
+    RING.buffer_size = Setting_get_int("io_uring.buffer_size", 64 * 1024);
+    log_info("MAX io_uring.buffers=%d, io_uring.buffer_size=%d", RING.nbuffers, RING.buffer_size);
+
+    if(RING.nbuffers <= 0) return;
+
+    RING.buffers = mmap(NULL, (size_t)RING.nbuffers * RING.buffer_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(RING.buffers != MAP_FAILED, "Failed to map the io_uring buffers.");
+
+    iov = calloc(sizeof(struct iovec), RING.nbuffers);
+    check_mem(iov);
+    RING.free_buffers = calloc(sizeof(int), RING.nbuffers);
+    check_mem(RING.free_buffers);
+
+    for(i = 0; i < RING.nbuffers; i++) {
+        iov[i].iov_base = RING.buffers + (size_t)i * RING.buffer_size;
+        iov[i].iov_len = RING.buffer_size;
+        RING.free_buffers[i] = i;
+    }
+
+    rc = io_uring_register(RING.fd, IORING_REGISTER_BUFFERS, iov, RING.nbuffers);
+    check(rc == 0, "Couldn't register io_uring buffers, files will use sendfile: %s", strerror(errno));
+
+    RING.nfree = RING.nbuffers;
+    free(iov);
+    return;
+
+error:
+    if(iov) free(iov);
+    if(RING.free_buffers) free(RING.free_buffers);
+    if(RING.buffers && RING.buffers != MAP_FAILED) {
+        munmap(RING.buffers, (size_t)RING.nbuffers * RING.buffer_size);
+    }
+    RING.buffers = NULL;
+    RING.free_buffers = NULL;
+    RING.nbuffers = 0;
+}
+
+static void uringtask(void *v);
+
+static int uringinit()
+{
+    struct io_uring_params params;
+    int entries = Setting_get_int("io_uring.entries", 1024);
+    log_info("MAX io_uring.entries=%d", entries);
+
+    memset(&params, 0, sizeof(params));
+
+    RING.fd = io_uring_setup(entries, &params);
+    check(RING.fd >= 0, "Failed to set up io_uring, staying with poll: %s", strerror(errno));
+    check(params.features & IORING_FEAT_FAST_POLL,
+            "Your kernel's io_uring is too old, staying with poll.");
+    check(uring_map(&params) == 0, "Failed to map io_uring, staying with poll.");
+
+    RING.max_fd = SuperPoll_get_max_fd();
+    RING.inflight = calloc(sizeof(UringOp *), RING.max_fd * 2);
+    check_mem(RING.inflight);
+
+    uring_register_files();
+    uring_register_buffers();
+
+    taskcreate(uringtask, NULL, 32 * 1024);
+
+    log_info("Using io_uring with %d entries for socket I/O.", RING.entries);
+    return 0;
+
+error:
+    if(RING.fd >= 0) close(RING.fd);
+    RING.fd = -1;
+    return -1;
+}
+
+int uringenabled()
+{
+    if(!URING_CHECKED) {
+        URING_CHECKED = 1;
+
+        if(Setting_get_int("io_uring.enabled", 0)) {
+            uringinit();
+        }
+    }
+
+    return RING.fd >= 0;
+}
+
+
+static inline void uring_complete(struct io_uring_cqe *cqe)
+{
+    UringOp *op = (UringOp *)(uintptr_t)cqe->user_data;
+
+    if(op == NULL) return; // cancel requests don't carry an op
+
+    op->res = cqe->res;
+    op->done = 1;
+
+    if(op->task) {
+        RING.waiting--;
+        taskready(op->task);
+    }
+}
+
+/* Hands completions to their tasks, returns how many it found. */
+int uringreap()
+{
+    unsigned head = 0;
+    unsigned tail = 0;
+    int found = 0;
+
+    if(RING.fd < 0) return 0;
+
+    head = *RING.cq_head;
+    tail = __atomic_load_n(RING.cq_tail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++, found++) {
+        uring_complete(&RING.cqes[head & *RING.cq_mask]);
+    }
+
+    __atomic_store_n(RING.cq_head, head, __ATOMIC_RELEASE);
+
+    return found;
+}
+
+/* Called by fdtask once per round, so every task's I/O goes in one syscall. */
+int uringsubmit()
+{
+    int rc = 0;
+
+    if(RING.fd < 0 || RING.to_submit == 0) return 0;
+
+    __atomic_store_n(RING.sq_tail, RING.sqe_tail, __ATOMIC_RELEASE);
+
+    do {
+        rc = io_uring_enter(RING.fd, RING.to_submit, 0, 0);
+    } while(rc == -1 && errno == EINTR);
+
+    check(rc >= 0, "io_uring_enter failed to submit %d entries.", RING.to_submit);
+
+    RING.to_submit -= rc;
+    return rc;
+
+error:
+    return -1;
+}
+
+int uringwaiting()
+{
+    return RING.fd >= 0 ? RING.waiting : 0;
+}
+
+static void uringtask(void *v)
+{
+    tasksystem();
+    taskname("uringtask");
+
+    for(;;) {
+        uringreap();
+
+        if(fdwait(RING.fd, 'r') == -1 && SIGNALED) {
+            break;
+        }
+    }
+
+    taskexit(0);
+}
+
+static struct io_uring_sqe *uring_get_sqe()
+{
+    unsigned head = __atomic_load_n(RING.sq_head, __ATOMIC_ACQUIRE);
+
+    if(RING.sqe_tail - head >= RING.entries) {
+        // ring is full, push what we have now rather than waiting for fdtask
+        check(uringsubmit() != -1, "Failed to flush a full io_uring.");
+        head = __atomic_load_n(RING.sq_head, __ATOMIC_ACQUIRE);
+        check(RING.sqe_tail - head < RING.entries, "io_uring is still full after a submit.");
+    }
+
+    unsigned index = RING.sqe_tail & *RING.sq_mask;
+    struct io_uring_sqe *sqe = &RING.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    RING.sq_array[index] = index;
+    RING.sqe_tail++;
+    RING.to_submit++;
+
+    return sqe;
+
+error:
+    return NULL;
+}
+
+static inline void uring_prep(struct io_uring_sqe *sqe, int opcode, int fd,
+        void *buf, unsigned len, uint64_t offset, UringOp *op)
+{
+    sqe->opcode = opcode;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t)op;
+
+    sqe->fd = fd;
+
+    if(RING.fixed_files && fd >= 0 && fd < RING.max_fd && RING.registered[fd]) {
+        // fd is also its index in the fixed file table
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+static int uring_wait(UringOp *op, int fd, int rw)
+{
+    int slot = fd >= 0 && fd < RING.max_fd ? fd * 2 + (rw == 'w') : -1;
+
+    op->task = taskrunning;
+    RING.waiting++;
+
+    if(slot >= 0) RING.inflight[slot] = op;
+
+    taskstate(rw == 'r' ? "uring read" : "uring write");
+
+    while(!op->done) {
+        taskswitch();
+    }
+
+    if(slot >= 0 && RING.inflight[slot] == op) RING.inflight[slot] = NULL;
+
+    return op->res;
+}
+
+int uringrecv(int fd, void *buf, int n)
+{
+    UringOp op = {.fd = fd};
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    check(sqe != NULL, "Failed to get an io_uring entry for recv on %d.", fd);
+
+    uring_prep(sqe, IORING_OP_RECV, fd, buf, n, 0, &op);
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    int rc = uring_wait(&op, fd, 'r');
+
+    if(rc < 0) {
+        errno = -rc;
+        return -1;
+    }
+
+    return rc;
+
+error:
+    return -1;
+}
+
+int uringsend(int fd, void *buf, int n)
+{
+    int tot = 0;
+    int rc = 0;
+
+    for(tot = 0; tot < n; tot += rc) {
+        UringOp op = {.fd = fd};
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        check(sqe != NULL, "Failed to get an io_uring entry for send on %d.", fd);
+
+        uring_prep(sqe, IORING_OP_SEND, fd, (char *)buf + tot, n - tot, 0, &op);
+        sqe->msg_flags = MSG_NOSIGNAL;
+
+        rc = uring_wait(&op, fd, 'w');
+
+        if(rc < 0) {
+            errno = -rc;
+            return -1;
+        } else if(rc == 0) {
+            break;
+        }
+    }
+
+    return tot;
+
+error:
+    return -1;
+}
+
+/*
+ * Streams len bytes of file_fd out to fd through one registered buffer, each
+ * chunk is a READ_FIXED linked to a SEND so it's one trip through the ring.
+ * Returns -2 when there's no free buffer so the caller can use sendfile.
+ */
+int uringstream(int fd, int file_fd, off_t offset, int len)
+{
+    int total = 0;
+    int sent = 0;
+    int chunk = 0;
+    int buffer = 0;
+    char *data = NULL;
+
+    if(RING.nfree == 0) return -2;
+
+    buffer = RING.free_buffers[--RING.nfree];
+    data = RING.buffers + (size_t)buffer * RING.buffer_size;
+
+    while(total < len) {
+        UringOp read_op = {.fd = file_fd};
+        UringOp send_op = {.fd = fd};
+        chunk = len - total < RING.buffer_size ? len - total : RING.buffer_size;
+
+        struct io_uring_sqe *rsqe = uring_get_sqe();
+        check(rsqe != NULL, "Failed to get an io_uring entry for file %d.", file_fd);
+        uring_prep(rsqe, IORING_OP_READ_FIXED, file_fd, data, chunk, offset + total, &read_op);
+        rsqe->buf_index = buffer;
+        rsqe->flags |= IOSQE_IO_LINK;
+
+        struct io_uring_sqe *ssqe = uring_get_sqe();
+        check(ssqe != NULL, "Failed to get an io_uring entry for send on %d.", fd);
+        uring_prep(ssqe, IORING_OP_SEND, fd, data, chunk, 0, &send_op);
+        ssqe->msg_flags = MSG_NOSIGNAL;
+
+        // the send completes after the read, even when the read cancels it
+        uring_wait(&send_op, fd, 'w');
+
+        check(read_op.done, "io_uring completed the send before its read.");
+        check_debug(read_op.res > 0, "Came up short reading file %d: %d", file_fd, read_op.res);
+
+        sent = send_op.res;
+
+        if(sent == -ECANCELED || (sent >= 0 && sent < read_op.res)) {
+            // short read or short send, push out the rest of what we read
+            int done = sent > 0 ? sent : 0;
+            int rc = uringsend(fd, data + done, read_op.res - done);
+            check_debug(rc == read_op.res - done, "Client closed during uring send on %d.", fd);
+            sent = read_op.res;
+        }
+
+        check_debug(sent > 0, "Client closed during uring send on %d: %d", fd, sent);
+        total += sent;
+    }
+
+    RING.free_buffers[RING.nfree++] = buffer;
+    return total;
+
+error:
+    RING.free_buffers[RING.nfree++] = buffer;
+    return -1;
+}
+
+void uringregister(int fd)
+{
+    struct io_uring_files_update up = {.offset = fd, .fds = (uintptr_t)&fd};
+
+    if(RING.fd < 0 || !RING.fixed_files || fd < 0 || fd >= RING.max_fd) return;
+
+    if(io_uring_register(RING.fd, IORING_REGISTER_FILES_UPDATE, &up, 1) == 1) {
+        RING.registered[fd] = 1;
+    } else {
+        log_warn("Failed to add fd %d to the io_uring file table.", fd);
+    }
+}
+
+static void uring_cancel(int fd)
+{
+    int rw = 0;
+
+    for(rw = 0; rw < 2; rw++) {
+        UringOp *op = RING.inflight[fd * 2 + rw];
+
+        if(op && !op->done) {
+            struct io_uring_sqe *sqe = uring_get_sqe();
+
+            if(sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = (uintptr_t)op;
+            }
+        }
+
+        RING.inflight[fd * 2 + rw] = NULL;
+    }
+}
+
+/* Cancels anything in flight on fd and drops it from the file table. */
+void uringclose(int fd)
+{
+    int none = -1;
+    struct io_uring_files_update up = {.offset = fd, .fds = (uintptr_t)&none};
+
+    if(RING.fd < 0 || fd < 0 || fd >= RING.max_fd) return;
+
+    uring_cancel(fd);
+
+    if(RING.fixed_files && RING.registered[fd]) {
+        io_uring_register(RING.fd, IORING_REGISTER_FILES_UPDATE, &up, 1);
+        RING.registered[fd] = 0;
+    }
+}
+
+void uringcancelall()
+{
+    int fd = 0;
+
+    if(RING.fd < 0) return;
+
+    for(fd = 0; fd < RING.max_fd && RING.waiting > 0; fd++) {
+        if(RING.inflight[fd * 2] || RING.inflight[fd * 2 + 1]) {
+            uring_cancel(fd);
+        }
+    }
+}
+
+#else
+
+int uringenabled()
+{
+    return 0;
+}
+
+int uringreap()
+{
+    return 0;
+}
+
+int uringsubmit()
+{
+    return 0;
+}
+
+int uringwaiting()
+{
+    return 0;
+}
+
+int uringrecv(int fd, void *buf, int n)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringsend(int fd, void *buf, int n)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringstream(int fd, int file_fd, off_t offset, int len)
+{
+    return -2;
+}
+
+void uringregister(int fd)
+{
+}
+
+void uringclose(int fd)
+{
+}
+
+void uringcancelall()
+{
+}
+
+#endif // HAS_IO_URING
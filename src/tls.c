@@ -0,0 +1,508 @@
+#include "tls.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <polarssl/sha2.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "dbg.h"
+#include "cache.h"
+#include "register.h"
+#include "setting.h"
+#include "tnetstrings.h"
+#include "tnetstrings_impl.h"
+#include "task/task.h"
+
+TLSStats TLS_STATS = {0};
+
+static Cache *SESSIONS = NULL;
+static int SESSION_TIMEOUT = DEFAULT_SSL_SESSION_TIMEOUT;
+
+static TLSDrbg DRBG;
+static int DRBG_SEEDED = 0;
+static int URANDOM_FD = -1;
+
+/*
+ * A handshake's private key operation waiting for (or done by) one of the
+ * handshake threads.  It lives on the connection task's stack, which
+ * sleeps on wait until the reaper task sees it come back.
+ */
+typedef struct TLSJob {
+    int (*fn)(void *);
+    void *arg;
+    int rc;
+    int done;
+    Rendez wait;
+    struct TLSJob *next;
+} TLSJob;
+
+static int HANDSHAKE_THREADS = DEFAULT_SSL_HANDSHAKE_THREADS;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    TLSJob *head;
+    TLSJob *tail;
+    int done_fd[2];
+    int threads;
+    pid_t pid;
+} POOL = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, {-1, -1}, 0, 0};
+
+struct tagbstring TLS_HEADERS = bsStatic("49:4:full,7:resumed,6:failed,9:offloaded,8:sessions,]");
+
+static uint32_t tls_session_hash(void *key_or_data)
+{
+    ssl_session *ssn = key_or_data;
+    uint32_t hash = 2166136261u;
+    int i = 0;
+
+    for(i = 0; i < ssn->length; i++) {
+        hash = (hash ^ ssn->id[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static int tls_session_lookup(void *data, void *key)
+{
+    ssl_session *cached = data;
+    ssl_session *wanted = key;
+
+    return cached->length == wanted->length &&
+        memcmp(cached->id, wanted->id, cached->length) == 0;
+}
+
+static void tls_session_evict(void *data)
+{
+    // don't leave master secrets lying around in freed memory
+    memset(data, 0, sizeof(ssl_session));
+    free(data);
+}
+
+/*
+ * polarssl calls this with the session id from the ClientHello to see if
+ * it can skip the key exchange.  Returns 0 and fills in the master secret
+ * if we've still got it and it was for the same cipher.
+ */
+static int tls_session_get(ssl_context *ssl)
+{
+    ssl_session *found = Cache_lookup(SESSIONS, ssl->session);
+
+    check_debug(found != NULL, "No cached TLS session to resume.");
+
+    if(SESSION_TIMEOUT > 0 && THE_CURRENT_TIME_IS - found->start > SESSION_TIMEOUT) {
+        Cache_evict_object(SESSIONS, found);
+        return 1;
+    }
+
+    check_debug(found->cipher == ssl->session->cipher,
+            "Cached TLS session was for a different cipher.");
+
+    memcpy(ssl->session->master, found->master, sizeof(found->master));
+    return 0;
+
+error:
+    return 1;
+}
+
+/*
+ * Called after a full key exchange with the new session id and master
+ * secret, which gets a copy in the cache.
+ */
+static int tls_session_set(ssl_context *ssl)
+{
+    ssl_session *ssn = NULL;
+    ssl_session *old = Cache_lookup(SESSIONS, ssl->session);
+
+    if(old) Cache_evict_object(SESSIONS, old);
+
+    ssn = malloc(sizeof(ssl_session));
+    check_mem(ssn);
+
+    memcpy(ssn, ssl->session, sizeof(ssl_session));
+    ssn->start = THE_CURRENT_TIME_IS;
+    ssn->next = NULL;
+
+    Cache_add_sized(SESSIONS, ssn, sizeof(ssl_session), 0);
+    return 0;
+
+error:
+    return 1;
+}
+
+/*
+ * HMAC_DRBG_Update: K = HMAC(K, V || 0x00 || data), V = HMAC(K, V), and
+ * again with 0x01 if there was any data.
+ */
+static void tls_drbg_update(TLSDrbg *drbg, const unsigned char *data, int len)
+{
+    sha2_context ctx;
+    unsigned char round = 0;
+
+    for(round = 0; round < (len > 0 ? 2 : 1); round++) {
+        sha2_hmac_starts(&ctx, drbg->key, sizeof(drbg->key), 0);
+        sha2_hmac_update(&ctx, drbg->v, sizeof(drbg->v));
+        sha2_hmac_update(&ctx, &round, 1);
+        if(len > 0) sha2_hmac_update(&ctx, data, len);
+        sha2_hmac_finish(&ctx, drbg->key);
+
+        sha2_hmac(drbg->key, sizeof(drbg->key), drbg->v, sizeof(drbg->v), drbg->v, 0);
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+void TLS_drbg_seed(TLSDrbg *drbg, const unsigned char *seed, int len)
+{
+    memset(drbg->key, 0x00, sizeof(drbg->key));
+    memset(drbg->v, 0x01, sizeof(drbg->v));
+    tls_drbg_update(drbg, seed, len);
+
+    drbg->generated = 0;
+    drbg->used = sizeof(drbg->buf);
+    drbg->pid = getpid();
+}
+
+void TLS_drbg_reseed(TLSDrbg *drbg, const unsigned char *entropy, int len)
+{
+    tls_drbg_update(drbg, entropy, len);
+
+    drbg->generated = 0;
+    drbg->used = sizeof(drbg->buf);
+    drbg->pid = getpid();
+}
+
+void TLS_drbg_generate(TLSDrbg *drbg, unsigned char *out, int len)
+{
+    int n = 0;
+
+    for(; len > 0; len -= n, out += n) {
+        sha2_hmac(drbg->key, sizeof(drbg->key), drbg->v, sizeof(drbg->v), drbg->v, 0);
+        n = len < (int)sizeof(drbg->v) ? len : (int)sizeof(drbg->v);
+        memcpy(out, drbg->v, n);
+    }
+
+    tls_drbg_update(drbg, NULL, 0);
+    drbg->generated++;
+}
+
+/*
+ * Fills buf from getrandom when the kernel has it, which works in the
+ * chroot, otherwise from /dev/urandom opened the first time through
+ * (before the chroot, since TLS_init runs when the server loads).
+ */
+static int tls_entropy(unsigned char *buf, int len)
+{
+    int rc = 0;
+    int got = 0;
+
+#if defined(__linux__) && defined(SYS_getrandom)
+    rc = syscall(SYS_getrandom, buf, len, 0);
+    if(rc == len) return 0;
+#endif
+
+    if(URANDOM_FD == -1) {
+        URANDOM_FD = open("/dev/urandom", O_RDONLY);
+        check(URANDOM_FD != -1, "Can't get entropy from getrandom or /dev/urandom.");
+    }
+
+    for(got = 0; got < len; got += rc) {
+        rc = read(URANDOM_FD, buf + got, len - got);
+        check(rc > 0, "Failed to read entropy from /dev/urandom.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/*
+ * Seeds (or reseeds) the shared DRBG with 48 bytes from the kernel plus
+ * the pid and time, so forked workers never share a stream.
+ */
+static int tls_drbg_seed_from_kernel()
+{
+    struct {
+        unsigned char entropy[48];
+        pid_t pid;
+        time_t now;
+    } seed;
+
+    check(tls_entropy(seed.entropy, sizeof(seed.entropy)) == 0,
+            "Failed to seed the TLS random number generator.");
+
+    seed.pid = getpid();
+    seed.now = time(NULL);
+
+    if(DRBG_SEEDED) {
+        TLS_drbg_reseed(&DRBG, (unsigned char *)&seed, sizeof(seed));
+    } else {
+        TLS_drbg_seed(&DRBG, (unsigned char *)&seed, sizeof(seed));
+        DRBG_SEEDED = 1;
+    }
+
+    memset(&seed, 0, sizeof(seed));
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * The RNG every ssl_context gets through ssl_set_rng.  polarssl takes a
+ * byte at a time, so this hands out a buffer from the DRBG and refills it
+ * when it's used up, reseeding from the kernel every so often.  A freshly
+ * forked worker throws away what's left of the parent's buffer and
+ * reseeds on its very first byte, since the parent hands out the same ones.
+ */
+int TLS_rand(void *p_rng)
+{
+    pid_t pid = getpid();
+
+    if(DRBG.used == sizeof(DRBG.buf) || DRBG.pid != pid) {
+        if(!DRBG_SEEDED || DRBG.pid != pid ||
+                DRBG.generated >= TLS_DRBG_RESEED_INTERVAL)
+        {
+            if(tls_drbg_seed_from_kernel() != 0) {
+                // only fatal if there was never any entropy at all
+                if(!DRBG_SEEDED) abort();
+            }
+        }
+
+        TLS_drbg_generate(&DRBG, DRBG.buf, sizeof(DRBG.buf));
+        DRBG.used = 0;
+    }
+
+    return DRBG.buf[DRBG.used++];
+}
+
+static void *tls_handshake_thread(void *unused)
+{
+    TLSJob *job = NULL;
+
+    while(1) {
+        pthread_mutex_lock(&POOL.lock);
+
+        while(POOL.head == NULL) {
+            pthread_cond_wait(&POOL.ready, &POOL.lock);
+        }
+
+        job = POOL.head;
+        POOL.head = job->next;
+        if(POOL.head == NULL) POOL.tail = NULL;
+
+        pthread_mutex_unlock(&POOL.lock);
+
+        job->rc = job->fn(job->arg);
+
+        // a pointer is well under PIPE_BUF so this can't be split up
+        while(write(POOL.done_fd[1], &job, sizeof(job)) != sizeof(job)) {}
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs on the scheduler thread and wakes up the connection task of every
+ * job the handshake threads hand back.
+ */
+static void tls_reaper_task(void *unused)
+{
+    TLSJob *job = NULL;
+
+    taskname("tls_reaper");
+    tasksystem();
+
+    while(fdwait(POOL.done_fd[0], 'r') == 0) {
+        while(read(POOL.done_fd[0], &job, sizeof(job)) == sizeof(job)) {
+            job->done = 1;
+            taskwakeup(&job->wait);
+        }
+    }
+
+    log_err("TLS handshake reaper stopped, handshakes will hang.");
+}
+
+/*
+ * Starts the threads the first time a handshake needs them, rather than in
+ * TLS_init, so they're made in the process that ends up serving.  A reload
+ * can add threads but never takes any away.
+ */
+static int tls_pool_start()
+{
+    pthread_t thread;
+    sigset_t all;
+    sigset_t old;
+    int rc = 0;
+
+    if(POOL.pid != getpid()) {
+        // threads and pipe from before a fork are no good
+        POOL.head = POOL.tail = NULL;
+        POOL.threads = 0;
+
+        check(pipe(POOL.done_fd) == 0, "Failed to make the TLS handshake pipe.");
+        fdnoblock(POOL.done_fd[0]);
+
+        if(taskcreate(tls_reaper_task, NULL, 32 * 1024) == -1) {
+            close(POOL.done_fd[0]);
+            close(POOL.done_fd[1]);
+            sentinel("Failed to start the TLS handshake reaper.");
+        }
+
+        POOL.pid = getpid();
+    }
+
+    // signals should keep going to the main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for(; POOL.threads < HANDSHAKE_THREADS; POOL.threads++) {
+        rc = pthread_create(&thread, NULL, tls_handshake_thread, NULL);
+        if(rc != 0) break;
+        pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    check(POOL.threads > 0, "Failed to start any TLS handshake threads.");
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * polarssl's f_async: hands one of the handshake's RSA or DH operations
+ * to the handshake threads and sleeps until it's done, so the other
+ * connections keep going meanwhile.  If there aren't any threads it just
+ * runs it here.
+ */
+int TLS_offload(void *p_async, int (*fn)(void *), void *arg)
+{
+    TLSJob job;
+
+    if(POOL.pid != getpid() || POOL.threads < HANDSHAKE_THREADS) {
+        if(tls_pool_start() != 0 && POOL.threads == 0) {
+            return fn(arg);
+        }
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.fn = fn;
+    job.arg = arg;
+
+    pthread_mutex_lock(&POOL.lock);
+
+    if(POOL.tail) {
+        POOL.tail->next = &job;
+    } else {
+        POOL.head = &job;
+    }
+    POOL.tail = &job;
+
+    pthread_cond_signal(&POOL.ready);
+    pthread_mutex_unlock(&POOL.lock);
+
+    while(!job.done) {
+        tasksleep(&job.wait);
+    }
+
+    TLS_STATS.offloaded++;
+    return job.rc;
+}
+
+/**
+ * Sets up the server wide TLS session cache from limits.ssl_session_cache
+ * and limits.ssl_session_timeout.  Any sessions from before (a reload,
+ * maybe with a new certificate) are dropped.
+ */
+int TLS_init()
+{
+    int size = Setting_get_int("limits.ssl_session_cache", DEFAULT_SSL_SESSION_CACHE);
+    SESSION_TIMEOUT = Setting_get_int("limits.ssl_session_timeout", DEFAULT_SSL_SESSION_TIMEOUT);
+    HANDSHAKE_THREADS = Setting_get_int("limits.ssl_handshake_threads", DEFAULT_SSL_HANDSHAKE_THREADS);
+
+    log_info("MAX limits.ssl_session_cache=%d, limits.ssl_session_timeout=%d, "
+            "limits.ssl_handshake_threads=%d",
+            size, SESSION_TIMEOUT, HANDSHAKE_THREADS);
+
+    TLS_destroy();
+
+    if(!DRBG_SEEDED) {
+        check(tls_drbg_seed_from_kernel() == 0, "Can't start TLS without a seeded RNG.");
+    }
+
+    if(size > 0) {
+        SESSIONS = Cache_create(size, tls_session_lookup, tls_session_evict);
+        check(SESSIONS != NULL, "Failed to create the TLS session cache.");
+
+        Cache_set_hash(SESSIONS, tls_session_hash, tls_session_hash);
+        SESSIONS->name = bfromcstr("ssl_sessions");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+void TLS_destroy()
+{
+    if(SESSIONS) {
+        Cache_destroy(SESSIONS);
+        SESSIONS = NULL;
+    }
+}
+
+/**
+ * Hooks a new server side ssl_context up to the shared RNG, the handshake
+ * threads and the session cache so returning clients can resume instead of
+ * doing the RSA key exchange again.
+ */
+void TLS_setup(ssl_context *ssl)
+{
+    ssl_set_rng(ssl, TLS_rand, NULL);
+
+    if(HANDSHAKE_THREADS > 0) {
+        ssl_set_async(ssl, TLS_offload, NULL);
+    }
+
+    if(SESSIONS) {
+        ssl_set_scb(ssl, tls_session_get, tls_session_set);
+    }
+}
+
+void TLS_handshake_done(ssl_context *ssl, int rc)
+{
+    if(rc != 0) {
+        TLS_STATS.failed++;
+    } else if(ssl->resume) {
+        TLS_STATS.resumed++;
+    } else {
+        TLS_STATS.full++;
+    }
+}
+
+tns_value_t *TLS_info()
+{
+    tns_value_t *rows = tns_new_list();
+    tns_value_t *data = tns_new_list();
+
+    tns_add_to_list(data, tns_new_integer(TLS_STATS.full));
+    tns_add_to_list(data, tns_new_integer(TLS_STATS.resumed));
+    tns_add_to_list(data, tns_new_integer(TLS_STATS.failed));
+    tns_add_to_list(data, tns_new_integer(TLS_STATS.offloaded));
+    tns_add_to_list(data, tns_new_integer(SESSIONS ? SESSIONS->count : 0));
+    tns_add_to_list(rows, data);
+
+    return tns_standard_table(&TLS_HEADERS, rows);
+}
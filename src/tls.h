@@ -0,0 +1,58 @@
+#ifndef _tls_h
+#define _tls_h
+
+#include <sys/types.h>
+#include <polarssl/ssl.h>
+
+#define DEFAULT_SSL_SESSION_CACHE 1024
+#define DEFAULT_SSL_SESSION_TIMEOUT 3600
+#define DEFAULT_SSL_HANDSHAKE_THREADS 4
+
+// bytes made per generate, polarssl wants them one at a time
+#define TLS_DRBG_BUFFER 256
+// generates before it goes back to the kernel for fresh entropy
+#define TLS_DRBG_RESEED_INTERVAL 4096
+
+/*
+ * HMAC_DRBG with SHA-256 (NIST SP 800-90A) that every ssl_context in the
+ * process shares as its RNG.
+ */
+typedef struct TLSDrbg {
+    unsigned char key[32];
+    unsigned char v[32];
+    int generated;
+    pid_t pid;
+    int used;
+    unsigned char buf[TLS_DRBG_BUFFER];
+} TLSDrbg;
+
+typedef struct TLSStats {
+    unsigned long full;
+    unsigned long resumed;
+    unsigned long failed;
+    unsigned long offloaded;
+} TLSStats;
+
+extern TLSStats TLS_STATS;
+
+int TLS_init();
+
+void TLS_destroy();
+
+void TLS_setup(ssl_context *ssl);
+
+void TLS_handshake_done(ssl_context *ssl, int rc);
+
+int TLS_rand(void *p_rng);
+
+int TLS_offload(void *p_async, int (*fn)(void *), void *arg);
+
+void TLS_drbg_seed(TLSDrbg *drbg, const unsigned char *seed, int len);
+
+void TLS_drbg_reseed(TLSDrbg *drbg, const unsigned char *entropy, int len);
+
+void TLS_drbg_generate(TLSDrbg *drbg, unsigned char *out, int len);
+
+struct tns_value_t *TLS_info();
+
+#endif
@@ -239,13 +239,6 @@ error:
 }
 
 
-void tns_outbuf_clamp(tns_outbuf *outbuf, int orig_size)
-{
-    size_t datalen = outbuf->used_size - orig_size;
-    tns_outbuf_putc(outbuf, ':');
-    tns_outbuf_itoa(datalen, outbuf);
-}
-
 char *tns_render(void *val, size_t *len)
 {
   char *output = NULL;
@@ -261,100 +254,135 @@ error:
   return NULL;
 }
 
-static inline void tns_render_hash_pair_list(tns_outbuf *outbuf, bstring key, struct bstrList *value)
+/*
+ * Requests are rendered front to back in one pass.  The sizes are all
+ * worked out first so every length prefix is known before its data is
+ * written, and the caller can hand over a buffer that's exactly right.
+ */
+
+size_t tns_number_size(size_t n)
 {
-    int i = 0;
-    tns_value_t val = {.type = tns_tag_string};
-    tns_outbuf_putc(outbuf, ']');
-    int orig_size = outbuf->used_size;
+    size_t len = 1;
 
-    for(i = value->qty - 1; i >= 0 ; i--) {
-        val.value.string = value->entry[i];
-        tns_render_value(&val, outbuf);
-    }
+    for(; n >= 10; n /= 10) len++;
 
-    tns_outbuf_clamp(outbuf, orig_size);
-    val.value.string = key;
-    tns_render_value(&val, outbuf);
+    return len;
 }
 
-void tns_render_hash_pair(tns_outbuf *outbuf, bstring key, bstring value)
+char *tns_write_number(char *out, size_t n)
 {
-    tns_value_t val = {.type = tns_tag_string, .value.string = value};
-    tns_render_value(&val, outbuf);
+    size_t len = tns_number_size(n);
+    char *end = out + len;
 
-    val.value.string = key;
-    tns_render_value(&val, outbuf);
+    do {
+        *--end = '0' + n % 10;
+        n /= 10;
+    } while(n > 0);
+
+    return out + len;
 }
 
-int tns_render_request_start(tns_outbuf *outbuf)
+static inline size_t tns_string_size(bstring str)
 {
-    check(tns_outbuf_init(outbuf) != -1, "Failed to init buffer.");
+    return tns_number_size(blength(str)) + blength(str) + 2;
+}
 
-    check(tns_outbuf_putc(outbuf, '}') != -1, "Failed ending request.");
+static inline char *tns_write_string(char *out, bstring str)
+{
+    out = tns_write_number(out, blength(str));
+    *out++ = ':';
+    memcpy(out, str->data, blength(str));
+    out += blength(str);
+    *out++ = ',';
 
-    return outbuf->used_size;
-error:
-    return -1;
+    return out;
 }
 
-int tns_render_request_end(tns_outbuf *outbuf, int header_start, bstring uuid, int id, bstring path)
+static inline size_t tns_string_list_size(struct bstrList *list)
 {
-    // close it off with the final size, minus ending } terminator
-    tns_outbuf_clamp(outbuf, header_start);
+    int i = 0;
+    size_t len = 0;
 
-    check(tns_outbuf_putc(outbuf, ' ') != -1, "Failed ending request.");
-    check(tns_outbuf_rputs(outbuf, bdata(path), blength(path)) != -1, "Failed ending request.");
+    for(i = 0; i < list->qty; i++) {
+        len += tns_string_size(list->entry[i]);
+    }
 
-    check(tns_outbuf_putc(outbuf, ' ') != -1, "Failed ending request.");
-    check(tns_outbuf_itoa(id, outbuf) != -1, "Failed ending request.");
+    return len;
+}
 
-    check(tns_outbuf_putc(outbuf, ' ') != -1, "Failed ending request.");
-    check(tns_outbuf_rputs(outbuf, bdata(uuid), blength(uuid)) != -1, "Failed ending request.");
+size_t tns_hash_pair_size(bstring key, bstring value)
+{
+    return tns_string_size(key) + tns_string_size(value);
+}
 
-    return 0;
+char *tns_write_hash_pair(char *out, bstring key, bstring value)
+{
+    out = tns_write_string(out, key);
+    return tns_write_string(out, value);
+}
 
-error:
-    return -1;
+static inline size_t tns_hash_pair_list_size(bstring key, struct bstrList *value)
+{
+    size_t len = tns_string_list_size(value);
+    return tns_string_size(key) + tns_number_size(len) + len + 2;
 }
 
-int tns_render_request_headers(tns_outbuf *outbuf, hash_t *headers)
+static inline char *tns_write_hash_pair_list(char *out, bstring key, struct bstrList *value)
+{
+    int i = 0;
+
+    out = tns_write_string(out, key);
+    out = tns_write_number(out, tns_string_list_size(value));
+    *out++ = ':';
+
+    for(i = 0; i < value->qty; i++) {
+        out = tns_write_string(out, value->entry[i]);
+    }
+
+    *out++ = ']';
+
+    return out;
+}
+
+size_t tns_request_headers_size(hash_t *headers)
 {
     hscan_t scan;
     hnode_t *n = NULL;
+    size_t len = 0;
     hash_scan_begin(&scan, headers);
 
     for(n = hash_scan_next(&scan); n != NULL; n = hash_scan_next(&scan)) {
         struct bstrList *val_list = hnode_get(n);
-        if(val_list->qty == 0) continue;
-
         bstring key = (bstring)hnode_getkey(n);
 
         if(val_list->qty == 1) {
-            tns_render_hash_pair(outbuf, key, val_list->entry[0]);
-        } else {
-            tns_render_hash_pair_list(outbuf, key, val_list);
+            len += tns_hash_pair_size(key, val_list->entry[0]);
+        } else if(val_list->qty > 1) {
+            len += tns_hash_pair_list_size(key, val_list);
         }
     }
 
-    return 0;
+    return len;
 }
 
-bstring tns_outbuf_to_bstring(tns_outbuf *outbuf)
+char *tns_write_request_headers(char *out, hash_t *headers)
 {
-    if(outbuf->used_size == outbuf->alloc_size) {
-        tns_outbuf_extend(outbuf);
-    }
+    hscan_t scan;
+    hnode_t *n = NULL;
+    hash_scan_begin(&scan, headers);
 
-    tns_inplace_reverse(outbuf->buffer, outbuf->used_size);
+    for(n = hash_scan_next(&scan); n != NULL; n = hash_scan_next(&scan)) {
+        struct bstrList *val_list = hnode_get(n);
+        bstring key = (bstring)hnode_getkey(n);
 
-    bstring b = malloc(sizeof(struct tagbstring));
-    b->slen = outbuf->used_size;
-    b->data = (unsigned char *)outbuf->buffer;
-    b->data[b->slen] = '\0';
-    b->mlen = outbuf->alloc_size;
+        if(val_list->qty == 1) {
+            out = tns_write_hash_pair(out, key, val_list->entry[0]);
+        } else if(val_list->qty > 1) {
+            out = tns_write_hash_pair_list(out, key, val_list);
+        }
+    }
 
-    return b;
+    return out;
 }
 
 char *tns_render_reversed(void *val, size_t *len)
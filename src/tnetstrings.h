@@ -72,18 +72,17 @@ char *tns_render(void *val, size_t *len);
 char *tns_render_reversed(void *val, size_t *len);
 
 
-void tns_render_hash_pair(tns_outbuf *outbuf, bstring key, bstring value);
+size_t tns_number_size(size_t n);
 
-int tns_render_request_headers(tns_outbuf *outbuf, hash_t *headers);
+char *tns_write_number(char *out, size_t n);
 
-bstring tns_outbuf_to_bstring(tns_outbuf *outbuf);
+size_t tns_hash_pair_size(bstring key, bstring value);
 
-void tns_outbuf_clamp(tns_outbuf *outbuf, int orig_size);
+char *tns_write_hash_pair(char *out, bstring key, bstring value);
 
+size_t tns_request_headers_size(hash_t *headers);
 
-int tns_render_request_start(tns_outbuf *outbuf);
-
-int tns_render_request_end(tns_outbuf *outbuf, int header_start, bstring uuid, int id, bstring path);
+char *tns_write_request_headers(char *out, hash_t *headers);
 
 tns_value_t *tns_standard_table(bstring header_data, tns_value_t *rows);
 
@@ -0,0 +1,247 @@
+/**
+ *
+ * Copyright (c) 2010, Zed A. Shaw and Mongrel2 Project Contributors.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ *     * Neither the name of the Mongrel2 Project, Zed A. Shaw, nor the names
+ *       of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <worker.h>
+#include <setting.h>
+#include <dbg.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int WORKER_ID = -1;
+
+static pid_t WORKER_PIDS[MAX_WORKERS];
+static int WORKER_COUNT = 0;
+static int SUPERVISING = 0;
+
+
+int Worker_count()
+{
+    int count = Setting_get_int("server.workers", 1);
+
+    if(count > MAX_WORKERS) {
+        log_warn("server.workers=%d is more than the %d max, using %d.",
+                count, MAX_WORKERS, MAX_WORKERS);
+        count = MAX_WORKERS;
+    } else if(count < 1) {
+        count = 1;
+    }
+
+    return count;
+}
+
+
+void Worker_stop(int sig)
+{
+    int i = 0;
+
+    for(i = 0; i < WORKER_COUNT; i++) {
+        if(WORKER_PIDS[i] > 0) {
+            kill(WORKER_PIDS[i], sig);
+        }
+    }
+}
+
+
+static void supervisor_signal(int s)
+{
+    if(s != SIGHUP) {
+        // workers do their own graceful shutdown, we just stop restarting them
+        SUPERVISING = 0;
+    }
+
+    Worker_stop(s);
+}
+
+
+static void start_supervisor_signals()
+{
+    struct sigaction sa, osa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = supervisor_signal;
+    sigaction(SIGINT, &sa, &osa);
+    sigaction(SIGTERM, &sa, &osa);
+    sigaction(SIGHUP, &sa, &osa);
+}
+
+
+static pid_t spawn_worker(int id)
+{
+    pid_t pid = fork();
+    check(pid != -1, "Failed to fork worker %d.", id);
+
+    if(pid == 0) {
+        WORKER_ID = id;
+        SUPERVISING = 0;
+        WORKER_COUNT = 0;
+    } else {
+        log_info("Started worker %d as pid %d.", id, pid);
+        WORKER_PIDS[id] = pid;
+    }
+
+    return pid;
+
+error:
+    return -1;
+}
+
+
+static int worker_for_pid(pid_t pid)
+{
+    int i = 0;
+
+    for(i = 0; i < WORKER_COUNT; i++) {
+        if(WORKER_PIDS[i] == pid) return i;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Forks count workers and returns the worker id in each of them.  The
+ * supervisor stays in here forwarding reload and shutdown signals, and
+ * restarting any worker that dies while we're still running.  Once every
+ * worker is gone it returns -1 so the caller can clean up and exit.
+ */
+int Worker_start(int count)
+{
+    int i = 0;
+    int status = 0;
+    int running = 0;
+    pid_t pid = 0;
+
+    check(count > 0 && count <= MAX_WORKERS, "Invalid worker count: %d", count);
+
+    WORKER_COUNT = count;
+    SUPERVISING = 1;
+    start_supervisor_signals();
+
+    for(i = 0; i < count; i++) {
+        pid = spawn_worker(i);
+        check(pid != -1, "Failed to start all %d workers, stopping.", count);
+        if(pid == 0) return i;
+        running++;
+    }
+
+    while(running > 0) {
+        pid = waitpid(-1, &status, 0);
+
+        if(pid == -1) {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        i = worker_for_pid(pid);
+        if(i == -1) continue;
+
+        WORKER_PIDS[i] = 0;
+        running--;
+
+        if(WIFSIGNALED(status)) {
+            log_err("Worker %d (pid %d) died from signal %d.", i, pid, WTERMSIG(status));
+        } else {
+            log_info("Worker %d (pid %d) exited with %d.", i, pid, WEXITSTATUS(status));
+        }
+
+        if(SUPERVISING) {
+            // don't spin if a worker dies right away every time
+            sleep(1);
+
+            pid = spawn_worker(i);
+            if(pid == 0) return i;
+            if(pid > 0) running++;
+        }
+    }
+
+    log_info("All workers exited, supervisor is done.");
+    return -1;
+
+error:
+    SUPERVISING = 0;
+    Worker_stop(SIGTERM);
+    return -1;
+}
+
+
+/**
+ * Each worker binds its own copy of a 0MQ endpoint.  TCP endpoints get
+ * worker id * server.worker_port_stride added to their port, so configs
+ * that use neighbouring ports for send and recv don't run into each
+ * other, and anything else gets the worker id appended.  Worker 0 and
+ * single process mode use the spec as is.
+ */
+bstring Worker_spec(bstring spec)
+{
+    int port_at = 0;
+    int port = 0;
+    int stride = 0;
+
+    if(WORKER_ID <= 0) return bstrcpy(spec);
+
+    port_at = bstrrchr(spec, ':');
+
+    if(port_at != BSTR_ERR && bisstemeqblk(spec, "tcp://", 6)) {
+        port = atoi((const char *)spec->data + port_at + 1);
+
+        if(port > 0) {
+            stride = Setting_get_int("server.worker_port_stride", DEFAULT_WORKER_PORT_STRIDE);
+            port += WORKER_ID * stride;
+
+            if(port > 65535) {
+                log_err("Worker %d would bind %s on port %d, lower server.worker_port_stride.",
+                        WORKER_ID, bdata(spec), port);
+            }
+
+            return bformat("%.*s:%d", port_at, bdata(spec), port);
+        }
+    }
+
+    return bformat("%s-%d", bdata(spec), WORKER_ID);
+}
+
+
+/**
+ * Handler identities carry the worker id so replies coming back over the
+ * PUB socket can be picked out by the worker that owns the connection.
+ */
+bstring Worker_ident(bstring ident)
+{
+    if(WORKER_ID < 0) return bstrcpy(ident);
+
+    return bformat("%s-%d", bdata(ident), WORKER_ID);
+}
@@ -1,6 +1,8 @@
 #include "minunit.h"
 #include <cache.h>
 #include <assert.h>
+#include <tnetstrings.h>
+#include <tnetstrings_impl.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -99,12 +101,122 @@ char *test_cache_lookup()
     return NULL;
 }
 
+uint32_t test_hash(void *key_or_data) {
+    // small so there are plenty of collisions in the buckets
+    return (uint32_t)(long)key_or_data % 7;
+}
+
+char *test_cache_hashed()
+{
+    long i;
+    long item;
+    Cache *cache = Cache_create(100, test_lookup, test_evict);
+    mu_assert(cache != NULL, "Failed to create cache");
+    Cache_set_hash(cache, test_hash, test_hash);
+
+    for(i = 1; i <= 100; i++) Cache_add(cache, (void *) i);
+
+    for(i = 1; i <= 100; i++) {
+        item = (long) Cache_lookup(cache, (void *) i);
+        mu_assert(item == i, "Did not find something that should be there");
+    }
+
+    item = (long) Cache_lookup(cache, (void *) 101);
+    mu_assert(item == 0, "Found something that wasn't there");
+
+    mu_assert(cache->hits == 100, "Wrong hit count.");
+    mu_assert(cache->misses == 1, "Wrong miss count.");
+
+    Cache_evict_object(cache, (void *) 50);
+    mu_assert(last_evicted == 50, "Didn't evict the right one.");
+    mu_assert(Cache_lookup(cache, (void *) 50) == NULL, "Evicted object still there.");
+    mu_assert(Cache_lookup(cache, (void *) 43) != NULL, "Evicted the wrong thing from the bucket.");
+    mu_assert(cache->count == 99, "Count should go down on evict.");
+
+    Cache_destroy(cache);
+    return NULL;
+}
+
+char *test_cache_lru()
+{
+    long i;
+    last_evicted = -1;
+
+    Cache *cache = Cache_create(MIN_CACHE_SIZE, test_lookup, test_evict);
+    Cache_set_hash(cache, test_hash, test_hash);
+
+    for(i = 1; i <= MIN_CACHE_SIZE; i++) Cache_add(cache, (void *) i);
+
+    // touching 1 means 2 is now the oldest
+    Cache_lookup(cache, (void *) 1);
+    Cache_add(cache, (void *) 100);
+    mu_assert(last_evicted == 2, "Should evict the least recently used.");
+
+    Cache_add(cache, (void *) 101);
+    mu_assert(last_evicted == 3, "Should evict the next least recently used.");
+    mu_assert(Cache_lookup(cache, (void *) 1) != NULL, "Recently used one got evicted.");
+    mu_assert(cache->evictions == 2, "Wrong eviction count.");
+
+    Cache_destroy(cache);
+    return NULL;
+}
+
+char *test_cache_budgets()
+{
+    long i;
+    last_evicted = -1;
+
+    Cache *cache = Cache_create(MIN_CACHE_SIZE, test_lookup, test_evict);
+    Cache_set_hash(cache, test_hash, test_hash);
+    Cache_set_limits(cache, 1000, 3);
+
+    Cache_add_sized(cache, (void *) 1, 400, 0);
+    Cache_add_sized(cache, (void *) 2, 400, 0);
+    mu_assert(last_evicted == -1, "Evicted something too early");
+    mu_assert(cache->bytes == 800, "Wrong byte count.");
+
+    Cache_add_sized(cache, (void *) 3, 400, 0);
+    mu_assert(last_evicted == 1, "Should evict to stay under the byte budget.");
+    mu_assert(cache->bytes == 800, "Bytes should go down on evict.");
+
+    for(i = 4; i <= 7; i++) Cache_add_sized(cache, (void *) i, 1, 1);
+    mu_assert(cache->fds == 3, "Should stay under the fd budget.");
+    mu_assert(Cache_lookup(cache, (void *) 4) == NULL, "Oldest fd should be gone.");
+    mu_assert(Cache_lookup(cache, (void *) 7) != NULL, "Newest fd should be there.");
+
+    last_evicted = -1;
+    Cache_add_sized(cache, (void *) 8, 2000, 0);
+    mu_assert(last_evicted == 8, "Too big for the whole cache should be evicted right away.");
+    mu_assert(Cache_lookup(cache, (void *) 7) != NULL, "Too big shouldn't flush the cache.");
+
+    Cache_destroy(cache);
+    return NULL;
+}
+
+char *test_cache_info()
+{
+    Cache *cache = Cache_create(MIN_CACHE_SIZE, test_lookup, test_evict);
+    cache->name = bfromcstr("test");
+
+    tns_value_t *info = Cache_info();
+    mu_assert(info != NULL, "Failed to get cache info.");
+    mu_assert(tns_get_type(info) == tns_tag_dict, "Info should be a table.");
+    tns_value_destroy(info);
+
+    Cache_destroy(cache);
+    return NULL;
+}
+
 char *all_tests() {
     mu_suite_start();
     
     mu_run_test(test_cache_evict);
     mu_run_test(test_cache_manual_evict);
     mu_run_test(test_cache_lookup);
+    mu_run_test(test_cache_hashed);
+    mu_run_test(test_cache_lru);
+    mu_run_test(test_cache_budgets);
+    mu_run_test(test_cache_info);
 
     return NULL;
 }
@@ -6,6 +6,12 @@
 #include <zmq.h>
 #include <task/task.h>
 #include <dir.h>
+#include <register.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <host.h>
+#include <events.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -37,6 +43,163 @@ char *test_Connection_deliver()
     return NULL;
 }
 
+char *test_Connection_read_header_pipelined()
+{
+    int pair[2] = {-1, -1};
+    int rc = 0;
+    const char remote[IPADDR_SIZE] = "127.0.0.1";
+    const char *reqs = "GET /tests/sample.html HTTP/1.1\r\nHost: zedshaw.com\r\n\r\n"
+        "GET /tests/sample.json HTTP/1.1\r\nHost: zedshaw.com\r\n\r\n";
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Failed to make a socketpair.");
+    Connection *conn = Connection_create(NULL, pair[0], 0, remote);
+    Register_connect(pair[0], conn);
+
+    // both in one packet, and then nothing else so another read would fail
+    rc = write(pair[1], reqs, strlen(reqs));
+    mu_assert(rc == (int)strlen(reqs), "Failed to write the requests.");
+    shutdown(pair[1], SHUT_WR);
+
+    rc = Connection_read_header(conn, conn->req);
+    mu_assert(rc > 0, "Failed to parse the first request.");
+    mu_assert(biseqcstr(Request_path(conn->req), "/tests/sample.html"), "Wrong first path.");
+    IOBuf_read_commit(conn->iob, rc);
+
+    rc = Connection_read_header(conn, conn->req);
+    mu_assert(rc > 0, "Second request should come out of the buffer.");
+    mu_assert(biseqcstr(Request_path(conn->req), "/tests/sample.json"), "Wrong second path.");
+    IOBuf_read_commit(conn->iob, rc);
+
+    Register_disconnect(pair[0]);
+    Connection_destroy(conn);
+    close(pair[1]);
+
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    struct sockaddr_in sa = {.sin_family = AF_INET};
+    socklen_t len = sizeof(sa);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd == -1 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+            listen(fd, 8) == -1 || getsockname(fd, (struct sockaddr *)&sa, &len) == -1) {
+        return -1;
+    }
+
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+// the proxy states are only reachable through the state machine otherwise
+int connection_http_to_proxy(Connection *conn);
+int connection_proxy_deliver(Connection *conn);
+int connection_proxy_reply_parse(Connection *conn);
+int connection_proxy_req_parse(Connection *conn);
+
+char *test_Connection_proxy_keep_alive()
+{
+    int pair[2] = {-1, -1};
+    int listeners[2] = {-1, -1};
+    int ports[2] = {0};
+    int backend = -1;
+    int i = 0;
+    int rc = 0;
+    char buf[1024];
+    bstring paths[2] = {NULL, NULL};
+    ProxyUpstream *first = NULL;
+    const char *reply = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    Request *probe = Request_create();
+
+    listeners[0] = listen_local(&ports[0]);
+    listeners[1] = listen_local(&ports[1]);
+    mu_assert(listeners[0] != -1 && listeners[1] != -1, "Failed to listen for the fake backends.");
+
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), ports[0]);
+    mu_assert(Proxy_add_upstream(proxy, bfromcstr("127.0.0.1"), ports[1]) == 0, "Failed to add upstream.");
+    mu_assert(Proxy_set_balance(proxy, "hash", "path") == 0, "Failed to set hash.");
+
+    Host *host = Host_create("proxy.com", "proxy.com");
+    Host_add_backend(host, "/proxy", strlen("/proxy"), BACKEND_PROXY, proxy);
+
+    // find two paths that hash to different upstreams
+    paths[0] = bfromcstr("/proxy/0");
+    probe->path = paths[0];
+    first = Proxy_select(proxy, probe, NULL);
+    for(i = 1; i < 100 && paths[1] == NULL; i++) {
+        probe->path = bformat("/proxy/%d", i);
+        if(Proxy_select(proxy, probe, NULL) != first) {
+            paths[1] = probe->path;
+        } else {
+            bdestroy(probe->path);
+        }
+    }
+    probe->path = NULL;
+    mu_assert(paths[1] != NULL, "Couldn't find a path for the other upstream.");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Failed to make a socketpair.");
+    Connection *conn = Connection_create(NULL, pair[0], 0, "127.0.0.1");
+    Register_connect(pair[0], conn);
+
+    for(i = 0; i < 2; i++) {
+        rc = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: proxy.com\r\n\r\n", bdata(paths[i]));
+        mu_assert(write(pair[1], buf, rc) == rc, "Failed to write a request.");
+    }
+
+    rc = Connection_read_header(conn, conn->req);
+    mu_assert(rc > 0, "Failed to parse the first request.");
+    conn->req->target_host = host;
+    Request_set_action(conn->req, Host_match_backend(host, Request_path(conn->req), NULL));
+
+    mu_assert(connection_http_to_proxy(conn) == CONNECT, "Failed to connect to the first upstream.");
+    mu_assert(conn->upstream == first, "First request went to the wrong upstream.");
+    mu_assert(first->outstanding == 1, "First request should be outstanding.");
+    mu_assert(connection_proxy_deliver(conn) == REQ_SENT, "Failed to send the first request.");
+
+    backend = accept(listeners[first->port == ports[0] ? 0 : 1], NULL, NULL);
+    rc = read(backend, buf, sizeof(buf) - 1);
+    mu_assert(rc > 0, "First backend didn't get the request.");
+    buf[rc] = '\0';
+    mu_assert(strstr(buf, (char *)paths[0]->data) != NULL, "First backend got the wrong request.");
+    mu_assert(write(backend, reply, strlen(reply)) == (int)strlen(reply), "Failed to reply.");
+
+    mu_assert(connection_proxy_reply_parse(conn) == REQ_RECV, "Failed to proxy the first reply.");
+    mu_assert(first->outstanding == 0, "Finished request shouldn't be outstanding.");
+
+    // the keep-alive request has a different key so it has to move
+    mu_assert(connection_proxy_req_parse(conn) == HTTP_REQ, "Failed to parse the second request.");
+    mu_assert(conn->upstream != NULL && conn->upstream != first, "Second request stayed on the first upstream.");
+    mu_assert(conn->upstream->outstanding == 1 && first->outstanding == 0, "Outstanding should follow the request.");
+    mu_assert(first->idle_count == 1, "First backend connection should be back in its pool.");
+    mu_assert(connection_proxy_deliver(conn) == REQ_SENT, "Failed to send the second request.");
+
+    close(backend);
+    backend = accept(listeners[conn->upstream->port == ports[0] ? 0 : 1], NULL, NULL);
+    rc = read(backend, buf, sizeof(buf) - 1);
+    mu_assert(rc > 0, "Second backend didn't get the request.");
+    buf[rc] = '\0';
+    mu_assert(strstr(buf, (char *)paths[1]->data) != NULL, "Second backend got the wrong request.");
+
+    Register_disconnect(pair[0]);
+    Connection_destroy(conn);
+    mu_assert(proxy->upstreams[0]->outstanding == 0 && proxy->upstreams[1]->outstanding == 0,
+            "Closing the connection should end its request.");
+
+    close(backend);
+    close(pair[1]);
+    close(listeners[0]);
+    close(listeners[1]);
+    bdestroy(paths[0]);
+    bdestroy(paths[1]);
+    Request_destroy(probe);
+    Host_destroy(host);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
 int test_task_with_sample(const char *sample_file)
 {
     check(SRV, "Server isn't configured.");
@@ -71,6 +234,8 @@ char *test_Connection_task()
 char * all_tests() {
     mu_suite_start();
 
+    Register_init();
+    Request_init();
     Server_init();
     Server *SRV = Server_create("uuid", "localhost", "0.0.0.0",
             "1999", "chroot", "access_log", "error_log", "pid_file");
@@ -87,6 +252,8 @@ char * all_tests() {
     mu_run_test(test_Connection_create_destroy);
     mu_run_test(test_Connection_deliver);
     mu_run_test(test_Connection_task);
+    mu_run_test(test_Connection_read_header_pipelined);
+    mu_run_test(test_Connection_proxy_keep_alive);
 
     Server_destroy(SRV);
     // TODO: the above will eventually do this
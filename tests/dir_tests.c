@@ -3,9 +3,17 @@
 #include "register.h"
 #include <string.h>
 #include <fcntl.h>
+#include <zlib.h>
+#include <utime.h>
 
 FILE *LOG_FILE = NULL;
 
+struct tagbstring TEXT_PLAIN = bsStatic("text/plain");
+struct tagbstring HTTP_206_LINE = bsStatic("HTTP/1.1 206 Partial Content\r\n");
+struct tagbstring CONTENT_RANGE_3_7 = bsStatic("Content-Range: bytes 3-7/9\r\n");
+struct tagbstring MULTIPART_TYPE = bsStatic("Content-Type: multipart/byteranges; boundary=");
+struct tagbstring MULTIPART_LAST_PART = bsStatic("Content-Range: bytes 6-8/9\r\n\r\nre\n\r\n--");
+
 char *test_Dir_find_file()
 {
     bstring ctype = NULL;
@@ -27,13 +35,13 @@ char *test_Dir_resolve_file()
     Dir *test = Dir_create("tests/", "sample.html", "test/plain", 0);
     mu_assert(test != NULL, "Failed to make test dir.");
 
-    FileRecord *rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.json"));
+    FileRecord *rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.json"), 0);
     mu_assert(rec != NULL, "Failed to resolve file that should be there.");
 
-    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/"));
+    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/"), 0);
     mu_assert(rec != NULL, "Failed to find default file.");
 
-    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/../../../../../etc/passwd"));
+    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/../../../../../etc/passwd"), 0);
     mu_assert(rec == NULL, "HACK! should not find this.");
 
     Dir_destroy(test);
@@ -41,7 +49,7 @@ char *test_Dir_resolve_file()
     test = Dir_create("foobar/", "sample.html", "test/plan", 0);
     mu_assert(test != NULL, "Failed to make the failed dir.");
 
-    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.json"));
+    rec = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.json"), 0);
     mu_assert(rec == NULL, "Should not get something from a bad base directory.");
 
     Dir_destroy(test);
@@ -49,9 +57,9 @@ char *test_Dir_resolve_file()
     return NULL;
 }
 
-const char *REQ_PATTERN = "%s %s HTTP/1.1\r\n\r\n";
+const char *REQ_PATTERN = "%s %s HTTP/1.1\r\n%s\r\n";
 
-Request *fake_req(const char *method, const char *prefix, const char *path)
+Request *fake_req_headers(const char *method, const char *prefix, const char *path, const char *headers)
 {
     int rc = 0;
     size_t nparsed = 0;
@@ -59,7 +67,7 @@ Request *fake_req(const char *method, const char *prefix, const char *path)
     Request_start(req);
 
     bstring p = bfromcstr(path);
-    bstring rp = bformat(REQ_PATTERN, method, bdata(p));
+    bstring rp = bformat(REQ_PATTERN, method, bdata(p), headers);
 
     rc = Request_parse(req, bdata(rp), blength(rp), &nparsed);
     req->prefix = bfromcstr(prefix);
@@ -74,6 +82,11 @@ error:
     return NULL;
 }
 
+Request *fake_req(const char *method, const char *prefix, const char *path)
+{
+    return fake_req_headers(method, prefix, path, "");
+}
+
 
 char *test_Dir_serve_file()
 {
@@ -102,13 +115,399 @@ char *test_Dir_serve_file()
     return NULL;
 }
 
+char *test_Dir_parse_range()
+{
+    FileRange ranges[DIR_MAX_RANGES];
+    struct tagbstring single = bsStatic("bytes=0-4");
+    struct tagbstring open_end = bsStatic("bytes=5-");
+    struct tagbstring suffix = bsStatic("bytes=-3");
+    struct tagbstring clamped = bsStatic("bytes=2-1000");
+    struct tagbstring multi = bsStatic("bytes=0-0, 2-3,,-1");
+    struct tagbstring past_end = bsStatic("bytes=10-20");
+    struct tagbstring some_past = bsStatic("bytes=10-20,1-1");
+    struct tagbstring backwards = bsStatic("bytes=5-2");
+    struct tagbstring not_bytes = bsStatic("pages=1-2");
+    struct tagbstring junk = bsStatic("bytes=1-2x");
+    struct tagbstring empty = bsStatic("bytes=");
+    struct tagbstring too_many = bsStatic("bytes=0-0,2-2,4-4,6-6,8-8,10-10,12-12,14-14,"
+            "16-16,18-18,20-20,22-22,24-24,26-26,28-28,30-30,32-32");
+    struct tagbstring repeated = bsStatic("bytes=0-,0-,0-,0-,0-,0-,0-,0-,"
+            "0-,0-,0-,0-,0-,0-,0-,0-,0-");
+    struct tagbstring overlapping = bsStatic("bytes=6-7,0-1,1-2,3-3,8-9");
+    struct tagbstring bridged = bsStatic("bytes=0-1,5-6,2-4");
+
+    mu_assert(Dir_parse_range(&single, 10, ranges, DIR_MAX_RANGES) == 1, "Should get one range.");
+    mu_assert(ranges[0].start == 0 && ranges[0].end == 4, "Wrong single range.");
+
+    mu_assert(Dir_parse_range(&open_end, 10, ranges, DIR_MAX_RANGES) == 1, "Should get open range.");
+    mu_assert(ranges[0].start == 5 && ranges[0].end == 9, "Open range should run to the end.");
+
+    mu_assert(Dir_parse_range(&suffix, 10, ranges, DIR_MAX_RANGES) == 1, "Should get suffix range.");
+    mu_assert(ranges[0].start == 7 && ranges[0].end == 9, "Suffix range should be the last 3.");
+
+    mu_assert(Dir_parse_range(&suffix, 2, ranges, DIR_MAX_RANGES) == 1, "Should get short suffix range.");
+    mu_assert(ranges[0].start == 0 && ranges[0].end == 1, "Suffix past the start should be everything.");
+
+    mu_assert(Dir_parse_range(&clamped, 10, ranges, DIR_MAX_RANGES) == 1, "Should get clamped range.");
+    mu_assert(ranges[0].start == 2 && ranges[0].end == 9, "Range should be clamped to the size.");
+
+    mu_assert(Dir_parse_range(&multi, 10, ranges, DIR_MAX_RANGES) == 3, "Should get 3 ranges.");
+    mu_assert(ranges[1].start == 2 && ranges[1].end == 3, "Wrong second range.");
+    mu_assert(ranges[2].start == 9 && ranges[2].end == 9, "Wrong suffix in the multi range.");
+
+    mu_assert(Dir_parse_range(&past_end, 10, ranges, DIR_MAX_RANGES) == 0, "Past the end is a 416.");
+    mu_assert(Dir_parse_range(&some_past, 10, ranges, DIR_MAX_RANGES) == 1, "Should drop the bad one.");
+    mu_assert(ranges[0].start == 1, "Kept the wrong range.");
+
+    mu_assert(Dir_parse_range(&backwards, 10, ranges, DIR_MAX_RANGES) == -1, "Backwards should be ignored.");
+    mu_assert(Dir_parse_range(&not_bytes, 10, ranges, DIR_MAX_RANGES) == -1, "Only bytes is valid.");
+    mu_assert(Dir_parse_range(&junk, 10, ranges, DIR_MAX_RANGES) == -1, "Junk should be ignored.");
+    mu_assert(Dir_parse_range(&empty, 10, ranges, DIR_MAX_RANGES) == -1, "Empty should be ignored.");
+    mu_assert(Dir_parse_range(&too_many, 40, ranges, DIR_MAX_RANGES) == -1, "Too many should be ignored.");
+
+    mu_assert(Dir_parse_range(&repeated, 10, ranges, DIR_MAX_RANGES) == 1, "Repeats should merge into one.");
+    mu_assert(ranges[0].start == 0 && ranges[0].end == 9, "Merged repeats should be the whole file.");
+
+    mu_assert(Dir_parse_range(&overlapping, 10, ranges, DIR_MAX_RANGES) == 2, "Should merge what touches.");
+    mu_assert(ranges[0].start == 6 && ranges[0].end == 9, "Merged range should keep its place.");
+    mu_assert(ranges[1].start == 0 && ranges[1].end == 3, "Overlapping and adjacent should merge.");
+
+    mu_assert(Dir_parse_range(&bridged, 10, ranges, DIR_MAX_RANGES) == 1, "Should merge across the gap it fills.");
+    mu_assert(ranges[0].start == 0 && ranges[0].end == 6, "Wrong bridged range.");
+
+    return NULL;
+}
+
+static bstring serve_to_file(Dir *test, Request *req)
+{
+    char tmpl[] = "/tmp/dir_tests.XXXXXX";
+    char out[1024] = {0};
+    int rc = 0;
+    Connection conn = {0};
+    int fd = mkstemp(tmpl);
+    check(fd != -1, "Failed to make temp file.");
+    unlink(tmpl);
+
+    conn.iob = IOBuf_create(1024, fd, IOBUF_FILE);
+    rc = Dir_serve_file(test, req, &conn);
+    check(rc == 0, "Failed to serve the file.");
+
+    rc = pread(fd, out, sizeof(out) - 1, 0);
+    IOBuf_destroy(conn.iob);
+
+    return bfromcstr(out);
+
+error:
+    return NULL;
+}
+
+char *test_Dir_serve_range()
+{
+    bstring out = NULL;
+    Dir *test = Dir_create("tests/", "sample.html", "test/plain", 0);
+    FileRecord *file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.html"), 0);
+    mu_assert(file != NULL, "Failed to get sample.html.");
+
+    Request *req = fake_req_headers("GET", "/", "/sample.html", "Range: bytes=3-7\r\n");
+    out = serve_to_file(test, req);
+    mu_assert(out != NULL, "Failed to serve range.");
+    mu_assert(req->status_code == 206, "Should get a 206.");
+    mu_assert(bstrncmp(out, &HTTP_206_LINE, blength(&HTTP_206_LINE)) == 0, "Wrong status line.");
+    mu_assert(binstr(out, 0, &CONTENT_RANGE_3_7) != BSTR_ERR, "Missing the Content-Range.");
+    mu_assert(strcmp(bdatae(out, "") + blength(out) - 5, "there") == 0, "Sent the wrong bytes.");
+    bdestroy(out);
+
+    req = fake_req_headers("GET", "/", "/sample.html", "Range: bytes=0-1,-3\r\n");
+    out = serve_to_file(test, req);
+    mu_assert(req->status_code == 206, "Should get a 206 for multiple ranges.");
+    mu_assert(binstr(out, 0, &MULTIPART_TYPE) != BSTR_ERR, "Should be multipart.");
+    mu_assert(binstr(out, 0, &MULTIPART_LAST_PART) != BSTR_ERR, "Missing the last part.");
+    bdestroy(out);
+
+    req = fake_req_headers("GET", "/", "/sample.html", "Range: bytes=100-\r\n");
+    out = serve_to_file(test, req);
+    mu_assert(req->status_code == 416, "Past the end should be a 416.");
+    bdestroy(out);
+
+    req = fake_req_headers("GET", "/", "/sample.html", "Range: bytes=3-7\r\nIf-Range: nope\r\n");
+    out = serve_to_file(test, req);
+    mu_assert(req->status_code == 200, "Stale If-Range should get the whole file.");
+    bdestroy(out);
+
+    bstring if_range = bformat("Range: bytes=3-7\r\nIf-Range: %s\r\n", bdata(file->etag));
+    req = fake_req_headers("GET", "/", "/sample.html", bdata(if_range));
+    out = serve_to_file(test, req);
+    mu_assert(req->status_code == 206, "Matching If-Range should get the range.");
+    bdestroy(out);
+    bdestroy(if_range);
+
+    FileRecord_release(file);
+    Dir_destroy(test);
+
+    return NULL;
+}
+
+char *test_Dir_accept_encoding()
+{
+    struct tagbstring both = bsStatic("gzip, deflate");
+    struct tagbstring just_deflate = bsStatic("deflate");
+    struct tagbstring no_gzip = bsStatic("gzip;q=0, deflate");
+    struct tagbstring anything = bsStatic("*");
+    struct tagbstring anything_but_gzip = bsStatic("*, gzip; q=0");
+    struct tagbstring weighted = bsStatic("GZIP;q=0.5");
+    struct tagbstring unknown = bsStatic("br, compress");
+
+    mu_assert(Dir_accept_encoding(NULL) == DIR_IDENTITY, "No header means no encoding.");
+    mu_assert(Dir_accept_encoding(&both) == (DIR_GZIP | DIR_DEFLATE), "Should take both.");
+    mu_assert(Dir_accept_encoding(&just_deflate) == DIR_DEFLATE, "Should only take deflate.");
+    mu_assert(Dir_accept_encoding(&no_gzip) == DIR_DEFLATE, "q=0 should refuse gzip.");
+    mu_assert(Dir_accept_encoding(&anything) == (DIR_GZIP | DIR_DEFLATE), "* should take both.");
+    mu_assert(Dir_accept_encoding(&anything_but_gzip) == DIR_DEFLATE, "* shouldn't override q=0.");
+    mu_assert(Dir_accept_encoding(&weighted) == DIR_GZIP, "Should take gzip with a q value.");
+    mu_assert(Dir_accept_encoding(&unknown) == DIR_IDENTITY, "Shouldn't take unknown encodings.");
+
+    return NULL;
+}
+
+char *test_Dir_gzip_variants()
+{
+    struct tagbstring gzip_header = bsStatic("Content-Encoding: gzip\r\n");
+    struct tagbstring deflate_header = bsStatic("Content-Encoding: deflate\r\n");
+    struct tagbstring vary_header = bsStatic("Vary: Accept-Encoding\r\n");
+    struct tagbstring content_encoding = bsStatic("Content-Encoding");
+    FILE *out = NULL;
+    gzFile gz = NULL;
+    int i = 0;
+    bstring resp = NULL;
+
+    out = fopen("tests/gzip_sample.txt", "w");
+    mu_assert(out != NULL, "Failed to make the gzip sample.");
+    for(i = 0; i < 200; i++) fprintf(out, "line %d of some very compressible text\n", i);
+    fclose(out);
+
+    Dir *test = Dir_create("tests/", "sample.html", "text/plain", 0);
+    mu_assert(test != NULL, "Failed to make test dir.");
+
+    FileRecord *plain = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/gzip_sample.txt"), 0);
+    mu_assert(plain != NULL, "Failed to get the plain file.");
+    mu_assert(plain->encoding == DIR_IDENTITY, "Should get the plain file without an encoding.");
+    mu_assert(binstr(plain->header, 0, &vary_header) != BSTR_ERR, "Plain file should Vary.");
+    mu_assert(binstr(plain->header, 0, &content_encoding) == BSTR_ERR, "Plain file isn't encoded.");
+
+    FileRecord *gzipped = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/gzip_sample.txt"), DIR_GZIP);
+    mu_assert(gzipped != NULL, "Failed to get the gzipped file.");
+    mu_assert(gzipped->encoding == DIR_GZIP, "Should be gzip.");
+    mu_assert(gzipped->data != NULL, "Without a .gz it should be compressed in memory.");
+    mu_assert(FileRecord_size(gzipped) < plain->sb.st_size, "Compressed should be smaller.");
+    mu_assert((unsigned char)bchar(gzipped->data, 0) == 0x1f, "Not a gzip stream.");
+    mu_assert(binstr(gzipped->header, 0, &gzip_header) != BSTR_ERR, "Missing Content-Encoding.");
+    mu_assert(binstr(gzipped->header, 0, &vary_header) != BSTR_ERR, "Missing the Vary.");
+    mu_assert(!biseq(gzipped->etag, plain->etag), "Variants need their own etags.");
+
+    FileRecord *cached = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/gzip_sample.txt"),
+            DIR_GZIP | DIR_DEFLATE);
+    mu_assert(cached == gzipped, "Should prefer gzip and get it from the cache.");
+
+    FileRecord *deflated = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/gzip_sample.txt"), DIR_DEFLATE);
+    mu_assert(deflated != NULL && deflated->encoding == DIR_DEFLATE, "Should get deflate.");
+    mu_assert(binstr(deflated->header, 0, &deflate_header) != BSTR_ERR, "Missing deflate encoding.");
+
+    FileRecord *tiny = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.html"), DIR_GZIP);
+    mu_assert(tiny != NULL && tiny->encoding == DIR_IDENTITY, "Tiny files aren't worth it.");
+
+    FileRecord_release(plain);
+    FileRecord_release(gzipped);
+    FileRecord_release(cached);
+    FileRecord_release(deflated);
+    FileRecord_release(tiny);
+    Dir_destroy(test);
+
+    // now with a precompressed one sitting next to it
+    gz = gzopen("tests/gzip_sample.txt.gz", "wb");
+    mu_assert(gz != NULL, "Failed to make the .gz sample.");
+    gzputs(gz, "not really the same, but we can tell it's this one");
+    gzclose(gz);
+
+    test = Dir_create("tests/", "sample.html", "text/plain", 0);
+
+    gzipped = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/gzip_sample.txt"), DIR_GZIP);
+    mu_assert(gzipped != NULL && gzipped->encoding == DIR_GZIP, "Should get the .gz.");
+    mu_assert(gzipped->data == NULL && gzipped->fd >= 0, "The .gz should be sent from its file.");
+    mu_assert(bstrcmp(gzipped->content_type, &TEXT_PLAIN) == 0, "Should keep the original type.");
+    FileRecord_release(gzipped);
+
+    Request *req = fake_req_headers("GET", "/", "/gzip_sample.txt", "Accept-Encoding: gzip\r\n");
+    resp = serve_to_file(test, req);
+    mu_assert(resp != NULL && req->status_code == 200, "Failed to serve the .gz.");
+    mu_assert(binstr(resp, 0, &gzip_header) != BSTR_ERR, "Served without Content-Encoding.");
+    bdestroy(resp);
+
+    Dir_destroy(test);
+    unlink("tests/gzip_sample.txt");
+    unlink("tests/gzip_sample.txt.gz");
+
+    return NULL;
+}
+
+char *test_Dir_no_variant()
+{
+    FILE *out = NULL;
+    gzFile gz = NULL;
+    unsigned int seed = 1;
+    int i = 0;
+
+    // noise doesn't get any smaller, so there's nothing to cache
+    out = fopen("tests/noise_sample.txt", "w");
+    mu_assert(out != NULL, "Failed to make the noise sample.");
+    for(i = 0; i < 4096; i++) {
+        seed = seed * 1103515245 + 12345;
+        fputc(seed >> 16, out);
+    }
+    fclose(out);
+
+    Dir *test = Dir_create("tests/", "sample.html", "text/plain", 0);
+    mu_assert(test != NULL, "Failed to make test dir.");
+
+    FileRecord *file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/noise_sample.txt"), DIR_GZIP);
+    mu_assert(file != NULL && file->encoding == DIR_IDENTITY, "Noise shouldn't get a gzip variant.");
+    mu_assert(file->no_variant == DIR_GZIP, "Should remember there's no gzip variant.");
+    FileRecord_release(file);
+
+    // a .gz showing up now proves it doesn't look, or compress, a second time
+    gz = gzopen("tests/noise_sample.txt.gz", "wb");
+    mu_assert(gz != NULL, "Failed to make the .gz sample.");
+    gzputs(gz, "too late");
+    gzclose(gz);
+
+    file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/noise_sample.txt"), DIR_GZIP);
+    mu_assert(file != NULL && file->encoding == DIR_IDENTITY, "Should not look for a gzip variant again.");
+    FileRecord_release(file);
+
+    file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/noise_sample.txt"), DIR_DEFLATE);
+    mu_assert(file != NULL && file->encoding == DIR_IDENTITY, "Noise shouldn't get a deflate variant.");
+    mu_assert(file->no_variant == (DIR_GZIP | DIR_DEFLATE), "Each encoding is remembered on its own.");
+    FileRecord_release(file);
+
+    Dir_destroy(test);
+    unlink("tests/noise_sample.txt");
+    unlink("tests/noise_sample.txt.gz");
+
+    return NULL;
+}
+
+char *test_Dir_stale_precompressed()
+{
+    FILE *out = NULL;
+    gzFile gz = NULL;
+    struct utimbuf old_time = {.actime = 1000000000, .modtime = 1000000000};
+    struct utimbuf new_time = {.actime = 1100000000, .modtime = 1100000000};
+    struct utimbuf newer_time = {.actime = 1200000000, .modtime = 1200000000};
+
+    out = fopen("tests/stale_sample.txt", "w");
+    mu_assert(out != NULL, "Failed to make the sample.");
+    fputs("plain text that would compress if it were in memory", out);
+    fclose(out);
+
+    gz = gzopen("tests/stale_sample.txt.gz", "wb");
+    mu_assert(gz != NULL, "Failed to make the .gz sample.");
+    gzputs(gz, "the old copy");
+    gzclose(gz);
+
+    // made before the file changed, so it has to be skipped
+    utime("tests/stale_sample.txt.gz", &old_time);
+    utime("tests/stale_sample.txt", &new_time);
+
+    Dir *test = Dir_create("tests/", "sample.html", "text/plain", 0);
+    mu_assert(test != NULL, "Failed to make test dir.");
+
+    FileRecord *file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/stale_sample.txt"), DIR_GZIP);
+    mu_assert(file != NULL && file->encoding == DIR_IDENTITY, "Shouldn't send a .gz older than the file.");
+    FileRecord_release(file);
+    Dir_destroy(test);
+
+    utime("tests/stale_sample.txt.gz", &new_time);
+    utime("tests/stale_sample.txt", &old_time);
+
+    test = Dir_create("tests/", "sample.html", "text/plain", 0);
+    file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/stale_sample.txt"), DIR_GZIP);
+    mu_assert(file != NULL && file->encoding == DIR_GZIP, "Should send a fresh .gz.");
+    mu_assert(bstrrchr(file->full_path, '.') == blength(file->full_path) - 3, "Should be the .gz.");
+    FileRecord_release(file);
+
+    // the file changing drops the cached .gz with it
+    file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/stale_sample.txt"), 0);
+    file->loaded -= 10;
+    FileRecord_release(file);
+    utime("tests/stale_sample.txt", &newer_time);
+
+    file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/stale_sample.txt"), DIR_GZIP);
+    mu_assert(file != NULL && file->encoding == DIR_IDENTITY, "Cached .gz should go when the file changes.");
+    FileRecord_release(file);
+
+    Dir_destroy(test);
+    unlink("tests/stale_sample.txt");
+    unlink("tests/stale_sample.txt.gz");
+
+    return NULL;
+}
+
+char *test_Dir_memory_file()
+{
+    bstring out = NULL;
+    bstring expect = NULL;
+    Dir *test = Dir_create("tests/", "sample.html", "test/plain", 0);
+    FileRecord *file = Dir_resolve_file(test, bfromcstr("/"), bfromcstr("/sample.html"), 0);
+    mu_assert(file != NULL, "Failed to get sample.html.");
+    mu_assert(file->data != NULL && file->fd == -1, "Small file should be in memory with no fd.");
+
+    Request *req = fake_req_headers("GET", "/", "/sample.html", "");
+    out = serve_to_file(test, req);
+    expect = bstrcpy(file->header);
+    bconcat(expect, file->data);
+    mu_assert(out != NULL && bstrcmp(out, expect) == 0, "Header and body came out wrong.");
+    bdestroy(out);
+    bdestroy(expect);
+    FileRecord_release(file);
+
+    // it's a copy, so cutting the file short underneath can't touch it
+    FILE *out_file = fopen("tests/trunc_sample.txt", "w");
+    mu_assert(out_file != NULL, "Failed to make the truncate sample.");
+    fputs("this gets truncated", out_file);
+    fclose(out_file);
+    file = Dir_find_file(bfromcstr("tests/trunc_sample.txt"), &TEXT_PLAIN);
+    mu_assert(file != NULL && file->data != NULL, "Small file should be in memory.");
+    mu_assert(truncate("tests/trunc_sample.txt", 0) == 0, "Failed to truncate the sample.");
+    mu_assert(biseqcstr(file->data, "this gets truncated"), "Truncating changed the copy.");
+    FileRecord_destroy(file);
+    unlink("tests/trunc_sample.txt");
+
+    int max_file = MAX_DIR_MEMORY_FILE;
+    MAX_DIR_MEMORY_FILE = 1;
+    file = Dir_find_file(bfromcstr("tests/sample.html"), &TEXT_PLAIN);
+    mu_assert(file != NULL && file->data == NULL && file->fd >= 0, "Too big should stay on the fd.");
+    FileRecord_destroy(file);
+    MAX_DIR_MEMORY_FILE = max_file;
+
+    Dir_destroy(test);
+
+    return NULL;
+}
+
 char * all_tests() {
     mu_suite_start();
     Register_init();
+    Request_init();
 
     mu_run_test(test_Dir_find_file);
     mu_run_test(test_Dir_serve_file);
     mu_run_test(test_Dir_resolve_file);
+    mu_run_test(test_Dir_parse_range);
+    mu_run_test(test_Dir_serve_range);
+    mu_run_test(test_Dir_accept_encoding);
+    mu_run_test(test_Dir_gzip_variants);
+    mu_run_test(test_Dir_no_variant);
+    mu_run_test(test_Dir_stale_precompressed);
+    mu_run_test(test_Dir_memory_file);
 
     return NULL;
 }
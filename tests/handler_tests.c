@@ -3,6 +3,11 @@
 #include <handler.h>
 #include <string.h>
 #include <task/task.h>
+#include <request.h>
+#include <register.h>
+#include <connection.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -57,14 +62,119 @@ char *test_Handler_create_destroy()
     return NULL;
 }
 
+char *test_Handler_send_request()
+{
+    int i = 0;
+    size_t nparsed = 0;
+    const char *http = "GET /slab HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    HandlerSlab *first = NULL;
+
+    Handler *handler = Handler_create("tcp://127.0.0.1:12349", "ZED", "tcp://127.0.0.1:4322", "ZED");
+    mu_assert(handler != NULL, "Failed to make the handler.");
+    mu_assert(handler->slabs != NULL && handler->queue != NULL, "Should have slabs and a queue.");
+
+    handler->send_socket = Handler_send_create("inproc://handler_send", "ZED");
+    void *pull = mqsocket(ZMQ_PULL);
+    mu_assert(zmq_connect(pull, "inproc://handler_send") == 0, "Failed to connect to the handler.");
+
+    Request *req = Request_create();
+    Request_start(req);
+    mu_assert(Request_parse(req, (char *)http, strlen(http), &nparsed) == 1, "Failed to parse.");
+
+    for(i = 0; i < 8; i++) {
+        zmq_msg_t msg;
+        int rc = Handler_send_request(handler, req, 0, "body", 4);
+        mu_assert(rc == 0, "Failed to send the request.");
+        mu_assert(handler->slab != NULL, "Small payloads should come out of a slab.");
+
+        if(first == NULL) first = handler->slab;
+
+        zmq_msg_init(&msg);
+        mu_assert(zmq_recv(pull, &msg, 0) == 0, "Failed to receive the request.");
+        char *data = zmq_msg_data(&msg);
+        mu_assert(memcmp(data, "ZED ", 4) == 0, "Payload should start with the ident.");
+        mu_assert(memcmp(data + zmq_msg_size(&msg) - 7, "4:body,", 7) == 0, "Wrong payload body.");
+        zmq_msg_close(&msg);
+    }
+
+    // once 0mq is done with them the same slab gets used over again
+    mu_assert(handler->slab == first, "Should have stayed on the first slab.");
+    mu_assert(first->refs == 0, "Every message should have been released.");
+    mu_assert(handler->sent == 8, "Should have sent all eight.");
+
+    // a full slab 0mq still has a message in means moving to another one
+    handler->slab->used = HANDLER_SLAB_SIZE;
+    first->refs++;
+    mu_assert(Handler_send_request(handler, req, 0, "body", 4) == 0, "Failed to send.");
+    mu_assert(handler->slab != first, "Should move on to a free slab.");
+    first->refs--;
+
+    Request_destroy(req);
+    zmq_close(pull);
+    Handler_destroy(handler);
+
+    return NULL;
+}
+
+char *test_Handler_send_failed()
+{
+    int pair[2] = {-1, -1};
+    int rc = 0;
+    char buf[128];
+    size_t nparsed = 0;
+    const char *http = "GET /fails HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    Handler *handler = Handler_create("tcp://127.0.0.1:12350", "ZED", "tcp://127.0.0.1:4323", "ZED");
+    mu_assert(handler != NULL, "Failed to make the handler.");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Failed to make a socketpair.");
+    Connection *conn = Connection_create(NULL, pair[0], 0, "127.0.0.1");
+    conn->type = CONN_TYPE_HTTP;
+    Register_connect(pair[0], conn);
+
+    Request *req = Request_create();
+    Request_start(req);
+    mu_assert(Request_parse(req, (char *)http, strlen(http), &nparsed) == 1, "Failed to parse.");
+
+    // with a send task it only gets queued, and there's no socket to take it
+    handler->send_task = taskself();
+    mu_assert(Handler_send_request(handler, req, pair[0], "", 0) == 0, "Should queue the request.");
+    mu_assert(handler->queued == 1, "Request should be queued.");
+
+    mu_assert(Handler_flush(handler) == -1, "Flush should say the send failed.");
+    mu_assert(Register_fd_exists(pair[0]) == NULL, "Connection should be disconnected.");
+
+    rc = read(pair[1], buf, sizeof(buf) - 1);
+    mu_assert(rc > 0, "Client should get an answer.");
+    buf[rc] = '\0';
+    mu_assert(strncmp(buf, "HTTP/1.1 502", 12) == 0, "Client should get a 502.");
+
+    handler->send_task = NULL;
+    Connection_destroy(conn);
+    Request_destroy(req);
+    close(pair[1]);
+    Handler_destroy(handler);
+
+    return NULL;
+}
+
 char * all_tests() {
     mu_suite_start();
     mqinit(2);
+    Register_init();
+    Request_init();
+
+    // the payloads need a registered fd, so mock one out
+    Connection *conn = calloc(sizeof(Connection), 1);
+    conn->type = CONN_TYPE_HTTP;
+    Register_connect(0, conn);
 
     mu_run_test(test_Handler_send_create);
     mu_run_test(test_Handler_recv_create);
     // disabled for now mu_run_test(test_Handler_deliver);
     mu_run_test(test_Handler_create_destroy);
+    mu_run_test(test_Handler_send_request);
+    mu_run_test(test_Handler_send_failed);
 
     zmq_term(ZMQ_CTX);
     return NULL;
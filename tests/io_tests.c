@@ -6,9 +6,16 @@
 #include <assert.h>
 #include <mem/halloc.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <polarssl/net.h>
 
 FILE *LOG_FILE = NULL;
 
+// too big for a task's stack
+char SPLICE_DATA[100000];
+char SPLICE_BUF[sizeof(SPLICE_DATA)];
+
 Connection *fake_conn(const char *file, int mode) {
     Connection *conn = h_calloc(sizeof(Connection), 1);
     assert(conn && "Failed to create connection.");
@@ -129,6 +136,140 @@ char *test_IOBuf_send_operations()
     return NULL;
 }
 
+char *test_IOBuf_sendv()
+{
+    char got[64] = {0};
+    int pair[2] = {-1, -1};
+    struct iovec iov[2];
+
+    // files don't have a sendv so they get gathered into one send
+    Connection *conn = fake_conn("/dev/null", O_WRONLY);
+    iov[0] = (struct iovec){.iov_base = "head ", .iov_len = 5};
+    iov[1] = (struct iovec){.iov_base = "body", .iov_len = 4};
+    int rc = IOBuf_sendv(conn->iob, iov, 2);
+    mu_assert(rc == 9, "Should have gathered and sent 9 bytes.");
+    fake_conn_close(conn);
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Failed to make a socketpair.");
+    conn = h_calloc(sizeof(Connection), 1);
+    conn->iob = IOBuf_create(1024, pair[0], IOBUF_SOCKET);
+    mu_assert(conn->iob->sendv != NULL, "Sockets should have a real sendv.");
+    Register_connect(pair[0], conn);
+
+    iov[0] = (struct iovec){.iov_base = "head ", .iov_len = 5};
+    iov[1] = (struct iovec){.iov_base = "body", .iov_len = 4};
+    rc = IOBuf_sendv(conn->iob, iov, 2);
+    mu_assert(rc == 9, "Should have sent 9 bytes on the socket.");
+
+    rc = read(pair[1], got, sizeof(got));
+    mu_assert(rc == 9 && memcmp(got, "head body", 9) == 0, "Socket got the wrong bytes.");
+
+    fake_conn_close(conn);
+    close(pair[1]);
+
+    return NULL;
+}
+
+char *test_IOBuf_cork()
+{
+    char got[64] = {0};
+    int pair[2] = {-1, -1};
+    int rc = 0;
+    int max_send = MAX_SEND_BUFFER;
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Failed to make a socketpair.");
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->iob = IOBuf_create(1024, pair[0], IOBUF_SOCKET);
+    Register_connect(pair[0], conn);
+
+    MAX_SEND_BUFFER = 16;
+    mu_assert(IOBuf_cork(conn->iob) == 0, "Failed to cork.");
+
+    rc = IOBuf_send(conn->iob, "one ", 4);
+    mu_assert(rc == 4, "Corked send should say it sent it all.");
+    rc = IOBuf_send(conn->iob, "two ", 4);
+    rc = recv(pair[1], got, sizeof(got), MSG_DONTWAIT);
+    mu_assert(rc == -1, "Nothing should go out while corked.");
+
+    // too big to hold, so what's pending goes first
+    rc = IOBuf_send(conn->iob, "three is too big", 16 + 1);
+    mu_assert(rc == 17, "Big send should go straight out.");
+    rc = recv(pair[1], got, sizeof(got), 0);
+    mu_assert(rc == 25 && memcmp(got, "one two three is too big", 25) == 0, "Came out in the wrong order.");
+
+    IOBuf_send(conn->iob, "four", 4);
+    mu_assert(IOBuf_flush(conn->iob) == 4, "Flush should send what's pending.");
+    mu_assert(!conn->iob->corked, "Flush should uncork.");
+    rc = recv(pair[1], got, sizeof(got), 0);
+    mu_assert(rc == 4 && memcmp(got, "four", 4) == 0, "Flush sent the wrong thing.");
+
+    MAX_SEND_BUFFER = max_send;
+    fake_conn_close(conn);
+    close(pair[1]);
+
+    return NULL;
+}
+
+static IOBuf *socket_iob(int fd)
+{
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->iob = IOBuf_create(1024, fd, IOBUF_SOCKET);
+    Register_connect(fd, conn);
+    return conn->iob;
+}
+
+char *test_IOBuf_splice()
+{
+    int in[2] = {-1, -1};
+    int out[2] = {-1, -1};
+    int i = 0;
+    int rc = 0;
+    int avail = 0;
+    int got = 0;
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in) == 0, "Failed to make a socketpair.");
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out) == 0, "Failed to make a socketpair.");
+    fdnoblock(in[0]);
+    fdnoblock(out[0]);
+
+    IOBuf *from = socket_iob(in[0]);
+    IOBuf *to = socket_iob(out[0]);
+    mu_assert(IOBuf_can_splice(from, to), "Plain sockets should be able to splice.");
+
+    for(i = 0; i < (int)sizeof(SPLICE_DATA); i++) SPLICE_DATA[i] = 'a' + i % 26;
+    rc = write(in[1], SPLICE_DATA, sizeof(SPLICE_DATA));
+    mu_assert(rc == sizeof(SPLICE_DATA), "Failed to write the test data.");
+
+    // some of it is already buffered, that has to go out first
+    IOBuf_read(from, 10, &avail);
+    mu_assert(avail == 10, "Failed to buffer the start.");
+
+    rc = IOBuf_stream(from, to, sizeof(SPLICE_DATA));
+    mu_assert(rc == sizeof(SPLICE_DATA), "Failed to splice it all.");
+    mu_assert(to->splice_pipe[0] != -1, "Should have spliced through a pipe.");
+
+    while(got < (int)sizeof(SPLICE_DATA)) {
+        rc = read(out[1], SPLICE_BUF + got, sizeof(SPLICE_BUF) - got);
+        mu_assert(rc > 0, "Failed to read what was spliced.");
+        got += rc;
+    }
+
+    mu_assert(memcmp(SPLICE_BUF, SPLICE_DATA, sizeof(SPLICE_DATA)) == 0, "Spliced data came out wrong.");
+
+    // until close just stops when the other side hangs up
+    write(in[1], "the end", 7);
+    close(in[1]);
+    rc = IOBuf_splice(from, to, sizeof(SPLICE_DATA));
+    mu_assert(rc == 7 && IOBuf_closed(from), "Should stop at the close.");
+
+    fdclose(out[1]);
+    Register_disconnect(in[0]);
+    Register_disconnect(out[0]);
+    IOBuf_destroy(from);
+    IOBuf_destroy(to);
+
+    return NULL;
+}
 
 char *test_IOBuf_streaming()
 {
@@ -158,13 +299,93 @@ char *test_IOBuf_streaming()
     return NULL;
 }
 
+/*
+ * Puts both ends of an ssl connection straight into the state after a
+ * handshake for the cipher, with the same made up master secret.
+ */
+static void fake_handshake(ssl_context *ssl, ssl_session *ssn, int cipher)
+{
+    ssn->cipher = cipher;
+    memset(ssn->master, 'M', sizeof(ssn->master));
+
+    ssl->session = ssn;
+    ssl->resume = 1;
+    ssl->major_ver = ssl->max_major_ver = SSL_MAJOR_VERSION_3;
+    ssl->minor_ver = ssl->max_minor_ver = SSL_MINOR_VERSION_3;
+    memset(ssl->randbytes, 'R', sizeof(ssl->randbytes));
+
+    ssl_derive_keys(ssl);
+    ssl->do_crypt = 1;
+    ssl->state = SSL_HANDSHAKE_OVER;
+}
+
+char *test_IOBuf_ssl_stream_file()
+{
+    int sv[2] = {-1, -1};
+    char path[] = "/tmp/mongrel2_io_tests.XXXXXX";
+    int file = mkstemp(path);
+    ssl_context client;
+    ssl_session client_ssn;
+    int len = 40000;
+    int got = 0;
+    int rc = 0;
+    int i = 0;
+
+    mu_assert(file != -1, "Failed to make a temp file.");
+    unlink(path);
+
+    for(i = 0; i < len; i++) SPLICE_DATA[i] = 'a' + i % 26;
+    mu_assert(write(file, SPLICE_DATA, len) == len, "Failed to write the test file.");
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "Failed to make a socketpair.");
+    fdnoblock(sv[0]);
+
+    Connection *conn = h_calloc(sizeof(Connection), 1);
+    conn->iob = IOBuf_create(1024, sv[0], IOBUF_SSL);
+    Register_connect(sv[0], conn);
+    fake_handshake(&conn->iob->ssl, &conn->iob->ssn, SSL_RSA_AES_128_GCM_SHA256);
+    conn->iob->handshake_performed = 1;
+
+    memset(&client_ssn, 0, sizeof(client_ssn));
+    ssl_init(&client);
+    ssl_set_endpoint(&client, SSL_IS_CLIENT);
+    ssl_set_bio(&client, net_recv, &sv[1], net_send, &sv[1]);
+    fake_handshake(&client, &client_ssn, SSL_RSA_AES_128_GCM_SHA256);
+
+    // skip the first 10 bytes to check the offset works
+    rc = IOBuf_stream_file(conn->iob, file, 10, len - 10);
+    mu_assert(rc == len - 10, "Failed to stream the file.");
+
+    for(got = 0; got < len - 10; got += rc) {
+        rc = ssl_read(&client, (unsigned char *)SPLICE_BUF + got, len - 10 - got);
+        mu_assert(rc > 0, "Failed to read what was streamed.");
+    }
+
+    mu_assert(memcmp(SPLICE_BUF, SPLICE_DATA + 10, len - 10) == 0, "Streamed file came out wrong.");
+
+    // 16k, 16k and what's left, not a record per 1k chunk
+    mu_assert(client.in_ctr[7] == 3, "Should have taken three full size records.");
+
+    ssl_free(&client);
+    close(sv[1]);
+    close(file);
+    Register_disconnect(sv[0]);
+    Connection_destroy(conn);
+
+    return NULL;
+}
+
 char * all_tests() {
     Register_init();
     mu_suite_start();
 
     mu_run_test(test_IOBuf_read_operations);
     mu_run_test(test_IOBuf_send_operations);
+    mu_run_test(test_IOBuf_sendv);
+    mu_run_test(test_IOBuf_cork);
+    mu_run_test(test_IOBuf_splice);
     mu_run_test(test_IOBuf_streaming);
+    mu_run_test(test_IOBuf_ssl_stream_file);
 
     return NULL;
 }
@@ -1,6 +1,7 @@
 #include "minunit.h"
 #include <pattern.h>
 #include <string.h>
+#include <mem/halloc.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -178,6 +179,45 @@ char *test_escaped()
     return NULL;
 }
 
+struct {
+    const char *s;
+    size_t len;
+    const char *p;
+} COMPILED_CASES[] = {
+    {"ZED", 3, "Z.D"}, {"ZEEEED", 6, "ZE*ED"}, {"ZD", 2, "ZE+D"},
+    {"ZEEEED", 6, "ZE-D"}, {"ZED", 3, "ZE$"}, {"ZED", 3, "ZED$"},
+    {"ZED", 3, "Z(ED)"}, {"ZEED", 4, "ZEE?D"}, {"ZEEED", 5, "ZEE?D"},
+    {"ZED", 3, "Z[^OE]D"}, {"ZED", 3, "Z[A-Z]D"}, {"Z]D", 3, "Z[]]D"},
+    {"/users/{1234}", 13, "/users/\\b{}"}, {"/users/{1234", 12, "/users/\\b{}"},
+    {"THE (QUICK) brOWN FOx JUMPS", 27, "\\f[\\a]\\u-\\f[\\a]"},
+    {"a \t 9 l . \n U w A \0", 19, "\\a \\c \\d \\l \\p \\s \\u \\w \\x \\z"},
+    {"*Z*E+D.", 7, "\\*Z\\*E\\+D\\."}, {"1234/x", 6, "[0-9]+/$"},
+    {"caf\xe9", 4, "caf[^\\a]"}, {"2024$", 5, "\\d+$$"},
+    {NULL, 0, NULL}
+};
+
+char *test_compiled()
+{
+    int i = 0;
+
+    for(i = 0; COMPILED_CASES[i].s != NULL; i++) {
+        PatternProg *prog = pattern_compile(COMPILED_CASES[i].p);
+        mu_assert(prog != NULL, "Failed to compile a good pattern.");
+
+        m = pattern_exec(prog, COMPILED_CASES[i].s, COMPILED_CASES[i].len);
+        debug("COMPILED %s against %s: %p", COMPILED_CASES[i].p, COMPILED_CASES[i].s, m);
+        mu_assert(m == pattern_match(COMPILED_CASES[i].s, COMPILED_CASES[i].len, COMPILED_CASES[i].p),
+                "Compiled pattern disagrees with pattern_match.");
+
+        h_free(prog);
+    }
+
+    mu_assert(pattern_compile("Z[AB") == NULL, "Missing ] should not compile.");
+    mu_assert(pattern_compile("Z\\") == NULL, "Trailing \\ should not compile.");
+    mu_assert(pattern_compile("\\b{") == NULL, "Half a balance should not compile.");
+
+    return NULL;
+}
 
 char * all_tests() {
     mu_suite_start();
@@ -191,6 +231,7 @@ char * all_tests() {
     mu_run_test(test_set);
     mu_run_test(test_optional);
     mu_run_test(test_escaped);
+    mu_run_test(test_compiled);
 
     return NULL;
 }
@@ -1,7 +1,13 @@
 #include "minunit.h"
 #include <proxy.h>
+#include <request.h>
 #include <stdlib.h>
 #include <mem/halloc.h>
+#include <task/task.h>
+#include <register.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -16,13 +22,233 @@ char *test_Proxy_create_destroy()
     return NULL;
 }
 
+char *test_Proxy_stop_start()
+{
+    struct tagbstring host = bsStatic("127.0.0.1");
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), 8099);
+    mu_assert(proxy != NULL, "Didn't make the proxy.");
+    mu_assert(proxy->upstreams[0]->addrs != NULL, "Upstream should be looked up when it's added.");
+
+    // a reload that drops the proxy takes it out of reach of the upstream command
+    Proxy_stop(proxy);
+    mu_assert(!proxy->running, "Stopped proxy shouldn't be running.");
+    mu_assert(Proxy_set_enabled(&host, 8099, 0) == 0, "Stopped proxy shouldn't be found.");
+    mu_assert(Proxy_health_check(100) == 0, "Stopped proxy shouldn't be probed.");
+    mu_assert(proxy->upstreams[0]->enabled, "Stopped proxy shouldn't change.");
+
+    Proxy_start(proxy);
+    Proxy_start(proxy);
+    mu_assert(proxy->running, "Started proxy should be running.");
+    mu_assert(Proxy_set_enabled(&host, 8099, 0) == 1, "Started proxy should be found once.");
+    mu_assert(!proxy->upstreams[0]->enabled, "Upstream should be disabled.");
+
+    Proxy_stop(proxy);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    struct sockaddr_in sa = {.sin_family = AF_INET};
+    socklen_t len = sizeof(sa);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd == -1 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+            listen(fd, 8) == -1 || getsockname(fd, (struct sockaddr *)&sa, &len) == -1) {
+        return -1;
+    }
+
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+char *test_Proxy_pool()
+{
+    int port = 0;
+    time_t connected = 0;
+    int listener = listen_local(&port);
+    mu_assert(listener != -1, "Failed to listen for the fake backend.");
+
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), port);
+    ProxyUpstream *up = proxy->upstreams[0];
+
+    IOBuf *first = ProxyUpstream_connect(up, &connected);
+    mu_assert(first != NULL, "Failed to dial the backend.");
+    mu_assert(up->dials == 1, "Should have dialed once.");
+    mu_assert(up->outstanding == 0, "Connections aren't requests, so they aren't outstanding.");
+    int backend = accept(listener, NULL, NULL);
+
+    ProxyUpstream_release(up, first, connected, 1);
+    mu_assert(up->idle_count == 1, "Reusable connection should be pooled.");
+
+    IOBuf *again = ProxyUpstream_connect(up, &connected);
+    mu_assert(again == first, "Should get the pooled connection back.");
+    mu_assert(up->reuses == 1 && up->idle_count == 0, "Should count the reuse.");
+
+    // the backend hangs up while it's idle, so it has to be thrown out
+    ProxyUpstream_release(up, again, connected, 1);
+    close(backend);
+    fdwait(IOBuf_fd(again), 'r');
+
+    IOBuf *fresh = ProxyUpstream_connect(up, &connected);
+    mu_assert(fresh != NULL && up->evictions == 1, "Dead connection should be evicted.");
+    mu_assert(up->dials == 2, "Should have dialed a new one.");
+    backend = accept(listener, NULL, NULL);
+
+    // not reusable means it's closed, not pooled
+    ProxyUpstream_release(up, fresh, connected, 0);
+    mu_assert(up->idle_count == 0, "Non keep-alive connection shouldn't be pooled.");
+
+    Proxy_destroy(proxy);
+    close(backend);
+    close(listener);
+
+    return NULL;
+}
+
+char *test_Proxy_select()
+{
+    int i = 0;
+    int hits[3] = {0};
+    ProxyUpstream *up = NULL;
+    ProxyUpstream *a = NULL;
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), 8001);
+
+    mu_assert(Proxy_add_upstreams(proxy, "127.0.0.1:8002, 127.0.0.1:8003") == 0,
+            "Failed to add the upstreams.");
+    mu_assert(proxy->upstream_count == 3, "Should have three upstreams.");
+    mu_assert(proxy->upstreams[2]->port == 8003, "Parsed the wrong port.");
+    mu_assert(Proxy_set_balance(proxy, "bogus", NULL) == -1, "Should reject a bad balance.");
+
+    // round robin hits each one in turn
+    for(i = 0; i < 6; i++) {
+        up = Proxy_select(proxy, NULL, NULL);
+        hits[up->port - 8001]++;
+    }
+    mu_assert(hits[0] == 2 && hits[1] == 2 && hits[2] == 2, "Round robin is uneven.");
+
+    // down and disabled ones are skipped, and so is the one to avoid
+    proxy->upstreams[0]->healthy = 0;
+    mu_assert(Proxy_set_enabled(&(struct tagbstring)bsStatic("127.0.0.1"), 8002, 0) == 1,
+            "Should disable one upstream.");
+    for(i = 0; i < 4; i++) {
+        up = Proxy_select(proxy, NULL, NULL);
+        mu_assert(up->port == 8003, "Should only pick the one that's up.");
+    }
+    mu_assert(Proxy_select(proxy, NULL, proxy->upstreams[2])->port == 8001,
+            "Should fail open to a down upstream rather than nothing.");
+    Proxy_set_enabled(&(struct tagbstring)bsStatic("127.0.0.1"), 0, 1);
+    proxy->upstreams[0]->healthy = 1;
+
+    // least outstanding avoids the busy ones
+    mu_assert(Proxy_set_balance(proxy, "least", NULL) == 0, "Failed to set least.");
+    proxy->upstreams[0]->outstanding = 5;
+    proxy->upstreams[2]->outstanding = 2;
+    for(i = 0; i < 3; i++) {
+        mu_assert(Proxy_select(proxy, NULL, NULL)->port == 8002, "Should pick the least busy.");
+    }
+    proxy->upstreams[0]->outstanding = proxy->upstreams[2]->outstanding = 0;
+
+    // consistent hash keeps a path on the same upstream
+    mu_assert(Proxy_set_balance(proxy, "hash", "path") == 0, "Failed to set hash.");
+    Request *req = Request_create();
+    req->path = bfromcstr("/some/path");
+    a = Proxy_select(proxy, req, NULL);
+    for(i = 0; i < 4; i++) {
+        mu_assert(Proxy_select(proxy, req, NULL) == a, "Hash should be sticky.");
+    }
+    up = Proxy_select(proxy, req, a);
+    mu_assert(up != NULL && up != a, "Should move off an upstream that's avoided.");
+
+    // paths that only differ at the end still spread over all of them
+    hits[0] = hits[1] = hits[2] = 0;
+    for(i = 0; i < 300; i++) {
+        bdestroy(req->path);
+        req->path = bformat("/some/path/%d", i);
+        hits[Proxy_select(proxy, req, NULL)->port - 8001]++;
+    }
+    mu_assert(hits[0] > 50 && hits[1] > 50 && hits[2] > 50, "Hash bunches paths up on one upstream.");
+    bdestroy(req->path);
+    req->path = bfromcstr("/some/path");
+
+    // passive failures take it out of rotation, a success puts it back
+    for(i = 0; i < PROXY_MAX_FAILS; i++) ProxyUpstream_failed(a);
+    mu_assert(!a->healthy, "Should be down after too many failures.");
+    mu_assert(Proxy_select(proxy, req, NULL) != a, "Hash should skip a down upstream.");
+    ProxyUpstream_ok(a);
+    mu_assert(a->healthy && Proxy_select(proxy, req, NULL) == a, "Should be back after a success.");
+
+    Request_destroy(req);
+    Proxy_destroy(proxy);
+
+    return NULL;
+}
+
+char *test_Proxy_health_check()
+{
+    int i = 0;
+    int port = 0;
+    int good_port = 0;
+    int dead_port = 0;
+    int fillers[4] = {-1, -1, -1, -1};
+    struct sockaddr_in sa = {.sin_family = AF_INET};
+    time_t start = 0;
+
+    int good = listen_local(&good_port);
+    int dead = listen_local(&dead_port);
+    close(dead);
+
+    // a listener with a full backlog drops SYNs, so connects to it hang
+    int blackhole = socket(AF_INET, SOCK_STREAM, 0);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    mu_assert(good != -1 && blackhole != -1, "Failed to make the fake backends.");
+    mu_assert(bind(blackhole, (struct sockaddr *)&sa, sizeof(sa)) == 0 && listen(blackhole, 0) == 0,
+            "Failed to listen for the blackhole.");
+    socklen_t len = sizeof(sa);
+    getsockname(blackhole, (struct sockaddr *)&sa, &len);
+    port = ntohs(sa.sin_port);
+
+    for(i = 0; i < 4; i++) {
+        fillers[i] = socket(AF_INET, SOCK_STREAM, 0);
+        fdnoblock(fillers[i]);
+        connect(fillers[i], (struct sockaddr *)&sa, sizeof(sa));
+    }
+
+    Proxy *proxy = Proxy_create(bfromcstr("127.0.0.1"), port);
+    mu_assert(Proxy_add_upstream(proxy, bfromcstr("127.0.0.1"), good_port) == 0, "Failed to add upstream.");
+    mu_assert(Proxy_add_upstream(proxy, bfromcstr("127.0.0.1"), dead_port) == 0, "Failed to add upstream.");
+    proxy->upstreams[1]->healthy = 0;
+
+    start = time(NULL);
+    mu_assert(Proxy_health_check(1000) == 3, "Should probe all three upstreams.");
+    mu_assert(difftime(time(NULL), start) <= 2, "Blackholed upstream held up the health check.");
+
+    mu_assert(!proxy->upstreams[0]->healthy, "Blackholed upstream should be taken out.");
+    mu_assert(proxy->upstreams[1]->healthy, "Answering upstream should be put back.");
+    mu_assert(!proxy->upstreams[2]->healthy, "Refused upstream should be taken out.");
+
+    Proxy_destroy(proxy);
+    for(i = 0; i < 4; i++) close(fillers[i]);
+    close(blackhole);
+    close(good);
+
+    return NULL;
+}
+
 char * all_tests() {
     mu_suite_start();
+    Register_init();
+    Request_init();
 
     mu_run_test(test_Proxy_create_destroy);
+    mu_run_test(test_Proxy_stop_start);
+    mu_run_test(test_Proxy_pool);
+    mu_run_test(test_Proxy_select);
+    mu_run_test(test_Proxy_health_check);
 
     return NULL;
 }
 
 RUN_TESTS(all_tests);
-
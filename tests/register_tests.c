@@ -1,6 +1,9 @@
 #include "minunit.h"
 #include <connection.h>
 #include <register.h>
+#include <setting.h>
+#include <task/task.h>
+#include <sys/socket.h>
 
 int V_TEST_CONN_1 = 1;
 int V_TEST_CONN_2 = 2;
@@ -64,12 +67,50 @@ char *test_Register_ping()
 }
 
 
+char *test_Register_timeouts()
+{
+    int idle[2] = {-1, -1};
+    int busy[2] = {-1, -1};
+    int i = 0;
+
+    Setting_add("limits.min_ping", "1");
+    Setting_add("limits.min_read_rate", "0");
+    Setting_add("limits.min_write_rate", "0");
+    Setting_add("limits.kill_limit", "0");
+    Register_load_limits();
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, idle) == 0, "Failed to make a socketpair.");
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, busy) == 0, "Failed to make a socketpair.");
+
+    mu_assert(Register_connect(idle[0], TEST_CONN_1) >= 0, "Failed to connect the idle one.");
+    mu_assert(Register_connect(busy[0], TEST_CONN_2) >= 0, "Failed to connect the busy one.");
+
+    // nobody runs Register_cleanout, the timers have to do it
+    for(i = 0; i < 7; i++) {
+        taskdelay(500);
+        mu_assert(Register_ping(busy[0]) > 0, "Busy connection got killed.");
+    }
+
+    mu_assert(Register_fd_exists(idle[0]) == NULL, "Idle connection didn't time out.");
+    mu_assert(Register_fd_exists(busy[0]) == TEST_CONN_2, "Busy connection should still be there.");
+
+    Register_disconnect(busy[0]);
+    close(idle[1]);
+    close(busy[1]);
+    Setting_destroy();
+    Register_load_limits();
+
+    return NULL;
+}
+
+
 char * all_tests() {
     mu_suite_start();
 
     mu_run_test(test_Register_init);
     mu_run_test(test_Register_connect_disconnect);
     mu_run_test(test_Register_ping);
+    mu_run_test(test_Register_timeouts);
 
     return NULL;
 }
@@ -1,6 +1,7 @@
 #include "minunit.h"
 #include "request.h"
 #include "tnetstrings.h"
+#include "tnetstrings_impl.h"
 #include "headers.h"
 #include <glob.h>
 #include "register.h"
@@ -47,6 +48,18 @@ char *test_Request_payloads()
 
             payload = Request_to_tnetstring(req, fake_sender, 0, "", 0);
             debug("TNETSTRING PAYLOAD: '%.*s'", blength(payload), bdata(payload));
+            mu_assert(payload != NULL, "Failed to render the tnetstring.");
+            mu_assert((size_t)blength(payload) == Request_tnetstring_size(req, fake_sender, 0, 0) + 1,
+                    "Tnetstring should come out exactly the size it said.");
+
+            // the header dict after uuid, id and path has to parse
+            int start = bstrchrp(payload, ' ', bstrchrp(payload, ' ', blength(fake_sender) + 1) + 1) + 1;
+            char *rest = NULL;
+            tns_value_t *dict = tns_parse(bdata(payload) + start, blength(payload) - start, &rest);
+            mu_assert(dict != NULL && tns_get_type(dict) == tns_tag_dict, "Header dict didn't parse.");
+            mu_assert(strcmp(rest, "0:,") == 0, "Should end with an empty body.");
+            tns_value_destroy(dict);
+
             bconchar(payload, '\n');
             fwrite(payload->data, blength(payload), 1, test_cases);
             bdestroy(payload);
@@ -210,6 +223,109 @@ char *test_Multiple_Header_Request()
     return NULL;
 }
 
+struct tagbstring EVIL_HEADER = bsStatic("x-evil");
+struct tagbstring EXPECTED_EVIL = bsStatic("\"x-evil\":\"long enough for the wide scan \\\"quoted\\\" back\\\\slash\\n\\t\\u0001\\u001f end\"");
+
+char *test_Request_json_escape()
+{
+    size_t nparsed = 0;
+    const char *raw = "GET / HTTP/1.0\r\n\r\n";
+
+    Request *req = Request_create();
+    Request_start(req);
+    mu_assert(Request_parse(req, (char *)raw, strlen(raw), &nparsed) == 1, "It should parse.");
+
+    // the parser won't let these through, so put them in by hand
+    bstring evil = bfromcstr("long enough for the wide scan \"quoted\" back\\slash\n\t\x01\x1f end");
+    Request_set(req, &EVIL_HEADER, evil, 1);
+    bdestroy(evil);
+
+    bstring payload = Request_to_payload(req, &JSON_METHOD, 0, "", 0);
+    mu_assert(payload != NULL, "Failed to render the JSON payload.");
+    debug("ESCAPED PAYLOAD: %s", bdata(payload));
+
+    mu_assert(binstr(payload, 0, &EXPECTED_EVIL) != BSTR_ERR,
+            "Header value wasn't escaped right.");
+    mu_assert(bstrchr(payload, '\n') == BSTR_ERR, "Raw newline made it into the JSON.");
+
+    bdestroy(payload);
+    Request_destroy(req);
+
+    return NULL;
+}
+
+struct tagbstring MIXED_CASE_HEADER = bsStatic("X-MIXED-case");
+
+char *test_Request_arena()
+{
+    size_t nparsed = 0;
+    int i = 0;
+    const char *first = "GET /first HTTP/1.1\r\nHost: Example.com:80\r\nX-Mixed-Case: yes\r\n\r\n";
+    const char *second = "GET /second HTTP/1.1\r\nHost: other.com\r\n\r\n";
+
+    Request *req = Request_create();
+    mu_assert(req != NULL, "Failed to make the request.");
+
+    Request_start(req);
+    mu_assert(Request_parse(req, (char *)first, strlen(first), &nparsed) == 1, "First should parse.");
+
+    mu_assert(biseqcstr(Request_get(req, &MIXED_CASE_HEADER), "yes"), "Lookups should ignore case.");
+    mu_assert(biseqcstr(req->host_name, "Example.com"), "Wrong host name.");
+    mu_assert(biseqcstr(Request_path(req), "/first"), "Wrong path.");
+
+    // enough to spill out of the first arena block
+    bstring big = bfromcstr("");
+    for(i = 0; i < REQUEST_ARENA_SIZE / 8; i++) bcatcstr(big, "12345678");
+    Request_set(req, &MIXED_CASE_HEADER, big, 0);
+    bdestroy(big);
+    mu_assert(req->arena->next != NULL, "Should have grown the arena.");
+
+    // the next request on the connection starts over in the first block
+    Request_start(req);
+    mu_assert(req->arena->next == NULL && req->arena->used == 0, "Arena wasn't reset.");
+
+    nparsed = 0;
+    mu_assert(Request_parse(req, (char *)second, strlen(second), &nparsed) == 1, "Second should parse.");
+    mu_assert(Request_get(req, &MIXED_CASE_HEADER) == NULL, "Old header hung around.");
+    mu_assert(biseqcstr(req->host_name, "other.com"), "Wrong host name.");
+    mu_assert(biseqcstr(Request_path(req), "/second"), "Wrong path.");
+
+    Request_destroy(req);
+
+    return NULL;
+}
+
+char *test_Request_known()
+{
+    size_t nparsed = 0;
+    const char *raw = "GET / HTTP/1.1\r\nHOST: zedshaw.com\r\nContent-Length: 0\r\n"
+        "If-Range: abc\r\nIf-Match: def\r\nX-Forwarded-Fox: nope\r\n\r\n";
+    struct tagbstring fox = bsStatic("x-forwarded-fox");
+
+    mu_assert(Headers_known("Content-Length", 14) == HEADER_CONTENT_LENGTH, "Should know content-length.");
+    mu_assert(Headers_known("if-unmodified-since", 19) == HEADER_IF_UNMODIFIED_SINCE, "Should know if-unmodified-since.");
+    mu_assert(Headers_known("x-forwarded-fox", 15) == HEADER_UNKNOWN, "Same length isn't the same header.");
+    mu_assert(Headers_known("if-mangle", 9) == HEADER_UNKNOWN, "Shouldn't know if-mangle.");
+
+    Request *req = Request_create();
+    Request_start(req);
+    mu_assert(Request_parse(req, (char *)raw, strlen(raw), &nparsed) == 1, "It should parse.");
+
+    mu_assert(biseqcstr(Request_known(req, HEADER_HOST), "zedshaw.com"), "Host should be in its slot.");
+    mu_assert(biseqcstr(Request_known(req, HEADER_IF_RANGE), "abc"), "If-Range should be in its slot.");
+    mu_assert(biseqcstr(Request_known(req, HEADER_IF_MATCH), "def"), "If-Match should be in its slot.");
+    mu_assert(Request_known(req, HEADER_RANGE) == NULL, "There was no range.");
+    mu_assert(Request_get(req, &HTTP_IF_MATCH) == Request_known(req, HEADER_IF_MATCH),
+            "Request_get should use the slot.");
+    mu_assert(biseqcstr(Request_get(req, &fox), "nope"), "Unknown headers still go in the hash.");
+
+    Request_start(req);
+    mu_assert(Request_known(req, HEADER_HOST) == NULL, "Slots should clear between requests.");
+
+    Request_destroy(req);
+
+    return NULL;
+}
 
 char * all_tests() {
     mu_suite_start();
@@ -223,6 +339,9 @@ char * all_tests() {
 
     mu_run_test(test_Request_create);
     mu_run_test(test_Multiple_Header_Request);
+    mu_run_test(test_Request_json_escape);
+    mu_run_test(test_Request_arena);
+    mu_run_test(test_Request_known);
     mu_run_test(test_Request_payloads);
     mu_run_test(test_Request_speeds);
 
@@ -4,6 +4,8 @@
 #include <routing.h>
 #include <string.h>
 #include <dbg.h>
+#include <pattern.h>
+#include <time.h>
 
 FILE *LOG_FILE = NULL;
 
@@ -215,6 +217,133 @@ char *test_routing_match_reversed()
     return NULL;
 }
 
+// what RouteMap_simple_prefix_match did before it had the compiled trie
+static Route *tst_prefix_match(RouteMap *map, bstring target)
+{
+    Route *route = tst_search_prefix(map->routes, bdata(target), blength(target));
+
+    if(route && route->has_pattern) {
+        int len = blength(target) - blength(route->prefix);
+        if(len < 0) return NULL;
+
+        return pattern_match(bdataofs(target, blength(route->prefix)), len,
+                bdataofs(route->pattern, route->first_paren)) ? route : NULL;
+    }
+
+    return route;
+}
+
+#define MANY_ROUTES 300
+
+static RouteMap *many_routes(char **names)
+{
+    RouteMap *routes = RouteMap_create(NULL);
+    int i = 0;
+
+    RouteMap_insert(routes, bfromcstr("/"), names[0]);
+
+    for(i = 1; i < MANY_ROUTES; i++) {
+        switch(i % 4) {
+            case 0: RouteMap_insert(routes, bformat("/app%d/users/([0-9]+)$", i / 4), names[i]); break;
+            case 1: RouteMap_insert(routes, bformat("/app%d/static/", i / 4), names[i]); break;
+            case 2: RouteMap_insert(routes, bformat("/app%d", i / 4), names[i]); break;
+            case 3: RouteMap_insert(routes, bformat("/app%d/api/(\\w+)/(\\d+)", i / 4), names[i]); break;
+        }
+    }
+
+    return routes;
+}
+
+static bstring many_targets(int i)
+{
+    switch(i % 9) {
+        case 0: return bformat("/app%d/users/%d", i % 80, i);
+        case 1: return bformat("/app%d/users/%dx", i % 80, i);
+        case 2: return bformat("/app%d/static/css/site%d.css", i % 80, i);
+        case 3: return bformat("/app%d/api/thing/%d", i % 80, i);
+        case 4: return bformat("/app%d/api/thing/", i % 80);
+        case 5: return bformat("/app%d", i % 80);
+        case 6: return bformat("/ap");
+        case 7: return bformat("/app%d/stat", i % 80);
+        default: return bformat("/nowhere/%d", i);
+    }
+}
+
+char *test_compiled_prefix_matching()
+{
+    char *names[MANY_ROUTES];
+    int i = 0;
+
+    for(i = 0; i < MANY_ROUTES; i++) names[i] = (char *)bdata(bformat("route%d", i));
+
+    RouteMap *routes = many_routes(names);
+
+    for(i = 0; i < 2000; i++) {
+        bstring target = many_targets(i);
+        Route *want = tst_prefix_match(routes, target);
+        Route *got = RouteMap_simple_prefix_match(routes, target);
+
+        if(got != want) debug("MISMATCH on %s: %p vs %p", bdata(target), got, want);
+        mu_assert(got == want, "Compiled trie disagrees with the TST.");
+        bdestroy(target);
+    }
+
+    // inserts after compiling get picked up
+    mu_assert(check_simple_prefix(routes, "/late/1", names[0]), "Should go to / before it's added.");
+    RouteMap_insert(routes, bfromcstr("/late/"), "late");
+    mu_assert(check_simple_prefix(routes, "/late/1", "late"), "Should recompile after an insert.");
+
+    RouteMap_destroy(routes);
+
+    return NULL;
+}
+
+static double route_ns_per_match(RouteMap *routes, bstring *targets, int count, int compiled)
+{
+    struct timespec start, end;
+    int i = 0;
+    int j = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(j = 0; j < 100; j++) {
+        for(i = 0; i < count; i++) {
+            if(compiled) {
+                RouteMap_simple_prefix_match(routes, targets[i]);
+            } else {
+                tst_prefix_match(routes, targets[i]);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (count * 100);
+}
+
+char *test_routing_speed()
+{
+    char *names[MANY_ROUTES];
+    bstring targets[1000];
+    int i = 0;
+
+    for(i = 0; i < MANY_ROUTES; i++) names[i] = (char *)bdata(bformat("route%d", i));
+    for(i = 0; i < 1000; i++) targets[i] = many_targets(i);
+
+    RouteMap *routes = many_routes(names);
+    mu_assert(RouteMap_compile(routes) == 0, "Failed to compile routes.");
+
+    double compiled = route_ns_per_match(routes, targets, 1000, 1);
+    double tst = route_ns_per_match(routes, targets, 1000, 0);
+
+    log_info("ROUTING SPEED: %d routes, compiled %.1f ns/match, tst %.1f ns/match",
+            MANY_ROUTES, compiled, tst);
+
+    for(i = 0; i < 1000; i++) bdestroy(targets[i]);
+    RouteMap_destroy(routes);
+
+    return NULL;
+}
 
 char * all_tests() {
     mu_suite_start();
@@ -222,6 +351,8 @@ char * all_tests() {
     mu_run_test(test_routing_match);
     mu_run_test(test_simple_prefix_matching);
     mu_run_test(test_routing_match_reversed);
+    mu_run_test(test_compiled_prefix_matching);
+    mu_run_test(test_routing_speed);
 
     return NULL;
 }
@@ -53,12 +53,72 @@ char *test_Server_adds()
 }
 
 
+char *test_Server_match_route()
+{
+    int rc = 0;
+    Host *found_host = NULL;
+    Route *route = NULL;
+    Backend *found = NULL;
+    bstring path = bfromcstr("/users/zed");
+    bstring host_name = bfromcstr("zedshaw.com");
+    struct tagbstring noway = bsStatic("NOWAY");
+    struct tagbstring nope = bsStatic("/nope");
+
+    Server *srv = Server_create("uuid", "localhost",
+            "0.0.0.0", "8080", "chroot", "access_log", "error_log", "pid_file");
+    mu_assert(srv != NULL, "Failed to make the server.");
+    mu_assert(srv->route_cache != NULL, "Should have a route cache by default.");
+
+    Host *host = Host_create("zedshaw.com", "zedshaw.com");
+    rc = Host_add_backend(host, "/users/", strlen("/users/"), BACKEND_HANDLER, srv);
+    mu_assert(rc == 0, "Failed to add a route.");
+    rc = Server_add_host(srv, bstrcpy(host->matching), host);
+    mu_assert(rc == 0, "Failed to add host to server.");
+
+    found = Server_match_route(srv, host_name, path, &found_host, &route);
+    mu_assert(found != NULL, "Didn't find the backend.");
+    mu_assert(found_host == host, "Got the wrong host.");
+    mu_assert(biseqcstr(route->pattern, "/users/"), "Got the wrong route.");
+    mu_assert(srv->route_cache_misses == 1 && srv->route_cache_hits == 0, "First one should miss.");
+
+    found = Server_match_route(srv, host_name, path, &found_host, &route);
+    mu_assert(found != NULL && found_host == host, "Cached match came out wrong.");
+    mu_assert(srv->route_cache_hits == 1, "Second one should hit.");
+
+    // a new route anywhere makes it all stale
+    rc = Host_add_backend(host, "/users/zed", strlen("/users/zed"), BACKEND_HANDLER, host);
+    mu_assert(rc == 0, "Failed to add a route.");
+
+    found = Server_match_route(srv, host_name, path, &found_host, &route);
+    mu_assert(srv->route_cache_misses == 2, "New route should have missed.");
+    mu_assert(biseqcstr(route->pattern, "/users/zed"), "Didn't pick up the new route.");
+
+    // unknown hosts without a default and unknown paths aren't found
+    found = Server_match_route(srv, &noway, path, &found_host, &route);
+    mu_assert(found == NULL && found_host == NULL, "Should not find an unknown host.");
+
+    found = Server_match_route(srv, host_name, &nope, &found_host, &route);
+    mu_assert(found == NULL && found_host == host, "Should find the host but not the path.");
+
+    Server_set_default_host(srv, host);
+    found = Server_match_route(srv, NULL, path, &found_host, &route);
+    mu_assert(found != NULL && found_host == host, "Didn't use the default host.");
+
+    bdestroy(path);
+    bdestroy(host_name);
+    Server_destroy(srv);
+
+    return NULL;
+}
+
+
 char *all_tests() {
     mu_suite_start();
 
     mu_run_test(test_Server_init);
     mu_run_test(test_Server_create_destroy);
     mu_run_test(test_Server_adds);
+    mu_run_test(test_Server_match_route);
     zmq_term(ZMQ_CTX);
 
     return NULL;
@@ -6,6 +6,7 @@
 #include <mem/halloc.h>
 
 #include <superpoll.h>
+#include <setting.h>
 #include <zmq.h>
 
 FILE *LOG_FILE = NULL;
@@ -150,6 +151,10 @@ int read_and_process_token(int fd)
 	char *buf = inf->buf;
 	int nr;
 	nr = read(fd, buf, BUFSIZE);
+
+    // edge triggered poll wakes anything left waiting on a closed fd
+    if(nr == -1 && errno == EAGAIN) return 0;
+
     check(nr != -1, "Failed to read from fd that was supposedly ready: %d", fd);
 
 	toke = (struct token *)buf;
@@ -193,7 +198,7 @@ void makeapipe(int idx, int hot)
 	inf->fd = fds[READ];
 	inf->pipe_idx = idx;
 
-    rc = SuperPoll_add(TEST_POLL, NULL, NULL, fds[READ], 'r', hot);
+    rc = SuperPoll_add(TEST_POLL, &fdinfo[fds[READ]], NULL, fds[READ], 'r', hot);
     check(rc != -1, "Failed to add read side to superpoll.");
 
 	inf = &fdinfo[fds[WRITE]];
@@ -223,6 +228,7 @@ void closepipes(int nr)
     int i = 0;
     for(i = 0; i < nr; i++) {
         free(fdinfo[pipefds[i].fds[READ]].buf);
+        SuperPoll_del(TEST_POLL, NULL, pipefds[i].fds[READ]);
         close(pipefds[i].fds[READ]);
 
         free(fdinfo[pipefds[i].fds[WRITE]].buf);
@@ -256,7 +262,7 @@ int run_main_loop(int hot)
 			if (result.hits[i].ev.revents & ZMQ_POLLIN) {
                 // don't add it back in if there was an error along the way
 				if(read_and_process_token(result.hits[i].ev.fd) == 0) {
-                    rc = SuperPoll_add(TEST_POLL, NULL, NULL, result.hits[i].ev.fd, 'r', hot);
+                    rc = SuperPoll_add(TEST_POLL, result.hits[i].data, NULL, result.hits[i].ev.fd, 'r', hot);
                 }
 			}
 		}
@@ -304,7 +310,7 @@ char *run_test(int nr, int threads, int gens, int hot, char *fail_msg)
     pid_t mypid = getpid();
 
 
-    fprintf(perf, "%s %d %d %d %ld %d ", hot ? "poll" : "epoll",
+    fprintf(perf, "%s %d %d %d %ld %d ", TEST_POLL->edge ? "edge" : hot ? "poll" : "epoll",
             mypid, nr, max_threads, max_generation, BUFSIZE);
 
 
@@ -386,10 +392,28 @@ char *test_totally_maxed()
     return run_test(400, 350, 10, 0, "midlevel pipes failed.");
 }
 
+char *test_sparse_pipes_edge()
+{
+    return run_test(50, 5, 50, 0, "sparse edge pipes failed");
+}
+
+char *test_maxed_pipes_edge()
+{
+    return run_test(50, 50, 50, 0, "max edge pipes failed");
+}
+
+char *test_totally_maxed_edge()
+{
+    return run_test(400, 350, 10, 0, "totally maxed edge pipes failed.");
+}
+
 char *all_tests() {
     mu_suite_start();
 
     SuperPoll_get_max_fd();
+
+    // the hot and idle sets are only used with edge triggering off
+    Setting_add("superpoll.edge_triggered", "0");
     TEST_POLL = SuperPoll_create();
 
     mu_run_test(test_sparse_pipes_hot);
@@ -404,6 +428,17 @@ char *all_tests() {
 #endif
 
     SuperPoll_destroy(TEST_POLL);
+    Setting_destroy();
+
+#ifdef __linux__
+    TEST_POLL = SuperPoll_create();
+
+    mu_run_test(test_sparse_pipes_edge);
+    mu_run_test(test_maxed_pipes_edge);
+    mu_run_test(test_totally_maxed_edge);
+
+    SuperPoll_destroy(TEST_POLL);
+#endif
 
     return NULL;
 }
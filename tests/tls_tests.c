@@ -0,0 +1,593 @@
+#include "minunit.h"
+#include <tls.h>
+#include <setting.h>
+#include <register.h>
+#include <cache.h>
+#include <tnetstrings.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <task/task.h>
+#include <polarssl/certs.h>
+#include <polarssl/x509.h>
+#include <polarssl/aes.h>
+#include <polarssl/rsa.h>
+#include <polarssl/gcm.h>
+#include <polarssl/chacha20.h>
+#include <polarssl/poly1305.h>
+#include <polarssl/chachapoly.h>
+
+FILE *LOG_FILE = NULL;
+
+static void make_session(ssl_context *ssl, ssl_session *ssn, unsigned char id, int cipher)
+{
+    memset(ssl, 0, sizeof(ssl_context));
+    memset(ssn, 0, sizeof(ssl_session));
+
+    ssl->session = ssn;
+    ssn->length = 32;
+    memset(ssn->id, id, sizeof(ssn->id));
+    ssn->cipher = cipher;
+
+    TLS_setup(ssl);
+}
+
+char *test_TLS_session_cache()
+{
+    ssl_context ssl;
+    ssl_session ssn;
+
+    Setting_add("limits.ssl_session_cache", "2");
+    Setting_add("limits.ssl_session_timeout", "60");
+    mu_assert(TLS_init() == 0, "Failed to init TLS.");
+
+    make_session(&ssl, &ssn, 'A', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get != NULL && ssl.s_set != NULL, "Session hooks weren't set.");
+    mu_assert(ssl.s_get(&ssl) != 0, "Shouldn't resume an unknown session.");
+
+    // what a full handshake leaves behind
+    memset(ssn.master, 'M', sizeof(ssn.master));
+    mu_assert(ssl.s_set(&ssl) == 0, "Failed to cache the session.");
+
+    make_session(&ssl, &ssn, 'A', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get(&ssl) == 0, "Didn't resume the cached session.");
+    mu_assert(ssn.master[0] == 'M' && ssn.master[47] == 'M', "Didn't get the master secret back.");
+
+    make_session(&ssl, &ssn, 'A', SSL_RSA_RC4_128_SHA);
+    mu_assert(ssl.s_get(&ssl) != 0, "Shouldn't resume with a different cipher.");
+
+    make_session(&ssl, &ssn, 'B', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get(&ssl) != 0, "Shouldn't resume a session it never saw.");
+
+    // too old to resume, and it gets thrown out
+    THE_CURRENT_TIME_IS += 61;
+    make_session(&ssl, &ssn, 'A', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get(&ssl) != 0, "Shouldn't resume an expired session.");
+
+    // only room for two, so the oldest goes
+    make_session(&ssl, &ssn, 'C', SSL_RSA_AES_256_SHA);
+    ssl.s_set(&ssl);
+    make_session(&ssl, &ssn, 'D', SSL_RSA_AES_256_SHA);
+    ssl.s_set(&ssl);
+    make_session(&ssl, &ssn, 'E', SSL_RSA_AES_256_SHA);
+    ssl.s_set(&ssl);
+
+    make_session(&ssl, &ssn, 'C', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get(&ssl) != 0, "Least recently used session should be gone.");
+    make_session(&ssl, &ssn, 'E', SSL_RSA_AES_256_SHA);
+    mu_assert(ssl.s_get(&ssl) == 0, "Newest session should still be there.");
+
+    TLS_destroy();
+    Setting_destroy();
+
+    return NULL;
+}
+
+char *test_TLS_counters()
+{
+    ssl_context ssl;
+    TLSStats before = TLS_STATS;
+
+    memset(&ssl, 0, sizeof(ssl));
+    TLS_handshake_done(&ssl, 0);
+
+    ssl.resume = 1;
+    TLS_handshake_done(&ssl, 0);
+    TLS_handshake_done(&ssl, 0);
+    TLS_handshake_done(&ssl, -1);
+
+    mu_assert(TLS_STATS.full == before.full + 1, "Wrong full handshake count.");
+    mu_assert(TLS_STATS.resumed == before.resumed + 2, "Wrong resumed count.");
+    mu_assert(TLS_STATS.failed == before.failed + 1, "Wrong failed count.");
+
+    tns_value_t *info = TLS_info();
+    mu_assert(info != NULL, "Failed to get the TLS info.");
+    tns_value_destroy(info);
+
+    return NULL;
+}
+
+char *test_TLS_drbg()
+{
+    TLSDrbg drbg;
+    TLSDrbg same;
+    unsigned char out[40];
+    unsigned char other[40];
+    // worked out with python's hmac and hashlib.sha256
+    unsigned char expect[] = {0x60, 0x09, 0x31, 0xad, 0xff, 0x56, 0x3f, 0x74,
+        0x74, 0x7a, 0x4b, 0xbc, 0xbc, 0x53, 0xb7, 0xbc};
+    unsigned char expect_next[] = {0x92, 0x9e, 0x7b, 0x44, 0xb1, 0xd3, 0x05, 0x11};
+    const unsigned char *seed = (const unsigned char *)"mongrel2 drbg seed";
+    int seen[256] = {0};
+    int i = 0;
+
+    TLS_drbg_seed(&drbg, seed, strlen((const char *)seed));
+    TLS_drbg_generate(&drbg, out, sizeof(out));
+    mu_assert(memcmp(out, expect, sizeof(expect)) == 0, "HMAC_DRBG output doesn't match.");
+
+    TLS_drbg_generate(&drbg, out, sizeof(expect_next));
+    mu_assert(memcmp(out, expect_next, sizeof(expect_next)) == 0, "Second generate doesn't match.");
+    mu_assert(drbg.generated == 2, "Wrong generate count.");
+
+    TLS_drbg_seed(&drbg, seed, strlen((const char *)seed));
+    TLS_drbg_seed(&same, seed, strlen((const char *)seed));
+    TLS_drbg_reseed(&same, (const unsigned char *)"more", 4);
+    TLS_drbg_generate(&drbg, out, sizeof(out));
+    TLS_drbg_generate(&same, other, sizeof(other));
+    mu_assert(memcmp(out, other, sizeof(out)) != 0, "Reseeding didn't change the output.");
+
+    // the shared one seeds itself and hands out every byte value
+    for(i = 0; i < 8192; i++) {
+        seen[TLS_rand(NULL)]++;
+    }
+
+    for(i = 0; i < 256; i++) {
+        mu_assert(seen[i] > 0, "TLS_rand never made one of the byte values.");
+    }
+
+    return NULL;
+}
+
+char *test_TLS_rand_fork()
+{
+    unsigned char parent[32];
+    unsigned char child[32];
+    int fds[2] = {-1, -1};
+    int status = 0;
+    pid_t pid = 0;
+    int i = 0;
+
+    // leave most of the buffer for both sides of the fork
+    TLS_rand(NULL);
+    mu_assert(pipe(fds) == 0, "Failed to make a pipe.");
+
+    pid = fork();
+    mu_assert(pid != -1, "Failed to fork.");
+
+    if(pid == 0) {
+        for(i = 0; i < (int)sizeof(child); i++) child[i] = TLS_rand(NULL);
+        _exit(write(fds[1], child, sizeof(child)) != sizeof(child));
+    }
+
+    for(i = 0; i < (int)sizeof(parent); i++) parent[i] = TLS_rand(NULL);
+
+    mu_assert(read(fds[0], child, sizeof(child)) == sizeof(child), "Child didn't send its bytes.");
+    mu_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+            "Child failed.");
+    mu_assert(memcmp(parent, child, sizeof(parent)) != 0, "Forked child got the parent's random bytes.");
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return NULL;
+}
+
+char *test_TLS_cipher_self_tests()
+{
+    mu_assert(aes_self_test(0) == 0, "AES self test failed.");
+    mu_assert(gcm_self_test(0) == 0, "GCM self test failed.");
+    mu_assert(chacha20_self_test(0) == 0, "ChaCha20 self test failed.");
+    mu_assert(poly1305_self_test(0) == 0, "Poly1305 self test failed.");
+    mu_assert(chachapoly_self_test(0) == 0, "ChaCha20-Poly1305 self test failed.");
+
+    return NULL;
+}
+
+// one direction of a connection, the server writes and the client reads
+typedef struct Wire {
+    unsigned char buf[SSL_BUFFER_LEN];
+    int len;
+    int off;
+} Wire;
+
+static int wire_send(void *ctx, unsigned char *buf, int len)
+{
+    Wire *wire = ctx;
+
+    if(len > (int)sizeof(wire->buf) - wire->len) len = sizeof(wire->buf) - wire->len;
+    memcpy(wire->buf + wire->len, buf, len);
+    wire->len += len;
+
+    return len;
+}
+
+static int wire_recv(void *ctx, unsigned char *buf, int len)
+{
+    Wire *wire = ctx;
+
+    if(len > wire->len - wire->off) len = wire->len - wire->off;
+    memcpy(buf, wire->buf + wire->off, len);
+    wire->off += len;
+
+    if(wire->off == wire->len) wire->off = wire->len = 0;
+
+    return len;
+}
+
+/*
+ * Sets up both ends of a connection as if they'd just done the handshake
+ * for this cipher, sharing a made up master secret.
+ */
+static void make_record_pair(ssl_context *srv, ssl_context *cli,
+        ssl_session *ssn, int cipher, Wire *wire)
+{
+    ssl_context *both[] = {srv, cli};
+    int i = 0;
+
+    memset(ssn, 0, sizeof(ssl_session));
+    memset(ssn->master, 'M', sizeof(ssn->master));
+    ssn->cipher = cipher;
+    wire->len = wire->off = 0;
+
+    for(i = 0; i < 2; i++) {
+        ssl_init(both[i]);
+        ssl_set_endpoint(both[i], i == 0 ? SSL_IS_SERVER : SSL_IS_CLIENT);
+        ssl_set_bio(both[i], wire_recv, wire, wire_send, wire);
+        TLS_setup(both[i]);
+
+        both[i]->session = ssn;
+        both[i]->resume = 1;
+        both[i]->major_ver = both[i]->max_major_ver = SSL_MAJOR_VERSION_3;
+        both[i]->minor_ver = both[i]->max_minor_ver =
+            ssl_cipher_is_tls12(cipher) ? SSL_MINOR_VERSION_3 : SSL_MINOR_VERSION_1;
+        memset(both[i]->randbytes, 'R', sizeof(both[i]->randbytes));
+
+        ssl_derive_keys(both[i]);
+        both[i]->do_crypt = 1;
+        both[i]->state = SSL_HANDSHAKE_OVER;
+    }
+}
+
+static int read_all(ssl_context *ssl, unsigned char *buf, int len)
+{
+    int rc = 0;
+    int got = 0;
+
+    for(got = 0; got < len; got += rc) {
+        rc = ssl_read(ssl, buf + got, len - got);
+        if(rc <= 0) return rc;
+    }
+
+    return got;
+}
+
+static int AEAD_CIPHERS[] = {
+    SSL_RSA_AES_128_GCM_SHA256,
+    SSL_RSA_AES_256_GCM_SHA384,
+    SSL_EDH_RSA_AES_128_GCM_SHA256,
+    SSL_EDH_RSA_AES_256_GCM_SHA384,
+    SSL_EDH_RSA_CHACHA20_POLY1305_SHA256,
+    0
+};
+
+char *test_TLS_aead_records()
+{
+    ssl_context srv;
+    ssl_context cli;
+    ssl_session ssn;
+    static Wire wire;
+    unsigned char msg[3000];
+    unsigned char got[3000];
+    int i = 0;
+    int n = 0;
+
+    for(i = 0; i < (int)sizeof(msg); i++) msg[i] = i * 7;
+
+    for(i = 0; AEAD_CIPHERS[i] != 0; i++) {
+        make_record_pair(&srv, &cli, &ssn, AEAD_CIPHERS[i], &wire);
+
+        // a few records so the sequence numbers move along
+        for(n = 1; n < (int)sizeof(msg); n *= 3) {
+            mu_assert(ssl_write(&srv, msg, n) == n, "Failed to write a record.");
+            mu_assert(read_all(&cli, got, n) == n, "Failed to read a record back.");
+            mu_assert(memcmp(msg, got, n) == 0, "Record came back different.");
+        }
+
+        mu_assert(srv.out_ctr[7] == 8 && cli.in_ctr[7] == 8, "Sequence numbers are off.");
+
+        // flip a bit in the ciphertext and the tag has to catch it
+        mu_assert(ssl_write(&srv, msg, 100) == 100, "Failed to write a record.");
+        wire.buf[wire.len - 30] ^= 0x01;
+        mu_assert(ssl_read(&cli, got, 100) == POLARSSL_ERR_SSL_INVALID_MAC,
+                "Tampered record wasn't rejected.");
+
+        mu_assert(strstr(ssl_get_cipher(&srv), "_GCM_") || strstr(ssl_get_cipher(&srv), "CHACHA"),
+                "Wrong cipher name.");
+
+        ssl_free(&srv);
+        ssl_free(&cli);
+    }
+
+    return NULL;
+}
+
+/*
+ * Not a pass/fail test, this logs how fast each cipher moves full size
+ * records through the record layer so they can be compared.
+ */
+char *test_TLS_cipher_speed()
+{
+    int ciphers[] = {
+        SSL_RSA_RC4_128_SHA,
+        SSL_RSA_AES_128_SHA,
+        SSL_RSA_AES_256_SHA,
+        SSL_RSA_CAMELLIA_128_SHA,
+        SSL_RSA_AES_128_GCM_SHA256,
+        SSL_RSA_AES_256_GCM_SHA384,
+        SSL_EDH_RSA_CHACHA20_POLY1305_SHA256,
+        0
+    };
+    ssl_context srv;
+    ssl_context cli;
+    ssl_session ssn;
+    static Wire wire;
+    static unsigned char data[SSL_MAX_CONTENT_LEN];
+    struct timeval start, end;
+    long usecs = 0;
+    int records = 256;
+    int i = 0;
+    int n = 0;
+
+    memset(data, 'D', sizeof(data));
+
+    for(i = 0; ciphers[i] != 0; i++) {
+        make_record_pair(&srv, &cli, &ssn, ciphers[i], &wire);
+
+        gettimeofday(&start, NULL);
+
+        for(n = 0; n < records; n++) {
+            mu_assert(ssl_write(&srv, data, sizeof(data)) == sizeof(data), "Failed to write.");
+            mu_assert(read_all(&cli, data, sizeof(data)) == sizeof(data), "Failed to read.");
+        }
+
+        gettimeofday(&end, NULL);
+        usecs = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+        if(usecs == 0) usecs++;
+
+        log_info("%s: %ld MB/s encrypt+decrypt", ssl_get_cipher(&srv),
+                (long)records * sizeof(data) / usecs);
+
+        ssl_free(&srv);
+        ssl_free(&cli);
+    }
+
+    return NULL;
+}
+
+static int not_on_thread(void *arg)
+{
+    return pthread_equal(*(pthread_t *)arg, pthread_self()) ? -1 : 42;
+}
+
+static int fd_recv(void *ctx, unsigned char *buf, int len)
+{
+    // polarssl keeps asking on a 0 return, so turn EOF into an error
+    int rc = fdrecv(*(int *)ctx, buf, len);
+    return rc == 0 ? -1 : rc;
+}
+
+static int fd_send(void *ctx, unsigned char *buf, int len)
+{
+    return fdsend(*(int *)ctx, buf, len);
+}
+
+typedef struct ClientEnd {
+    int fd;
+    int cipher;
+    int rc;
+    int done;
+} ClientEnd;
+
+static void client_handshake_task(void *arg)
+{
+    ClientEnd *end = arg;
+    ssl_context ssl;
+    ssl_session ssn;
+    int ciphers[] = {end->cipher, 0};
+
+    memset(&ssn, 0, sizeof(ssn));
+    ssl_init(&ssl);
+    ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
+    ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
+    ssl_set_rng(&ssl, TLS_rand, NULL);
+    ssl_set_bio(&ssl, fd_recv, &end->fd, fd_send, &end->fd);
+    ssl_set_ciphers(&ssl, ciphers);
+    ssl_set_session(&ssl, 0, 0, &ssn);
+
+    end->rc = ssl_handshake(&ssl);
+
+    ssl_free(&ssl);
+    end->done = 1;
+}
+
+/*
+ * Does a real handshake over a socketpair, with the client in its own task
+ * so the server can sleep while a handshake thread does its RSA and DH.
+ */
+static int offloaded_handshake(x509_cert *crt, rsa_context *rsa, int cipher)
+{
+    int sv[2] = {-1, -1};
+    ssl_context ssl;
+    ssl_session ssn;
+    ClientEnd client = {.cipher = cipher};
+    int rc = 0;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return -1;
+    fdnoblock(sv[0]);
+    fdnoblock(sv[1]);
+
+    client.fd = sv[1];
+    taskcreate(client_handshake_task, &client, 64 * 1024);
+
+    memset(&ssn, 0, sizeof(ssn));
+    ssl_init(&ssl);
+    ssl_set_endpoint(&ssl, SSL_IS_SERVER);
+    ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
+    ssl_set_bio(&ssl, fd_recv, &sv[0], fd_send, &sv[0]);
+    ssl_set_ciphers(&ssl, ssl_default_ciphers);
+    ssl_set_session(&ssl, 0, 0, &ssn);
+    ssl_set_own_cert(&ssl, crt, rsa);
+    ssl_set_dh_param(&ssl, (char *)"E4004C1F94182000103D883A448B3F80"
+            "2CE4B44A83301270002C20D0321CFD0011CCEF784C26A400F43DFB901BCA7538"
+            "F2C6B176001CF5A0FD16D2C48B1D0C1CF6AC8E1DA6BCC3B4E1F96B0564965300"
+            "FFA1D0B601EB2800F489AA512C4B248C01F76949A60BB7F00A40B1EAB64BDD48"
+            "E8A700D60B7F1200FA8E77B0A979DABF", (char *)"4");
+    TLS_setup(&ssl);
+
+    rc = ssl_handshake(&ssl);
+    debug("Server handshake for %d returned %d", cipher, rc);
+
+    // closing our end gets the client out if we gave up on it
+    ssl_free(&ssl);
+    fdclose(sv[0]);
+
+    while(!client.done) taskdelay(1);
+    fdclose(sv[1]);
+
+    return rc == 0 && client.rc == 0 ? 0 : -1;
+}
+
+static int blinding_rng(void *p_rng)
+{
+    (void)p_rng;
+    return rand();
+}
+
+static int stuck_rng(void *p_rng)
+{
+    (void)p_rng;
+    return 0;
+}
+
+// hands out as many bytes as it's given, then runs dry like ssl_async_rng
+static int dry_rng(void *p_rng)
+{
+    int *left = p_rng;
+    return (*left)-- > 0 ? rand() : -1;
+}
+
+char *test_TLS_rsa_blinding()
+{
+    rsa_context rsa;
+    unsigned char hash[36];
+    unsigned char plain[48];
+    unsigned char sig[512];
+    unsigned char blinded[512];
+    unsigned char cipher[512];
+    unsigned char out[512];
+    int len = 0;
+    int left = 0;
+
+    mu_assert(rsa_self_test(0) == 0, "RSA self test failed.");
+
+    memset(&rsa, 0, sizeof(rsa));
+    mu_assert(x509parse_key(&rsa, (unsigned char *)test_srv_key, strlen(test_srv_key), NULL, 0) == 0,
+            "Failed to parse the test key.");
+    memset(hash, 0x5a, sizeof(hash));
+    memset(plain, 0x3c, sizeof(plain));
+
+    // blinding only hides the input, the signature comes out the same
+    mu_assert(rsa_pkcs1_sign(&rsa, NULL, NULL, RSA_PRIVATE, SIG_RSA_RAW,
+                sizeof(hash), hash, sig) == 0, "Unblinded sign failed.");
+    mu_assert(rsa_pkcs1_sign(&rsa, blinding_rng, NULL, RSA_PRIVATE, SIG_RSA_RAW,
+                sizeof(hash), hash, blinded) == 0, "Blinded sign failed.");
+    mu_assert(memcmp(sig, blinded, rsa.len) == 0, "Blinded signature differs.");
+    mu_assert(rsa_pkcs1_sign(&rsa, stuck_rng, NULL, RSA_PRIVATE, SIG_RSA_RAW,
+                sizeof(hash), hash, blinded) != 0, "Sign didn't use the RNG to blind.");
+    left = rsa.len / 2;
+    mu_assert(rsa_pkcs1_sign(&rsa, dry_rng, &left, RSA_PRIVATE, SIG_RSA_RAW,
+                sizeof(hash), hash, blinded) != 0, "Sign blinded with a dry RNG.");
+    left = rsa.len;
+    mu_assert(rsa_pkcs1_sign(&rsa, dry_rng, &left, RSA_PRIVATE, SIG_RSA_RAW,
+                sizeof(hash), hash, blinded) == 0, "Sign failed with enough random bytes.");
+
+    mu_assert(rsa_pkcs1_encrypt(&rsa, blinding_rng, NULL, RSA_PUBLIC,
+                sizeof(plain), plain, cipher) == 0, "Encrypt failed.");
+    mu_assert(rsa_pkcs1_decrypt(&rsa, blinding_rng, NULL, RSA_PRIVATE, &len,
+                cipher, out, sizeof(out)) == 0, "Blinded decrypt failed.");
+    mu_assert(len == sizeof(plain) && memcmp(out, plain, len) == 0,
+            "Blinded decrypt gave the wrong plaintext.");
+
+    rsa_free(&rsa);
+
+    return NULL;
+}
+
+char *test_TLS_offload()
+{
+    pthread_t self = pthread_self();
+    unsigned long before = 0;
+    x509_cert crt;
+    rsa_context rsa;
+
+    Setting_add("limits.ssl_handshake_threads", "2");
+    mu_assert(TLS_init() == 0, "Failed to init TLS.");
+
+    before = TLS_STATS.offloaded;
+    mu_assert(TLS_offload(NULL, not_on_thread, &self) == 42, "Didn't run on a handshake thread.");
+    mu_assert(TLS_STATS.offloaded == before + 1, "Didn't count the offload.");
+
+    memset(&crt, 0, sizeof(crt));
+    memset(&rsa, 0, sizeof(rsa));
+    mu_assert(x509parse_crt(&crt, (unsigned char *)test_srv_crt, strlen(test_srv_crt)) == 0,
+            "Failed to parse the test certificate.");
+    mu_assert(x509parse_key(&rsa, (unsigned char *)test_srv_key, strlen(test_srv_key), NULL, 0) == 0,
+            "Failed to parse the test key.");
+
+    // the first use of the key fills in its cache inline, after that it all goes
+    before = TLS_STATS.offloaded;
+    mu_assert(offloaded_handshake(&crt, &rsa, SSL_EDH_RSA_AES_256_SHA) == 0, "DHE handshake failed.");
+    mu_assert(offloaded_handshake(&crt, &rsa, SSL_RSA_AES_128_SHA) == 0, "RSA handshake failed.");
+    mu_assert(offloaded_handshake(&crt, &rsa, SSL_EDH_RSA_AES_128_SHA) == 0, "DHE handshake failed.");
+    mu_assert(TLS_STATS.offloaded == before + 5, "Wrong number of offloaded operations.");
+
+    x509_free(&crt);
+    rsa_free(&rsa);
+    TLS_destroy();
+    Setting_destroy();
+
+    return NULL;
+}
+
+char *all_tests()
+{
+    mu_suite_start();
+
+    Register_init();
+
+    mu_run_test(test_TLS_session_cache);
+    mu_run_test(test_TLS_counters);
+    mu_run_test(test_TLS_drbg);
+    mu_run_test(test_TLS_rand_fork);
+    mu_run_test(test_TLS_cipher_self_tests);
+    mu_run_test(test_TLS_aead_records);
+    mu_run_test(test_TLS_cipher_speed);
+    mu_run_test(test_TLS_rsa_blinding);
+    mu_run_test(test_TLS_offload);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
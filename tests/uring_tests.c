@@ -0,0 +1,114 @@
+#include "minunit.h"
+#include <task/task.h>
+#include <setting.h>
+#include <io.h>
+#include <register.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <string.h>
+
+FILE *LOG_FILE = NULL;
+
+int PAIR[2] = {-1, -1};
+
+// too big for a task's stack
+char STREAM_DATA[20000];
+char STREAM_BUF[sizeof(STREAM_DATA)];
+
+char *test_uring_send_recv()
+{
+    char buf[64];
+    int rc = 0;
+
+    rc = uringsend(PAIR[0], "hello uring", 11);
+    mu_assert(rc == 11, "Failed to send over io_uring.");
+
+    rc = uringrecv(PAIR[1], buf, sizeof(buf));
+    mu_assert(rc == 11, "Failed to recv over io_uring.");
+    mu_assert(memcmp(buf, "hello uring", 11) == 0, "Got the wrong data back.");
+
+    return NULL;
+}
+
+char *test_uring_stream()
+{
+    char *data = STREAM_DATA;
+    char *buf = STREAM_BUF;
+    char tmpl[] = "/tmp/uring_tests.XXXXXX";
+    int i = 0;
+    int rc = 0;
+    int got = 0;
+    int file_fd = mkstemp(tmpl);
+    mu_assert(file_fd != -1, "Failed to make the temp file.");
+    unlink(tmpl);
+
+    for(i = 0; i < (int)sizeof(STREAM_DATA); i++) data[i] = 'A' + i % 26;
+    rc = write(file_fd, data, sizeof(STREAM_DATA));
+    mu_assert(rc == sizeof(STREAM_DATA), "Failed to write the temp file.");
+
+    // small buffers so it has to go around the ring a few times
+    rc = uringstream(PAIR[0], file_fd, 0, sizeof(STREAM_DATA));
+    mu_assert(rc == sizeof(STREAM_DATA), "Failed to stream the whole file.");
+
+    while(got < (int)sizeof(STREAM_DATA)) {
+        rc = uringrecv(PAIR[1], buf + got, sizeof(STREAM_BUF) - got);
+        mu_assert(rc > 0, "Failed to read the streamed file.");
+        got += rc;
+    }
+
+    mu_assert(memcmp(buf, data, sizeof(STREAM_DATA)) == 0, "Streamed file came out wrong.");
+
+    close(file_fd);
+    return NULL;
+}
+
+char *test_uring_iobuf()
+{
+    char buf[64];
+    int rc = 0;
+
+    IOBuf *iob = IOBuf_create(1024, PAIR[0], IOBUF_SOCKET);
+    mu_assert(iob != NULL, "Failed to make the IOBuf.");
+    mu_assert(iob->use_uring, "IOBuf should use io_uring when it's enabled.");
+
+    rc = IOBuf_send(iob, "through the iobuf", 17);
+    mu_assert(rc == 17, "Failed to send through the IOBuf.");
+
+    rc = fdrecv(PAIR[1], buf, sizeof(buf));
+    mu_assert(rc == 17, "Failed to get what the IOBuf sent.");
+
+    // destroying it closes (and unregisters) the socket for us
+    IOBuf_destroy(iob);
+    PAIR[0] = -1;
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    Setting_add("io_uring.enabled", "1");
+    Setting_add("io_uring.buffer_size", "4096");
+    Register_init();
+
+    if(!uringenabled()) {
+        log_warn("No io_uring on this machine, skipping the io_uring tests.");
+        return NULL;
+    }
+
+    mu_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, PAIR) == 0, "Failed to make a socketpair.");
+    fdnoblock(PAIR[0]);
+    fdnoblock(PAIR[1]);
+    uringregister(PAIR[0]);
+
+    mu_run_test(test_uring_send_recv);
+    mu_run_test(test_uring_stream);
+    mu_run_test(test_uring_iobuf);
+
+    fdclose(PAIR[1]);
+    Setting_destroy();
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
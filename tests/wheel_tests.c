@@ -0,0 +1,170 @@
+#include "minunit.h"
+#include <adt/wheel.h>
+#include <stdlib.h>
+
+FILE *LOG_FILE = NULL;
+
+#define RANDOM_TIMERS 2000
+
+typedef struct Fired {
+    wheel_t *wheel;
+    uint64_t at;
+    int count;
+    int late;
+} Fired;
+
+wheel_timer_t RANDOM[RANDOM_TIMERS];
+Fired RANDOM_FIRED[RANDOM_TIMERS];
+
+static void record_fire(wheel_timer_t *timer)
+{
+    Fired *fired = timer->data;
+
+    fired->at = fired->wheel->now;
+    fired->count++;
+    if(fired->at != timer->expires) fired->late++;
+}
+
+static void repeat_fire(wheel_timer_t *timer)
+{
+    Fired *fired = timer->data;
+
+    record_fire(timer);
+    if(fired->count < 3) wheel_add(fired->wheel, timer, fired->wheel->now + 100);
+}
+
+char *test_wheel_levels()
+{
+    // one for the root, one for each level and one past the end
+    uint64_t offsets[] = {1, 5, 255, 256, 300, 20000, 2000000, 100000000, 1ULL << 40};
+    int count = sizeof(offsets) / sizeof(uint64_t);
+    wheel_timer_t timers[count];
+    Fired fired[count];
+    int i = 0;
+    uint64_t start = 123456789;
+
+    wheel_t *wheel = wheel_create(start);
+    mu_assert(wheel != NULL, "Failed to make the wheel.");
+    mu_assert(wheel_next(wheel) == -1, "Empty wheel should say -1 for next.");
+
+    for(i = 0; i < count; i++) {
+        fired[i] = (Fired){.wheel = wheel};
+        wheel_timer_init(&timers[i], record_fire, &fired[i]);
+        wheel_add(wheel, &timers[i], start + offsets[i]);
+        mu_assert(wheel_timer_pending(&timers[i]), "Timer should be pending.");
+    }
+
+    mu_assert(wheel->count == count, "Wrong count after adding.");
+    mu_assert(wheel_next(wheel) == 1, "Next should be the first timer.");
+    mu_assert(timers[count - 1].expires == start + 0xffffffffULL, "Far timer wasn't clamped.");
+
+    mu_assert(wheel_advance(wheel, start + 4) == 1, "Only the first should fire.");
+    mu_assert(wheel_next(wheel) == 1, "Next should be the 5 tick timer.");
+
+    // in big jumps so it has to cascade on the way
+    mu_assert(wheel_advance(wheel, start + 150000000) == count - 2, "Wrong number fired.");
+
+    for(i = 0; i < count - 1; i++) {
+        mu_assert(fired[i].count == 1, "Timer didn't fire exactly once.");
+        mu_assert(fired[i].at == start + offsets[i], "Timer fired at the wrong tick.");
+    }
+
+    mu_assert(fired[count - 1].count == 0, "Far timer fired early.");
+    mu_assert(wheel_advance(wheel, start + 0xffffffffULL) == 1, "Far timer didn't fire.");
+    mu_assert(fired[count - 1].late == 0, "Far timer fired at the wrong tick.");
+
+    mu_assert(wheel->count == 0, "Wheel should be empty.");
+    mu_assert(wheel_next(wheel) == -1, "Empty wheel should say -1 for next.");
+
+    wheel_destroy(wheel);
+    return NULL;
+}
+
+char *test_wheel_cancel_repeat()
+{
+    wheel_timer_t gone;
+    wheel_timer_t again;
+    Fired gone_fired = {0};
+    Fired again_fired = {0};
+
+    wheel_t *wheel = wheel_create(0);
+    gone_fired.wheel = again_fired.wheel = wheel;
+
+    wheel_timer_init(&gone, record_fire, &gone_fired);
+    wheel_timer_init(&again, repeat_fire, &again_fired);
+
+    wheel_add(wheel, &gone, 50);
+    wheel_add(wheel, &gone, 5000);
+    mu_assert(wheel->count == 1, "Adding again should move it, not add it twice.");
+
+    wheel_cancel(wheel, &gone);
+    mu_assert(!wheel_timer_pending(&gone), "Cancelled timer still pending.");
+    mu_assert(wheel->count == 0, "Cancel didn't take it out of the count.");
+    wheel_cancel(wheel, &gone);
+
+    wheel_add(wheel, &again, 10);
+    wheel_advance(wheel, 10000);
+
+    mu_assert(gone_fired.count == 0, "Cancelled timer fired.");
+    mu_assert(again_fired.count == 3, "Timer didn't re-add itself.");
+    mu_assert(again_fired.at == 210, "Repeating timer ended at the wrong time.");
+
+    // late ones go off on the next tick
+    wheel_add(wheel, &gone, 5);
+    mu_assert(gone.expires == 10001, "Late timer should be due next tick.");
+    wheel_advance(wheel, 10001);
+    mu_assert(gone_fired.count == 1, "Late timer didn't fire.");
+
+    wheel_destroy(wheel);
+    return NULL;
+}
+
+char *test_wheel_random()
+{
+    int i = 0;
+    int total = 0;
+    uint64_t now = 987654;
+
+    srand(42);
+    wheel_t *wheel = wheel_create(now);
+
+    for(i = 0; i < RANDOM_TIMERS; i++) {
+        RANDOM_FIRED[i] = (Fired){.wheel = wheel};
+        wheel_timer_init(&RANDOM[i], record_fire, &RANDOM_FIRED[i]);
+        wheel_add(wheel, &RANDOM[i], now + (rand() % (1 << (i % 25))) + 1);
+    }
+
+    for(i = 0; i < RANDOM_TIMERS; i += 7) {
+        wheel_cancel(wheel, &RANDOM[i]);
+    }
+
+    while(wheel->count > 0) {
+        int64_t next = wheel_next(wheel);
+        mu_assert(next > 0, "Next should be ahead while there's timers.");
+        now += rand() % 2 ? next : rand() % 5000 + 1;
+        total += wheel_advance(wheel, now);
+    }
+
+    for(i = 0; i < RANDOM_TIMERS; i++) {
+        mu_assert(RANDOM_FIRED[i].count == (i % 7 ? 1 : 0), "Timer fired the wrong number of times.");
+        mu_assert(RANDOM_FIRED[i].late == 0, "Timer fired at the wrong tick.");
+    }
+
+    mu_assert(total == RANDOM_TIMERS - (RANDOM_TIMERS + 6) / 7, "Wrong total fired.");
+
+    wheel_destroy(wheel);
+    return NULL;
+}
+
+char *all_tests()
+{
+    mu_suite_start();
+
+    mu_run_test(test_wheel_levels);
+    mu_run_test(test_wheel_cancel_repeat);
+    mu_run_test(test_wheel_random);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,134 @@
+#include "minunit.h"
+#include <worker.h>
+#include <setting.h>
+#include <dbg.h>
+#include <stdio.h>
+
+FILE *LOG_FILE = NULL;
+
+struct tagbstring TCP_SPEC = bsStatic("tcp://127.0.0.1:9997");
+struct tagbstring IPC_SPEC = bsStatic("ipc://run/handler");
+struct tagbstring TCP_PREFIX = bsStatic("tcp://");
+struct tagbstring IDENT = bsStatic("34f9ceee-cd52-4b7f-b197-88bf2f0ec378");
+
+char *test_Worker_count()
+{
+    mu_assert(Worker_count() == 1, "Should default to one worker.");
+
+    Setting_add("server.workers", "4");
+    mu_assert(Worker_count() == 4, "Should read server.workers.");
+    Setting_destroy();
+
+    Setting_add("server.workers", "100000");
+    mu_assert(Worker_count() == MAX_WORKERS, "Should cap at MAX_WORKERS.");
+    Setting_destroy();
+
+    return NULL;
+}
+
+char *test_Worker_spec()
+{
+    bstring spec = NULL;
+
+    WORKER_ID = -1;
+    spec = Worker_spec(&TCP_SPEC);
+    mu_assert(biseq(spec, &TCP_SPEC), "Single process should keep the spec.");
+    bdestroy(spec);
+
+    WORKER_ID = 0;
+    spec = Worker_spec(&TCP_SPEC);
+    mu_assert(biseq(spec, &TCP_SPEC), "Worker 0 should keep the spec.");
+    bdestroy(spec);
+
+    WORKER_ID = 3;
+    spec = Worker_spec(&TCP_SPEC);
+    mu_assert(biseqcstr(spec, "tcp://127.0.0.1:10297"), "Worker 3 should add 3 strides to the port.");
+    bdestroy(spec);
+
+    spec = Worker_spec(&IPC_SPEC);
+    mu_assert(biseqcstr(spec, "ipc://run/handler-3"), "Worker 3 should append to ipc.");
+    bdestroy(spec);
+
+    WORKER_ID = -1;
+    return NULL;
+}
+
+char *test_Worker_spec_no_overlap()
+{
+    FILE *conf = fopen("examples/configs/mongrel2.conf", "r");
+    bstring text = NULL;
+    bstring specs[32] = {NULL};
+    bstring found[32 * 2] = {NULL};
+    int nspecs = 0;
+    int nfound = 0;
+    int at = 0;
+    int end = 0;
+    int i = 0;
+    int j = 0;
+
+    mu_assert(conf != NULL, "Failed to open the example config.");
+    text = bread((bNread)fread, conf);
+    fclose(conf);
+    mu_assert(text != NULL, "Failed to read the example config.");
+
+    // every handler's send and recv spec, which use neighbouring ports
+    while((at = binstr(text, at, &TCP_PREFIX)) != BSTR_ERR && nspecs < 32) {
+        end = bstrchrp(text, '\'', at);
+        mu_assert(end != BSTR_ERR, "Unterminated spec in the example config.");
+        specs[nspecs++] = bmidstr(text, at, end - at);
+        at = end;
+    }
+
+    mu_assert(nspecs >= 4, "Should find the handler specs in the example config.");
+
+    for(WORKER_ID = 0; WORKER_ID < 2; WORKER_ID++) {
+        for(i = 0; i < nspecs; i++) {
+            found[nfound++] = Worker_spec(specs[i]);
+        }
+    }
+
+    for(i = 0; i < nfound; i++) {
+        for(j = i + 1; j < nfound; j++) {
+            debug("Checking %s against %s", bdata(found[i]), bdata(found[j]));
+            mu_assert(!biseq(found[i], found[j]), "Two workers would bind the same endpoint.");
+        }
+    }
+
+    for(i = 0; i < nspecs; i++) bdestroy(specs[i]);
+    for(i = 0; i < nfound; i++) bdestroy(found[i]);
+    bdestroy(text);
+
+    WORKER_ID = -1;
+    return NULL;
+}
+
+char *test_Worker_ident()
+{
+    bstring ident = NULL;
+
+    WORKER_ID = -1;
+    ident = Worker_ident(&IDENT);
+    mu_assert(biseq(ident, &IDENT), "Single process should keep the ident.");
+    bdestroy(ident);
+
+    WORKER_ID = 0;
+    ident = Worker_ident(&IDENT);
+    mu_assert(biseqcstr(ident, "34f9ceee-cd52-4b7f-b197-88bf2f0ec378-0"), "Worker 0 needs its own ident.");
+    bdestroy(ident);
+
+    WORKER_ID = -1;
+    return NULL;
+}
+
+char * all_tests() {
+    mu_suite_start();
+
+    mu_run_test(test_Worker_count);
+    mu_run_test(test_Worker_spec);
+    mu_run_test(test_Worker_spec_no_overlap);
+    mu_run_test(test_Worker_ident);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
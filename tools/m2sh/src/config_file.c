@@ -95,10 +95,43 @@ error:
 }
 
 
+struct tagbstring UPSTREAMS = bsStatic("upstreams");
+struct tagbstring BALANCE = bsStatic("balance");
+struct tagbstring HASH_ON = bsStatic("hash_on");
+
+/*
+ * Joins the upstreams=["host:port", ...] list into the comma separated
+ * form the proxy table stores.
+ */
+static bstring Proxy_upstreams(tst_t *settings, tst_t *params)
+{
+    lnode_t *n = NULL;
+    Value *list = AST_get(settings, params, &UPSTREAMS, VAL_LIST);
+    check(list, "Proxy upstreams should be a list of \"host:port\" strings.");
+
+    bstring upstreams = bfromcstr("");
+
+    for(n = list_first(list->as.list); n != NULL; n = list_next(list->as.list, n)) {
+        Value *val = lnode_get(n);
+        check(Value_is(val, QSTRING), "Proxy upstreams should be a list of \"host:port\" strings.");
+
+        if(blength(upstreams) > 0) bconchar(upstreams, ',');
+        bconcat(upstreams, val->as.string->data);
+    }
+
+    return upstreams;
+
+error:
+    return NULL;
+}
+
 int Proxy_load(tst_t *settings, tst_t *params)
 {
     const char *addr = AST_str(settings, params, "addr", VAL_QSTRING);
     const char *port = AST_str(settings, params, "port", VAL_NUMBER);
+    const char *balance = NULL;
+    const char *hash_on = NULL;
+    bstring upstreams = NULL;
 
     char *sql = NULL;
 
@@ -108,10 +141,32 @@ int Proxy_load(tst_t *settings, tst_t *params)
     int rc = DB_exec(sql, NULL, NULL);
     check(rc == 0, "Failed to load Proxy: %s:%s", addr, port);
 
+    if(tst_search(params, bdata(&UPSTREAMS), blength(&UPSTREAMS))) {
+        upstreams = Proxy_upstreams(settings, params);
+        check(upstreams != NULL, "Invalid upstreams for Proxy: %s:%s", addr, port);
+
+        if(tst_search(params, bdata(&BALANCE), blength(&BALANCE))) {
+            balance = AST_str(settings, params, "balance", VAL_QSTRING);
+        }
+
+        if(tst_search(params, bdata(&HASH_ON), blength(&HASH_ON))) {
+            hash_on = AST_str(settings, params, "hash_on", VAL_QSTRING);
+        }
+
+        sqlite3_free(sql);
+        sql = sqlite3_mprintf(bdata(&PROXY_BALANCE_SQL), bdata(upstreams),
+                balance ? balance : "roundrobin", hash_on ? hash_on : "");
+
+        rc = DB_exec(sql, NULL, NULL);
+        check(rc == 0, "Cannot load Proxy upstreams: '%s'", bdata(upstreams));
+        bdestroy(upstreams);
+    }
+
     sqlite3_free(sql);
     return DB_lastid();
 
 error:
+    bdestroy(upstreams);
     if(sql) sqlite3_free(sql);
     return -1;
 }
@@ -38,7 +38,10 @@ struct tagbstring CONFIG_SCHEMA = bsStatic(
 "\n"
 "CREATE TABLE proxy (id INTEGER PRIMARY KEY,\n"
 "    addr TEXT,\n"
-"    port INTEGER);\n"
+"    port INTEGER,\n"
+"    upstreams TEXT DEFAULT '',\n"
+"    balance TEXT DEFAULT 'roundrobin',\n"
+"    hash_on TEXT DEFAULT '');\n"
 "\n"
 "CREATE TABLE directory (id INTEGER PRIMARY KEY,"
 "   base TEXT,"
@@ -92,6 +95,8 @@ struct tagbstring DIR_CACHE_TTL_SQL = bsStatic("UPDATE directory SET cache_ttl=%
 
 struct tagbstring PROXY_SQL = bsStatic("INSERT INTO proxy (addr, port) VALUES (%Q, %Q);");
 
+struct tagbstring PROXY_BALANCE_SQL = bsStatic("UPDATE proxy SET upstreams=%Q, balance=%Q, hash_on=%Q WHERE id=last_insert_rowid();");
+
 struct tagbstring HANDLER_SQL = bsStatic("INSERT INTO handler (send_spec, send_ident, recv_spec, recv_ident) VALUES (%Q, %Q, %Q, %Q);");
 
 struct tagbstring ROUTE_SQL = bsStatic("INSERT INTO route (path, host_id, target_id, target_type) VALUES (%Q, %d, %d, %Q);");
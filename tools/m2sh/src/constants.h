@@ -10,6 +10,7 @@ extern struct tagbstring MIMETYPE_SQL;
 extern struct tagbstring DIR_SQL;
 extern struct tagbstring DIR_CACHE_TTL_SQL;
 extern struct tagbstring PROXY_SQL;
+extern struct tagbstring PROXY_BALANCE_SQL;
 extern struct tagbstring HANDLER_SQL;
 extern struct tagbstring ROUTE_SQL;
 extern struct tagbstring MIMETYPES_DEFAULT_SQL;